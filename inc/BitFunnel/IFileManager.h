@@ -85,6 +85,7 @@ namespace BitFunnel
         //virtual FileDescriptor0 Model() = 0;
         //virtual FileDescriptor0 PlanDescriptors() = 0;
         //virtual FileDescriptor0 PostingCounts() = 0;
+        virtual FileDescriptor0 QueryLatencyPercentiles() = 0;
         virtual FileDescriptor0 QueryLog() = 0;
         virtual FileDescriptor0 QueryPipelineStatistics() = 0;
         virtual FileDescriptor0 QuerySummaryStatistics() = 0;
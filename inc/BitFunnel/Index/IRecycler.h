@@ -23,7 +23,9 @@
 
 #pragma once
 
+#include <iosfwd>                   // std::ostream parameter.
 #include <memory>                   // std::shared_ptr is a parameter.
+#include <stddef.h>                 // size_t embedded.
 
 #include "BitFunnel/IInterface.h"
 #include "BitFunnel/NonCopyable.h"
@@ -32,6 +34,39 @@ namespace BitFunnel
 {
     class IRecyclable;
 
+    //*************************************************************************
+    //
+    // RecyclerStatistics
+    //
+    // A snapshot of an IRecycler's progress. Lag is the time in seconds
+    // between an item being scheduled and being recycled.
+    //
+    //*************************************************************************
+    class RecyclerStatistics
+    {
+    public:
+        RecyclerStatistics();
+
+        void Print(std::ostream& out) const;
+
+        // Items scheduled but not yet recycled.
+        size_t m_pendingCount;
+
+        // Seconds since the oldest pending item was scheduled, or zero if
+        // there are no pending items.
+        double m_oldestPendingAge;
+
+        // Items recycled so far, and the number of batches they were
+        // recycled in.
+        size_t m_recycledCount;
+        size_t m_batchCount;
+
+        // Sum and maximum of the lag of the recycled items.
+        double m_totalLag;
+        double m_maxLag;
+    };
+
+
     //*************************************************************************
     //
     // Abstract class or interface for classes which handle recycling of items
@@ -49,5 +84,8 @@ namespace BitFunnel
         virtual void ScheduleRecyling(std::unique_ptr<IRecyclable>& resource) = 0;
 
         virtual void Shutdown() = 0;
+
+        // Returns the reclamation lag and backlog. Thread safe.
+        virtual RecyclerStatistics GetStatistics() const = 0;
     };
 }
@@ -24,6 +24,7 @@
 
 #include <cstddef>                      // ptrdiff_t return value.
 #include <iosfwd>                       // std::ostream parameter.
+#include <vector>                       // std::vector parameter.
 #include "BitFunnel/BitFunnelTypes.h"   // DocIndex return value.
 #include "BitFunnel/IInterface.h"       // Base class.
 #include "BitFunnel/Index/RowId.h"      // RowId parameter.
@@ -97,5 +98,15 @@ namespace BitFunnel
         // documents.
         virtual std::vector<double>
             GetDensities(Rank rank) const = 0;
+
+        // For each rows[i], adds the number of bits set in a sample of the
+        // row to setBitCounts[i] and the number of bits sampled to
+        // bitCounts[i]. Samples are drawn from a few full slices spread
+        // across the shard. They are cached, and taken again only once the
+        // number of slices has doubled or halved, so most calls are a
+        // lock-free lookup.
+        virtual void SampleRowDensities(std::vector<RowId> const & rows,
+                                        std::vector<size_t> & setBitCounts,
+                                        std::vector<size_t> & bitCounts) const = 0;
     };
 }
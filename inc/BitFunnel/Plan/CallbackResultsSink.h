@@ -0,0 +1,86 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <functional>                       // std::function embedded.
+#include <stddef.h>                         // size_t embedded.
+
+#include "BitFunnel/NonCopyable.h"          // Base class.
+#include "BitFunnel/Plan/IResultsSink.h"    // Base class.
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // CallbackResultsSink
+    //
+    // IResultsSink that passes each batch of matches to a callback instead
+    // of storing them, for consumers that process matches as they stream
+    // out of the query engine. With a single matching thread, batches are
+    // delivered while the index is being scanned. With parallel matching,
+    // they are delivered after all of the morsels have been matched.
+    //
+    // The matches passed to the callback are only valid for the duration
+    // of the call. The callback runs on the thread that called
+    // IQueryEngine::Run() while that thread holds a Token, so it should not
+    // block for long.
+    //
+    //*************************************************************************
+    class CallbackResultsSink : public IResultsSink, NonCopyable
+    {
+    public:
+        typedef std::function<void(ResultsBuffer::Result const * matches,
+                                   size_t count)> Callback;
+
+        CallbackResultsSink(Callback const & callback)
+          : m_callback(callback),
+            m_matchCount(0)
+        {
+        }
+
+        virtual void Reset() override
+        {
+            m_matchCount = 0;
+        }
+
+        virtual void Add(ResultsBuffer::Result const * matches,
+                         size_t count) override
+        {
+            if (count > 0)
+            {
+                m_callback(matches, count);
+                m_matchCount += count;
+            }
+        }
+
+        virtual size_t GetMatchCount() const override
+        {
+            return m_matchCount;
+        }
+
+    private:
+        Callback m_callback;
+        size_t m_matchCount;
+    };
+}
@@ -0,0 +1,129 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <iterator>                         // std::iterator base class.
+#include <memory>                           // std::unique_ptr embedded.
+#include <stddef.h>                         // size_t embedded.
+#include <stdint.h>                         // uint32_t embedded.
+#include <vector>                           // std::vector embedded.
+
+#include "BitFunnel/NonCopyable.h"          // Base class.
+#include "BitFunnel/Plan/IResultsSink.h"    // Base class.
+
+
+namespace BitFunnel
+{
+    class Slice;
+
+    //*************************************************************************
+    //
+    // ChunkedResultsSink
+    //
+    // The default IResultsSink. Stores matches in fixed size chunks that are
+    // allocated as the number of matches grows, so memory is proportional to
+    // the largest result set seen rather than to the size of the index.
+    // Chunks are retained by Reset() and reused by subsequent queries.
+    //
+    // Each match is encoded in 8 bytes as a 32-bit slice ordinal and a 32-bit
+    // DocIndex. The slice ordinal indexes a table holding the Slice pointer
+    // for each run of consecutive matches from the same slice.
+    //
+    //*************************************************************************
+    class ChunkedResultsSink : public IResultsSink, NonCopyable
+    {
+    public:
+        class const_iterator;
+
+        ChunkedResultsSink();
+
+        //
+        // IResultsSink methods
+        //
+        virtual void Reset() override;
+        virtual void Add(ResultsBuffer::Result const * matches,
+                         size_t count) override;
+        virtual size_t GetMatchCount() const override;
+
+        // Adds count matches, starting with the match at position start, to
+        // sink.
+        void CopyTo(size_t start, size_t count, IResultsSink & sink) const;
+
+        // Returns the match at position, which must be less than size().
+        ResultsBuffer::Result operator[](size_t position) const;
+
+        const_iterator begin() const;
+        const_iterator end() const;
+        size_t size() const;
+
+        // Returns the number of bytes allocated for chunks and the slice
+        // table.
+        size_t GetBytesAllocated() const;
+
+        class const_iterator
+            : public std::iterator<std::input_iterator_tag, ResultsBuffer::Result>
+        {
+        public:
+            const_iterator(ChunkedResultsSink const & sink, size_t position)
+              : m_sink(&sink),
+                m_position(position)
+            {
+            }
+
+            bool operator!=(const_iterator const & other) const
+            {
+                return m_position != other.m_position;
+            }
+
+            const_iterator& operator++()
+            {
+                m_position++;
+                return *this;
+            }
+
+            ResultsBuffer::Result const operator*() const
+            {
+                return (*m_sink)[m_position];
+            }
+
+        private:
+            ChunkedResultsSink const * m_sink;
+            size_t m_position;
+        };
+
+    private:
+        struct Entry
+        {
+            uint32_t m_slice;
+            uint32_t m_index;
+        };
+        static_assert(sizeof(Entry) == 8, "Entry must be 8 bytes.");
+
+        static const size_t c_log2ChunkSize = 12;
+        static const size_t c_chunkSize = 1ull << c_log2ChunkSize;
+
+        std::vector<std::unique_ptr<Entry[]>> m_chunks;
+        std::vector<Slice*> m_slices;
+        size_t m_size;
+    };
+}
@@ -36,6 +36,7 @@ namespace BitFunnel
     class IInputStream;
     class IMatchVerifier;
     class IQueryEngine;
+    class IQueryService;
     class IPlanRows;
     class IRowSet;
     class ISimpleIndex;
@@ -50,6 +51,17 @@ namespace BitFunnel
         std::unique_ptr<IQueryEngine> CreateQueryEngine(ISimpleIndex const & index,
                                                                    IStreamConfiguration const & config);
 
+        // Creates an IQueryService with threadCount worker threads and room
+        // for queueCapacity waiting queries. If cachePlans is true, the
+        // workers share a QueryPlanCache and a TermRowCache.
+        std::unique_ptr<IQueryService>
+            CreateQueryService(ISimpleIndex const & index,
+                               IStreamConfiguration const & config,
+                               size_t threadCount,
+                               size_t queueCapacity,
+                               bool useNativeCode = true,
+                               bool cachePlans = true);
+
         std::unique_ptr<IMatchVerifier> CreateMatchVerifier(std::string query);
 
         IPlanRows& CreatePlanRows(IInputStream& input,
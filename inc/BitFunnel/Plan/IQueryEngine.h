@@ -22,15 +22,39 @@
 
 #pragma once
 
+#include <stddef.h>                     // size_t parameter.
+#include <vector>                       // std::vector parameter.
+
 #include "BitFunnel/IInterface.h"       // Base class.
 
 
 namespace BitFunnel
 {
+    class IResultsSink;
+    class QueryCancellation;
     class QueryInstrumentation;
-    class ResultsBuffer;
     class TermMatchNode;
 
+    //*************************************************************************
+    //
+    // QueryEstimate
+    //
+    // The predicted cost of a query, returned by IQueryEngine::Estimate().
+    //
+    //*************************************************************************
+    struct QueryEstimate
+    {
+        // Expected number of matches, including false positives.
+        double m_matchCount;
+
+        // Expected number of row quadwords read while matching.
+        double m_quadwordCount;
+
+        // Number of rows in the query plan.
+        size_t m_rowCount;
+    };
+
+
     //*************************************************************************
     //
     // IQueryEngine
@@ -46,10 +70,71 @@ namespace BitFunnel
         // Parse a query
         virtual TermMatchNode const *Parse(const char *query) = 0;
 
-        // Runs a parsed query
+        // Runs a parsed query. The results sink is reset before the matches
+        // are added to it.
+        virtual void Run(TermMatchNode const * tree,
+                         QueryInstrumentation & instrumentation,
+                         IResultsSink & results) = 0;
+
+        // Runs a parsed query until it completes or cancellation is
+        // cancelled or reaches its deadline. A run that is cut short leaves
+        // the matches found so far in results and calls
+        // QueryTruncated() on instrumentation. Planning is not interrupted.
         virtual void Run(TermMatchNode const * tree,
                          QueryInstrumentation & instrumentation,
-                         ResultsBuffer & resultsBuffer) = 0;
+                         IResultsSink & results,
+                         QueryCancellation const & cancellation) = 0;
+
+        // Returns the number of matches for a parsed query without writing
+        // them to an IResultsSink. The count is the same as the number of
+        // results Run() would return without a match limit. Match limits do
+        // not apply.
+        virtual size_t Count(TermMatchNode const * tree,
+                             QueryInstrumentation & instrumentation) = 0;
+
+        // Plans a parsed query as Run() would and predicts its match count
+        // and matching cost from the sampled densities of its rows, without
+        // scanning the index. The estimate is also recorded in
+        // instrumentation. If the engine has a QueryPlanCache, the plan is
+        // cached for Run(). Intended for admission control of expensive
+        // queries.
+        virtual QueryEstimate Estimate(TermMatchNode const * tree,
+                                       QueryInstrumentation & instrumentation) = 0;
+
+        // Parses, plans and runs a batch of queries with a single pass over
+        // the index. Every slice is matched against all of the queries
+        // before the next slice is read. The matches for queries[i] are
+        // written to results[i], which is reset first, and its statistics
+        // to instrumentation[i]. Throws if any query fails to parse or plan,
+        // in which case the contents of results are undefined. Invalidates
+        // trees returned by Parse().
+        virtual void RunBatch(std::vector<char const *> const & queries,
+                              std::vector<QueryInstrumentation *> const & instrumentation,
+                              std::vector<IResultsSink *> const & results) = 0;
+
+        // Configures intra-query parallelism. The slice buffers of each shard
+        // are divided into morsels of slicesPerMorsel slices which are
+        // matched by threadCount worker threads. A threadCount of 1, the
+        // default, matches all slices on the thread that calls Run().
+        virtual void SetMatchingThreads(size_t threadCount,
+                                        size_t slicesPerMorsel) = 0;
+
+        // Limits the number of matches returned by Run() to matchLimit in
+        // total and to shardMatchLimit from any single shard. Scanning stops
+        // as soon as the limits are reached. A value of zero, the default,
+        // means no limit.
+        virtual void SetMatchLimit(size_t matchLimit,
+                                   size_t shardMatchLimit) = 0;
+
+        // Queries in conjunctive normal form that need more than rowCount
+        // rows are run by the WideDisjunctionMatcher instead of being
+        // compiled. The default is c_maxRowsPerQuery.
+        virtual void SetWideDisjunctionRowCount(size_t rowCount) = 0;
+
+        // Returns the largest number of bytes that the match tree arena has
+        // held for one query, which shows whether its initial size is large
+        // enough for the query log.
+        virtual size_t GetMatchTreeHighWaterMark() const = 0;
 
         // Adds the diagnostic keyword prefix to the list of prefixes that
         // enable diagnostics.
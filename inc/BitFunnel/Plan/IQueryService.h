@@ -0,0 +1,129 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <functional>                           // std::function parameter.
+#include <future>                               // std::future return value.
+#include <stddef.h>                             // size_t return value.
+#include <string>                               // std::string parameter.
+#include <vector>                               // std::vector embedded.
+
+#include "BitFunnel/BitFunnelTypes.h"           // DocId embedded.
+#include "BitFunnel/IInterface.h"               // Base class.
+#include "BitFunnel/Plan/QueryInstrumentation.h"  // QueryInstrumentation::Data embedded.
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // QueryResponse
+    //
+    // The outcome of a query submitted to an IQueryService.
+    //
+    //*************************************************************************
+    class QueryResponse
+    {
+    public:
+        QueryResponse()
+          : m_queueTime(0.0)
+        {
+        }
+
+        // The query, as submitted.
+        std::string m_query;
+
+        // DocIds of the matching documents, in no particular order.
+        std::vector<DocId> m_matches;
+
+        // Statistics for the query. GetSucceeded() is false if the query
+        // could not be parsed or run, in which case m_error describes the
+        // failure.
+        QueryInstrumentation::Data m_instrumentation;
+        std::string m_error;
+
+        // Seconds the query waited in the submission queue before a worker
+        // started on it.
+        double m_queueTime;
+    };
+
+
+    //*************************************************************************
+    //
+    // IQueryService
+    //
+    // A long-lived query server. Queries are placed on a bounded submission
+    // queue and run by a fixed pool of worker threads, each of which owns
+    // its own query engine. Results are delivered through a std::future or
+    // a callback.
+    //
+    // When the queue is full, Submit() blocks the caller until a worker
+    // takes a query, while TrySubmit() fails immediately, allowing callers
+    // to shed load.
+    //
+    //*************************************************************************
+    class IQueryService : public IInterface
+    {
+    public:
+        // Invoked on a worker thread with the response to a query. Callbacks
+        // should be brief since the worker cannot start another query until
+        // the callback returns. Exceptions thrown by a callback are logged
+        // and discarded. A callback must not call Shutdown() or destroy the
+        // service: Shutdown() throws when called from a worker thread, since
+        // it would otherwise wait for that thread to exit.
+        typedef std::function<void(QueryResponse &&)> Callback;
+
+        // Queues query, blocking while the queue is full. Returns a future
+        // that becomes ready when the query completes. Throws if the service
+        // has been shut down.
+        virtual std::future<QueryResponse> Submit(std::string const & query) = 0;
+
+        // Queues query, blocking while the queue is full. Invokes callback
+        // when the query completes. Throws if the service has been shut
+        // down.
+        virtual void Submit(std::string const & query, Callback callback) = 0;
+
+        // Queues query if there is room and returns true. Returns false
+        // without blocking if the queue is full or the service has been
+        // shut down, in which case callback is never invoked.
+        virtual bool TrySubmit(std::string const & query, Callback callback) = 0;
+
+        // Stops accepting queries, waits for the queries already queued to
+        // complete, and then stops the worker threads. Safe to call more
+        // than once. Throws if called from a Callback.
+        virtual void Shutdown() = 0;
+
+        // Returns the number of queries waiting for a worker.
+        virtual size_t GetQueueDepth() const = 0;
+
+        // Returns the maximum number of queries that may wait for a worker.
+        virtual size_t GetQueueCapacity() const = 0;
+
+        // Returns the number of queries rejected by TrySubmit() because the
+        // queue was full.
+        virtual size_t GetRejectedCount() const = 0;
+
+        // Returns the number of worker threads.
+        virtual size_t GetThreadCount() const = 0;
+    };
+}
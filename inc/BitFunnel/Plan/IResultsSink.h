@@ -0,0 +1,60 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <stddef.h>                         // size_t parameter.
+
+#include "BitFunnel/IInterface.h"           // Base class.
+#include "BitFunnel/Plan/ResultsBuffer.h"   // ResultsBuffer::Result parameter.
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // IResultsSink
+    //
+    // An abstract base class or interface for the destination of the matches
+    // found by IQueryEngine::Run(). The query engines match into a small,
+    // fixed size ResultsBuffer and hand each batch of matches to the sink,
+    // so the memory needed for results is determined by the sink rather
+    // than by the number of documents in the index.
+    //
+    // Matches are delivered in no particular order.
+    //
+    //*************************************************************************
+    class IResultsSink : public IInterface
+    {
+    public:
+        // Discards all matches. Called by the query engines before matching
+        // starts.
+        virtual void Reset() = 0;
+
+        // Appends count matches.
+        virtual void Add(ResultsBuffer::Result const * matches,
+                         size_t count) = 0;
+
+        // Returns the number of matches added since the last Reset().
+        virtual size_t GetMatchCount() const = 0;
+    };
+}
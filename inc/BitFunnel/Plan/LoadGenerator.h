@@ -0,0 +1,162 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <iosfwd>                                   // std::ostream parameter.
+#include <random>                                   // std::mt19937_64 embedded.
+#include <stddef.h>                                 // size_t embedded.
+#include <stdint.h>                                 // uint64_t parameter.
+#include <string>                                   // std::string template parameter.
+#include <vector>                                   // std::vector embedded.
+
+#include "BitFunnel/NonCopyable.h"                  // Base class.
+#include "BitFunnel/Utilities/LatencyHistogram.h"   // LatencyHistogram embedded.
+
+
+namespace BitFunnel
+{
+    class IQueryService;
+
+    //*************************************************************************
+    //
+    // LoadGenerator
+    //
+    // An open-loop load generator for an IQueryService. Queries are issued
+    // on a schedule at a target rate, whether or not earlier queries have
+    // completed. Latency is measured from the time each query was scheduled
+    // to start. It therefore includes the time spent waiting in the
+    // service's queue and any delay in issuing the query.
+    //
+    // Queries are submitted with TrySubmit(). Queries rejected because the
+    // service's queue is full are counted as dropped.
+    //
+    // Ramp() runs a sequence of steps at increasing rates until the service
+    // saturates. That locates the highest rate the service can sustain.
+    //
+    //*************************************************************************
+    class LoadGenerator : public NonCopyable
+    {
+    public:
+        enum Arrivals
+        {
+            // Queries are issued at exactly 1 / rate second intervals.
+            Fixed,
+
+            // Intervals are exponentially distributed with mean 1 / rate,
+            // as for independent users.
+            Poisson
+        };
+
+        // The outcome of issuing queries at a single target rate.
+        class Step
+        {
+        public:
+            Step(double offeredRate, double duration);
+
+            // Returns the rate at which queries completed, in queries per
+            // second.
+            double GetAchievedRate() const;
+
+            // Target rate, in queries per second.
+            double m_offeredRate;
+
+            // Seconds over which queries were scheduled.
+            double m_duration;
+
+            // Seconds from the first scheduled query until the last
+            // response.
+            double m_elapsedTime;
+
+            size_t m_issued;
+            size_t m_completed;
+            size_t m_failed;
+            size_t m_dropped;
+
+            // Largest delay, in seconds, between the time a query was
+            // scheduled and the time it was submitted.
+            double m_maxLag;
+
+            // Latencies, from scheduled start to response, of the queries
+            // that completed.
+            LatencyHistogram m_latencies;
+        };
+
+        // Steps that take more than this fraction of their duration longer
+        // than their duration to complete are saturated.
+        static const double c_drainTolerance;
+
+        // Steps in which a query was submitted more than this fraction of
+        // their duration after it was scheduled are behind schedule.
+        static const double c_lagTolerance;
+
+        // Queries are taken from queries in order, wrapping around at the
+        // end. The seed initializes the Poisson arrival process.
+        LoadGenerator(IQueryService & service,
+                      std::vector<std::string> const & queries,
+                      Arrivals arrivals,
+                      uint64_t seed = 0);
+
+        // Issues queries at rate queries per second for duration seconds and
+        // waits for them to complete.
+        Step Run(double rate, double duration);
+
+        // Runs steps of duration seconds at startRate, startRate * growth,
+        // and so on. Stops after maxSteps steps or the first step that is
+        // saturated or behind schedule.
+        std::vector<Step> Ramp(double startRate,
+                               double growth,
+                               size_t maxSteps,
+                               double duration,
+                               double latencyLimit);
+
+        // Returns true if step dropped queries, left issued queries without
+        // a response, took more than c_drainTolerance longer than its
+        // duration to complete, or, if latencyLimit is nonzero, had a 99th
+        // percentile latency above latencyLimit seconds.
+        //
+        // Saturation is judged against the queries actually issued rather
+        // than the offered rate. With Poisson arrivals the number of queries
+        // issued in a step is random, so the achieved rate of a lightly
+        // loaded service often falls short of the offered rate.
+        static bool IsSaturated(Step const & step, double latencyLimit);
+
+        // Returns true if the generator itself fell behind its schedule by
+        // more than c_lagTolerance of the step's duration. Such a step did
+        // not offer its rate open-loop, so its rate is not sustained.
+        static bool IsBehindSchedule(Step const & step);
+
+        // Writes a table of steps, followed by the highest rate that
+        // neither saturated nor fell behind schedule.
+        static void Print(std::ostream & out,
+                          std::vector<Step> const & steps,
+                          double latencyLimit);
+
+    private:
+        IQueryService & m_service;
+        std::vector<std::string> const & m_queries;
+        const Arrivals m_arrivals;
+
+        std::mt19937_64 m_random;
+        size_t m_nextQuery;
+    };
+}
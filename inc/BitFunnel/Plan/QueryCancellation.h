@@ -0,0 +1,154 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <atomic>                           // std::atomic embedded.
+#include <stddef.h>                         // size_t embedded.
+#include <stdint.h>                         // uint64_t embedded.
+
+#include "BitFunnel/NonCopyable.h"          // Base class.
+#include "BitFunnel/Utilities/Stopwatch.h"  // Stopwatch embedded.
+#include "LoggerInterfaces/Check.h"         // CHECK_GT() and CHECK_EQ() inlined.
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // QueryCancellation
+    //
+    // A deadline and cancellation token for IQueryEngine::Run(). Matching
+    // stops early once Cancel() has been called or the deadline, if any,
+    // has passed. The matches found so far are left in the IResultsSink
+    // and the run is recorded as truncated in its QueryInstrumentation.
+    //
+    // The query engines check the token before each slice and, within a
+    // slice, every GetStride() iterations of the matching loop. Each check
+    // reads a flag and, if the token has a deadline, compares the deadline
+    // with the clock. The generated native code reads the flag itself and
+    // calls out to IsCancelled() for the deadline. The WideDisjunctionPlan
+    // matcher scans a slice in a single pass, so it only checks the token
+    // between slices.
+    //
+    // Thread safety: Cancel() may be called from any thread, for example
+    // by a watchdog, while a query is running.
+    //
+    //*************************************************************************
+    class QueryCancellation : public NonCopyable
+    {
+    public:
+        // Default number of matching loop iterations between checks inside
+        // a slice. Each iteration covers 64 documents at the initial rank
+        // of the query plan.
+        static const size_t c_defaultStride = 64;
+
+        // Constructs a token without a deadline.
+        QueryCancellation()
+          : m_cancelled(0),
+            m_hasDeadline(false),
+            m_deadline(0.0),
+            m_stride(c_defaultStride)
+        {
+        }
+
+        // Constructs a token whose deadline is the specified number of
+        // seconds after construction.
+        explicit QueryCancellation(double seconds)
+          : m_cancelled(0),
+            m_hasDeadline(true),
+            m_deadline(seconds),
+            m_stride(c_defaultStride)
+        {
+        }
+
+        void Cancel()
+        {
+            m_cancelled.store(1, std::memory_order_relaxed);
+        }
+
+        // Returns true if Cancel() has been called or the deadline has
+        // passed.
+        bool IsCancelled() const
+        {
+            if (WasCancelled())
+            {
+                return true;
+            }
+
+            if (m_hasDeadline && m_stopwatch.ElapsedTime() >= m_deadline)
+            {
+                m_cancelled.store(1, std::memory_order_relaxed);
+                return true;
+            }
+
+            return false;
+        }
+
+        // Returns true if Cancel() has been called or an earlier call to
+        // IsCancelled() found that the deadline had passed. Does not read
+        // the clock.
+        bool WasCancelled() const
+        {
+            return m_cancelled.load(std::memory_order_relaxed) != 0;
+        }
+
+        bool HasDeadline() const
+        {
+            return m_hasDeadline;
+        }
+
+        // Sets the number of matching loop iterations between checks inside
+        // a slice. The stride must be a power of two.
+        void SetStride(size_t iterations)
+        {
+            CHECK_GT(iterations, 0u)
+                << "Cancellation stride must be a power of two.";
+            CHECK_EQ(iterations & (iterations - 1), 0u)
+                << "Cancellation stride must be a power of two.";
+            m_stride = iterations;
+        }
+
+        size_t GetStride() const
+        {
+            return m_stride;
+        }
+
+        // Returns the flag read by the generated native code. It is nonzero
+        // once the query has been cancelled.
+        std::atomic<uint64_t> const & GetFlag() const
+        {
+            return m_cancelled;
+        }
+
+    private:
+        // The generated code reads the flag as a plain quadword.
+        static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t),
+                      "Generated code requires a quadword cancellation flag.");
+
+        mutable std::atomic<uint64_t> m_cancelled;
+        const bool m_hasDeadline;
+        const double m_deadline;
+        size_t m_stride;
+        Stopwatch m_stopwatch;
+    };
+}
@@ -45,6 +45,13 @@ namespace BitFunnel
             m_data.m_succeeded = true;
         }
 
+        // Records that matching was stopped early by a QueryCancellation,
+        // so the matches are incomplete.
+        inline void QueryTruncated()
+        {
+            m_data.m_truncated = true;
+        }
+
         inline void SetMatchCount(size_t matchCount)
         {
             m_data.m_matchCount = matchCount;
@@ -70,6 +77,21 @@ namespace BitFunnel
             m_data.m_cacheLineCount += amount;
         }
 
+        // Records the planner's estimates of the number of quadwords the
+        // matcher will read, before and after the rows were reordered by
+        // density.
+        inline void SetQuadwordEstimates(double unordered, double ordered)
+        {
+            m_data.m_unorderedQuadwordEstimate = unordered;
+            m_data.m_orderedQuadwordEstimate = ordered;
+        }
+
+        // Records the planner's estimate of the number of matches.
+        inline void SetMatchEstimate(double matches)
+        {
+            m_data.m_matchEstimate = matches;
+        }
+
         inline void FinishParsing()
         {
             m_data.m_parsingTime = m_stopwatch.ElapsedTime();
@@ -95,23 +117,35 @@ namespace BitFunnel
         public:
             inline Data()
               : m_succeeded(false),
+                m_truncated(false),
                 m_rowCount(0ull),
                 m_matchCount(0ull),
                 m_quadwordCount(0ull),
                 m_cacheLineCount(0ll),
+                m_unorderedQuadwordEstimate(0.0),
+                m_orderedQuadwordEstimate(0.0),
+                m_matchEstimate(0.0),
                 m_parsingTime(0.0),
                 m_planningTime(0.0),
                 m_matchingTime(0.0)
             {
             }
 
+            // Declared because operator= is user-provided, which deprecates
+            // the implicit copy constructor that QueryResponse relies on.
+            Data(Data const &) = default;
+
             Data & operator=(Data const & other)
             {
                 m_succeeded = other.m_succeeded;
+                m_truncated = other.m_truncated;
                 m_rowCount = other.m_rowCount;
                 m_matchCount = other.m_matchCount;
                 m_quadwordCount = other.m_quadwordCount;
                 m_cacheLineCount = other.m_cacheLineCount;
+                m_unorderedQuadwordEstimate = other.m_unorderedQuadwordEstimate;
+                m_orderedQuadwordEstimate = other.m_orderedQuadwordEstimate;
+                m_matchEstimate = other.m_matchEstimate;
                 m_parsingTime = other.m_parsingTime;
                 m_planningTime = other.m_planningTime;
                 m_matchingTime = other.m_matchingTime;
@@ -123,6 +157,11 @@ namespace BitFunnel
                 return m_succeeded;
             }
 
+            inline bool GetTruncated()
+            {
+                return m_truncated;
+            }
+
             inline size_t GetRowCount()
             {
                 return m_rowCount;
@@ -143,6 +182,21 @@ namespace BitFunnel
                 return m_cacheLineCount;
             }
 
+            inline double GetUnorderedQuadwordEstimate()
+            {
+                return m_unorderedQuadwordEstimate;
+            }
+
+            inline double GetOrderedQuadwordEstimate()
+            {
+                return m_orderedQuadwordEstimate;
+            }
+
+            inline double GetMatchEstimate()
+            {
+                return m_matchEstimate;
+            }
+
             inline double GetParsingTime()
             {
                 return m_parsingTime;
@@ -165,10 +219,14 @@ namespace BitFunnel
             friend class QueryInstrumentation;
 
             bool m_succeeded;
+            bool m_truncated;
             size_t m_rowCount;
             size_t m_matchCount;
             size_t m_quadwordCount;
             size_t m_cacheLineCount;
+            double m_unorderedQuadwordEstimate;
+            double m_orderedQuadwordEstimate;
+            double m_matchEstimate;
             double m_parsingTime;
             double m_planningTime;
             double m_matchingTime;
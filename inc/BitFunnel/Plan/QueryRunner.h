@@ -22,8 +22,12 @@
 
 #pragma once
 
+#include <iosfwd>       // std::ostream parameter.
+#include <utility>      // std::pair return value.
 #include <vector>       // std::vector parameter
 
+#include "BitFunnel/Utilities/LatencyHistogram.h"   // LatencyHistogram embedded.
+
 
 namespace BitFunnel
 {
@@ -42,11 +46,27 @@ namespace BitFunnel
                        double elapsedTime,
                        double parsingTime,
                        double planningTime,
-                       double matchingTime);
+                       double matchingTime,
+                       size_t planCacheHits,
+                       size_t planCacheMisses,
+                       size_t matchTreeHighWaterMark,
+                       LatencyHistogram const & parsingLatencies,
+                       LatencyHistogram const & planningLatencies,
+                       LatencyHistogram const & matchingLatencies);
 
             void Print(std::ostream& out) const;
 
+            // Writes the latency percentiles of each phase as a CSV table.
+            void WriteLatencyPercentiles(std::ostream& out) const;
+
         private:
+            typedef std::pair<char const *, LatencyHistogram const *> Phase;
+
+            // Returns the name and latency distribution of each phase, in
+            // the order in which both Print() and WriteLatencyPercentiles()
+            // list them.
+            std::vector<Phase> GetPhases() const;
+
             const size_t m_threadCount;
             const size_t m_uniqueQueryCount;
             size_t m_processedCount;
@@ -55,6 +75,17 @@ namespace BitFunnel
             double m_parsingLatency;
             double m_planningLatency;
             double m_matchingLatency;
+            size_t m_planCacheHits;
+            size_t m_planCacheMisses;
+
+            // Largest number of bytes held by any thread's match tree arena
+            // for one query.
+            size_t m_matchTreeHighWaterMark;
+
+            // Distributions of the per-query latency of each phase.
+            LatencyHistogram m_parsingLatencies;
+            LatencyHistogram m_planningLatencies;
+            LatencyHistogram m_matchingLatencies;
         };
 
 
@@ -70,6 +101,20 @@ namespace BitFunnel
                               std::vector<std::string> const & queries,
                               size_t iterations,
                               bool useNativeCode,
-                              bool countCacheLines);
+                              bool countCacheLines,
+                              bool cachePlans,
+                              size_t batchSize = 1,
+                              size_t prefetchDistance = 0,
+                              bool prefetchNonTemporal = false,
+                              bool specializeShards = false);
+
+    private:
+        // Maximum number of compiled queries retained when cachePlans is
+        // true.
+        static const size_t c_planCacheCapacity = 1024;
+
+        // Maximum number of terms whose rows are retained when cachePlans is
+        // true.
+        static const size_t c_termRowCacheCapacity = 65536;
     };
 }
@@ -24,6 +24,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
 #include "BitFunnel/Allocators/IAllocator.h"
 #include "BitFunnel/NonCopyable.h"
@@ -31,10 +32,31 @@
 
 namespace BitFunnel
 {
+    //*************************************************************************
+    //
+    // Allocator
+    //
+    // An arena for short-lived allocations, such as the match trees and
+    // plans built for a single query. Blocks are handed out by bumping a
+    // pointer and are only freed, all at once, by Reset().
+    //
+    // The arena starts with a single block of the size passed to the
+    // constructor. When a block is full, allocation continues in the next
+    // block of the chain, which is added on demand with at least twice the
+    // size of the last block. Reset() keeps every block, so an arena that
+    // is reused for many queries stops growing once it has held the largest
+    // one.
+    //
+    // Allocations are rounded up to a multiple of c_alignment bytes.
+    //
+    //*************************************************************************
     // TODO: This should be a private header.
-    class Allocator : public IAllocator
+    class Allocator : public IAllocator, NonCopyable
     {
     public:
+        static const size_t c_alignment = 8;
+
+        // Constructs an Allocator whose first block holds bufferSize bytes.
         Allocator(size_t bufferSize);
 
         virtual ~Allocator() override;
@@ -45,18 +67,53 @@ namespace BitFunnel
         // Frees a block.
         virtual void Deallocate(void* block) override;
 
-        // Returns the maximum legal allocation size in bytes.
+        // Returns the maximum legal allocation size in bytes. Allocations
+        // are only limited by available memory.
         virtual size_t MaxSize() const override;
 
         // Frees all blocks that have been allocated since construction or the
-        // last call to Reset().
+        // last call to Reset(). The memory is kept for reuse.
         virtual void Reset() override;
 
+        // Returns the number of bytes allocated since construction or the
+        // last call to Reset(), including alignment padding and the unused
+        // space at the end of full blocks.
+        size_t GetBytesAllocated() const;
+
+        // Returns the largest value of GetBytesAllocated() since
+        // construction.
+        size_t GetHighWaterMark() const;
+
+        // Returns the total size of the blocks in the chain.
+        size_t GetBytesReserved() const;
+
+        // Returns the number of blocks in the chain.
+        size_t GetBlockCount() const;
+
     private:
-        void DebugInitialize();
+        // Moves to the first block after the current one that can hold
+        // size bytes, adding a block to the chain if there is none.
+        void NextBlock(size_t size);
+
+        void DebugInitialize(size_t block);
+
+        struct Block
+        {
+            std::unique_ptr<char[]> m_buffer;
+            size_t m_size;
+        };
+
+        std::vector<Block> m_blocks;
+
+        // Index of the block being allocated from, and the bytes allocated
+        // from it.
+        size_t m_current;
+        size_t m_used;
+
+        // Bytes allocated from the blocks before m_current, including the
+        // space skipped at the end of each.
+        size_t m_usedBefore;
 
-        size_t m_bufferSize;
-        size_t m_bytesAllocated;
-        std::unique_ptr<char[]> m_buffer;
+        size_t m_highWaterMark;
     };
 }
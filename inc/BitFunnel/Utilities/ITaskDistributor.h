@@ -37,11 +37,12 @@ namespace BitFunnel
     // Uses multiple threads to dispatch numbered tasks to a vector of objects
     // that derive from ITaskProcessor.
     //
-    // One thread is started for each ITaskProcessor. The ITaskProcessors are
-    // assigned task ids via ITaskProcessor::ProcessTask(). Task ids are handed
-    // out starting from 0 and increasing until all ITaskProcessors are busy.
-    // Each time a thread returns from ProcessTask(), a new task id will be
-    // assigned until all tasks have been processed.
+    // Each ITaskProcessor runs on its own thread, taken from a persistent
+    // pool. The ITaskProcessors are assigned task ids via
+    // ITaskProcessor::ProcessTask(). Each time a thread returns from
+    // ProcessTask(), a new task id will be assigned until all tasks have been
+    // processed, after which ITaskProcessor::Finished() is called once on
+    // each thread. Task ids are not necessarily assigned in increasing order.
     //
     // Task coordinator only knows about task ids. The interpretation of the
     // work associated with a particular task id is up to the ITaskProcessor.
@@ -52,10 +53,10 @@ namespace BitFunnel
     public:
         virtual ~ITaskDistributor() {}
 
-        // TaskDistributorThreads call TryAllocateTask() to get their next task
-        // assignment. If there is work remaining, taskId will be set to the id
-        // of the assigned task and the method will return true. If there are
-        // no tasks remaining, the method will return false.
+        // Allocates a task to a caller outside the distributor's threads. If
+        // there is work remaining, taskId will be set to the id of the
+        // assigned task and the method will return true. If there are no
+        // tasks remaining, the method will return false.
         virtual bool TryAllocateTask(size_t& taskId) = 0;
 
         // Waits for all tasks to complete.
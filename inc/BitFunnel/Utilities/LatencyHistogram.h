@@ -0,0 +1,91 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <stddef.h>     // size_t embedded.
+#include <stdint.h>     // uint64_t embedded.
+#include <vector>       // std::vector embedded.
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // LatencyHistogram
+    //
+    // A log-linear histogram of latencies, in the style of HdrHistogram.
+    // Latencies are recorded in nanoseconds. Each power of two is divided
+    // into 2^c_subBucketBits equal buckets, so that percentiles are
+    // reported with a relative error below 2^-c_subBucketBits. Latencies
+    // below 2^c_subBucketBits nanoseconds are recorded exactly.
+    //
+    // Record() costs a count of leading zeros, a few shifts and an
+    // increment, so each thread can keep its own histograms on the query
+    // path and Merge() them at the end of a run.
+    //
+    // Thread safety: none.
+    //
+    //*************************************************************************
+    class LatencyHistogram
+    {
+    public:
+        static const unsigned c_subBucketBits = 6;
+
+        LatencyHistogram();
+
+        // Records a latency in seconds. Negative latencies are recorded as
+        // zero.
+        void Record(double seconds);
+
+        // Adds the latencies recorded by other to this histogram.
+        void Merge(LatencyHistogram const & other);
+
+        // Discards all recorded latencies.
+        void Reset();
+
+        // Returns the number of latencies recorded.
+        uint64_t GetCount() const;
+
+        // Returns the smallest latency, in seconds, that is at least as
+        // large as percentile percent of the recorded latencies, to within
+        // the resolution of the histogram. The value never exceeds
+        // GetMax(). Returns zero if no latencies have been recorded.
+        double GetPercentile(double percentile) const;
+
+        // Returns the exact largest and mean latencies in seconds, or zero
+        // if no latencies have been recorded.
+        double GetMax() const;
+        double GetMean() const;
+
+    private:
+        static size_t GetBucket(uint64_t nanoseconds);
+
+        // Returns the largest value, in nanoseconds, recorded in bucket.
+        static uint64_t GetBucketMax(size_t bucket);
+
+        std::vector<uint64_t> m_buckets;
+        uint64_t m_count;
+        uint64_t m_max;
+        double m_sum;
+    };
+}
@@ -83,6 +83,10 @@ namespace BitFunnel
                                             indexDirectory,
                                             "Manifest",
                                             ".txt" )),
+          m_queryLatencyPercentiles(new ParameterizedFile0(fileSystem,
+                                                           statisticsDirectory,
+                                                           "QueryLatencyPercentiles",
+                                                           ".csv")),
           m_queryLog(new ParameterizedFile0(fileSystem,
                                             statisticsDirectory,
                                             "QueryLog",
@@ -152,6 +156,12 @@ namespace BitFunnel
     }
 
 
+    FileDescriptor0 FileManager::QueryLatencyPercentiles()
+    {
+        return FileDescriptor0(*m_queryLatencyPercentiles);
+    }
+
+
     FileDescriptor0 FileManager::QueryLog()
     {
         return FileDescriptor0(*m_queryLog);
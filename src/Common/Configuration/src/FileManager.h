@@ -55,6 +55,7 @@ namespace BitFunnel
         //virtual FileDescriptor0 Model() override;
         //virtual FileDescriptor0 PlanDescriptors() override;
         //virtual FileDescriptor0 PostingCounts() override;
+        virtual FileDescriptor0 QueryLatencyPercentiles() override;
         virtual FileDescriptor0 QueryLog() override;
         virtual FileDescriptor0 QueryPipelineStatistics() override;
         virtual FileDescriptor0 QuerySummaryStatistics() override;
@@ -99,6 +100,7 @@ namespace BitFunnel
         std::unique_ptr<IParameterizedFile0> m_indexSliceMain;
         std::unique_ptr<IParameterizedFile2> m_indexSlice;
         std::unique_ptr<IParameterizedFile0> m_manifest;
+        std::unique_ptr<IParameterizedFile0> m_queryLatencyPercentiles;
         std::unique_ptr<IParameterizedFile0> m_queryLog;
         std::unique_ptr<IParameterizedFile0> m_queryPipelineStatistics;
         std::unique_ptr<IParameterizedFile0> m_querySummaryStatistics;
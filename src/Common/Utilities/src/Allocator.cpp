@@ -22,6 +22,7 @@
 
 
 #include <cstring>
+#include <limits>       // std::numeric_limits.
 #include <memory>
 
 #include "BitFunnel/Utilities/Allocator.h"
@@ -44,12 +45,15 @@ namespace BitFunnel
     //
     //*************************************************************************
     Allocator::Allocator(size_t bufferSize)
-      : m_bufferSize(bufferSize),
-        m_bytesAllocated(0),
-        m_buffer(new char[bufferSize])
+      : m_current(0),
+        m_used(0),
+        m_usedBefore(0),
+        m_highWaterMark(0)
     {
+        m_blocks.push_back({ std::unique_ptr<char[]>(new char[bufferSize]),
+                             bufferSize });
 #ifdef DEBUG
-        DebugInitialize();
+        DebugInitialize(0);
 #endif
     }
 
@@ -61,20 +65,63 @@ namespace BitFunnel
 
     void* Allocator::Allocate(size_t size)
     {
-        LogAssertB(m_bytesAllocated + size <= m_bufferSize, "Out of memory");
+        size = (size + c_alignment - 1) & ~(c_alignment - 1);
 
-        void* result = static_cast<void*>(m_buffer.get() + m_bytesAllocated);
-        m_bytesAllocated += size;
+        if (m_used + size > m_blocks[m_current].m_size)
+        {
+            NextBlock(size);
+        }
+
+        void* result = static_cast<void*>(m_blocks[m_current].m_buffer.get() + m_used);
+        m_used += size;
 
         return result;
     }
 
 
+    void Allocator::NextBlock(size_t size)
+    {
+        m_usedBefore += m_blocks[m_current].m_size;
+        m_used = 0;
+
+        // Reuse a block kept by Reset() if one is large enough. Smaller
+        // blocks are skipped until the next Reset().
+        while (++m_current < m_blocks.size())
+        {
+            if (m_blocks[m_current].m_size >= size)
+            {
+                return;
+            }
+            m_usedBefore += m_blocks[m_current].m_size;
+        }
+
+        size_t blockSize = 2 * m_blocks.back().m_size;
+        if (blockSize < size)
+        {
+            blockSize = size;
+        }
+
+        m_blocks.push_back({ std::unique_ptr<char[]>(new char[blockSize]),
+                             blockSize });
+#ifdef DEBUG
+        DebugInitialize(m_current);
+#endif
+    }
+
+
     void Allocator::Deallocate(void* block)
     {
-        LogAssertB(static_cast<char*>(block) >= m_buffer.get() &&
-                       static_cast<char*>(block) < m_buffer.get() + m_bytesAllocated,
-                       "Attempting to deallocate memory not owned by this allocator.");
+        char* p = static_cast<char*>(block);
+        bool owned = false;
+        for (size_t i = 0; i <= m_current && !owned; ++i)
+        {
+            char* start = m_blocks[i].m_buffer.get();
+            size_t used = (i == m_current) ? m_used : m_blocks[i].m_size;
+            owned = (p >= start && p < start + used);
+        }
+
+        LogAssertB(owned,
+                   "Attempting to deallocate memory not owned by this allocator.");
 
         // Intentional NOP
     }
@@ -82,21 +129,57 @@ namespace BitFunnel
 
     size_t Allocator::MaxSize() const
     {
-        return m_bufferSize;
+        return (std::numeric_limits<size_t>::max)();
     }
 
 
     void Allocator::Reset()
     {
-        m_bytesAllocated = 0;
+        m_highWaterMark = GetHighWaterMark();
+        m_current = 0;
+        m_used = 0;
+        m_usedBefore = 0;
 #ifdef DEBUG
-        DebugInitialize();
+        for (size_t i = 0; i < m_blocks.size(); ++i)
+        {
+            DebugInitialize(i);
+        }
 #endif
     }
 
 
-    void Allocator::DebugInitialize()
+    size_t Allocator::GetBytesAllocated() const
+    {
+        return m_usedBefore + m_used;
+    }
+
+
+    size_t Allocator::GetHighWaterMark() const
+    {
+        const size_t allocated = GetBytesAllocated();
+        return (allocated > m_highWaterMark) ? allocated : m_highWaterMark;
+    }
+
+
+    size_t Allocator::GetBytesReserved() const
+    {
+        size_t bytes = 0;
+        for (auto const & block : m_blocks)
+        {
+            bytes += block.m_size;
+        }
+        return bytes;
+    }
+
+
+    size_t Allocator::GetBlockCount() const
+    {
+        return m_blocks.size();
+    }
+
+
+    void Allocator::DebugInitialize(size_t block)
     {
-        memset(m_buffer.get(), 0xcc, m_bufferSize);
+        memset(m_blocks[block].m_buffer.get(), 0xcc, m_blocks[block].m_size);
     }
 }
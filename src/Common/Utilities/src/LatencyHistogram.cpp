@@ -0,0 +1,182 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifdef _MSC_VER
+#include <intrin.h>     // _BitScanReverse64.
+#endif
+
+#include <cmath>        // std::ceil().
+
+#include "BitFunnel/Utilities/LatencyHistogram.h"
+
+
+namespace BitFunnel
+{
+    static const double c_nanosecondsPerSecond = 1e9;
+
+    static const uint64_t c_subBucketCount = 1ull << LatencyHistogram::c_subBucketBits;
+
+    // Values below c_subBucketCount have a bucket each. Each of the
+    // remaining powers of two up to 2^63 has c_subBucketCount buckets.
+    static const size_t c_bucketCount =
+        (64 - LatencyHistogram::c_subBucketBits + 1) * c_subBucketCount;
+
+
+    // Returns the index of the highest bit set in a nonzero value.
+    static unsigned HighestBit(uint64_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<unsigned>(index);
+#else
+        return 63u - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+    }
+
+
+    LatencyHistogram::LatencyHistogram()
+      : m_buckets(c_bucketCount, 0),
+        m_count(0),
+        m_max(0),
+        m_sum(0)
+    {
+    }
+
+
+    void LatencyHistogram::Record(double seconds)
+    {
+        const uint64_t nanoseconds = (seconds > 0) ?
+            static_cast<uint64_t>(seconds * c_nanosecondsPerSecond) :
+            0;
+
+        ++m_buckets[GetBucket(nanoseconds)];
+        ++m_count;
+        if (nanoseconds > m_max)
+        {
+            m_max = nanoseconds;
+        }
+        m_sum += seconds;
+    }
+
+
+    void LatencyHistogram::Merge(LatencyHistogram const & other)
+    {
+        for (size_t i = 0; i < c_bucketCount; ++i)
+        {
+            m_buckets[i] += other.m_buckets[i];
+        }
+        m_count += other.m_count;
+        if (other.m_max > m_max)
+        {
+            m_max = other.m_max;
+        }
+        m_sum += other.m_sum;
+    }
+
+
+    void LatencyHistogram::Reset()
+    {
+        m_buckets.assign(c_bucketCount, 0);
+        m_count = 0;
+        m_max = 0;
+        m_sum = 0;
+    }
+
+
+    uint64_t LatencyHistogram::GetCount() const
+    {
+        return m_count;
+    }
+
+
+    double LatencyHistogram::GetPercentile(double percentile) const
+    {
+        if (m_count == 0)
+        {
+            return 0;
+        }
+
+        // Number of values at or below the percentile, at least one.
+        uint64_t rank =
+            static_cast<uint64_t>(std::ceil(percentile / 100.0 * m_count));
+        if (rank == 0)
+        {
+            rank = 1;
+        }
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < c_bucketCount; ++i)
+        {
+            seen += m_buckets[i];
+            if (seen >= rank)
+            {
+                const uint64_t value = GetBucketMax(i);
+                return ((value < m_max) ? value : m_max) / c_nanosecondsPerSecond;
+            }
+        }
+
+        return GetMax();
+    }
+
+
+    double LatencyHistogram::GetMax() const
+    {
+        return m_max / c_nanosecondsPerSecond;
+    }
+
+
+    double LatencyHistogram::GetMean() const
+    {
+        return (m_count == 0) ? 0 : m_sum / m_count;
+    }
+
+
+    size_t LatencyHistogram::GetBucket(uint64_t nanoseconds)
+    {
+        if (nanoseconds < c_subBucketCount)
+        {
+            return static_cast<size_t>(nanoseconds);
+        }
+
+        // The top c_subBucketBits + 1 bits of the value select the bucket
+        // within its power of two.
+        const unsigned shift = HighestBit(nanoseconds) - c_subBucketBits;
+        return static_cast<size_t>(
+            (shift + 1) * c_subBucketCount
+            + (nanoseconds >> shift) - c_subBucketCount);
+    }
+
+
+    uint64_t LatencyHistogram::GetBucketMax(size_t bucket)
+    {
+        if (bucket < c_subBucketCount)
+        {
+            return bucket;
+        }
+
+        const unsigned shift =
+            static_cast<unsigned>(bucket / c_subBucketCount) - 1;
+        const uint64_t top = c_subBucketCount + bucket % c_subBucketCount;
+        return (top << shift) + ((1ull << shift) - 1);
+    }
+}
@@ -21,6 +21,7 @@
 // THE SOFTWARE.
 
 #include "BitFunnel/Utilities/Factories.h"
+#include "LoggerInterfaces/Check.h"
 #include "TaskDistributor.h"
 #include "TaskDistributorThread.h"
 
@@ -35,33 +36,79 @@ namespace BitFunnel
     }
 
 
+    TaskDistributor::Lane::Lane(size_t begin, size_t end)
+        : m_range(Pack(begin, end)),
+          m_next(0),
+          m_end(0)
+    {
+    }
+
+
     TaskDistributor::TaskDistributor(std::vector<std::unique_ptr<ITaskProcessor>> const & processors,
                                      size_t taskCount)
-        : m_processors(processors),
-          m_taskCount(taskCount),
-          m_nextTaskId(0)
     {
-        for (size_t i = 0 ; i < m_processors.size(); ++i)
+        CHECK_LE(taskCount, 0xffffffffull)
+            << "TaskDistributor: task count must fit in 32 bits.";
+
+        const size_t laneCount = processors.size();
+        for (size_t i = 0 ; i < laneCount; ++i)
+        {
+            m_lanes.push_back(
+                std::unique_ptr<Lane>(
+                    new Lane(i * taskCount / laneCount,
+                             (i + 1) * taskCount / laneCount)));
+        }
+
+        // Lanes must be initialized before the threads start.
+        for (size_t i = 0 ; i < laneCount; ++i)
         {
-            m_threads.push_back(std::unique_ptr<IThreadBase>(new TaskDistributorThread(*this, *m_processors[i])));
+            m_threads.push_back(std::unique_ptr<IThreadBase>(new TaskDistributorThread(*this, i, *processors[i])));
         }
         m_threadManager = std::unique_ptr<ThreadManager>((new ThreadManager(m_threads)));
     }
 
 
-    bool TaskDistributor::TryAllocateTask(size_t& taskId)
+    TaskDistributor::~TaskDistributor()
     {
-        std::lock_guard<std::mutex> lock(m_lock);
+        // Destroy the ThreadManager, which waits for the threads, before the
+        // lanes they use.
+        m_threadManager.reset();
+    }
+
 
-        if (m_nextTaskId < m_taskCount)
+    bool TaskDistributor::TryAllocateTask(size_t lane, size_t& taskId)
+    {
+        Lane& owner = *m_lanes[lane];
+        while (owner.m_next == owner.m_end && !TryClaimBatch(owner))
         {
-            taskId = m_nextTaskId++;
-            return true;
+            if (!TrySteal(lane))
+            {
+                return false;
+            }
         }
-        else
+
+        taskId = owner.m_next++;
+        return true;
+    }
+
+
+    bool TaskDistributor::TryAllocateTask(size_t& taskId)
+    {
+        for (auto & lane : m_lanes)
         {
-            return false;
+            uint64_t range = lane->m_range.load();
+            while (Begin(range) < End(range))
+            {
+                const size_t end = End(range) - 1;
+                if (lane->m_range.compare_exchange_weak(range,
+                                                        Pack(Begin(range), end)))
+                {
+                    taskId = end;
+                    return true;
+                }
+            }
         }
+        return false;
     }
 
 
@@ -69,4 +116,89 @@ namespace BitFunnel
     {
         m_threadManager->WaitForThreads();
     }
+
+
+    uint64_t TaskDistributor::Pack(size_t begin, size_t end)
+    {
+        return (static_cast<uint64_t>(begin) << 32) | static_cast<uint64_t>(end);
+    }
+
+
+    size_t TaskDistributor::Begin(uint64_t range)
+    {
+        return static_cast<size_t>(range >> 32);
+    }
+
+
+    size_t TaskDistributor::End(uint64_t range)
+    {
+        return static_cast<size_t>(range & 0xffffffffull);
+    }
+
+
+    bool TaskDistributor::TryClaimBatch(Lane& lane)
+    {
+        uint64_t range = lane.m_range.load();
+        for (;;)
+        {
+            const size_t begin = Begin(range);
+            const size_t end = End(range);
+            if (begin == end)
+            {
+                return false;
+            }
+
+            // Claim a quarter of what remains, so that the tail of the
+            // range is left in small pieces that thieves can balance.
+            size_t count = (end - begin) / 4;
+            if (count == 0)
+            {
+                count = 1;
+            }
+            else if (count > c_maxBatchSize)
+            {
+                count = c_maxBatchSize;
+            }
+
+            if (lane.m_range.compare_exchange_weak(range, Pack(begin + count, end)))
+            {
+                lane.m_next = begin;
+                lane.m_end = begin + count;
+                return true;
+            }
+        }
+    }
+
+
+    bool TaskDistributor::TrySteal(size_t thief)
+    {
+        const size_t laneCount = m_lanes.size();
+        for (size_t i = 1; i < laneCount; ++i)
+        {
+            Lane& victim = *m_lanes[(thief + i) % laneCount];
+            uint64_t range = victim.m_range.load();
+            for (;;)
+            {
+                const size_t begin = Begin(range);
+                const size_t end = End(range);
+
+                // Leave the last id for the victim, so that every processor
+                // with a non-empty range processes at least one task.
+                if (end - begin < 2)
+                {
+                    break;
+                }
+
+                const size_t split = end - (end - begin) / 2;
+                if (victim.m_range.compare_exchange_weak(range, Pack(begin, split)))
+                {
+                    // No other thread adds ids to an empty range, so a plain
+                    // store is sufficient.
+                    m_lanes[thief]->m_range.store(Pack(split, end));
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
 }
@@ -22,8 +22,9 @@
 
 #pragma once
 
+#include <atomic>                                   // std::atomic member.
 #include <memory>                                   // For std::unique_ptr.
-#include <mutex>                                    // std::mutex member.
+#include <stdint.h>                                 // uint64_t member.
 #include <vector>                                   // std::vector member.
 
 #include "BitFunnel/Utilities/ITaskDistributor.h"   // Inherits from ITaskDistributor.
@@ -44,11 +45,17 @@ namespace BitFunnel
     // Uses multiple threads to dispatch numbered tasks to a vector of objects
     // that derive from ITaskProcessor.
     //
-    // One thread is started for each ITaskProcessor. The ITaskProcessors are
-    // assigned task ids via ITaskProcessor::ProcessTask(). Task ids are handed
-    // out starting from 0 and increasing until all ITaskProcessors are busy.
-    // Each time a thread returns from ProcessTask(), a new task id will be
-    // assigned until all tasks have been processed.
+    // Each ITaskProcessor runs on its own thread from the process-wide
+    // ThreadPool. The task ids are divided into one contiguous range per
+    // ITaskProcessor. A processor claims small batches of ids from the front
+    // of its own range, and when its range is empty, steals the back half of
+    // another processor's range. Claims and steals are single compare-and-swap
+    // operations, so there is no shared lock or shared counter.
+    //
+    // A processor whose range is not initially empty always processes at
+    // least one task from it, since thieves never take the last remaining id
+    // in a range. When taskCount >= processors.size(), every processor
+    // therefore processes at least one task.
     //
     // Task coordinator only knows about task ids. The interpretation of the
     // work associated with a particular task id is up to the ITaskProcessor.
@@ -61,23 +68,68 @@ namespace BitFunnel
             const std::vector<std::unique_ptr<ITaskProcessor>>& processors,
             size_t taskCount);
 
-        // TaskDistributorThreads call TryAllocateTask() to get their next task
-        // assignment. If there is work remaining, taskId will be set to the id
-        // of the assigned task and the method will return true. If there are
-        // no tasks remaining, the method will return false.
-        bool TryAllocateTask(size_t& taskId);
+        // Waits for all tasks to complete.
+        ~TaskDistributor();
+
+        // Allocates a task to the processor that owns lane, which must only
+        // be called from that processor's thread. If there is work
+        // remaining, taskId will be set to the id of the assigned task and
+        // the method will return true. If there are no tasks remaining, the
+        // method will return false.
+        bool TryAllocateTask(size_t lane, size_t& taskId);
+
+        //
+        // ITaskDistributor methods.
+        //
+
+        // Takes a single task from the back of any lane. Intended for
+        // callers outside the distributor's own threads.
+        virtual bool TryAllocateTask(size_t& taskId) override;
 
         // Wait for all tasks to complete.
-        void WaitForCompletion();
+        virtual void WaitForCompletion() override;
+
+        // Maximum number of task ids a processor claims from its own range
+        // at a time.
+        static const size_t c_maxBatchSize = 16;
 
     private:
-        std::vector<std::unique_ptr<ITaskProcessor>> const & m_processors;
-        size_t m_taskCount;
-        size_t m_nextTaskId;
+        // Per-processor state. Each Lane is allocated separately and padded
+        // so that lanes used by different threads don't share cache lines.
+        class Lane
+        {
+        public:
+            Lane(size_t begin, size_t end);
+
+            // Unclaimed task ids, packed by Pack(). Modified by the owner
+            // and by thieves.
+            std::atomic<uint64_t> m_range;
+
+            // Task ids claimed by the owner but not yet processed. Only
+            // accessed by the owner.
+            size_t m_next;
+            size_t m_end;
+
+        private:
+            char m_padding[64];
+        };
+
+        static uint64_t Pack(size_t begin, size_t end);
+        static size_t Begin(uint64_t range);
+        static size_t End(uint64_t range);
+
+        // Moves a batch of ids from the front of lane's unclaimed range to
+        // its claimed range. Returns false if the unclaimed range is empty.
+        bool TryClaimBatch(Lane& lane);
+
+        // Moves the back half of some other lane's unclaimed range into
+        // thief's unclaimed range, which must be empty. Returns false if no
+        // lane has at least two unclaimed ids.
+        bool TrySteal(size_t thief);
+
+        std::vector<std::unique_ptr<Lane>> m_lanes;
 
         std::vector<std::unique_ptr<IThreadBase>> m_threads;
         std::unique_ptr<ThreadManager> m_threadManager;
-
-        std::mutex m_lock;
     };
 }
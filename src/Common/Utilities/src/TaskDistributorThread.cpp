@@ -27,8 +27,11 @@
 
 namespace BitFunnel
 {
-    TaskDistributorThread::TaskDistributorThread(TaskDistributor& distributor, ITaskProcessor& processor)
+    TaskDistributorThread::TaskDistributorThread(TaskDistributor& distributor,
+                                                 size_t lane,
+                                                 ITaskProcessor& processor)
         : m_distributor(distributor),
+          m_lane(lane),
           m_processor(processor)
     {
     }
@@ -36,7 +39,7 @@ namespace BitFunnel
     void TaskDistributorThread::EntryPoint()
     {
         size_t taskId = 0;
-        while (m_distributor.TryAllocateTask(taskId))
+        while (m_distributor.TryAllocateTask(m_lane, taskId))
         {
             m_processor.ProcessTask(taskId);
         }
@@ -22,6 +22,8 @@
 
 #pragma once
 
+#include <stddef.h>     // size_t member.
+
 #include "ThreadManager.h"
 
 namespace BitFunnel
@@ -32,11 +34,14 @@ namespace BitFunnel
     class TaskDistributorThread : public IThreadBase
     {
     public:
-        TaskDistributorThread(TaskDistributor& distributor, ITaskProcessor& processor);
+        TaskDistributorThread(TaskDistributor& distributor,
+                              size_t lane,
+                              ITaskProcessor& processor);
         void EntryPoint();
 
     private:
         TaskDistributor& m_distributor;
+        size_t m_lane;
         ITaskProcessor& m_processor;
     };
 }
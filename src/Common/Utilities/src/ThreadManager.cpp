@@ -21,8 +21,6 @@
 // THE SOFTWARE.
 
 
-#include <stddef.h>
-
 #include "BitFunnel/Utilities/Factories.h"
 #include "ThreadManager.h"
 
@@ -38,31 +36,18 @@ namespace BitFunnel
 
     ThreadManager::ThreadManager(const std::vector<std::unique_ptr<IThreadBase>>& threads)
     {
-        for (size_t i = 0 ; i < threads.size(); ++i)
-        {
-            m_threads.push_back(std::thread(ThreadEntryPoint, threads[i].get()));
-        }
+        ThreadPool::GetInstance().Start(threads, m_completion);
     }
 
 
     ThreadManager::~ThreadManager()
     {
-        // REVIEW: what should this do if threads are still running?
+        m_completion.Wait();
     }
 
 
     void ThreadManager::WaitForThreads()
     {
-        for (auto& thread : m_threads)
-        {
-            thread.join();
-        }
-    }
-
-
-    void ThreadManager::ThreadEntryPoint(void* data)
-    {
-        IThreadBase* thread = static_cast<IThreadBase*>(data);
-        thread->EntryPoint();
+        m_completion.Wait();
     }
 }
@@ -22,29 +22,39 @@
 
 #pragma once
 
-#include <thread>                                   // std::thread embedded.
-#include <vector>                                   // std::vector embedded.
+#include <memory>                                   // std::unique_ptr parameter.
+#include <vector>                                   // std::vector parameter.
 
 #include "BitFunnel/Utilities/IThreadManager.h"     // Base class.
 #include "BitFunnel/NonCopyable.h"                  // Base class.
+#include "ThreadPool.h"                             // ThreadPool::Completion embedded.
 
 
 namespace BitFunnel
 {
+    //*************************************************************************
+    //
+    // ThreadManager
+    //
+    // Runs each IThreadBase on its own thread, borrowed from the process-wide
+    // ThreadPool. The threads return to the pool when their entry points
+    // exit, rather than being destroyed.
+    //
+    //*************************************************************************
     class ThreadManager : public IThreadManager, NonCopyable
     {
     public:
-        // Starts one thread for each IThreadBase* in threads. Returns true if succesful.
+        // Starts one thread for each IThreadBase* in threads.
         ThreadManager(const std::vector<std::unique_ptr<IThreadBase>>& threads);
 
+        // Waits for all threads to finish, since they reference the
+        // IThreadBases owned by the caller.
         ~ThreadManager();
 
         // Wait for all threads to finish.
         void WaitForThreads();
 
     private:
-        static void ThreadEntryPoint(void* data);
-
-        std::vector<std::thread> m_threads;
+        ThreadPool::Completion m_completion;
     };
 }
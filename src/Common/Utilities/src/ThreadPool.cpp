@@ -0,0 +1,317 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <algorithm>                                // std::find_if(), std::max().
+#include <thread>                                   // std::thread embedded.
+
+#include "BitFunnel/Utilities/IThreadManager.h"
+#include "ThreadPool.h"
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // ThreadPool::Completion
+    //
+    //*************************************************************************
+    ThreadPool::Completion::Completion()
+      : m_remaining(0)
+    {
+    }
+
+
+    void ThreadPool::Completion::Wait()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (m_remaining > 0)
+        {
+            m_done.wait(lock);
+        }
+    }
+
+
+    void ThreadPool::Completion::Add(size_t count)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_remaining += count;
+    }
+
+
+    void ThreadPool::Completion::OnThreadExit()
+    {
+        // Notify while holding the lock so that a thread returning from
+        // Wait() cannot destroy the Completion before notify_all() is done
+        // with it.
+        std::lock_guard<std::mutex> lock(m_lock);
+        --m_remaining;
+        if (m_remaining == 0)
+        {
+            m_done.notify_all();
+        }
+    }
+
+
+    //*************************************************************************
+    //
+    // ThreadPool::Worker
+    //
+    //*************************************************************************
+    class ThreadPool::Worker : NonCopyable
+    {
+    public:
+        Worker(ThreadPool& pool);
+
+        // Hands thread to this Worker. Must be called with the pool's lock
+        // held, while the Worker is idle.
+        void Assign(IThreadBase& thread, Completion& completion);
+
+        // Wakes the Worker so that it can observe shutdown. Must be called
+        // with the pool's lock held.
+        void Wake();
+
+        // Tells the idle Worker to exit. Must be called with the pool's lock
+        // held.
+        void Retire();
+
+        void Join();
+
+    private:
+        void EntryPoint();
+
+        ThreadPool& m_pool;
+
+        // Protected by the pool's lock. Non-null while the Worker has an
+        // entry point to run.
+        IThreadBase* m_current;
+        Completion* m_completion;
+        bool m_retired;
+        std::condition_variable m_wake;
+
+        std::thread m_thread;
+    };
+
+
+    ThreadPool::Worker::Worker(ThreadPool& pool)
+      : m_pool(pool),
+        m_current(nullptr),
+        m_completion(nullptr),
+        m_retired(false)
+    {
+        // Start the OS thread last, since it reads the members above.
+        m_thread = std::thread(&Worker::EntryPoint, this);
+    }
+
+
+    void ThreadPool::Worker::Assign(IThreadBase& thread, Completion& completion)
+    {
+        m_current = &thread;
+        m_completion = &completion;
+        m_wake.notify_one();
+    }
+
+
+    void ThreadPool::Worker::Wake()
+    {
+        m_wake.notify_one();
+    }
+
+
+    void ThreadPool::Worker::Retire()
+    {
+        m_retired = true;
+        m_wake.notify_one();
+    }
+
+
+    void ThreadPool::Worker::Join()
+    {
+        m_thread.join();
+    }
+
+
+    void ThreadPool::Worker::EntryPoint()
+    {
+        std::unique_lock<std::mutex> lock(m_pool.m_lock);
+        for (;;)
+        {
+            while (m_current == nullptr && !m_pool.m_shutdown && !m_retired)
+            {
+                m_wake.wait(lock);
+            }
+
+            if (m_current == nullptr)
+            {
+                break;
+            }
+
+            IThreadBase& thread = *m_current;
+            Completion& completion = *m_completion;
+            lock.unlock();
+
+            thread.EntryPoint();
+
+            // Return to the idle stack before signalling completion so that
+            // a caller that immediately starts another batch reuses this
+            // thread instead of growing the pool.
+            lock.lock();
+            m_current = nullptr;
+            m_completion = nullptr;
+            m_pool.m_idle.push_back(this);
+            lock.unlock();
+
+            // The Completion may be destroyed as soon as this returns.
+            completion.OnThreadExit();
+
+            lock.lock();
+        }
+    }
+
+
+    //*************************************************************************
+    //
+    // ThreadPool
+    //
+    //*************************************************************************
+    ThreadPool& ThreadPool::GetInstance()
+    {
+        // Deliberately leaked. Destroying the pool at exit would join every
+        // thread, and hang if any entry point were still running.
+        static ThreadPool* pool =
+            new ThreadPool((std::max)(std::thread::hardware_concurrency(), 1u));
+        return *pool;
+    }
+
+
+    ThreadPool::ThreadPool(size_t maxIdleThreads)
+      : m_shutdown(false),
+        m_maxIdleThreads(maxIdleThreads)
+    {
+    }
+
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_shutdown = true;
+            for (auto & worker : m_workers)
+            {
+                worker->Wake();
+            }
+        }
+
+        for (auto & worker : m_workers)
+        {
+            worker->Join();
+        }
+    }
+
+
+    void ThreadPool::Start(std::vector<std::unique_ptr<IThreadBase>> const & threads,
+                           Completion& completion)
+    {
+        completion.Add(threads.size());
+
+        std::vector<std::unique_ptr<Worker>> retired;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            for (auto & thread : threads)
+            {
+                Worker* worker = nullptr;
+                if (m_idle.empty())
+                {
+                    m_workers.push_back(std::unique_ptr<Worker>(new Worker(*this)));
+                    worker = m_workers.back().get();
+                }
+                else
+                {
+                    worker = m_idle.back();
+                    m_idle.pop_back();
+                }
+                worker->Assign(*thread, completion);
+            }
+
+            retired = RetireIdleThreads();
+        }
+
+        for (auto & worker : retired)
+        {
+            worker->Join();
+        }
+    }
+
+
+    size_t ThreadPool::GetThreadCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_workers.size();
+    }
+
+
+    size_t ThreadPool::GetIdleThreadCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_idle.size();
+    }
+
+
+    void ThreadPool::SetMaxIdleThreadCount(size_t maxIdleThreads)
+    {
+        std::vector<std::unique_ptr<Worker>> retired;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_maxIdleThreads = maxIdleThreads;
+            retired = RetireIdleThreads();
+        }
+
+        for (auto & worker : retired)
+        {
+            worker->Join();
+        }
+    }
+
+
+    std::vector<std::unique_ptr<ThreadPool::Worker>> ThreadPool::RetireIdleThreads()
+    {
+        std::vector<std::unique_ptr<Worker>> retired;
+        if (m_idle.size() > m_maxIdleThreads)
+        {
+            // The bottom of the idle stack holds the coldest threads.
+            const size_t count = m_idle.size() - m_maxIdleThreads;
+            for (size_t i = 0; i < count; ++i)
+            {
+                m_idle[i]->Retire();
+                auto it = std::find_if(m_workers.begin(),
+                                       m_workers.end(),
+                                       [&](std::unique_ptr<Worker> const & worker)
+                                       {
+                                           return worker.get() == m_idle[i];
+                                       });
+                retired.push_back(std::move(*it));
+                m_workers.erase(it);
+            }
+            m_idle.erase(m_idle.begin(), m_idle.begin() + static_cast<ptrdiff_t>(count));
+        }
+        return retired;
+    }
+}
@@ -0,0 +1,137 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <condition_variable>                       // std::condition_variable embedded.
+#include <limits>                                   // std::numeric_limits parameter.
+#include <memory>                                   // std::unique_ptr embedded.
+#include <mutex>                                    // std::mutex embedded.
+#include <stddef.h>                                 // size_t embedded.
+#include <vector>                                   // std::vector embedded.
+
+#include "BitFunnel/NonCopyable.h"                  // Base class.
+
+
+namespace BitFunnel
+{
+    class IThreadBase;
+
+    //*************************************************************************
+    //
+    // ThreadPool
+    //
+    // A set of persistent OS threads that run IThreadBase::EntryPoint() on
+    // behalf of ThreadManager, and therefore TaskDistributor. Threads that
+    // return from EntryPoint() park until they are given another entry point,
+    // so short-lived batches don't pay for thread creation.
+    //
+    // Each entry point passed to Start() runs on its own thread, concurrently
+    // with the others. If there are not enough idle threads, the pool grows.
+    // This preserves the one-thread-per-IThreadBase guarantee of the original
+    // ThreadManager, which callers such as QueryRunner's ThreadSynchronizer
+    // rely on, and prevents deadlock when an entry point itself waits for a
+    // nested batch of work.
+    //
+    // Threads left idle above a cap, for example after a batch larger than
+    // usual, are stopped the next time work is started or the cap is set.
+    //
+    //*************************************************************************
+    class ThreadPool : NonCopyable
+    {
+    public:
+        //*********************************************************************
+        //
+        // Completion
+        //
+        // Tracks a group of entry points started together.
+        //
+        //*********************************************************************
+        class Completion : NonCopyable
+        {
+        public:
+            Completion();
+
+            // Blocks until every entry point associated with this Completion
+            // has returned. Safe to call more than once.
+            void Wait();
+
+        private:
+            friend class ThreadPool;
+
+            void Add(size_t count);
+            void OnThreadExit();
+
+            std::mutex m_lock;
+            std::condition_variable m_done;
+            size_t m_remaining;
+        };
+
+        // Returns the process-wide pool shared by all ThreadManagers. The
+        // pool is never destroyed, so that an entry point still running when
+        // the process exits cannot keep it from exiting. It keeps at most
+        // one idle thread per hardware thread.
+        static ThreadPool& GetInstance();
+
+        // Keeps at most maxIdleThreads idle threads.
+        ThreadPool(size_t maxIdleThreads = (std::numeric_limits<size_t>::max)());
+
+        // Stops and joins every thread. All entry points must have returned.
+        ~ThreadPool();
+
+        // Runs each entry point on its own pool thread, reporting to
+        // completion as they return. The IThreadBases must outlive
+        // completion.Wait().
+        void Start(std::vector<std::unique_ptr<IThreadBase>> const & threads,
+                   Completion& completion);
+
+        // Returns the number of OS threads owned by the pool.
+        size_t GetThreadCount() const;
+
+        // Returns the number of threads waiting for an entry point.
+        size_t GetIdleThreadCount() const;
+
+        // Sets the maximum number of idle threads and stops any idle threads
+        // above it.
+        void SetMaxIdleThreadCount(size_t maxIdleThreads);
+
+    private:
+        class Worker;
+
+        // Removes the idle threads above m_maxIdleThreads from the pool,
+        // starting with those idle longest, and tells them to exit. Must be
+        // called with m_lock held. The caller must join the returned Workers
+        // after releasing m_lock.
+        std::vector<std::unique_ptr<Worker>> RetireIdleThreads();
+
+        // Protects the members that follow and the state of every Worker.
+        mutable std::mutex m_lock;
+        bool m_shutdown;
+        size_t m_maxIdleThreads;
+
+        std::vector<std::unique_ptr<Worker>> m_workers;
+
+        // Used as a stack so that the most recently active threads, whose
+        // caches are warm, are reused first.
+        std::vector<Worker*> m_idle;
+    };
+}
@@ -20,13 +20,13 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
-
-#include <algorithm>
+#include <memory>                           // std::align.
+#include <new>                              // Placement new.
+#include <type_traits>                      // std::is_trivially_destructible.
 
 #include "BitFunnel/Utilities/Factories.h"
 #include "LoggerInterfaces/Logging.h"
 #include "TokenManager.h"
-#include "TokenTracker.h"
 
 namespace BitFunnel
 {
@@ -36,11 +36,142 @@ namespace BitFunnel
     }
 
 
+    //*************************************************************************
+    //
+    // TokenManager::Slot
+    //
+    // Per-thread token counts. Slots are aligned to cache lines, and
+    // TokenManager places them on a cache line boundary, so threads using
+    // different slots don't share the lines they update.
+    //
+    //*************************************************************************
+    class alignas(64) TokenManager::Slot
+    {
+    public:
+        Slot()
+          : m_nextSequence(0)
+        {
+            for (auto & count : m_counts)
+            {
+                count = 0;
+            }
+        }
+
+        // Tokens in flight for each epoch, indexed by epoch % c_epochCount.
+        std::atomic<int64_t> m_counts[c_epochCount];
+
+        std::atomic<uint64_t> m_nextSequence;
+    };
+
+
+    //*************************************************************************
+    //
+    // TokenManager::Tracker
+    //
+    // Tracks the tokens issued in epochs before m_epoch. Completed by the
+    // TokenManager.
+    //
+    //*************************************************************************
+    class TokenManager::Tracker : public ITokenTracker,
+                                  private NonCopyable
+    {
+    public:
+        Tracker(uint64_t epoch)
+          : m_epoch(epoch),
+            m_isComplete(false)
+        {
+        }
+
+        uint64_t GetEpoch() const
+        {
+            return m_epoch;
+        }
+
+        void Complete()
+        {
+            // This lock is to prevent a race between notification on the
+            // condition variable and waiting on the condition variable.
+            {
+                std::lock_guard<std::mutex> lock(m_conditionLock);
+                m_isComplete = true;
+            }
+            m_condition.notify_all();
+        }
+
+        //
+        // ITokenTracker API
+        //
+        virtual bool IsComplete() const override
+        {
+            return m_isComplete.load();
+        }
+
+        virtual void WaitForCompletion() override
+        {
+            std::unique_lock<std::mutex> lock(m_conditionLock);
+            while (!IsComplete())
+            {
+                m_condition.wait(lock);
+            }
+        }
+
+    private:
+        const uint64_t m_epoch;
+        std::atomic<bool> m_isComplete;
+
+        std::condition_variable m_condition;
+        std::mutex m_conditionLock;
+    };
+
+
+    //*************************************************************************
+    //
+    // TokenManager
+    //
+    //*************************************************************************
+
+    // SerialNumber layout, from most to least significant bit: 6 bits of
+    // slot, 33 bits of epoch, and 24 bits of sequence number. The sequence
+    // number wraps.
+    static const unsigned c_epochShift = 24;
+    static const unsigned c_slotShift = 57;
+    static const uint64_t c_sequenceMask = (1ull << c_epochShift) - 1;
+    static const uint64_t c_epochMask = (1ull << (c_slotShift - c_epochShift)) - 1;
+
+    static_assert(TokenManager::c_slotCount <= (1ull << (63 - c_slotShift)),
+                  "TokenManager: slot does not fit in SerialNumber.");
+
+
+    static std::atomic<uint64_t> s_nextManagerId(1);
+
+
     TokenManager::TokenManager()
-        : m_nextSerialNumber(0),
-          m_tokensInFlight(0),
-          m_isShuttingDown(false)
+        : m_id(s_nextManagerId++),
+          m_nextSlot(0),
+          m_slotBuffer(new char[c_slotCount * sizeof(Slot) + alignof(Slot)]),
+          m_slots(nullptr),
+          m_epoch(0),
+          m_isShuttingDown(false),
+          m_drainedEpoch(0),
+          m_lockedReleaseCount(0)
     {
+        static_assert(sizeof(Slot) % 64 == 0,
+                      "TokenManager: Slot is not a whole number of cache lines.");
+        static_assert(std::is_trivially_destructible<Slot>::value,
+                      "TokenManager: Slots are released without being destroyed.");
+
+        // operator new[] does not honor alignas(64) before C++17, so the
+        // slots are aligned by hand.
+        void * base = m_slotBuffer.get();
+        size_t space = c_slotCount * sizeof(Slot) + alignof(Slot);
+        base = std::align(alignof(Slot), c_slotCount * sizeof(Slot), base, space);
+        LogAssertB(base != nullptr, "TokenManager: could not align slots.");
+
+        m_slots = static_cast<Slot*>(base);
+        for (size_t i = 0; i < c_slotCount; ++i)
+        {
+            new (m_slots + i) Slot();
+        }
     }
 
 
@@ -54,28 +185,38 @@ namespace BitFunnel
     {
         LogAssertB(!m_isShuttingDown, "Requested Token while shutting down");
 
-        std::lock_guard<std::mutex> lock(m_lock);
-        const SerialNumber serialNumber = m_nextSerialNumber++;
-        ++m_tokensInFlight;
-        return Token(*this, serialNumber);
+        const size_t slotIndex = GetSlotIndex();
+        Slot& slot = m_slots[slotIndex];
+
+        // Count the token before confirming its epoch. If the epoch ends in
+        // between, the tracker for that epoch may have already counted the
+        // tokens in flight, so the token moves to the new epoch instead.
+        uint64_t epoch = m_epoch.load();
+        for (;;)
+        {
+            ++slot.m_counts[epoch % c_epochCount];
+            const uint64_t current = m_epoch.load();
+            if (current == epoch)
+            {
+                break;
+            }
+            Release(slotIndex, epoch);
+            epoch = current;
+        }
+
+        const uint64_t sequence = slot.m_nextSequence++;
+        return Token(*this, Encode(slotIndex, epoch, sequence));
     }
 
 
     const std::shared_ptr<ITokenTracker> TokenManager::StartTracker()
     {
         std::lock_guard<std::mutex> lock(m_lock);
-        std::shared_ptr<TokenTracker> tracker(
-            new TokenTracker(m_nextSerialNumber, m_tokensInFlight));
-
-        // If there are no tokens in flight, then the tracker is already
-        // complete. There is no point in adding it to the list of active
-        // trackers. Returns it to the client so that they can check its
-        // completion status, but from the TokenManager's perspective, this
-        // tracker is not of interest.
-        if (!(tracker->IsComplete()))
-        {
-            m_trackers.push_back(tracker);
-        }
+
+        const uint64_t epoch = m_epoch.load() + 1;
+        std::shared_ptr<Tracker> tracker(new Tracker(epoch));
+        m_trackers.push_back(tracker);
+        UpdateTrackers();
 
         return tracker;
     }
@@ -88,47 +229,146 @@ namespace BitFunnel
 
         // Wait for existing tokens to be returned.
         // TODO: consider if we want to timeout and log an error.
-        while (m_tokensInFlight > 0)
+        StartTracker()->WaitForCompletion();
+    }
+
+
+    uint64_t TokenManager::GetLockedReleaseCount()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_lockedReleaseCount;
+    }
+
+
+    void TokenManager::OnTokenComplete(SerialNumber serialNumber)
+    {
+        Release(GetSlot(serialNumber), GetEpoch(serialNumber));
+    }
+
+
+    size_t TokenManager::GetSlotIndex()
+    {
+        // Slots are assigned per TokenManager, so that threads using a new
+        // TokenManager are distributed from its first slot.
+        struct ThreadSlot
+        {
+            uint64_t m_managerId;
+            size_t m_slot;
+        };
+        static thread_local ThreadSlot threadSlot = { 0, 0 };
+
+        if (threadSlot.m_managerId != m_id)
         {
-            std::unique_lock<std::mutex> lock(m_lock);
-            m_shutdownCondition.wait(lock);
+            threadSlot.m_managerId = m_id;
+            threadSlot.m_slot = static_cast<size_t>(m_nextSlot++ % c_slotCount);
         }
+        return threadSlot.m_slot;
     }
 
 
-    void TokenManager::OnTokenComplete(SerialNumber serialNumber)
+    void TokenManager::Release(size_t slot, uint64_t epoch)
     {
-        LogAssertB(m_tokensInFlight > 0,
-                   "Token completed with <= 0 tokens in flight.");
+        const int64_t remaining = --m_slots[slot].m_counts[epoch % c_epochCount];
+        LogAssertB(remaining >= 0, "Token completed with <= 0 tokens in flight.");
 
+        // If the epoch has not ended, the epoch change that ends it will
+        // happen after the decrement above, and before the trackers count
+        // tokens.
+        if (epoch < m_epoch.load())
         {
             std::lock_guard<std::mutex> lock(m_lock);
-            --m_tokensInFlight;
+            ++m_lockedReleaseCount;
+            UpdateTrackers();
+        }
+    }
 
-            // m_trackers consists of a sequence of zero or more complete trackers,
-            // followed by a sequence of trackers that have not completed.
 
-            // First notify and remove the completed trackers at the head of m_trackers.
-            while (!m_trackers.empty() &&
-                   m_trackers.front()->OnTokenComplete(serialNumber))
+    int64_t TokenManager::CountTokens(uint64_t begin, uint64_t end) const
+    {
+        int64_t count = 0;
+        for (size_t slot = 0; slot < c_slotCount; ++slot)
+        {
+            for (uint64_t epoch = begin; epoch < end; ++epoch)
             {
-                m_trackers.pop_front();
+                count += m_slots[slot].m_counts[epoch % c_epochCount].load();
             }
+        }
+        return count;
+    }
 
-            // Then notify the remaining trackers, starting with index 1, since we
-            // have already notified the first one in the while loop above.
-            for (unsigned i = 1; i < m_trackers.size(); ++i)
-            {
-                // All older trackers must be complete for a tracker to
-                // complete.
-                LogAssertB(!m_trackers[i]->OnTokenComplete(serialNumber),
-                           "Tracker completed out of order.");
-            }
+
+    bool TokenManager::TryAdvanceEpoch()
+    {
+        const uint64_t epoch = m_epoch.load();
+        if (m_trackers.empty() || m_trackers.back()->GetEpoch() <= epoch)
+        {
+            // No tracker is waiting for the current epoch to end.
+            return false;
         }
 
-        if (m_tokensInFlight == 0 && m_isShuttingDown)
+        // The next epoch's counters were last used by epoch + 1 -
+        // c_epochCount, which must have drained.
+        const uint64_t next = epoch + 1;
+        if (next >= c_epochCount && next - c_epochCount >= m_drainedEpoch)
         {
-            m_shutdownCondition.notify_all();
+            return false;
         }
+
+        // Tokens from the ended epoch now take the lock when destroyed, so
+        // UpdateTrackers() must count them after this store.
+        m_epoch = next;
+        return true;
+    }
+
+
+    void TokenManager::UpdateTrackers()
+    {
+        do
+        {
+            // Trackers complete in the order they were started, since each
+            // one covers all of the epochs of the trackers before it.
+            while (!m_trackers.empty())
+            {
+                Tracker& tracker = *m_trackers.front();
+                if (tracker.GetEpoch() > m_epoch.load() ||
+                    CountTokens(m_drainedEpoch, tracker.GetEpoch()) != 0)
+                {
+                    break;
+                }
+
+                m_drainedEpoch = tracker.GetEpoch();
+                tracker.Complete();
+                m_trackers.pop_front();
+            }
+
+            // Completing trackers may have freed the counters needed to end
+            // the current epoch.
+        } while (TryAdvanceEpoch());
+    }
+
+
+    SerialNumber TokenManager::Encode(size_t slot, uint64_t epoch, uint64_t sequence)
+    {
+        return static_cast<SerialNumber>(
+            (static_cast<uint64_t>(slot) << c_slotShift) |
+            ((epoch & c_epochMask) << c_epochShift) |
+            (sequence & c_sequenceMask));
+    }
+
+
+    size_t TokenManager::GetSlot(SerialNumber serialNumber)
+    {
+        return static_cast<size_t>(static_cast<uint64_t>(serialNumber) >> c_slotShift);
+    }
+
+
+    uint64_t TokenManager::GetEpoch(SerialNumber serialNumber) const
+    {
+        // Only the low bits of the epoch are stored. Tokens in flight are
+        // never from a later epoch than the current one, so the full epoch
+        // is the latest one with matching low bits.
+        const uint64_t bits = (static_cast<uint64_t>(serialNumber) >> c_epochShift) & c_epochMask;
+        const uint64_t current = m_epoch.load();
+        return current - ((current - bits) & c_epochMask);
     }
 }
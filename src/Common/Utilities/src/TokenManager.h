@@ -24,17 +24,16 @@
 #pragma once
 
 #include <atomic>                   // std::atomic embedded.
-#include <condition_variable>       // std::contiion_variable embedded.
+#include <condition_variable>       // std::condition_variable embedded.
 #include <deque>                    // std::deque embedded.
 #include <memory>                   // std::shared_ptr template parameter.
 #include <mutex>                    // std::mutex embedded.
+#include <stdint.h>                 // uint64_t embedded.
 
 #include "BitFunnel/Index/Token.h"  // Inherits from ITokenManager and ITokenListener
 
 namespace BitFunnel
 {
-    class TokenTracker;
-
     //*************************************************************************
     //
     // TokenManager provides an implementation of ITokenManager which assists
@@ -42,10 +41,28 @@ namespace BitFunnel
     // well as to stop and resume distributing new tokens.
     // This class is thread-safe.
     //
-    // DESIGN NOTE: To make it easier to track old tokens, all tokens are
-    // assigned a monotonically increasing serial numbers. With this scheme
-    // ITokenTracker needs only store the most recently issued SerialNumber and
-    // the number of Tokens currently in existence.
+    // DESIGN NOTE: Tokens are grouped into epochs. StartTracker() ends the
+    // current epoch, and its tracker completes once every token from that
+    // epoch and earlier ones has been destroyed.
+    //
+    // Tokens are counted per epoch in one of c_slotCount slots. Each thread
+    // is assigned a slot the first time it requests a token, so threads
+    // requesting and returning tokens usually touch only their own cache
+    // lines. RequestToken() and the Token destructor take no locks. The
+    // exception is the destruction of a token from an epoch that has ended,
+    // since a tracker is waiting for it. Tokens from the current epoch never
+    // take the lock, even while trackers are waiting for it to end.
+    //
+    // Slots hold a counter for each of the last c_epochCount epochs, reusing
+    // counters round robin. An epoch that would reuse the counter of an
+    // epoch still holding tokens is postponed, and tokens continue to be
+    // issued in the current epoch without taking the lock. Trackers are
+    // never completed early, but in this case they may also wait for tokens
+    // issued after they started.
+    //
+    // A token's SerialNumber encodes the slot, the low bits of the epoch, and
+    // a per-slot sequence number. Serial numbers are unique among tokens in flight and
+    // increase for tokens issued by the same thread.
     //
     //*************************************************************************
     class TokenManager : public ITokenManager,
@@ -64,44 +81,83 @@ namespace BitFunnel
         virtual const std::shared_ptr<ITokenTracker> StartTracker() override;
         virtual void Shutdown() override;
 
+        // Returns the number of tokens whose destruction took the lock to
+        // update trackers. Used by tests and diagnostics.
+        uint64_t GetLockedReleaseCount();
+
+        // Number of slots that threads are distributed over.
+        static const size_t c_slotCount = 64;
+
+        // Number of epochs that may have tokens in flight at once.
+        static const size_t c_epochCount = 16;
+
     private:
+        class Slot;
+        class Tracker;
 
         //
         // ITokenListener API.
         //
         virtual void OnTokenComplete(SerialNumber serialNumber) override;
 
-        // Serial number for the next issued token.
-        std::atomic<int64_t> m_nextSerialNumber;
+        // Returns the index of the calling thread's slot.
+        size_t GetSlotIndex();
+
+        // Removes a token issued in epoch from slot, and completes any
+        // trackers that were waiting for it.
+        void Release(size_t slot, uint64_t epoch);
+
+        // Sums the tokens in flight from epochs in [begin, end). Counts may
+        // include tokens that are being issued concurrently, but never omit
+        // tokens from epochs that have ended.
+        int64_t CountTokens(uint64_t begin, uint64_t end) const;
+
+        // Starts a new epoch if a tracker is waiting for the current one to
+        // end and the new epoch's counters are no longer in use. Returns true
+        // if a new epoch was started. Requires m_lock.
+        bool TryAdvanceEpoch();
 
-        // Number of tokens currently in-flight.
-        std::atomic<int64_t> m_tokensInFlight;
+        // Completes trackers whose epochs have no tokens in flight. Requires
+        // m_lock.
+        void UpdateTrackers();
+
+        static SerialNumber Encode(size_t slot, uint64_t epoch, uint64_t sequence);
+        static size_t GetSlot(SerialNumber serialNumber);
+        uint64_t GetEpoch(SerialNumber serialNumber) const;
+
+        // Distinguishes this TokenManager from others in the thread-local
+        // slot assignment.
+        const uint64_t m_id;
+
+        // Used to assign slots to threads round robin.
+        std::atomic<uint64_t> m_nextSlot;
+
+        // Storage for m_slots, which starts at the first cache line boundary
+        // in the buffer.
+        std::unique_ptr<char[]> m_slotBuffer;
+        Slot * m_slots;
+
+        // Epoch in which new tokens are issued. Epochs end only when a
+        // tracker is waiting for them, so tokens from earlier epochs must
+        // update trackers when they are destroyed.
+        std::atomic<uint64_t> m_epoch;
 
         // Flag indicating that TokenManager is shutting down.
         std::atomic<bool> m_isShuttingDown;
 
-        // A list of registered token trackers.
+        // Protects m_trackers, m_drainedEpoch and m_lockedReleaseCount. Not
+        // used by RequestToken() or by tokens from the current epoch.
+        std::mutex m_lock;
+
+        // Trackers that have not completed, in the order they were started.
         // DESIGN NOTE: std::deque is chosen since we always want to add new
         // trackers at the back and remove the completed ones off the front.
-        // The trackers in front will always complete faster than the ones
-        // at the back - since they were started earlier - and we need to
-        // be able to pop the trackers off the list as soon as they complete.
-        std::deque<std::shared_ptr<TokenTracker>> m_trackers;
-
-        // This lock is required to protect two things. First, it's used
-        // to protect the m_trackers deque, which isn't thread safe.
-        // Second, it's used to protect the tuple (m_nextSerialNumber,
-        // m_tokensInFlight), which must be updated in tandem.
-        // Making each of those atomic isn't sufficient. because a new tracker
-        // instantiated when only one of the two variables has been updated will
-        // have an inconsistent state.
-        // This mutex is also used to protect the condition variable, although,
-        // strictly speaking, a finer grained mutex could be used that only
-        // protects the condition variable and m_tokensInFlight.
-        std::mutex m_lock;
+        std::deque<std::shared_ptr<Tracker>> m_trackers;
+
+        // Epochs before this one have no tokens in flight, so their counters
+        // may be reused.
+        uint64_t m_drainedEpoch;
 
-        // Signal that all tokens have been destroyed. This allows Shutdown()
-        // to proceed.
-        std::condition_variable m_shutdownCondition;
+        uint64_t m_lockedReleaseCount;
     };
 }
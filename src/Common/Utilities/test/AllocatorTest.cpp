@@ -0,0 +1,134 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include <cstring>
+#include <set>
+
+#include "gtest/gtest.h"
+
+#include "BitFunnel/Utilities/Allocator.h"
+#include "LoggerInterfaces/Logging.h"
+#include "ThrowingLogger.h"
+
+
+namespace BitFunnel
+{
+    namespace AllocatorTest
+    {
+        TEST(Allocator, Trivial)
+        {
+            Allocator allocator(64);
+
+            EXPECT_EQ(0u, allocator.GetBytesAllocated());
+            EXPECT_EQ(1u, allocator.GetBlockCount());
+
+            // Sizes are rounded up to the alignment.
+            char * a = static_cast<char *>(allocator.Allocate(3));
+            char * b = static_cast<char *>(allocator.Allocate(8));
+            EXPECT_EQ(a + Allocator::c_alignment, b);
+            EXPECT_EQ(2 * Allocator::c_alignment, allocator.GetBytesAllocated());
+
+            allocator.Deallocate(a);
+            allocator.Deallocate(b);
+        }
+
+
+        TEST(Allocator, GrowsAcrossBlocks)
+        {
+            const size_t c_blockSize = 64;
+            Allocator allocator(c_blockSize);
+
+            // Fill several blocks and check that allocations don't overlap.
+            std::set<char *> blocks;
+            for (size_t i = 0; i < 100; ++i)
+            {
+                char * block = static_cast<char *>(allocator.Allocate(24));
+                memset(block, static_cast<int>(i), 24);
+                EXPECT_TRUE(blocks.insert(block).second);
+            }
+            for (auto block : blocks)
+            {
+                EXPECT_EQ(block[0], block[23]);
+                allocator.Deallocate(block);
+            }
+
+            EXPECT_GT(allocator.GetBlockCount(), 1u);
+            EXPECT_GE(allocator.GetBytesReserved(), 100u * 24u);
+            EXPECT_GE(allocator.GetBytesAllocated(), 100u * 24u);
+
+            // Allocations larger than the next block get a block of their
+            // own.
+            const size_t c_large = 100 * c_blockSize;
+            char * large = static_cast<char *>(allocator.Allocate(c_large));
+            memset(large, 0, c_large);
+        }
+
+
+        TEST(Allocator, ResetReusesBlocks)
+        {
+            Allocator allocator(64);
+
+            for (size_t i = 0; i < 50; ++i)
+            {
+                allocator.Allocate(32);
+            }
+            const size_t blockCount = allocator.GetBlockCount();
+            const size_t reserved = allocator.GetBytesReserved();
+            const size_t highWaterMark = allocator.GetHighWaterMark();
+            EXPECT_EQ(allocator.GetBytesAllocated(), highWaterMark);
+
+            // Rerunning the same allocations after Reset() doesn't add
+            // blocks.
+            for (size_t round = 0; round < 3; ++round)
+            {
+                allocator.Reset();
+                EXPECT_EQ(0u, allocator.GetBytesAllocated());
+                EXPECT_EQ(highWaterMark, allocator.GetHighWaterMark());
+
+                for (size_t i = 0; i < 50; ++i)
+                {
+                    allocator.Allocate(32);
+                }
+                EXPECT_EQ(blockCount, allocator.GetBlockCount());
+                EXPECT_EQ(reserved, allocator.GetBytesReserved());
+            }
+
+            // A smaller run leaves the high-water mark unchanged.
+            allocator.Reset();
+            allocator.Allocate(32);
+            EXPECT_EQ(highWaterMark, allocator.GetHighWaterMark());
+        }
+
+
+        TEST(Allocator, DeallocateForeignBlock)
+        {
+            ThrowingLogger logger;
+            Logging::RegisterLogger(&logger);
+
+            Allocator allocator(64);
+            allocator.Allocate(8);
+            char foreign[8];
+            EXPECT_ANY_THROW(allocator.Deallocate(foreign));
+        }
+    }
+}
@@ -0,0 +1,119 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+
+#include "gtest/gtest.h"
+
+#include "BitFunnel/Utilities/LatencyHistogram.h"
+
+
+namespace BitFunnel
+{
+    namespace LatencyHistogramTest
+    {
+        // Largest relative error of a percentile.
+        static const double c_resolution =
+            1.0 / (1ull << LatencyHistogram::c_subBucketBits);
+
+
+        TEST(LatencyHistogram, Empty)
+        {
+            LatencyHistogram histogram;
+
+            EXPECT_EQ(0u, histogram.GetCount());
+            EXPECT_EQ(0.0, histogram.GetPercentile(50));
+            EXPECT_EQ(0.0, histogram.GetMax());
+            EXPECT_EQ(0.0, histogram.GetMean());
+        }
+
+
+        TEST(LatencyHistogram, Percentiles)
+        {
+            LatencyHistogram histogram;
+
+            // 1 to 10000 microseconds, so that percentile p is close to
+            // p * 100 microseconds.
+            const size_t c_count = 10000;
+            for (size_t i = 1; i <= c_count; ++i)
+            {
+                histogram.Record(i * 1e-6);
+            }
+
+            EXPECT_EQ(c_count, histogram.GetCount());
+            EXPECT_NEAR(0.01, histogram.GetMax(), 1e-9);
+            EXPECT_NEAR(0.0050005, histogram.GetMean(), 1e-9);
+
+            const double c_percentiles[] = { 50, 90, 99, 99.9 };
+            for (auto p : c_percentiles)
+            {
+                const double expected = p * 1e-4;
+                const double actual = histogram.GetPercentile(p);
+                EXPECT_GE(actual, expected * (1 - 1e-6)) << p;
+                EXPECT_LE(actual, expected * (1 + c_resolution)) << p;
+            }
+
+            EXPECT_EQ(histogram.GetMax(), histogram.GetPercentile(100));
+        }
+
+
+        TEST(LatencyHistogram, SmallValuesAreExact)
+        {
+            LatencyHistogram histogram;
+            histogram.Record(5e-9);
+            histogram.Record(-1);
+
+            EXPECT_EQ(2u, histogram.GetCount());
+            EXPECT_EQ(0.0, histogram.GetPercentile(50));
+            EXPECT_NEAR(5e-9, histogram.GetPercentile(100), 1e-12);
+        }
+
+
+        TEST(LatencyHistogram, Merge)
+        {
+            LatencyHistogram a;
+            LatencyHistogram b;
+            LatencyHistogram all;
+
+            for (size_t i = 0; i < 1000; ++i)
+            {
+                const double latency = (i * 7919 % 1000 + 1) * 1e-5;
+                (i % 3 == 0 ? a : b).Record(latency);
+                all.Record(latency);
+            }
+
+            a.Merge(b);
+
+            EXPECT_EQ(all.GetCount(), a.GetCount());
+            EXPECT_EQ(all.GetMax(), a.GetMax());
+            EXPECT_NEAR(all.GetMean(), a.GetMean(), 1e-12);
+            const double c_percentiles[] = { 50, 90, 99, 99.9, 100 };
+            for (auto p : c_percentiles)
+            {
+                EXPECT_EQ(all.GetPercentile(p), a.GetPercentile(p)) << p;
+            }
+
+            a.Reset();
+            EXPECT_EQ(0u, a.GetCount());
+            EXPECT_EQ(0.0, a.GetPercentile(99));
+        }
+    }
+}
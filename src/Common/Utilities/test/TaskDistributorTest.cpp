@@ -76,6 +76,105 @@ namespace BitFunnel
         }
 
 
+        //*************************************************************************
+        //
+        // CountingProcessor
+        //
+        // Records the tasks it processes in a vector shared by all processors.
+        // Even-numbered processors sleep on every task, so that the others
+        // must steal their work.
+        //
+        //*************************************************************************
+        class CountingProcessor : public ITaskProcessor, NonCopyable
+        {
+        public:
+            CountingProcessor(std::vector<std::atomic<uint64_t>>& tasks,
+                              bool slow)
+              : m_processed(0),
+                m_finished(0),
+                m_tasks(tasks),
+                m_slow(slow)
+            {
+            }
+
+            void ProcessTask(size_t taskId)
+            {
+                ++m_tasks[taskId];
+                ++m_processed;
+                if (m_slow)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                }
+            }
+
+            void Finished()
+            {
+                ++m_finished;
+            }
+
+            size_t m_processed;
+            size_t m_finished;
+
+        private:
+            std::vector<std::atomic<uint64_t>>& m_tasks;
+            bool m_slow;
+        };
+
+
+        void RunUneven(size_t threadCount, size_t taskCount)
+        {
+            std::vector<std::atomic<uint64_t>> tasks(taskCount);
+            for (auto & task : tasks)
+            {
+                task = 0;
+            }
+
+            std::vector<std::unique_ptr<ITaskProcessor>> processors;
+            for (size_t i = 0 ; i < threadCount; ++i)
+            {
+                processors.push_back(
+                    std::unique_ptr<ITaskProcessor>(
+                        new CountingProcessor(tasks, (i % 2) == 0)));
+            }
+
+            auto distributor = Factories::CreateTaskDistributor(processors, taskCount);
+            distributor->WaitForCompletion();
+
+            size_t processed = 0;
+            for (auto & processor : processors)
+            {
+                auto & p = dynamic_cast<CountingProcessor&>(*processor);
+                ASSERT_EQ(1u, p.m_finished);
+                processed += p.m_processed;
+
+                // Every processor gets at least one task when there are
+                // enough to go around.
+                if (taskCount >= threadCount)
+                {
+                    ASSERT_GT(p.m_processed, 0u);
+                }
+            }
+            ASSERT_EQ(taskCount, processed);
+
+            for (auto & task : tasks)
+            {
+                ASSERT_EQ(1u, task.load());
+            }
+        }
+
+
+        TEST(TaskDistributor, WorkStealing)
+        {
+            RunUneven(4, 0);
+            RunUneven(4, 1);
+            RunUneven(4, 3);
+            RunUneven(4, 4);
+            RunUneven(4, 1000);
+            RunUneven(7, 1001);
+            RunUneven(1, 100);
+        }
+
+
         void RunTest1(unsigned taskCount, int maxSleepInMS)
         {
             const int threadCount = 10;
@@ -0,0 +1,188 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "BitFunnel/Utilities/Factories.h"
+#include "BitFunnel/Utilities/ITaskDistributor.h"
+#include "ThreadPool.h"
+#include "gtest/gtest.h"
+
+
+namespace BitFunnel
+{
+    namespace ThreadPoolTest
+    {
+        class CountingThread : public IThreadBase
+        {
+        public:
+            CountingThread(std::atomic<size_t>& count)
+              : m_count(count)
+            {
+            }
+
+            void EntryPoint() override
+            {
+                ++m_count;
+            }
+
+        private:
+            std::atomic<size_t>& m_count;
+        };
+
+
+        std::vector<std::unique_ptr<IThreadBase>>
+            CreateThreads(size_t threadCount, std::atomic<size_t>& count)
+        {
+            std::vector<std::unique_ptr<IThreadBase>> threads;
+            for (size_t i = 0; i < threadCount; ++i)
+            {
+                threads.push_back(
+                    std::unique_ptr<IThreadBase>(new CountingThread(count)));
+            }
+            return threads;
+        }
+
+
+        TEST(ThreadPool, ReusesThreads)
+        {
+            ThreadPool pool;
+            const size_t c_threadCount = 8;
+
+            std::atomic<size_t> count(0);
+            auto threads = CreateThreads(c_threadCount, count);
+
+            for (size_t i = 0; i < 10; ++i)
+            {
+                ThreadPool::Completion completion;
+                pool.Start(threads, completion);
+                completion.Wait();
+                EXPECT_EQ(c_threadCount * (i + 1), count.load());
+
+                // Threads return to the idle stack before signalling
+                // completion, so the pool never grows beyond one batch.
+                EXPECT_EQ(c_threadCount, pool.GetThreadCount());
+                EXPECT_EQ(c_threadCount, pool.GetIdleThreadCount());
+            }
+        }
+
+
+        TEST(ThreadPool, TrimsIdleThreads)
+        {
+            ThreadPool pool(2);
+            std::atomic<size_t> count(0);
+
+            {
+                auto threads = CreateThreads(8, count);
+                ThreadPool::Completion completion;
+                pool.Start(threads, completion);
+                completion.Wait();
+                EXPECT_EQ(8u, pool.GetIdleThreadCount());
+            }
+
+            // A smaller batch leaves at most the cap idle.
+            {
+                auto threads = CreateThreads(1, count);
+                ThreadPool::Completion completion;
+                pool.Start(threads, completion);
+                EXPECT_EQ(3u, pool.GetThreadCount());
+                completion.Wait();
+            }
+
+            pool.SetMaxIdleThreadCount(1);
+            EXPECT_EQ(1u, pool.GetThreadCount());
+            EXPECT_EQ(1u, pool.GetIdleThreadCount());
+            EXPECT_EQ(9u, count.load());
+        }
+
+
+        // Each task runs a nested TaskDistributor. The nested processors
+        // need threads of their own while the outer ones are waiting, so
+        // the shared pool must grow rather than deadlock.
+        class NestedProcessor : public ITaskProcessor
+        {
+        public:
+            NestedProcessor(std::atomic<size_t>& count)
+              : m_count(count)
+            {
+            }
+
+            void ProcessTask(size_t /*taskId*/) override
+            {
+                std::vector<std::unique_ptr<ITaskProcessor>> processors;
+                for (size_t i = 0; i < 3; ++i)
+                {
+                    processors.push_back(
+                        std::unique_ptr<ITaskProcessor>(new LeafProcessor(m_count)));
+                }
+                auto distributor = Factories::CreateTaskDistributor(processors, 10);
+                distributor->WaitForCompletion();
+            }
+
+            void Finished() override
+            {
+            }
+
+        private:
+            class LeafProcessor : public ITaskProcessor
+            {
+            public:
+                LeafProcessor(std::atomic<size_t>& count)
+                  : m_count(count)
+                {
+                }
+
+                void ProcessTask(size_t /*taskId*/) override
+                {
+                    ++m_count;
+                }
+
+                void Finished() override
+                {
+                }
+
+            private:
+                std::atomic<size_t>& m_count;
+            };
+
+            std::atomic<size_t>& m_count;
+        };
+
+
+        TEST(ThreadPool, NestedDistributors)
+        {
+            std::atomic<size_t> count(0);
+            std::vector<std::unique_ptr<ITaskProcessor>> processors;
+            for (size_t i = 0; i < 4; ++i)
+            {
+                processors.push_back(
+                    std::unique_ptr<ITaskProcessor>(new NestedProcessor(count)));
+            }
+
+            auto distributor = Factories::CreateTaskDistributor(processors, 20);
+            distributor->WaitForCompletion();
+            EXPECT_EQ(20u * 10u, count.load());
+        }
+    }
+}
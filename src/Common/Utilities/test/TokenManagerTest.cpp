@@ -22,7 +22,9 @@
 
 
 #include <chrono>
+#include <iostream>
 #include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -468,5 +470,177 @@ namespace BitFunnel
             t1.join();
             t2.join();
         }
+
+
+        // Starts more trackers than TokenManager has epoch counters while a
+        // token from the first epoch is held. New epochs are postponed until
+        // that token is returned, but no tracker may complete early.
+        TEST(TokenManager, ManyTrackers)
+        {
+            TokenManager tokenManager;
+
+            std::vector<std::shared_ptr<ITokenTracker>> trackers;
+            {
+                const Token oldest = tokenManager.RequestToken();
+                for (size_t i = 0; i < 3 * TokenManager::c_epochCount; ++i)
+                {
+                    const Token token = tokenManager.RequestToken();
+                    trackers.push_back(tokenManager.StartTracker());
+                }
+
+                for (auto const & tracker : trackers)
+                {
+                    ASSERT_FALSE(tracker->IsComplete());
+                }
+            }
+
+            for (auto const & tracker : trackers)
+            {
+                ASSERT_TRUE(tracker->IsComplete());
+            }
+
+            // Epochs resume once the oldest token is returned.
+            const Token held = tokenManager.RequestToken();
+            auto tracker = tokenManager.StartTracker();
+            ASSERT_FALSE(tracker->IsComplete());
+            {
+                const Token later = tokenManager.RequestToken();
+            }
+            ASSERT_FALSE(tracker->IsComplete());
+        }
+
+
+        // Starts more trackers than TokenManager has epoch counters while a
+        // token from the first epoch is held, so the current epoch cannot
+        // end. Tokens issued and returned in the current epoch must not take
+        // the lock, while the held token still completes the trackers.
+        TEST(TokenManager, PostponedEpochIsLockFree)
+        {
+            TokenManager tokenManager;
+
+            std::vector<std::shared_ptr<ITokenTracker>> trackers;
+            std::unique_ptr<Token> oldest(new Token(tokenManager.RequestToken()));
+            for (size_t i = 0; i < 2 * TokenManager::c_epochCount; ++i)
+            {
+                trackers.push_back(tokenManager.StartTracker());
+            }
+
+            const uint64_t lockedReleases = tokenManager.GetLockedReleaseCount();
+            for (size_t i = 0; i < 1000; ++i)
+            {
+                const Token token = tokenManager.RequestToken();
+                trackers.push_back(tokenManager.StartTracker());
+            }
+            EXPECT_EQ(lockedReleases, tokenManager.GetLockedReleaseCount());
+
+            for (auto const & tracker : trackers)
+            {
+                ASSERT_FALSE(tracker->IsComplete());
+            }
+
+            oldest.reset();
+            EXPECT_EQ(lockedReleases + 1, tokenManager.GetLockedReleaseCount());
+            for (auto const & tracker : trackers)
+            {
+                ASSERT_TRUE(tracker->IsComplete());
+            }
+        }
+
+
+        //*********************************************************************
+        //
+        // Contention benchmark. Each thread requests and releases tokens in a
+        // tight loop while another thread repeatedly starts trackers and
+        // waits for them. Reports the rate at which tokens are issued.
+        // Disabled since it is timing based; run it with
+        // --gtest_also_run_disabled_tests.
+        //
+        //*********************************************************************
+        class TightLoopThread : public IThreadBase
+        {
+        public:
+            TightLoopThread(ITokenManager& tokenManager,
+                            std::atomic<bool>& isRunning)
+              : m_tokenManager(tokenManager),
+                m_isRunning(isRunning),
+                m_count(0)
+            {
+            }
+
+            virtual void EntryPoint() override
+            {
+                while (m_isRunning)
+                {
+                    const Token token = m_tokenManager.RequestToken();
+                    ++m_count;
+                }
+            }
+
+            uint64_t GetCount() const
+            {
+                return m_count;
+            }
+
+        private:
+            ITokenManager& m_tokenManager;
+            std::atomic<bool>& m_isRunning;
+            uint64_t m_count;
+        };
+
+
+        TEST(TokenManager, DISABLED_ContentionBenchmark)
+        {
+            const unsigned c_threadCounts[] = { 1, 4, 16 };
+            const auto c_duration = std::chrono::milliseconds(100);
+
+            for (auto threadCount : c_threadCounts)
+            {
+                TokenManager tokenManager;
+                std::atomic<bool> isRunning(true);
+                std::atomic<uint64_t> trackerCount(0);
+
+                std::vector<std::unique_ptr<IThreadBase>> threads;
+                for (unsigned i = 0; i < threadCount; ++i)
+                {
+                    threads.push_back(
+                        std::unique_ptr<IThreadBase>(
+                            new TightLoopThread(tokenManager, isRunning)));
+                }
+
+                std::thread trackerThread([&]()
+                {
+                    while (isRunning)
+                    {
+                        tokenManager.StartTracker()->WaitForCompletion();
+                        ++trackerCount;
+                    }
+                });
+
+                const auto start = std::chrono::steady_clock::now();
+                auto threadManager = Factories::CreateThreadManager(threads);
+                std::this_thread::sleep_for(c_duration);
+                isRunning = false;
+                threadManager->WaitForThreads();
+                trackerThread.join();
+                const std::chrono::duration<double> elapsed =
+                    std::chrono::steady_clock::now() - start;
+
+                uint64_t tokenCount = 0;
+                for (auto const & thread : threads)
+                {
+                    tokenCount += static_cast<TightLoopThread&>(*thread).GetCount();
+                }
+                ASSERT_GT(tokenCount, 0u);
+                ASSERT_GT(trackerCount.load(), 0u);
+
+                std::cout
+                    << threadCount << " threads: "
+                    << static_cast<uint64_t>(tokenCount / elapsed.count())
+                    << " tokens/second, "
+                    << trackerCount.load()
+                    << " trackers"
+                    << std::endl;
+            }
+        }
     }
 }
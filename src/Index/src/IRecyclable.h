@@ -39,6 +39,13 @@ namespace BitFunnel
     class IRecyclable : public IInterface
     {
     public:
+        // Returns true if every consumer of the resource has drained, so that
+        // Recycle() will not block. Thread safe.
+        virtual bool CanRecycle() const = 0;
+
+        // Blocks until CanRecycle() returns true. Thread safe.
+        virtual void WaitForRecyclable() = 0;
+
         // Not thread safe - the caller must maintain thread safety.
         virtual void Recycle() = 0;
     };
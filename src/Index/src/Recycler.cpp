@@ -21,6 +21,9 @@
 // THE SOFTWARE.
 
 
+#include <algorithm>
+#include <ostream>
+
 #include "BitFunnel/Index/Factories.h"
 #include "BitFunnel/Index/Token.h"
 #include "LoggerInterfaces/Logging.h"
@@ -30,6 +33,39 @@
 
 namespace BitFunnel
 {
+    //*************************************************************************
+    //
+    // RecyclerStatistics.
+    //
+    //*************************************************************************
+    RecyclerStatistics::RecyclerStatistics()
+        : m_pendingCount(0),
+          m_oldestPendingAge(0.0),
+          m_recycledCount(0),
+          m_batchCount(0),
+          m_totalLag(0.0),
+          m_maxLag(0.0)
+    {
+    }
+
+
+    void RecyclerStatistics::Print(std::ostream& out) const
+    {
+        out << "Recycler pending items: " << m_pendingCount << std::endl
+            << "Recycler oldest pending item age: "
+            << m_oldestPendingAge << "s" << std::endl
+            << "Recycled items: " << m_recycledCount
+            << " in " << m_batchCount << " batches" << std::endl;
+
+        if (m_recycledCount > 0)
+        {
+            out << "Recycler mean lag: "
+                << m_totalLag / m_recycledCount << "s" << std::endl
+                << "Recycler max lag: " << m_maxLag << "s" << std::endl;
+        }
+    }
+
+
     //*************************************************************************
     //
     // Recycler.
@@ -41,11 +77,12 @@ namespace BitFunnel
     }
 
 
-    // TODO: put this arbitrary 100 constant somewhere
     Recycler::Recycler()
-        : m_queue (std::unique_ptr<BlockingQueue<IRecyclable*>>
-                   (new BlockingQueue<IRecyclable*>(100))),
-          m_shutdown (false)
+        : m_shutdown(false),
+          m_recycledCount(0),
+          m_batchCount(0),
+          m_totalLag(0.0),
+          m_maxLag(0.0)
     {
     }
 
@@ -56,35 +93,130 @@ namespace BitFunnel
     }
 
 
-    // Run until shutdown. When m_shutdown is flagged, run until queue is
-    // empty and then return.
+    // Run until shutdown. When m_shutdown is flagged, run until there are no
+    // pending items and then return.
     void Recycler::Run()
     {
         for(;;)
         {
-            IRecyclable* item;
-            if (!m_queue->TryDequeue(item))
+            std::shared_ptr<IRecyclable> oldest;
             {
-                // false indicates queue shutdown.
-                break;
+                std::unique_lock<std::mutex> lock(m_lock);
+                while (m_pending.empty() && !m_shutdown)
+                {
+                    m_notEmpty.wait(lock);
+                }
+
+                if (m_pending.empty())
+                {
+                    break;
+                }
+                oldest = m_pending.front().m_item;
+            }
+
+            // Wait without holding the lock, so that ScheduleRecyling() is
+            // never blocked by a long-running query.
+            oldest->WaitForRecyclable();
+            oldest.reset();
+
+            std::vector<Pending> batch;
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                TakeRecyclable(batch);
+            }
+
+            // Another thread may have taken the batch.
+            if (batch.empty())
+            {
+                continue;
+            }
+
+            for (auto & pending : batch)
+            {
+                pending.m_item->Recycle();
+            }
+
+            const double now = m_stopwatch.ElapsedTime();
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                for (auto const & pending : batch)
+                {
+                    const double lag = now - pending.m_scheduledTime;
+                    m_totalLag += lag;
+                    m_maxLag = (std::max)(m_maxLag, lag);
+                }
+                m_recycledCount += batch.size();
+                ++m_batchCount;
             }
-            LogAssertB(item, "null IRecycable item.");
-            item->Recycle();
-            delete item;
         }
     }
 
+
     void Recycler::ScheduleRecyling(std::unique_ptr<IRecyclable>& resource)
     {
-        auto ptr = resource.release();
-        LogAssertB(m_queue->TryEnqueue(ptr),
-                   "ScheduleRecycling called on queue that's shutting down.");
+        LogAssertB(resource != nullptr, "null IRecycable item.");
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            LogAssertB(!m_shutdown,
+                       "ScheduleRecycling called on queue that's shutting down.");
+
+            m_pending.emplace_back();
+            m_pending.back().m_item.reset(resource.release());
+            m_pending.back().m_scheduledTime = m_stopwatch.ElapsedTime();
+        }
+        m_notEmpty.notify_one();
     }
 
 
     void Recycler::Shutdown()
     {
-        m_queue->Shutdown();
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_shutdown = true;
+        }
+        m_notEmpty.notify_all();
+    }
+
+
+    RecyclerStatistics Recycler::GetStatistics() const
+    {
+        RecyclerStatistics statistics;
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        statistics.m_pendingCount = m_pending.size();
+        if (!m_pending.empty())
+        {
+            statistics.m_oldestPendingAge =
+                m_stopwatch.ElapsedTime() - m_pending.front().m_scheduledTime;
+        }
+        statistics.m_recycledCount = m_recycledCount;
+        statistics.m_batchCount = m_batchCount;
+        statistics.m_totalLag = m_totalLag;
+        statistics.m_maxLag = m_maxLag;
+
+        return statistics;
+    }
+
+
+    void Recycler::TakeRecyclable(std::vector<Pending>& batch)
+    {
+        // Items are usually ready in the order they were scheduled, but
+        // trackers started by different shards may be scheduled slightly
+        // out of order, so check every item.
+        auto it = m_pending.begin();
+        while (it != m_pending.end())
+        {
+            if (it->m_item->CanRecycle())
+            {
+                batch.push_back(std::move(*it));
+                it = m_pending.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
     }
 
 
@@ -103,6 +235,18 @@ namespace BitFunnel
     }
 
 
+    bool DeferredSliceListDelete::CanRecycle() const
+    {
+        return m_tokenTracker->IsComplete();
+    }
+
+
+    void DeferredSliceListDelete::WaitForRecyclable()
+    {
+        m_tokenTracker->WaitForCompletion();
+    }
+
+
     void DeferredSliceListDelete::Recycle()
     {
         m_tokenTracker->WaitForCompletion();
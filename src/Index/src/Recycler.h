@@ -23,12 +23,15 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "BitFunnel/NonCopyable.h"
 #include "BitFunnel/Index/IRecycler.h"
-#include "BitFunnel/Utilities/BlockingQueue.h"
+#include "BitFunnel/Utilities/Stopwatch.h"
 #include "IRecyclable.h"
 
 
@@ -68,6 +71,8 @@ namespace BitFunnel
         //
         // IRecyclable API.
         //
+        virtual bool CanRecycle() const override;
+        virtual void WaitForRecyclable() override;
         virtual void Recycle() override;
 
     private:
@@ -87,9 +92,14 @@ namespace BitFunnel
     // scheduled for recycling. Instances of IRecyclable indicate that they
     // can be recycled by returning true from their CanRecycle() method.
     //
-    // Maintains a queue of objects that were dropped for recyling and polls
-    // them to check if they can be recycled by checking their CanRecycle(),
-    // and it if returns true, calls their OnRecycle().
+    // Items are kept in the order they were scheduled, which is also the
+    // order of the token epochs they wait for. Run() waits for the oldest
+    // item to become recyclable and then recycles every item that is ready
+    // as a single batch. Since token trackers complete in order, items
+    // scheduled behind the oldest are usually ready at the same time.
+    //
+    // The list of pending items is unbounded, so ScheduleRecyling() never
+    // blocks ingestion. Run() may be called on more than one thread.
     //
     //*************************************************************************
     class Recycler : public IRecycler, NonCopyable
@@ -104,19 +114,48 @@ namespace BitFunnel
         // that things are shut down correctly on an exception.
         ~Recycler();
 
+        // Recycles items until Shutdown() is called and every pending item
+        // has been recycled.
         void Run() override;
 
+        // Stops accepting items. Does not wait for pending items.
         void Shutdown() override;
 
         // Adds a resource to the list for recycling.
         // Recycler takes ownership of the resource.
         virtual void
             ScheduleRecyling(std::unique_ptr<IRecyclable>& resource) override;
-    private:
-        // TODO: we should log of this queue fills to the point of blocking on
-        // enqueue. That's an unexpected condition.
-        std::unique_ptr<BlockingQueue<IRecyclable*>> m_queue;
 
-        std::atomic<bool> m_shutdown;
+        virtual RecyclerStatistics GetStatistics() const override;
+
+    private:
+        class Pending
+        {
+        public:
+            // Shared so that the item remains valid while a Run() thread
+            // waits on it without holding m_lock.
+            std::shared_ptr<IRecyclable> m_item;
+
+            // Value of m_stopwatch when the item was scheduled.
+            double m_scheduledTime;
+        };
+
+        // Moves every pending item that can be recycled into batch. Requires
+        // m_lock.
+        void TakeRecyclable(std::vector<Pending>& batch);
+
+        // Started at construction. Provides timestamps for measuring lag.
+        const Stopwatch m_stopwatch;
+
+        // Protects the members that follow.
+        mutable std::mutex m_lock;
+        std::condition_variable m_notEmpty;
+        std::deque<Pending> m_pending;
+        bool m_shutdown;
+
+        size_t m_recycledCount;
+        size_t m_batchCount;
+        double m_totalLag;
+        double m_maxLag;
     };
 }
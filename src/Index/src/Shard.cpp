@@ -20,6 +20,13 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#ifdef _MSC_VER
+#include <intrin.h>                         // __popcnt64.
+#endif
+
+#include <functional>                       // std::function member.
+#include <utility>                          // std::pair.
+
 #include "BitFunnel/Exceptions.h"
 #include "BitFunnel/IFileManager.h"
 #include "BitFunnel/Index/IRecycler.h"
@@ -39,6 +46,16 @@
 
 namespace BitFunnel
 {
+    static size_t PopulationCount(uint64_t value)
+    {
+#ifdef _MSC_VER
+        return static_cast<size_t>(__popcnt64(value));
+#else
+        return static_cast<size_t>(__builtin_popcountll(value));
+#endif
+    }
+
+
     // Extracts a RowId used to mark documents as active/soft-deleted.
     static RowId RowIdForActiveDocument(ITermTable const & termTable)
     {
@@ -85,6 +102,7 @@ namespace BitFunnel
           m_documentActiveRowId(RowIdForActiveDocument(termTable)),
           m_activeSlice(nullptr),
           m_sliceBuffers(new std::vector<void*>()),
+          m_densitySamples(new RowDensitySamples()),
           m_sliceCapacity(GetCapacityForByteSize(sliceBufferSize,
                                                  docDataSchema,
                                                  termTable)),
@@ -105,6 +123,7 @@ namespace BitFunnel
 
     Shard::~Shard() {
         delete static_cast<std::vector<void*>*>(m_sliceBuffers);
+        delete m_densitySamples.load();
     }
 
 
@@ -666,6 +685,151 @@ namespace BitFunnel
     }
 
 
+    //*************************************************************************
+    //
+    // DeferredDensitySamplesDelete
+    //
+    // Deletes a table of density samples once the tokens that could have
+    // seen it have been returned.
+    //
+    //*************************************************************************
+    class DeferredDensitySamplesDelete : public IRecyclable
+    {
+    public:
+        template <typename T>
+        DeferredDensitySamplesDelete(T const * samples,
+                                     ITokenManager& tokenManager)
+          : m_delete([samples]() { delete samples; }),
+            m_tokenTracker(tokenManager.StartTracker())
+        {
+        }
+
+        //
+        // IRecyclable API.
+        //
+        virtual bool CanRecycle() const override
+        {
+            return m_tokenTracker->IsComplete();
+        }
+
+        virtual void WaitForRecyclable() override
+        {
+            m_tokenTracker->WaitForCompletion();
+        }
+
+        virtual void Recycle() override
+        {
+            m_tokenTracker->WaitForCompletion();
+            m_delete();
+        }
+
+    private:
+        std::function<void()> m_delete;
+        std::shared_ptr<ITokenTracker> m_tokenTracker;
+    };
+
+
+    //*************************************************************************
+    //
+    // SampleRowDensities
+    //
+    //*************************************************************************
+    size_t Shard::RowIdHasher::operator()(RowId row) const
+    {
+        return (static_cast<size_t>(row.GetIndex()) << 8) |
+               (static_cast<size_t>(row.GetRank()) << 1) |
+               (row.IsAdhoc() ? 1u : 0u);
+    }
+
+
+    void Shard::SampleRowDensities(std::vector<RowId> const & rows,
+                                   std::vector<size_t> & setBitCounts,
+                                   std::vector<size_t> & bitCounts) const
+    {
+        // Hold a token to ensure that neither m_sliceBuffers nor
+        // m_densitySamples will be recycled.
+        auto token = m_tokenManager.RequestToken();
+        std::vector<void*> const & buffers = *m_sliceBuffers;
+        RowDensitySamples const & samples = *m_densitySamples;
+
+        // The newest slice is still being filled, so it is sampled only
+        // when it is the only slice.
+        const size_t fullSliceCount =
+            buffers.size() > 1 ? buffers.size() - 1 : buffers.size();
+
+        // Compare by value so that c_densitySampleSliceCount is not
+        // odr-used.
+        const size_t sampleCount =
+            fullSliceCount < c_densitySampleSliceCount ?
+                fullSliceCount : c_densitySampleSliceCount;
+
+        std::vector<std::pair<RowId, RowDensitySample>> taken;
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            // Samples are refreshed once the shard has doubled or halved in
+            // size, so each row is sampled a logarithmic number of times as
+            // the shard grows or shrinks.
+            auto it = samples.find(rows[i]);
+            if (it != samples.end() &&
+                buffers.size() < 2 * it->second.m_sliceCount &&
+                2 * buffers.size() > it->second.m_sliceCount)
+            {
+                setBitCounts[i] += it->second.m_setBitCount;
+                bitCounts[i] += it->second.m_bitCount;
+                continue;
+            }
+
+            const RowId row = rows[i];
+            const size_t quadwordCount = (m_sliceCapacity >> 6) >> row.GetRank();
+            const ptrdiff_t offset = GetRowOffset(row);
+
+            RowDensitySample sample = { 0, 0, buffers.size() };
+            for (size_t s = 0; s < sampleCount; ++s)
+            {
+                // Take the middle slice of each of sampleCount equal parts of
+                // the shard, rather than only its oldest slices.
+                const size_t slice =
+                    ((2 * s + 1) * fullSliceCount) / (2 * sampleCount);
+                uint64_t const * quadwords =
+                    reinterpret_cast<uint64_t const *>(
+                        static_cast<char const *>(buffers[slice]) + offset);
+                for (size_t q = 0; q < quadwordCount; ++q)
+                {
+                    sample.m_setBitCount += PopulationCount(quadwords[q]);
+                }
+            }
+            sample.m_bitCount = sampleCount * quadwordCount * 64;
+
+            setBitCounts[i] += sample.m_setBitCount;
+            bitCounts[i] += sample.m_bitCount;
+            taken.push_back(std::make_pair(row, sample));
+        }
+
+        if (!taken.empty())
+        {
+            // Publish a copy of the latest table with the new samples. Only
+            // misses take the lock; lookups never do.
+            RowDensitySamples const * oldSamples = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(m_densitySamplesLock);
+                oldSamples = m_densitySamples;
+                RowDensitySamples * newSamples =
+                    new RowDensitySamples(*oldSamples);
+                for (auto const & entry : taken)
+                {
+                    (*newSamples)[entry.first] = entry.second;
+                }
+                m_densitySamples = newSamples;
+            }
+
+            std::unique_ptr<IRecyclable>
+                recyclableSamples(new DeferredDensitySamplesDelete(oldSamples,
+                                                                   m_tokenManager));
+            m_recycler.ScheduleRecyling(recyclableSamples);
+        }
+    }
+
+
     // static
     ptrdiff_t Shard::GetSlicePtrOffset()
     {
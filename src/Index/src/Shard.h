@@ -25,6 +25,7 @@
 
 #include <memory>                           // std::unique_ptr member.
 #include <ostream>                          // TODO: Remove this temporary include.
+#include <unordered_map>                    // std::unordered_map template parameter.
 #include <vector>
 
 #include "BitFunnel/BitFunnelTypes.h"       // ShardId parameter, embedded.
@@ -131,6 +132,12 @@ namespace BitFunnel
         virtual std::vector<double>
             GetDensities(Rank rank) const override;
 
+        // Adds the bits set in a cached sample of each row to setBitCounts
+        // and the bits sampled to bitCounts.
+        virtual void SampleRowDensities(std::vector<RowId> const & rows,
+                                        std::vector<size_t> & setBitCounts,
+                                        std::vector<size_t> & bitCounts) const override;
+
         //
         // Shard exclusive members.
         //
@@ -313,6 +320,33 @@ namespace BitFunnel
         // of vectors is implemented.
         std::atomic<std::vector<void*>*> m_sliceBuffers;
 
+        // Bits counted by SampleRowDensities() for a row, and the number of
+        // slices in the shard when they were counted.
+        struct RowDensitySample
+        {
+            size_t m_setBitCount;
+            size_t m_bitCount;
+            size_t m_sliceCount;
+        };
+
+        struct RowIdHasher
+        {
+            size_t operator()(RowId row) const;
+        };
+
+        typedef std::unordered_map<RowId, RowDensitySample, RowIdHasher>
+            RowDensitySamples;
+
+        // Samples taken by SampleRowDensities(). Like m_sliceBuffers, the
+        // table is never modified once published. Readers hold a Token, and
+        // writers, serialized by m_densitySamplesLock, publish a new copy
+        // and recycle the old one once no Token can see it.
+        mutable std::atomic<RowDensitySamples const *> m_densitySamples;
+        mutable std::mutex m_densitySamplesLock;
+
+        // Maximum number of slices read by SampleRowDensities().
+        static const size_t c_densitySampleSliceCount = 4;
+
        // Capacity of a Slice. All Slices in the shard have the same capacity.
         const DocIndex m_sliceCapacity;
 
@@ -0,0 +1,141 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <atomic>
+#include <future>
+#include <memory>
+
+#include "gtest/gtest.h"
+
+#include "BitFunnel/Index/Factories.h"
+#include "BitFunnel/Index/IRecycler.h"
+#include "BitFunnel/Index/Token.h"
+#include "BitFunnel/Utilities/Factories.h"
+#include "IRecyclable.h"
+
+
+namespace BitFunnel
+{
+    namespace RecyclerTest
+    {
+        // Counts its own recycling once the tokens issued before it was
+        // constructed have been returned.
+        class CountingRecyclable : public IRecyclable
+        {
+        public:
+            CountingRecyclable(ITokenManager& tokenManager,
+                               std::atomic<size_t>& recycledCount)
+              : m_tracker(tokenManager.StartTracker()),
+                m_recycledCount(recycledCount)
+            {
+            }
+
+            virtual bool CanRecycle() const override
+            {
+                return m_tracker->IsComplete();
+            }
+
+            virtual void WaitForRecyclable() override
+            {
+                m_tracker->WaitForCompletion();
+            }
+
+            virtual void Recycle() override
+            {
+                EXPECT_TRUE(CanRecycle());
+                ++m_recycledCount;
+            }
+
+        private:
+            std::shared_ptr<ITokenTracker> m_tracker;
+            std::atomic<size_t>& m_recycledCount;
+        };
+
+
+        TEST(Recycler, BatchesWithoutBlocking)
+        {
+            auto recycler = Factories::CreateRecycler();
+            auto background = std::async(std::launch::async, &IRecycler::Run, recycler.get());
+            auto tokenManager = Factories::CreateTokenManager();
+
+            std::atomic<size_t> recycledCount(0);
+
+            // Schedule many more items than the Recycler used to queue while
+            // a query holds a token. None of them can be recycled, but
+            // scheduling must not block.
+            const size_t c_itemCount = 500;
+            {
+                const Token token = tokenManager->RequestToken();
+                for (size_t i = 0; i < c_itemCount; ++i)
+                {
+                    std::unique_ptr<IRecyclable>
+                        item(new CountingRecyclable(*tokenManager, recycledCount));
+                    recycler->ScheduleRecyling(item);
+                }
+
+                auto statistics = recycler->GetStatistics();
+                EXPECT_EQ(c_itemCount, statistics.m_pendingCount);
+                EXPECT_EQ(0u, statistics.m_recycledCount);
+                EXPECT_EQ(0u, recycledCount.load());
+            }
+
+            // Returning the token makes every item recyclable at once.
+            while (recycler->GetStatistics().m_recycledCount != c_itemCount) {}
+
+            auto statistics = recycler->GetStatistics();
+            EXPECT_EQ(c_itemCount, recycledCount.load());
+            EXPECT_EQ(0u, statistics.m_pendingCount);
+            EXPECT_GE(statistics.m_batchCount, 1u);
+            EXPECT_LT(statistics.m_batchCount, c_itemCount);
+            EXPECT_GE(statistics.m_maxLag, 0.0);
+            EXPECT_LE(statistics.m_totalLag, statistics.m_maxLag * c_itemCount);
+
+            tokenManager->Shutdown();
+            recycler->Shutdown();
+            background.wait();
+        }
+
+
+        TEST(Recycler, ShutdownDrainsPendingItems)
+        {
+            auto recycler = Factories::CreateRecycler();
+            auto tokenManager = Factories::CreateTokenManager();
+
+            std::atomic<size_t> recycledCount(0);
+            for (size_t i = 0; i < 10; ++i)
+            {
+                std::unique_ptr<IRecyclable>
+                    item(new CountingRecyclable(*tokenManager, recycledCount));
+                recycler->ScheduleRecyling(item);
+            }
+
+            // Run() returns once it has recycled every item scheduled before
+            // Shutdown().
+            recycler->Shutdown();
+            recycler->Run();
+            EXPECT_EQ(10u, recycledCount.load());
+            EXPECT_EQ(10u, recycler->GetStatistics().m_recycledCount);
+
+            tokenManager->Shutdown();
+        }
+    }
+}
@@ -120,5 +120,94 @@ namespace BitFunnel
             recycler->Shutdown();
             background.wait();
         }
+
+
+        TEST(Shard, SampleRowDensities)
+        {
+            auto recycler = Factories::CreateRecycler();
+            auto background = std::async(std::launch::async, &IRecycler::Run, recycler.get());
+
+            auto tokenManager = Factories::CreateTokenManager();
+            auto termTable = Factories::CreateTermTable();
+            termTable->Seal();
+
+            DocumentDataSchema docDataSchema;
+
+            const size_t blockSize =
+                GetMinimumBlockSize(docDataSchema, *termTable);
+
+            std::unique_ptr<TrackingSliceBufferAllocator>
+                trackingAllocator(new TrackingSliceBufferAllocator(blockSize));
+
+            Shard shard(0,
+                        *recycler,
+                        *tokenManager,
+                        *termTable,
+                        docDataSchema,
+                        *trackingAllocator,
+                        blockSize);
+
+            const DocIndex sliceCapacity = shard.GetSliceCapacity();
+            std::vector<Slice*> slices;
+
+            // Fills a slice, activating its documents if active is true.
+            auto addSlice = [&](bool active)
+            {
+                for (DocIndex i = 0; i < sliceCapacity; ++i)
+                {
+                    DocumentHandleInternal h =
+                        shard.AllocateDocument(slices.size() * sliceCapacity + i);
+                    if (i == 0)
+                    {
+                        slices.push_back(&h.GetSlice());
+                    }
+                    if (active)
+                    {
+                        h.Activate();
+                    }
+                    h.GetSlice().CommitDocument();
+                }
+            };
+
+            // Returns the density of the document active row.
+            const std::vector<RowId> rows = { shard.GetDocumentActiveRowId() };
+            auto sample = [&]()
+            {
+                std::vector<size_t> setBitCounts(1, 0);
+                std::vector<size_t> bitCounts(1, 0);
+                shard.SampleRowDensities(rows, setBitCounts, bitCounts);
+                EXPECT_GT(bitCounts[0], 0u);
+                return static_cast<double>(setBitCounts[0]) / bitCounts[0];
+            };
+
+            for (size_t i = 0; i < 3; ++i)
+            {
+                addSlice(true);
+            }
+            EXPECT_EQ(1.0, sample());
+
+            // The sample is reused until the shard has doubled in size. Once
+            // it has, half of the sampled slices have no active documents.
+            addSlice(false);
+            addSlice(false);
+            EXPECT_EQ(1.0, sample());
+            addSlice(false);
+            EXPECT_EQ(0.5, sample());
+
+            // It is also retaken once the shard has halved in size.
+            for (size_t i = 3; i < 6; ++i)
+            {
+                for (DocIndex d = 0; d < sliceCapacity; ++d)
+                {
+                    slices[i]->ExpireDocument();
+                }
+                shard.RecycleSlice(*slices[i]);
+            }
+            EXPECT_EQ(1.0, sample());
+
+            tokenManager->Shutdown();
+            recycler->Shutdown();
+            background.wait();
+        }
     }
 }
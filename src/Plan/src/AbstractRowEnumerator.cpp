@@ -24,6 +24,7 @@
 #include "AbstractRowEnumerator.h"
 #include "BitFunnel/Index/ITermTable.h"
 #include "BitFunnel/Index/RowIdSequence.h"
+#include "TermRowCache.h"
 // #include "BitFunnel/Stream.h"
 
 // TODO: port this to use C++ iterator interface?
@@ -31,19 +32,38 @@
 namespace BitFunnel
 {
     AbstractRowEnumerator::AbstractRowEnumerator(const Term& term,
-                                                 IPlanRows& planRows)
+                                                 IPlanRows& planRows,
+                                                 TermRowCache * termRowCache)
         : m_term(&term)
           // m_fact(nullptr)
     {
         // Initialize the RowIds for the match-all and match-none terms for all the shards.
-        GetSystemRowIds(planRows);
+        GetSystemRowIds(planRows, termRowCache);
 
         // Look up the RowIds for the Term in each Shard and add them to the
         // IPlanRows.
-        for (ShardId shard = 0; shard < planRows.GetShardCount(); ++shard)
+        if (termRowCache != nullptr)
         {
-            RowIdSequence rowIdSequence(term, planRows.GetTermTable(shard));
-            ProcessShard(rowIdSequence, planRows, shard);
+            auto rows = termRowCache->GetRows(term, planRows);
+            for (ShardId shard = 0; shard < planRows.GetShardCount(); ++shard)
+            {
+                RowId const * begin = rows->GetRows(shard);
+                ProcessShard(begin,
+                             begin + rows->GetRowCount(shard),
+                             planRows,
+                             shard);
+            }
+        }
+        else
+        {
+            for (ShardId shard = 0; shard < planRows.GetShardCount(); ++shard)
+            {
+                RowIdSequence rowIdSequence(term, planRows.GetTermTable(shard));
+                ProcessShard(rowIdSequence.begin(),
+                             rowIdSequence.end(),
+                             planRows,
+                             shard);
+            }
         }
 
         FinishInitialization(planRows);
@@ -56,22 +76,38 @@ namespace BitFunnel
           // m_fact(&fact)
     {
         // Initialize the RowIds for the match-all and match-none terms for all the shards.
-        GetSystemRowIds(planRows);
+        GetSystemRowIds(planRows, nullptr);
 
         // Look up the RowIds for the fact in each Shard and add them to the
         // IPlanRows.
         for (ShardId shard = 0; shard < planRows.GetShardCount(); ++shard)
         {
             RowIdSequence rowIdSequence(fact, planRows.GetTermTable(shard));
-            ProcessShard(rowIdSequence, planRows, shard);
+            ProcessShard(rowIdSequence.begin(),
+                         rowIdSequence.end(),
+                         planRows,
+                         shard);
         }
 
         FinishInitialization(planRows);
     }
 
 
-    void AbstractRowEnumerator::GetSystemRowIds(IPlanRows& planRows)
+    void AbstractRowEnumerator::GetSystemRowIds(IPlanRows& planRows,
+                                                TermRowCache * termRowCache)
     {
+        if (termRowCache != nullptr)
+        {
+            auto matchAll = termRowCache->GetRows(ITermTable::GetMatchAllTerm(), planRows);
+            auto matchNone = termRowCache->GetRows(ITermTable::GetMatchNoneTerm(), planRows);
+            for (ShardId shard = 0; shard < planRows.GetShardCount(); ++shard)
+            {
+                m_matchAllTermRowIds[shard] = *matchAll->GetRows(shard);
+                m_matchNoneTermRowIds[shard] = *matchNone->GetRows(shard);
+            }
+            return;
+        }
+
         // Initialize the RowIds for the match-all and match-none terms for all the shards.
         for (ShardId shard = 0; shard < planRows.GetShardCount(); ++shard)
         {
@@ -86,7 +122,9 @@ namespace BitFunnel
     }
 
 
-    void AbstractRowEnumerator::ProcessShard(RowIdSequence& rows,
+    template <typename ITERATOR>
+    void AbstractRowEnumerator::ProcessShard(ITERATOR begin,
+                                             ITERATOR end,
                                              IPlanRows& planRows,
                                              ShardId shard)
     {
@@ -94,8 +132,8 @@ namespace BitFunnel
         unsigned rowsPerRank[c_maxRankValue + 1] = { 0 };
 
         // Enumerate the RowIds associated with the Term in this Shard.
-        auto it = rows.begin();
-        while (it != rows.end())
+        auto it = begin;
+        while (it != end)
         {
             auto row = *it;
             ++it;
@@ -34,7 +34,7 @@ namespace BitFunnel
 {
     class IPlanRows;
     class Term;
-    class RowIdSequence;
+    class TermRowCache;
 
     //*************************************************************************
     //
@@ -58,6 +58,9 @@ namespace BitFunnel
     // has been constructed, it can be used to enumerate the resulting
     // AbstractRows which will be incorporated into the Row-level plan.
     //
+    // If a TermRowCache is supplied, the RowIds for Terms are taken from the
+    // cache instead of being looked up in each Shard's TermTable.
+    //
     //*************************************************************************
     class AbstractRowEnumerator : public IEnumerator<AbstractRow>, NonCopyable
     {
@@ -65,7 +68,9 @@ namespace BitFunnel
         // Looks up the RowIds associated with the Term in each of the Shards,
         // determines the number of AbstractRows required, then constructs the
         // mapping from AbstractRow to RowId in the IPlanRows.
-        AbstractRowEnumerator(const Term& term, IPlanRows& planRows);
+        AbstractRowEnumerator(const Term& term,
+                              IPlanRows& planRows,
+                              TermRowCache * termRowCache = nullptr);
 
         // Looks up the RowIds associated with the Fact in each of the Shards,
         // determines the number of AbstractRows required, then constructs the
@@ -84,12 +89,15 @@ namespace BitFunnel
     private:
 
         // Get the Ids of system rows which will be used for plan row generation.
-        void GetSystemRowIds(IPlanRows& planRows);
-
-        // Called by the constructor. Uses RowIdSequence to looks up the RowIds
-        // for a term of a fact in a single Shard and adds them to the
-        // IPlanRows.
-        void ProcessShard(RowIdSequence& rowIds,
+        void GetSystemRowIds(IPlanRows& planRows, TermRowCache * termRowCache);
+
+        // Called by the constructor. Adds the RowIds for a term or a fact in
+        // a single Shard, enumerated by the iterators begin and end, to the
+        // IPlanRows. ITERATOR is either a RowIdSequence::const_iterator or a
+        // pointer into a TermRows from the TermRowCache.
+        template <typename ITERATOR>
+        void ProcessShard(ITERATOR begin,
+                          ITERATOR end,
                           IPlanRows& planRows,
                           ShardId shard);
 
@@ -20,7 +20,9 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#include <algorithm>                    // std::min().
 #include <iostream>
+#include <limits>                       // std::numeric_limits.
 
 #ifdef _MSC_VER
 #include <intrin.h>
@@ -30,6 +32,7 @@
 #include "BitFunnel/IDiagnosticStream.h"
 #include "BitFunnel/Index/DocumentHandle.h"
 #include "BitFunnel/Index/Factories.h"
+#include "BitFunnel/Plan/QueryCancellation.h"
 #include "BitFunnel/Plan/QueryInstrumentation.h"
 #include "BitFunnel/Plan/ResultsBuffer.h"
 #include "ByteCodeInterpreter.h"
@@ -60,6 +63,60 @@ Decide on type of Slices
     ByteCodeInterpreter::ByteCodeInterpreter(
         ByteCodeGenerator const & code,
         ResultsBuffer & resultsBuffer,
+        size_t maxMatches,
+        size_t sliceCount,
+        void * const * sliceBuffers,
+        size_t iterationsPerSlice,
+        Rank initialRank,
+        ptrdiff_t const * rowOffsets,
+        IDiagnosticStream * diagnosticStream,
+        QueryInstrumentation & instrumentation,
+        size_t sliceBufferSize)
+      : ByteCodeInterpreter(code,
+                            &resultsBuffer,
+                            (std::min)(maxMatches,
+                                       resultsBuffer.m_capacity - resultsBuffer.size()),
+                            sliceCount,
+                            sliceBuffers,
+                            iterationsPerSlice,
+                            initialRank,
+                            rowOffsets,
+                            diagnosticStream,
+                            instrumentation,
+                            sliceBufferSize)
+    {
+    }
+
+
+    ByteCodeInterpreter::ByteCodeInterpreter(
+        ByteCodeGenerator const & code,
+        size_t sliceCount,
+        void * const * sliceBuffers,
+        size_t iterationsPerSlice,
+        Rank initialRank,
+        ptrdiff_t const * rowOffsets,
+        IDiagnosticStream * diagnosticStream,
+        QueryInstrumentation & instrumentation,
+        size_t sliceBufferSize)
+      : ByteCodeInterpreter(code,
+                            nullptr,
+                            (std::numeric_limits<size_t>::max)(),
+                            sliceCount,
+                            sliceBuffers,
+                            iterationsPerSlice,
+                            initialRank,
+                            rowOffsets,
+                            diagnosticStream,
+                            instrumentation,
+                            sliceBufferSize)
+    {
+    }
+
+
+    ByteCodeInterpreter::ByteCodeInterpreter(
+        ByteCodeGenerator const & code,
+        ResultsBuffer * resultsBuffer,
+        size_t matchLimit,
         size_t sliceCount,
         void * const * sliceBuffers,
         size_t iterationsPerSlice,
@@ -71,11 +128,18 @@ Decide on type of Slices
       : m_code(code.GetCode()),
         m_jumpTable(code.GetJumpTable()),
         m_resultsBuffer(resultsBuffer),
+        m_matchLimit(matchLimit),
+        m_matchCount(0),
         m_sliceCount(sliceCount),
         m_sliceBuffers(sliceBuffers),
         m_iterationsPerSlice(iterationsPerSlice),
         m_initialRank(initialRank),
         m_rowOffsets(rowOffsets),
+        m_cancellation(nullptr),
+        m_cancellationMask(0),
+        m_wasCancelled(false),
+        m_callStack(new Instruction const *[code.GetCallStackCapacity()]),
+        m_valueStack(new uint64_t[code.GetValueStackCapacity()]),
         m_dedupe(),
         m_diagnosticStream(diagnosticStream),
         m_instrumentation(instrumentation)
@@ -92,11 +156,51 @@ Decide on type of Slices
         }
     }
 
+    //*************************************************************************
+    //
+    // Instrumentation policies for the matching loop. When c_enabled is
+    // false, the checks for diagnostic output and cache line recording are
+    // compiled out of the loop.
+    //
+    //*************************************************************************
+    class ByteCodeInterpreter::Instrumented
+    {
+    public:
+        static const bool c_enabled = true;
+    };
+
+
+    class ByteCodeInterpreter::Uninstrumented
+    {
+    public:
+        static const bool c_enabled = false;
+    };
+
+
     bool ByteCodeInterpreter::Run()
+    {
+        if (m_matchCount >= m_matchLimit)
+        {
+            return true;
+        }
+
+        if (m_diagnosticStream != nullptr || m_cacheLineRecorder != nullptr)
+        {
+            return RunSlices<Instrumented>();
+        }
+        else
+        {
+            return RunSlices<Uninstrumented>();
+        }
+    }
+
+
+    template <typename INSTRUMENTATION>
+    bool ByteCodeInterpreter::RunSlices()
     {
         for (size_t i = 0; i < m_sliceCount; ++i)
         {
-            bool terminate = ProcessOneSlice(i);
+            bool terminate = ProcessOneSlice<INSTRUMENTATION>(i);
             if (terminate)
             {
                 return true;
@@ -108,11 +212,12 @@ Decide on type of Slices
     }
 
 
+    template <typename INSTRUMENTATION>
     bool ByteCodeInterpreter::ProcessOneSlice(size_t slice)
     {
         auto sliceBuffer = m_sliceBuffers[slice];
 
-        if (m_cacheLineRecorder != nullptr)
+        if (INSTRUMENTATION::c_enabled && m_cacheLineRecorder != nullptr)
         {
             m_cacheLineRecorder->Reset();
             m_cacheLineRecorder->SetBase(sliceBuffer);
@@ -122,24 +227,57 @@ Decide on type of Slices
 
         for (size_t i = 0; i < m_iterationsPerSlice; ++i)
         {
-            terminate = RunOneIteration(sliceBuffer, i);
+            if (m_cancellation != nullptr
+                && (i & m_cancellationMask) == 0
+                && m_cancellation->IsCancelled())
+            {
+                m_wasCancelled = true;
+                terminate = true;
+                break;
+            }
+
+            terminate = RunOneIteration<INSTRUMENTATION>(sliceBuffer, i);
             if (terminate)
             {
                 break;
             }
         }
 
-        if (m_cacheLineRecorder != nullptr)
+        if (INSTRUMENTATION::c_enabled && m_cacheLineRecorder != nullptr)
         {
             m_instrumentation.IncrementCacheLineCount(
                 m_cacheLineRecorder->GetCacheLinesAccessed());
         }
 
         // false ==> ran to completion.
-        return false;
+        return terminate;
     }
 
 
+    // Instruction dispatch. With GCC and Clang, each instruction ends with
+    // an indirect jump through a table of label addresses (direct
+    // threading), which gives the branch predictor one site per opcode
+    // instead of one shared switch. Other compilers use a switch statement
+    // in a loop.
+#if defined(__GNUC__)
+#define BYTECODE_COMPUTED_GOTO
+#endif
+
+#ifdef BYTECODE_COMPUTED_GOTO
+#define OPCODE(name) Label##name:
+#define DISPATCH()                                                          \
+    if (INSTRUMENTATION::c_enabled && traceOpcodes)                         \
+    {                                                                       \
+        TraceInstruction(ip, iteration, offset);                            \
+    }                                                                       \
+    goto *c_dispatch[static_cast<unsigned>(ip->GetOpcode())];
+#else
+#define OPCODE(name) case Opcode::name:
+#define DISPATCH() continue;
+#endif
+
+
+    template <typename INSTRUMENTATION>
     bool ByteCodeInterpreter::RunOneIteration(
         void const * voidSliceBuffer,
         size_t iteration)
@@ -152,184 +290,297 @@ Decide on type of Slices
         auto ip = m_code.data();
         size_t offset = iteration;
 
-        if (m_diagnosticStream != nullptr &&
-            m_diagnosticStream->IsEnabled("bytecode/opcode"))
+        // The stacks are empty at the start of each iteration.
+        uint64_t * valueStack = m_valueStack.get();
+        Instruction const ** callStack = m_callStack.get();
+
+        // Quadwords loaded in this iteration.
+        size_t quadwordCount = 0;
+
+        const bool traceOpcodes =
+            INSTRUMENTATION::c_enabled &&
+            m_diagnosticStream != nullptr &&
+            m_diagnosticStream->IsEnabled("bytecode/opcode");
+        const bool traceRows =
+            INSTRUMENTATION::c_enabled &&
+            m_diagnosticStream != nullptr &&
+            m_diagnosticStream->IsEnabled("bytecode/loadrow");
+
+        if (traceOpcodes)
         {
             std::ostream& out = m_diagnosticStream->GetStream();
             out << "--------------------" << std::endl;
             out << "ByteCode RunOneIteration:" << std::endl;
         }
 
-        while (ip->GetOpcode() != Opcode::End)
+        // Returns the quadword of the instruction's row that corresponds to
+        // the current offset, complemented if the row is inverted.
+        auto loadRowValue = [&](Instruction const * instruction) -> uint64_t
         {
-            const Opcode opcode = ip->GetOpcode();
-            const unsigned row = ip->GetRow();
-            const unsigned delta = ip->GetDelta();
-            const bool inverted = ip->IsInverted();
+            ++quadwordCount;
+            uint64_t const * rowPtr =
+                reinterpret_cast<uint64_t const *>(
+                    sliceBuffer + m_rowOffsets[instruction->GetRow()]);
 
-            if (m_diagnosticStream != nullptr &&
-                m_diagnosticStream->IsEnabled("bytecode/opcode"))
+            auto ptr = rowPtr + (offset >> instruction->GetDelta());
+            if (INSTRUMENTATION::c_enabled && m_cacheLineRecorder != nullptr)
             {
-                std::ostream& out = m_diagnosticStream->GetStream();
-                out << "IP: " << std::hex << ip << std::dec << std::endl
-                    << "Opcode: " << opcode << std::endl
-                    << "Iteration: " << iteration << std::endl
-                    << "Offset: " << offset << std::endl
-                    << "Row: " << row << std::endl
-                    << "RowOffset: " << std::hex << m_rowOffsets[row] << std::dec << std::endl;
+                m_cacheLineRecorder->RecordAccess(ptr);
             }
-            switch (opcode)
-            {
-            case Opcode::AndRow:
-                {
-                    m_instrumentation.IncrementQuadwordCount();
-                    uint64_t const * rowPtr =
-                        reinterpret_cast<uint64_t const *>(
-                            sliceBuffer + m_rowOffsets[row]);
-
-                    auto ptr = rowPtr + (offset >> delta);
-                    if (m_cacheLineRecorder != nullptr)
-                    {
-                        m_cacheLineRecorder->RecordAccess(ptr);
-                    }
-
-                    uint64_t value = *ptr;
-                    accumulator &= (inverted ? ~value : value);
-                    m_zeroFlag = (accumulator == 0);
-                    ip++;
-
-                    if (m_diagnosticStream != nullptr &&
-                        m_diagnosticStream->IsEnabled("bytecode/loadrow"))
-                    {
-                        std::ostream& out = m_diagnosticStream->GetStream();
-                        out << "AndRow: " << std::hex << accumulator
-                            << std::dec << std::endl;
-                    }
-                }
-                break;
-            case Opcode::LoadRow:
-                {
-                    m_instrumentation.IncrementQuadwordCount();
-                    uint64_t const * rowPtr =
-                        reinterpret_cast<uint64_t const *>(
-                            sliceBuffer + m_rowOffsets[row]);
 
-                    auto ptr = rowPtr + (offset >> delta);
-                    if (m_cacheLineRecorder != nullptr)
-                    {
-                        m_cacheLineRecorder->RecordAccess(ptr);
-                    }
+            uint64_t value = *ptr;
+            return instruction->IsInverted() ? ~value : value;
+        };
 
-                    auto value = *ptr;
-                    accumulator = (inverted ? ~value : value);
-                    m_zeroFlag = (accumulator == 0);
-                    ip++;
+        auto traceRow = [&](char const * name)
+        {
+            if (INSTRUMENTATION::c_enabled && traceRows)
+            {
+                std::ostream& out = m_diagnosticStream->GetStream();
+                out << name << ": " << std::hex << accumulator
+                    << std::dec << std::endl;
+            }
+        };
+
+#ifdef BYTECODE_COMPUTED_GOTO
+        // DESIGN NOTE: this table must be kept in sync with enum Opcode.
+        static void * const c_dispatch[] = {
+            &&LabelAndRow,
+            &&LabelLoadRow,
+            &&LabelLeftShiftOffset,
+            &&LabelRightShiftOffset,
+            &&LabelIncrementOffset,
+            &&LabelPush,
+            &&LabelPop,
+            &&LabelAndStack,
+            &&LabelConstant,
+            &&LabelNot,
+            &&LabelOrStack,
+            &&LabelUpdateFlags,
+            &&LabelReport,
+            &&LabelCall,
+            &&LabelJmp,
+            &&LabelJnz,
+            &&LabelJz,
+            &&LabelReturn,
+            &&LabelAndRowJz,
+            &&LabelLoadRowJz,
+            &&LabelAndRowReport,
+            &&LabelLoadRowReport,
+            &&LabelRankDownLoop,
+            &&LabelRankDownNext,
+            &&LabelEnd,
+            &&LabelLast
+        };
+        static_assert(sizeof(c_dispatch) / sizeof(c_dispatch[0]) ==
+                      static_cast<size_t>(Opcode::Last) + 1,
+                      "c_dispatch must have one entry for each Opcode.");
+
+        DISPATCH();
+        {
+#else
+        for (;;)
+        {
+            if (INSTRUMENTATION::c_enabled && traceOpcodes)
+            {
+                TraceInstruction(ip, iteration, offset);
+            }
 
-                    if (m_diagnosticStream != nullptr &&
-                        m_diagnosticStream->IsEnabled("bytecode/loadrow"))
-                    {
-                        std::ostream& out = m_diagnosticStream->GetStream();
-                        out << "LoadRow: " << std::hex << accumulator
-                            << std::dec << std::endl;
-                    }
-                }
-                break;
-            case Opcode::LeftShiftOffset:
-                offset <<= row;
+            switch (ip->GetOpcode())
+            {
+#endif
+            OPCODE(AndRow)
+                accumulator &= loadRowValue(ip);
+                m_zeroFlag = (accumulator == 0);
+                traceRow("AndRow");
                 ip++;
-                break;
-            case Opcode::RightShiftOffset:
-                offset >>= row;
+                DISPATCH();
+            OPCODE(LoadRow)
+                accumulator = loadRowValue(ip);
+                m_zeroFlag = (accumulator == 0);
+                traceRow("LoadRow");
                 ip++;
-                break;
-            case Opcode::IncrementOffset:
+                DISPATCH();
+            OPCODE(LeftShiftOffset)
+                offset <<= ip->GetRow();
+                ip++;
+                DISPATCH();
+            OPCODE(RightShiftOffset)
+                offset >>= ip->GetRow();
+                ip++;
+                DISPATCH();
+            OPCODE(IncrementOffset)
                 offset++;
                 ip++;
-                break;
-            case Opcode::Push:
-                m_valueStack.push_back(accumulator);
+                DISPATCH();
+            OPCODE(Push)
+                *valueStack++ = accumulator;
                 ip++;
-                break;
-            case Opcode::Pop:
-                accumulator = m_valueStack.back();
-                m_valueStack.pop_back();
+                DISPATCH();
+            OPCODE(Pop)
+                accumulator = *--valueStack;
                 ip++;
-                break;
-            case Opcode::AndStack:
-                {
-                    accumulator &= m_valueStack.back();
-                    m_valueStack.pop_back();
-                    ip++;
-                }
-                break;
-            case Opcode::Constant:
+                DISPATCH();
+            OPCODE(AndStack)
+                accumulator &= *--valueStack;
+                ip++;
+                DISPATCH();
+            OPCODE(Constant)
                 throw NotImplemented("Constant opcode not implemented.");
-            case Opcode::Not:
-                accumulator = !accumulator;
+            OPCODE(Not)
+                accumulator = ~accumulator;
                 ip++;
-                break;
-            case Opcode::OrStack:
-                {
-                    accumulator |= m_valueStack.back();
-                    m_valueStack.pop_back();
-                    ip++;
-                }
-                break;
-            case Opcode::UpdateFlags:
-                m_zeroFlag = (m_valueStack.back() == 0);
+                DISPATCH();
+            OPCODE(OrStack)
+                accumulator |= *--valueStack;
                 ip++;
-                break;
-            case Opcode::Report:
+                DISPATCH();
+            OPCODE(UpdateFlags)
+                m_zeroFlag = (valueStack[-1] == 0);
+                ip++;
+                DISPATCH();
+            OPCODE(Report)
                 // TODO: Combine accumulator with value stack.
                 if (accumulator != 0)
                 {
                     AddResult(accumulator, offset, base);
                 }
                 ip++;
-                break;
-            case Opcode::Call:
-                m_callStack.push_back(ip + 1);
-                ip = m_jumpTable[row];
-                break;
-            case Opcode::Jmp:
-                ip = m_jumpTable[row];
-                break;
-            case Opcode::Jnz:
+                DISPATCH();
+            OPCODE(Call)
+                *callStack++ = ip + 1;
+                ip = m_jumpTable[ip->GetRow()];
+                DISPATCH();
+            OPCODE(Jmp)
+                ip = m_jumpTable[ip->GetRow()];
+                DISPATCH();
+            OPCODE(Jnz)
                 if (accumulator != 0ull)
                 {
-                    ip = m_jumpTable[row];
+                    ip = m_jumpTable[ip->GetRow()];
                 }
                 else
                 {
                     ip++;
                 }
-                break;
-            case Opcode::Jz:
+                DISPATCH();
+            OPCODE(Jz)
                 if (accumulator == 0ull)
                 {
-                    ip = m_jumpTable[row];
+                    ip = m_jumpTable[ip->GetRow()];
                 }
                 else
                 {
                     ip++;
                 }
-                break;
-            case Opcode::Return:
-                ip = m_callStack.back();
-                m_callStack.pop_back();
-                break;
+                DISPATCH();
+            OPCODE(Return)
+                ip = *--callStack;
+                DISPATCH();
+            OPCODE(AndRowJz)
+                accumulator &= loadRowValue(ip);
+                m_zeroFlag = (accumulator == 0);
+                traceRow("AndRowJz");
+                // The following Jz holds the jump target.
+                ip = (accumulator == 0ull) ? m_jumpTable[ip[1].GetRow()] : ip + 2;
+                DISPATCH();
+            OPCODE(LoadRowJz)
+                accumulator = loadRowValue(ip);
+                m_zeroFlag = (accumulator == 0);
+                traceRow("LoadRowJz");
+                ip = (accumulator == 0ull) ? m_jumpTable[ip[1].GetRow()] : ip + 2;
+                DISPATCH();
+            OPCODE(AndRowReport)
+                accumulator &= loadRowValue(ip);
+                m_zeroFlag = (accumulator == 0);
+                traceRow("AndRowReport");
+                if (accumulator != 0)
+                {
+                    AddResult(accumulator, offset, base);
+                }
+                ip++;
+                DISPATCH();
+            OPCODE(LoadRowReport)
+                accumulator = loadRowValue(ip);
+                m_zeroFlag = (accumulator == 0);
+                traceRow("LoadRowReport");
+                if (accumulator != 0)
+                {
+                    AddResult(accumulator, offset, base);
+                }
+                ip++;
+                DISPATCH();
+            OPCODE(RankDownLoop)
+                // Save the accumulator and make the first call to the loop
+                // body, which returns to the RankDownNext that follows.
+                offset <<= ip->GetDelta();
+                *valueStack++ = accumulator;
+                *callStack++ = ip + 1;
+                ip = m_jumpTable[ip[1].GetRow()];
+                DISPATCH();
+            OPCODE(RankDownNext)
+                {
+                    const unsigned delta = ip->GetDelta();
+                    ++offset;
+                    if ((offset & ((1ull << delta) - 1)) != 0)
+                    {
+                        accumulator = valueStack[-1];
+                        *callStack++ = ip;
+                        ip = m_jumpTable[ip->GetRow()];
+                    }
+                    else
+                    {
+                        // The increment carried out of the low delta bits, so
+                        // every offset at the lower rank has been visited.
+                        --valueStack;
+                        offset = (offset >> delta) - 1;
+                        ip++;
+                    }
+                }
+                DISPATCH();
+            OPCODE(End)
+                goto finishIteration;
+            OPCODE(Last)
+#ifndef BYTECODE_COMPUTED_GOTO
             default:
-                RecoverableError error("ByteCodeInterpreter:: bad opcode.");
-                throw error;
+#endif
+                {
+                    RecoverableError error("ByteCodeInterpreter:: bad opcode.");
+                    throw error;
+                }
+#ifndef BYTECODE_COMPUTED_GOTO
             }  // switch
-        }  // while
+#endif
+        }
 
+    finishIteration:
+        m_instrumentation.IncrementQuadwordCount(quadwordCount);
 
         bool terminate = FinishIteration(base, sliceBuffer);
 
         return terminate;
     }
 
+#undef DISPATCH
+#undef OPCODE
+#undef BYTECODE_COMPUTED_GOTO
+
+
+    void ByteCodeInterpreter::TraceInstruction(Instruction const * ip,
+                                               size_t iteration,
+                                               size_t offset) const
+    {
+        std::ostream& out = m_diagnosticStream->GetStream();
+        const unsigned row = ip->GetRow();
+        out << "IP: " << std::hex << ip << std::dec << std::endl
+            << "Opcode: " << ip->GetOpcode() << std::endl
+            << "Iteration: " << iteration << std::endl
+            << "Offset: " << offset << std::endl
+            << "Row: " << row << std::endl
+            << "RowOffset: " << std::hex << m_rowOffsets[row] << std::dec << std::endl;
+    }
+
+
     void ByteCodeInterpreter::AddResult(uint64_t accumulator,
                                         size_t offset,
                                         size_t base)
@@ -367,6 +618,16 @@ Decide on type of Slices
     }
 
 
+    static uint64_t popcount(uint64_t value)
+    {
+#ifdef _MSC_VER
+        return __popcnt64(value);
+#else
+        return static_cast<uint64_t>(__builtin_popcountll(value));
+#endif
+    }
+
+
     bool ByteCodeInterpreter::FinishIteration(size_t base,
                                               void const * sliceBuffer)
     {
@@ -374,6 +635,24 @@ Decide on type of Slices
         //    << "FinishIteration: " << base << std::endl;
 
         uint64_t map = m_dedupe[0];
+
+        if (m_resultsBuffer == nullptr)
+        {
+            // Count-only mode. Each bit set in the dedupe buffer is a match.
+            while (map != 0)
+            {
+                size_t offset = bsf(map);
+                m_matchCount += popcount(m_dedupe[offset + 1]);
+                m_dedupe[offset + 1] = 0;
+
+                // Clear the lowest bit set in the map.
+                map &= (map - 1);
+            }
+            m_dedupe[0] = 0;
+
+            return false;
+        }
+
         while (map != 0)
         {
             size_t offset = bsf(map);
@@ -386,10 +665,16 @@ Decide on type of Slices
 
                 DocIndex docIndex = (base + offset) * c_bitsPerQuadword + bitPos;
 
-                // TODO: find a better way to get the Slice pointer.
-                Slice* slice =
-                    *reinterpret_cast<Slice**>(const_cast<void*>(sliceBuffer));
-                m_resultsBuffer.push_back(slice, docIndex);
+                // Like the native code, drop matches that exceed the limit
+                // but finish clearing the dedupe buffer.
+                if (m_matchCount < m_matchLimit)
+                {
+                    // TODO: find a better way to get the Slice pointer.
+                    Slice* slice =
+                        *reinterpret_cast<Slice**>(const_cast<void*>(sliceBuffer));
+                    m_resultsBuffer->push_back(slice, docIndex);
+                    ++m_matchCount;
+                }
 
                 // Clear the lowest bit set in the accumulator.
                 accumulator &= (accumulator - 1);
@@ -401,8 +686,26 @@ Decide on type of Slices
         }
         m_dedupe[0] = 0;
 
-        // TODO: don't always return false.
-        return false;
+        return m_matchCount >= m_matchLimit;
+    }
+
+
+    size_t ByteCodeInterpreter::GetMatchCount() const
+    {
+        return m_matchCount;
+    }
+
+
+    bool ByteCodeInterpreter::WasCancelled() const
+    {
+        return m_wasCancelled;
+    }
+
+
+    void ByteCodeInterpreter::SetCancellation(QueryCancellation const & cancellation)
+    {
+        m_cancellation = &cancellation;
+        m_cancellationMask = cancellation.GetStride() - 1;
     }
 
 
@@ -412,7 +715,9 @@ Decide on type of Slices
     //
     //*************************************************************************
     ByteCodeGenerator::ByteCodeGenerator()
-        : m_sealed(false)
+        : m_sealed(false),
+          m_valueStackCapacity(0),
+          m_callStackCapacity(0)
     {
     }
 
@@ -437,6 +742,26 @@ Decide on type of Slices
             m_jumpTable.push_back(&m_code[0] + offset);
         }
 
+        for (auto const & instruction : m_code)
+        {
+            switch (instruction.GetOpcode())
+            {
+            case ByteCodeInterpreter::Opcode::Push:
+                ++m_valueStackCapacity;
+                break;
+            case ByteCodeInterpreter::Opcode::Call:
+                ++m_callStackCapacity;
+                break;
+            case ByteCodeInterpreter::Opcode::RankDownLoop:
+                // Saves the accumulator and calls the loop body.
+                ++m_valueStackCapacity;
+                ++m_callStackCapacity;
+                break;
+            default:
+                break;
+            }
+        }
+
         m_sealed = true;
     }
 
@@ -457,6 +782,20 @@ Decide on type of Slices
     }
 
 
+    size_t ByteCodeGenerator::GetValueStackCapacity() const
+    {
+        EnsureSealed(true);
+        return m_valueStackCapacity;
+    }
+
+
+    size_t ByteCodeGenerator::GetCallStackCapacity() const
+    {
+        EnsureSealed(true);
+        return m_callStackCapacity;
+    }
+
+
     void ByteCodeGenerator::AndRow(size_t row, bool inverted, size_t rankDelta)
     {
         EnsureSealed(false);
@@ -634,6 +973,71 @@ Decide on type of Slices
     }
 
 
+    void ByteCodeGenerator::AndRowJz(size_t row,
+                                     bool inverted,
+                                     size_t rankDelta,
+                                     Label label)
+    {
+        EnsureSealed(false);
+        CHECK_LT(label, m_jumpOffsets.size())
+            << "AndRowJz to unknown label " << label;
+
+        m_code.emplace_back(
+            ByteCodeInterpreter::Opcode::AndRowJz, row, rankDelta, inverted);
+        m_code.emplace_back(
+            ByteCodeInterpreter::Opcode::Jz, label);
+    }
+
+
+    void ByteCodeGenerator::LoadRowJz(size_t row,
+                                      bool inverted,
+                                      size_t rankDelta,
+                                      Label label)
+    {
+        EnsureSealed(false);
+        CHECK_LT(label, m_jumpOffsets.size())
+            << "LoadRowJz to unknown label " << label;
+
+        m_code.emplace_back(
+            ByteCodeInterpreter::Opcode::LoadRowJz, row, rankDelta, inverted);
+        m_code.emplace_back(
+            ByteCodeInterpreter::Opcode::Jz, label);
+    }
+
+
+    void ByteCodeGenerator::AndRowReport(size_t row,
+                                         bool inverted,
+                                         size_t rankDelta)
+    {
+        EnsureSealed(false);
+        m_code.emplace_back(
+            ByteCodeInterpreter::Opcode::AndRowReport, row, rankDelta, inverted);
+    }
+
+
+    void ByteCodeGenerator::LoadRowReport(size_t row,
+                                          bool inverted,
+                                          size_t rankDelta)
+    {
+        EnsureSealed(false);
+        m_code.emplace_back(
+            ByteCodeInterpreter::Opcode::LoadRowReport, row, rankDelta, inverted);
+    }
+
+
+    void ByteCodeGenerator::RankDownLoop(size_t delta, Label label)
+    {
+        EnsureSealed(false);
+        CHECK_LT(label, m_jumpOffsets.size())
+            << "RankDownLoop to unknown label " << label;
+
+        m_code.emplace_back(
+            ByteCodeInterpreter::Opcode::RankDownLoop, 0, delta);
+        m_code.emplace_back(
+            ByteCodeInterpreter::Opcode::RankDownNext, label, delta);
+    }
+
+
     void ByteCodeGenerator::EnsureSealed(bool sealed) const
     {
         CHECK_EQ(sealed, m_sealed)
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <memory>                           // std::unique_ptr embedded.
 #include <stddef.h>                         // size_t, ptrdiff_t parameter.
 #include <stdint.h>                         // uint32_t embedded.
 #include <vector>                           // std::vector embedded.
@@ -36,6 +37,7 @@ namespace BitFunnel
     class ByteCodeGenerator;
     class CacheLineRecorder;
     class IDiagnosticStream;
+    class QueryCancellation;
     class QueryInstrumentation;
     class ResultsBuffer;
 
@@ -54,6 +56,12 @@ namespace BitFunnel
     //   4. Construct the ByteCodeInterpreter.
     //   5. Invoke the Run() method.
     //
+    // The matching loop is a template, instantiated once with diagnostic
+    // output and cache line recording and once without them. Run() selects
+    // the uninstrumented loop unless the interpreter was constructed with a
+    // diagnostic stream or a nonzero sliceBufferSize. On compilers that
+    // support it, instructions are dispatched with computed gotos.
+    //
     //*************************************************************************
     class ByteCodeInterpreter
     {
@@ -63,8 +71,26 @@ namespace BitFunnel
         // Constructs a ByteCodeInterpreter for the sequence of instructions
         // in a specific ByteCodeGenerator. This interpreter will run against
         // the rows passed as that second parameter.
+        //
+        // The interpreter appends at most maxMatches matches to the
+        // resultsBuffer and stops scanning as soon as this limit or the
+        // capacity of the resultsBuffer is reached.
         ByteCodeInterpreter(ByteCodeGenerator const & code,
                             ResultsBuffer & resultsBuffer,
+                            size_t maxMatches,
+                            size_t sliceCount,
+                            void * const * sliceBuffers,
+                            size_t iterationsPerSlice,
+                            Rank initialRank,
+                            ptrdiff_t const * rowOffsets,
+                            IDiagnosticStream * diagnosticStream,
+                            QueryInstrumentation & instrumentation,
+                            size_t sliceBufferSize);
+
+        // Constructs a ByteCodeInterpreter that only counts matches. The
+        // matches in each iteration are counted with a population count of
+        // the dedupe buffer and no results are extracted.
+        ByteCodeInterpreter(ByteCodeGenerator const & code,
                             size_t sliceCount,
                             void * const * sliceBuffers,
                             size_t iterationsPerSlice,
@@ -82,9 +108,29 @@ namespace BitFunnel
         // termination.
         bool Run();
 
-        // Virtual machine opcodes. With the exception of the End opcode,
-        // these values have a 1:1 correspondance with the ICodeGenerator
-        // methods.
+        // Returns the number of matches found by Run(). In count-only mode
+        // this is the only record of the matches.
+        size_t GetMatchCount() const;
+
+        // Returns true if Run() stopped early because the cancellation flag
+        // was set, rather than because it reached its match limit.
+        bool WasCancelled() const;
+
+        // Makes Run() terminate early once the query is cancelled or its
+        // deadline passes. The token is checked at the start of each slice
+        // and every cancellation.GetStride() iterations.
+        void SetCancellation(QueryCancellation const & cancellation);
+
+        // Virtual machine opcodes. With the exception of the RankDownNext
+        // and End opcodes, these values have a 1:1 correspondance with the
+        // ICodeGenerator methods.
+        //
+        // The fused opcodes AndRowJz, LoadRowJz and RankDownLoop take a jump
+        // target in addition to their row or delta. The target is stored in
+        // the row field of the instruction that follows, which is a Jz for
+        // AndRowJz and LoadRowJz, and a RankDownNext for RankDownLoop.
+        // AndRowJz and LoadRowJz skip over their Jz. RankDownNext is the
+        // return point for each call made by the RankDown loop.
         //
         // DESIGN NOTE: this enum should be kept in sync with c_opcodeNames[].
         enum class Opcode
@@ -107,6 +153,12 @@ namespace BitFunnel
             Jnz,
             Jz,
             Return,
+            AndRowJz,
+            LoadRowJz,
+            AndRowReport,
+            LoadRowReport,
+            RankDownLoop,
+            RankDownNext,
             End,
             Last
         };
@@ -177,13 +229,41 @@ namespace BitFunnel
         };
 
     private:
+        // Instrumentation policies for the matching loop.
+        class Instrumented;
+        class Uninstrumented;
+
+        ByteCodeInterpreter(ByteCodeGenerator const & code,
+                            ResultsBuffer * resultsBuffer,
+                            size_t matchLimit,
+                            size_t sliceCount,
+                            void * const * sliceBuffers,
+                            size_t iterationsPerSlice,
+                            Rank initialRank,
+                            ptrdiff_t const * rowOffsets,
+                            IDiagnosticStream * diagnosticStream,
+                            QueryInstrumentation & instrumentation,
+                            size_t sliceBufferSize);
+
+        // Processes every slice. Returns true to indicate early termination.
+        template <typename INSTRUMENTATION>
+        bool RunSlices();
+
         //  Returns true to indicate early termination.
+        template <typename INSTRUMENTATION>
         bool ProcessOneSlice(size_t slice);
 
         // Executes the instruction sequence for the specified iteration
         // number. Returns true to indicate early termination.
+        template <typename INSTRUMENTATION>
         bool RunOneIteration(void const * sliceBuffer, size_t iteration);
 
+        // Writes the state of the virtual machine before executing the
+        // instruction at ip to the diagnostic stream.
+        void TraceInstruction(Instruction const * ip,
+                              size_t iteration,
+                              size_t offset) const;
+
         // The 'base' parameter has the rank0 quadword position for the start
         // of the current iteration. The accumulator corresponds to position
         // 'base + offset'.
@@ -192,7 +272,8 @@ namespace BitFunnel
                        size_t base);
 
         // The 'base' parameter has the rank0 quadword position for the start
-        // of this iteration.
+        // of this iteration. Returns true when the match limit has been
+        // reached.
         bool FinishIteration(size_t base, void const * sliceBuffer);
 
         //
@@ -202,7 +283,12 @@ namespace BitFunnel
         std::vector<Instruction> const & m_code;
         std::vector<Instruction const *> const & m_jumpTable;
 
-        ResultsBuffer & m_resultsBuffer;
+        // Set to nullptr in count-only mode.
+        ResultsBuffer * m_resultsBuffer;
+
+        // Matching terminates when m_matchCount reaches this value.
+        size_t m_matchLimit;
+        size_t m_matchCount;
 
         size_t m_sliceCount;
         void * const * m_sliceBuffers;
@@ -211,16 +297,25 @@ namespace BitFunnel
 
         ptrdiff_t const * m_rowOffsets;
 
+        // Cancellation token and mask applied to the iteration number to
+        // decide when to check the token. Null when not cancellable.
+        QueryCancellation const * m_cancellation;
+        size_t m_cancellationMask;
+
+        // Set when Run() stops because the query was cancelled.
+        bool m_wasCancelled;
 
         //
         // Virtual machine state.
         //
 
-        // Control flow call stack. Holds return addresses for calls.
-        std::vector<Instruction const *> m_callStack;
+        // Control flow call stack. Holds return addresses for calls. Sized
+        // by ByteCodeGenerator::GetCallStackCapacity().
+        std::unique_ptr<Instruction const *[]> m_callStack;
 
-        // 64-bit value stack for Rank0 methods.
-        std::vector<uint64_t> m_valueStack;
+        // 64-bit value stack for Rank0 methods. Sized by
+        // ByteCodeGenerator::GetValueStackCapacity().
+        std::unique_ptr<uint64_t[]> m_valueStack;
 
         // TODO: Formalize definition and usage of zero flag.
         bool m_zeroFlag;
@@ -257,6 +352,12 @@ namespace BitFunnel
             "Jnz",
             "Jz",
             "Return",
+            "AndRowJz",
+            "LoadRowJz",
+            "AndRowReport",
+            "LoadRowReport",
+            "RankDownLoop",
+            "RankDownNext",
             "End",
             "Last"
     };
@@ -326,6 +427,14 @@ namespace BitFunnel
         std::vector<ByteCodeInterpreter::Instruction const *> const &
             GetJumpTable() const;
 
+        // Return upper bounds on the depths of the value and call stacks.
+        // The code generated from a CompileNode tree never recurses, so the
+        // stacks can hold no more entries than there are Push, Call and
+        // RankDownLoop instructions. Class must be sealed before calling
+        // these methods.
+        size_t GetValueStackCapacity() const;
+        size_t GetCallStackCapacity() const;
+
         //
         // ICodeGenerator methods
         //
@@ -362,6 +471,23 @@ namespace BitFunnel
         virtual void Jz(Label label) override;
         virtual void Return() override;
 
+        // Fused primitives.
+        virtual void AndRowJz(size_t row,
+                              bool inverted,
+                              size_t rankDelta,
+                              Label label) override;
+        virtual void LoadRowJz(size_t row,
+                               bool inverted,
+                               size_t rankDelta,
+                               Label label) override;
+        virtual void AndRowReport(size_t row,
+                                  bool inverted,
+                                  size_t rankDelta) override;
+        virtual void LoadRowReport(size_t row,
+                                   bool inverted,
+                                   size_t rankDelta) override;
+        virtual void RankDownLoop(size_t delta, Label label) override;
+
     private:
         void EnsureSealed(bool sealed) const;
 
@@ -369,5 +495,7 @@ namespace BitFunnel
         std::vector<ByteCodeInterpreter::Instruction> m_code;
         std::vector<size_t> m_jumpOffsets;
         std::vector<ByteCodeInterpreter::Instruction const *> m_jumpTable;
+        size_t m_valueStackCapacity;
+        size_t m_callStackCapacity;
     };
 }
@@ -20,13 +20,19 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#include <algorithm>                                // std::find().
 #include <iostream>
+#include <memory>                                   // std::unique_ptr.
+#include <string>                                   // std::to_string().
+#include <vector>                                   // std::vector.
 
 #include "BitFunnel/Configuration/Factories.h"
 #include "BitFunnel/Plan/Factories.h"
 #include "BitFunnel/Index/IIngestor.h"
 #include "BitFunnel/Index/IShard.h"
 #include "BitFunnel/Index/Token.h"
+#include "BitFunnel/Plan/IResultsSink.h"
+#include "BitFunnel/Plan/QueryCancellation.h"
 #include "BitFunnel/Plan/QueryInstrumentation.h"
 #include "BitFunnel/Plan/QueryParser.h"
 #include "BitFunnel/Plan/ResultsBuffer.h"
@@ -34,19 +40,156 @@
 #include "BitFunnel/Utilities/Factories.h"
 #include "ByteCodeQueryEngine.h"
 #include "CompileNode.h"
+#include "LoggerInterfaces/Check.h"
+#include "MatchEstimator.h"
+#include "QueryPlanCache.h"
 #include "QueryPlanner.h"
 #include "RowSet.h"
+#include "WideDisjunctionPlan.h"
 
 
 namespace BitFunnel
 {
+    //*************************************************************************
+    //
+    // ByteCodePlan
+    //
+    // A CompiledQuery whose code is a sealed ByteCodeGenerator.
+    //
+    //*************************************************************************
+    class ByteCodePlan : public CompiledQuery
+    {
+    public:
+        // Compiles the CompileNode tree of each shard. Shards that share a
+        // tree share its code.
+        ByteCodePlan(QueryPlanner const & planner)
+          : CompiledQuery(planner)
+        {
+            std::vector<CompileNode const *> trees;
+            for (ShardId shard = 0; shard < planner.GetRowSet().GetShardCount(); ++shard)
+            {
+                CompileNode const & tree = planner.GetCompileTree(shard);
+                auto it = std::find(trees.begin(), trees.end(), &tree);
+                if (it == trees.end())
+                {
+                    trees.push_back(&tree);
+                    m_code.emplace_back(new ByteCodeGenerator());
+                    tree.Compile(*m_code.back());
+                    m_code.back()->Seal();
+                    it = trees.end() - 1;
+                }
+                m_shardCode.push_back(m_code[static_cast<size_t>(it - trees.begin())].get());
+            }
+        }
+
+        ByteCodeGenerator const & GetCode(ShardId shard) const
+        {
+            return *m_shardCode[shard];
+        }
+
+    private:
+        std::vector<std::unique_ptr<ByteCodeGenerator>> m_code;
+        std::vector<ByteCodeGenerator const *> m_shardCode;
+    };
+
+
+    //*************************************************************************
+    //
+    // ByteCodeMorselMatcher
+    //
+    // Runs the ByteCodeInterpreter over the slices of a single SliceMorsel.
+    //
+    //*************************************************************************
+    class ByteCodeMorselMatcher : public IMorselMatcher
+    {
+    public:
+        ByteCodeMorselMatcher(IIngestor const & ingestor,
+                              ByteCodePlan const & plan,
+                              bool countCacheLines)
+          : m_ingestor(ingestor),
+            m_plan(plan),
+            m_countCacheLines(countCacheLines)
+        {
+        }
+
+        virtual bool MatchMorsel(SliceMorsel const & morsel,
+                                 ResultsBuffer & results,
+                                 size_t maxMatches,
+                                 QueryCancellation const & cancellation,
+                                 QueryInstrumentation & instrumentation) override
+        {
+            auto & shard = m_ingestor.GetShard(morsel.m_shard);
+            const Rank initialRank = m_plan.GetInitialRank(morsel.m_shard);
+
+            // Iterations per slice calculation.
+            auto iterationsPerSlice = shard.GetSliceCapacity() >> 6 >> initialRank;
+
+            ByteCodeInterpreter interpreter(m_plan.GetCode(morsel.m_shard),
+                results,
+                maxMatches,
+                morsel.m_sliceCount,
+                morsel.m_sliceBuffers,
+                iterationsPerSlice,
+                initialRank,
+                m_plan.GetRowOffsets(morsel.m_shard),
+                nullptr,
+                instrumentation,
+                m_countCacheLines ? shard.GetSliceBufferSize() : 0);
+
+            interpreter.SetCancellation(cancellation);
+            interpreter.Run();
+
+            return interpreter.WasCancelled();
+        }
+
+        virtual size_t CountMorsel(SliceMorsel const & morsel,
+                                   QueryInstrumentation & instrumentation) override
+        {
+            auto & shard = m_ingestor.GetShard(morsel.m_shard);
+            const Rank initialRank = m_plan.GetInitialRank(morsel.m_shard);
+
+            // Iterations per slice calculation.
+            auto iterationsPerSlice = shard.GetSliceCapacity() >> 6 >> initialRank;
+
+            ByteCodeInterpreter interpreter(m_plan.GetCode(morsel.m_shard),
+                morsel.m_sliceCount,
+                morsel.m_sliceBuffers,
+                iterationsPerSlice,
+                initialRank,
+                m_plan.GetRowOffsets(morsel.m_shard),
+                nullptr,
+                instrumentation,
+                m_countCacheLines ? shard.GetSliceBufferSize() : 0);
+
+            interpreter.Run();
+
+            return interpreter.GetMatchCount();
+        }
+
+    private:
+        IIngestor const & m_ingestor;
+        ByteCodePlan const & m_plan;
+        const bool m_countCacheLines;
+    };
+
+
+    //*************************************************************************
+    //
+    // ByteCodeQueryEngine
+    //
+    //*************************************************************************
     ByteCodeQueryEngine::ByteCodeQueryEngine(ISimpleIndex const & index,
                                              IStreamConfiguration const & config,
-                                             size_t treeAllocatorBytes)
+                                             size_t treeAllocatorBytes,
+                                             QueryPlanCache * planCache,
+                                             TermRowCache * termRowCache)
         : m_index(index),
           m_config(config),
           m_diagnostic(Factories::CreateDiagnosticStream(std::cout)),
-          m_matchTreeAllocator(new BitFunnel::Allocator(treeAllocatorBytes))
+          m_matchTreeAllocator(new BitFunnel::Allocator(treeAllocatorBytes)),
+          m_planCache(planCache),
+          m_termRowCache(termRowCache),
+          m_wideDisjunctionRowCount(c_maxRowsPerQuery)
     {
     }
 
@@ -63,58 +206,256 @@ namespace BitFunnel
     // Runs a parsed query
     void ByteCodeQueryEngine::Run(TermMatchNode const * tree,
         QueryInstrumentation & instrumentation,
-        ResultsBuffer & resultsBuffer)
-    {
-        const int c_arbitraryRowCount = 500;
-        QueryPlanner planner(*tree,
-                             c_arbitraryRowCount,
-                             m_index,
-                             *m_matchTreeAllocator,
-                             *m_diagnostic,
-                             instrumentation);
-        CompileNode const & compileTree = planner.GetCompileTree();
-        const Rank initialRank = planner.GetInitialRank();
-        const RowSet & rowSet = planner.GetRowSet();
-
-        // TODO: Clear results buffer here?
-        compileTree.Compile(m_code);
-        m_code.Seal();
+        IResultsSink & results)
+    {
+        QueryCancellation none;
+        Run(tree, instrumentation, results, none);
+    }
+
+
+    // Runs a parsed query until it completes or is cancelled.
+    void ByteCodeQueryEngine::Run(TermMatchNode const * tree,
+        QueryInstrumentation & instrumentation,
+        IResultsSink & results,
+        QueryCancellation const & cancellation)
+    {
+        auto plan = GetPlan(*tree, instrumentation);
 
         instrumentation.FinishPlanning();
-        resultsBuffer.Reset();
+        results.Reset();
 
         // Get token before we GetSliceBuffers.
         {
             auto token = m_index.GetIngestor().GetTokenManager().RequestToken();
 
-            for (ShardId shardId = 0; shardId < m_index.GetIngestor().GetShardCount(); ++shardId)
+            auto matcher = CreateMatcher(*plan);
+
+            const bool truncated = m_matcher.Run(m_index.GetIngestor(),
+                                                 *matcher,
+                                                 instrumentation,
+                                                 results,
+                                                 cancellation);
+
+            instrumentation.FinishMatching();
+            instrumentation.SetMatchCount(results.GetMatchCount());
+            if (truncated)
             {
-                auto & shard = m_index.GetIngestor().GetShard(shardId);
-                auto & sliceBuffers = shard.GetSliceBuffers();
-
-                // Iterations per slice calculation.
-                auto iterationsPerSlice = shard.GetSliceCapacity() >> 6 >> initialRank;
-
-                auto countCacheLines = m_diagnostic->IsEnabled("planning/countcachelines");
-
-                ByteCodeInterpreter interpreter(m_code,
-                    resultsBuffer,
-                    sliceBuffers.size(),
-                    sliceBuffers.data(),
-                    iterationsPerSlice,
-                    initialRank,
-                    rowSet.GetRowOffsets(shardId),
-                    nullptr,
-                    instrumentation,
-                    countCacheLines ? shard.GetSliceBufferSize() : 0);
-
-                interpreter.Run();
+                instrumentation.QueryTruncated();
             }
+            instrumentation.QuerySucceeded();
+        } // End of token lifetime.
+    }
+
+
+    // Counts the matches for a parsed query
+    size_t ByteCodeQueryEngine::Count(TermMatchNode const * tree,
+                                      QueryInstrumentation & instrumentation)
+    {
+        auto plan = GetPlan(*tree, instrumentation);
+
+        instrumentation.FinishPlanning();
+
+        size_t matchCount = 0;
+
+        // Get token before we GetSliceBuffers.
+        {
+            auto token = m_index.GetIngestor().GetTokenManager().RequestToken();
+
+            auto matcher = CreateMatcher(*plan);
+
+            matchCount = m_matcher.Count(m_index.GetIngestor(),
+                                         *matcher,
+                                         instrumentation);
 
             instrumentation.FinishMatching();
-            instrumentation.SetMatchCount(resultsBuffer.size());
+            instrumentation.SetMatchCount(matchCount);
             instrumentation.QuerySucceeded();
         } // End of token lifetime.
+
+        return matchCount;
+    }
+
+
+    // Estimates the matches for a parsed query
+    QueryEstimate ByteCodeQueryEngine::Estimate(TermMatchNode const * tree,
+                                                QueryInstrumentation & instrumentation)
+    {
+        // The query is planned as Run() plans it, so the estimate describes
+        // the plan that would run, and a cached plan is shared with Run().
+        auto plan = GetPlan(*tree, instrumentation);
+
+        instrumentation.FinishPlanning();
+
+        QueryEstimate estimate =
+            MatchEstimator::Estimate(*plan, m_index, instrumentation);
+        instrumentation.QuerySucceeded();
+
+        return estimate;
+    }
+
+
+    void ByteCodeQueryEngine::RunBatch(std::vector<char const *> const & queries,
+                                       std::vector<QueryInstrumentation *> const & instrumentation,
+                                       std::vector<IResultsSink *> const & results)
+    {
+        CHECK_EQ(queries.size(), instrumentation.size())
+            << "RunBatch() requires one QueryInstrumentation per query.";
+        CHECK_EQ(queries.size(), results.size())
+            << "RunBatch() requires one IResultsSink per query.";
+
+        // Each query is planned immediately after it is parsed, since Parse()
+        // resets the match tree allocator.
+        std::vector<std::shared_ptr<CompiledQuery const>> plans;
+        std::vector<QueryInstrumentation *> batchInstrumentation;
+        std::vector<IResultsSink *> batchResults;
+
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            results[i]->Reset();
+
+            auto tree = Parse(queries[i]);
+            instrumentation[i]->FinishParsing();
+
+            if (tree != nullptr)
+            {
+                plans.push_back(GetPlan(*tree, *instrumentation[i]));
+                instrumentation[i]->FinishPlanning();
+
+                batchInstrumentation.push_back(instrumentation[i]);
+                batchResults.push_back(results[i]);
+            }
+        }
+
+        // Get token before we GetSliceBuffers.
+        {
+            auto token = m_index.GetIngestor().GetTokenManager().RequestToken();
+
+            std::vector<std::unique_ptr<IMorselMatcher>> matchers;
+            std::vector<IMorselMatcher *> batchMatchers;
+            for (auto & plan : plans)
+            {
+                matchers.push_back(CreateMatcher(*plan));
+                batchMatchers.push_back(matchers.back().get());
+            }
+
+            m_matcher.RunBatch(m_index.GetIngestor(),
+                               batchMatchers,
+                               batchInstrumentation,
+                               batchResults);
+
+            for (size_t i = 0; i < batchResults.size(); ++i)
+            {
+                batchInstrumentation[i]->FinishMatching();
+                batchInstrumentation[i]->SetMatchCount(batchResults[i]->GetMatchCount());
+                batchInstrumentation[i]->QuerySucceeded();
+            }
+        } // End of token lifetime.
+    }
+
+
+    std::shared_ptr<CompiledQuery const>
+        ByteCodeQueryEngine::GetPlan(TermMatchNode const & tree,
+                                     QueryInstrumentation & instrumentation)
+    {
+        std::shared_ptr<CompiledQuery const> plan;
+        std::string key;
+
+        if (m_planCache != nullptr)
+        {
+            key = QueryPlanCache::CreateKey(tree);
+            if (m_wideDisjunctionRowCount != c_maxRowsPerQuery)
+            {
+                key += "|w" + std::to_string(m_wideDisjunctionRowCount);
+            }
+            plan = m_planCache->Find(QueryPlanCache::Engine::ByteCode,
+                                     key,
+                                     m_index);
+        }
+
+        if (plan == nullptr)
+        {
+            plan = WideDisjunctionPlan::TryCreate(tree,
+                                                  m_index,
+                                                  m_wideDisjunctionRowCount,
+                                                  *m_diagnostic,
+                                                  m_termRowCache);
+            if (plan != nullptr)
+            {
+                instrumentation.SetRowCount(plan->GetRowCount());
+            }
+            else
+            {
+                const int c_arbitraryRowCount = 500;
+                QueryPlanner planner(tree,
+                                     c_arbitraryRowCount,
+                                     m_index,
+                                     *m_matchTreeAllocator,
+                                     *m_diagnostic,
+                                     instrumentation,
+                                     m_termRowCache);
+
+                plan = std::make_shared<ByteCodePlan>(planner);
+            }
+
+            if (m_planCache != nullptr)
+            {
+                m_planCache->Add(QueryPlanCache::Engine::ByteCode,
+                                 key,
+                                 plan,
+                                 m_index);
+            }
+        }
+        else
+        {
+            instrumentation.SetRowCount(plan->GetRowCount());
+        }
+
+        return plan;
+    }
+
+
+    std::unique_ptr<IMorselMatcher>
+        ByteCodeQueryEngine::CreateMatcher(CompiledQuery const & plan) const
+    {
+        auto wide = dynamic_cast<WideDisjunctionPlan const *>(&plan);
+        if (wide != nullptr)
+        {
+            return std::unique_ptr<IMorselMatcher>(
+                new WideDisjunctionMatcher(m_index.GetIngestor(), *wide));
+        }
+
+        auto countCacheLines = m_diagnostic->IsEnabled("planning/countcachelines");
+
+        return std::unique_ptr<IMorselMatcher>(
+            new ByteCodeMorselMatcher(m_index.GetIngestor(),
+                                      static_cast<ByteCodePlan const &>(plan),
+                                      countCacheLines));
+    }
+
+
+    void ByteCodeQueryEngine::SetMatchingThreads(size_t threadCount,
+                                                 size_t slicesPerMorsel)
+    {
+        m_matcher.Configure(threadCount, slicesPerMorsel);
+    }
+
+
+    void ByteCodeQueryEngine::SetMatchLimit(size_t matchLimit,
+                                            size_t shardMatchLimit)
+    {
+        m_matcher.SetMatchLimit(matchLimit, shardMatchLimit);
+    }
+
+
+    void ByteCodeQueryEngine::SetWideDisjunctionRowCount(size_t rowCount)
+    {
+        m_wideDisjunctionRowCount = rowCount;
+    }
+
+
+    size_t ByteCodeQueryEngine::GetMatchTreeHighWaterMark() const
+    {
+        return m_matchTreeAllocator->GetHighWaterMark();
     }
 
 
@@ -28,24 +28,37 @@
 #include "BitFunnel/Index/ISimpleIndex.h"
 #include "BitFunnel/IDiagnosticStream.h"
 #include "BitFunnel/Plan/IQueryEngine.h"
+#include "BitFunnel/Utilities/Allocator.h"          // Template parameter.
 #include "ByteCodeInterpreter.h"
+#include "ParallelMatcher.h"                       // ParallelMatcher embedded.
 
 
 namespace BitFunnel
 {
+    class CompiledQuery;
+    class QueryPlanCache;
+    class TermRowCache;
+
     //*************************************************************************
     //
     // ByteCodeQueryEngine
     //
     // The class used to run parsed queries using the ByteCodeInterpreter.
     //
+    // If a QueryPlanCache is supplied, compiled queries are looked up in and
+    // added to the cache, skipping planning and code generation for queries
+    // that have been seen before. If a TermRowCache is supplied, queries
+    // that must be planned look up the rows for their terms in the cache.
+    //
     //*************************************************************************
     class ByteCodeQueryEngine : public IQueryEngine
     {
     public:
         ByteCodeQueryEngine(ISimpleIndex const & index,
                             IStreamConfiguration const & config,
-                            size_t treeAllocatorBytes);
+                            size_t treeAllocatorBytes,
+                            QueryPlanCache * planCache = nullptr,
+                            TermRowCache * termRowCache = nullptr);
 
         // Parse a query
         virtual TermMatchNode const *Parse(const char *query) override;
@@ -53,7 +66,62 @@ namespace BitFunnel
         // Runs a parsed query
         virtual void Run(TermMatchNode const * tree,
                          QueryInstrumentation & instrumentation,
-                         ResultsBuffer & resultsBuffer) override;
+                         IResultsSink & results) override;
+
+        // Runs a parsed query until it completes or is cancelled.
+        virtual void Run(TermMatchNode const * tree,
+                         QueryInstrumentation & instrumentation,
+                         IResultsSink & results,
+                         QueryCancellation const & cancellation) override;
+
+        // Returns the number of matches for a parsed query without writing
+        // them to an IResultsSink. The count is the same as the number of
+        // results Run() would return without a match limit. Match limits do
+        // not apply.
+        virtual size_t Count(TermMatchNode const * tree,
+                             QueryInstrumentation & instrumentation) override;
+
+        // Plans a parsed query and predicts its match count and matching
+        // cost from the sampled densities of its rows, without scanning the
+        // index. The estimate is also recorded in instrumentation. Intended
+        // for admission control of expensive queries.
+        virtual QueryEstimate Estimate(TermMatchNode const * tree,
+                                       QueryInstrumentation & instrumentation) override;
+
+        // Parses, plans and runs a batch of queries with a single pass over
+        // the index. Every slice is matched against all of the queries
+        // before the next slice is read. The matches for queries[i] are
+        // written to results[i], which is reset first, and its statistics
+        // to instrumentation[i]. Throws if any query fails to parse or plan,
+        // in which case the contents of results are undefined. Invalidates
+        // trees returned by Parse().
+        virtual void RunBatch(std::vector<char const *> const & queries,
+                              std::vector<QueryInstrumentation *> const & instrumentation,
+                              std::vector<IResultsSink *> const & results) override;
+
+        // Configures intra-query parallelism. The slice buffers of each shard
+        // are divided into morsels of slicesPerMorsel slices which are
+        // matched by threadCount worker threads. A threadCount of 1, the
+        // default, matches all slices on the thread that calls Run().
+        virtual void SetMatchingThreads(size_t threadCount,
+                                        size_t slicesPerMorsel) override;
+
+        // Limits the number of matches returned by Run() to matchLimit in
+        // total and to shardMatchLimit from any single shard. Scanning stops
+        // as soon as the limits are reached. A value of zero, the default,
+        // means no limit.
+        virtual void SetMatchLimit(size_t matchLimit,
+                                   size_t shardMatchLimit) override;
+
+        // Queries in conjunctive normal form that need more than rowCount
+        // rows are run by the WideDisjunctionMatcher instead of being
+        // compiled. The default is c_maxRowsPerQuery.
+        virtual void SetWideDisjunctionRowCount(size_t rowCount) override;
+
+        // Returns the largest number of bytes that the match tree arena has
+        // held for one query, which shows whether its initial size is large
+        // enough for the query log.
+        virtual size_t GetMatchTreeHighWaterMark() const override;
 
         // Adds the diagnostic keyword prefix to the list of prefixes that
         // enable diagnostics.
@@ -64,11 +132,31 @@ namespace BitFunnel
         virtual void DisableDiagnostic(char const * prefix) override;
 
     private:
+        // Returns the compiled query for tree, from the QueryPlanCache if
+        // possible.
+        std::shared_ptr<CompiledQuery const>
+            GetPlan(TermMatchNode const & tree,
+                    QueryInstrumentation & instrumentation);
+
+        // Returns the IMorselMatcher that runs plan.
+        std::unique_ptr<IMorselMatcher>
+            CreateMatcher(CompiledQuery const & plan) const;
+
         ISimpleIndex const & m_index;
         IStreamConfiguration const & m_config;
         std::unique_ptr<IDiagnosticStream> m_diagnostic;
-        std::unique_ptr<IAllocator> m_matchTreeAllocator;
+        std::unique_ptr<Allocator> m_matchTreeAllocator;
+
+        // Optional cache of compiled queries, shared with other engines.
+        QueryPlanCache * m_planCache;
+
+        // Optional cache of the rows for each term, shared with other
+        // engines.
+        TermRowCache * m_termRowCache;
+
+        // Row count above which queries use a WideDisjunctionPlan.
+        size_t m_wideDisjunctionRowCount;
 
-        ByteCodeGenerator m_code;
+        ParallelMatcher m_matcher;
     };
 }
@@ -0,0 +1,139 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <algorithm>                            // std::min().
+#include <limits>                               // std::numeric_limits.
+
+#include "BitFunnel/Plan/ChunkedResultsSink.h"
+#include "LoggerInterfaces/Logging.h"
+
+
+namespace BitFunnel
+{
+    ChunkedResultsSink::ChunkedResultsSink()
+      : m_size(0)
+    {
+    }
+
+
+    void ChunkedResultsSink::Reset()
+    {
+        // Chunks are kept for the next query.
+        m_slices.clear();
+        m_size = 0;
+    }
+
+
+    void ChunkedResultsSink::Add(ResultsBuffer::Result const * matches,
+                                 size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto const & match = matches[i];
+
+            if (m_slices.size() == 0 || m_slices.back() != match.m_slice)
+            {
+                LogAssertB(m_slices.size() < (std::numeric_limits<uint32_t>::max)(),
+                           "Slice ordinal overflow.");
+                m_slices.push_back(match.m_slice);
+            }
+
+            LogAssertB(match.m_index <= (std::numeric_limits<uint32_t>::max)(),
+                       "DocIndex overflow.");
+
+            const size_t chunk = m_size >> c_log2ChunkSize;
+            if (chunk == m_chunks.size())
+            {
+                m_chunks.emplace_back(new Entry[c_chunkSize]);
+            }
+
+            Entry & entry = m_chunks[chunk][m_size & (c_chunkSize - 1)];
+            entry.m_slice = static_cast<uint32_t>(m_slices.size() - 1);
+            entry.m_index = static_cast<uint32_t>(match.m_index);
+            ++m_size;
+        }
+    }
+
+
+    size_t ChunkedResultsSink::GetMatchCount() const
+    {
+        return m_size;
+    }
+
+
+    void ChunkedResultsSink::CopyTo(size_t start,
+                                    size_t count,
+                                    IResultsSink & sink) const
+    {
+        LogAssertB(start + count <= m_size, "Range out of bounds.");
+
+        // Decode into a small buffer to pass matches on in batches.
+        const size_t c_batchSize = 256;
+        ResultsBuffer::Result batch[c_batchSize];
+
+        while (count > 0)
+        {
+            const size_t batchSize = (std::min)(count, c_batchSize);
+            for (size_t i = 0; i < batchSize; ++i)
+            {
+                batch[i] = (*this)[start + i];
+            }
+            sink.Add(batch, batchSize);
+
+            start += batchSize;
+            count -= batchSize;
+        }
+    }
+
+
+    ResultsBuffer::Result ChunkedResultsSink::operator[](size_t position) const
+    {
+        Entry const & entry =
+            m_chunks[position >> c_log2ChunkSize][position & (c_chunkSize - 1)];
+        return { m_slices[entry.m_slice], entry.m_index };
+    }
+
+
+    ChunkedResultsSink::const_iterator ChunkedResultsSink::begin() const
+    {
+        return const_iterator(*this, 0);
+    }
+
+
+    ChunkedResultsSink::const_iterator ChunkedResultsSink::end() const
+    {
+        return const_iterator(*this, m_size);
+    }
+
+
+    size_t ChunkedResultsSink::size() const
+    {
+        return m_size;
+    }
+
+
+    size_t ChunkedResultsSink::GetBytesAllocated() const
+    {
+        return m_chunks.size() * c_chunkSize * sizeof(Entry) +
+               m_slices.capacity() * sizeof(Slice*);
+    }
+}
@@ -0,0 +1,503 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <new>                              // For placement new.
+#include <stdint.h>                         // uint64_t.
+#include <unordered_map>                    // std::unordered_map.
+
+#include "BitFunnel/Allocators/IAllocator.h"
+#include "CommonRowHoister.h"
+#include "CompileNode.h"
+#include "IPlanRows.h"
+#include "LoggerInterfaces/Logging.h"
+
+
+namespace BitFunnel
+{
+    static bool IsRowNode(CompileNode const & node)
+    {
+        return node.GetType() == CompileNode::opAndRowJz ||
+               node.GetType() == CompileNode::opLoadRowJz;
+    }
+
+
+    static AbstractRow const & GetRow(CompileNode const & node)
+    {
+        if (node.GetType() == CompileNode::opLoadRowJz)
+        {
+            return static_cast<CompileNode::LoadRowJz const &>(node).GetRow();
+        }
+        return static_cast<CompileNode::AndRowJz const &>(node).GetRow();
+    }
+
+
+    static CompileNode const & GetChild(CompileNode const & node)
+    {
+        if (node.GetType() == CompileNode::opLoadRowJz)
+        {
+            return static_cast<CompileNode::LoadRowJz const &>(node).GetChild();
+        }
+        return static_cast<CompileNode::AndRowJz const &>(node).GetChild();
+    }
+
+
+    // Appends the branches of the or-expression rooted at node to branches.
+    static void FlattenOr(CompileNode const & node,
+                          std::vector<CompileNode const *> & branches)
+    {
+        if (node.GetType() == CompileNode::opOr)
+        {
+            CompileNode::Or const & orNode =
+                static_cast<CompileNode::Or const &>(node);
+            FlattenOr(orNode.GetLeft(), branches);
+            FlattenOr(orNode.GetRight(), branches);
+        }
+        else
+        {
+            branches.push_back(&node);
+        }
+    }
+
+
+    static bool IsUnconditionalReport(CompileNode const & node)
+    {
+        return node.GetType() == CompileNode::opReport &&
+            static_cast<CompileNode::Report const &>(node).GetChild() == nullptr;
+    }
+
+
+    //*************************************************************************
+    //
+    // CommonRowHoister
+    //
+    //*************************************************************************
+    CommonRowHoister::CommonRowHoister(std::vector<unsigned> const & rowClasses,
+                                       IAllocator& allocator)
+      : m_rowClasses(rowClasses),
+        m_allocator(allocator)
+    {
+    }
+
+
+    CompileNode const & CommonRowHoister::Hoist(CompileNode const & node) const
+    {
+        switch (node.GetType())
+        {
+        case CompileNode::opAndRowJz:
+            {
+                CompileNode::AndRowJz const & andRow =
+                    static_cast<CompileNode::AndRowJz const &>(node);
+                CompileNode const & child = Hoist(andRow.GetChild());
+                if (&child == &andRow.GetChild())
+                {
+                    return node;
+                }
+                return *new (m_allocator.Allocate(sizeof(CompileNode::AndRowJz)))
+                            CompileNode::AndRowJz(andRow.GetRow(), child);
+            }
+        case CompileNode::opLoadRowJz:
+            {
+                CompileNode::LoadRowJz const & loadRow =
+                    static_cast<CompileNode::LoadRowJz const &>(node);
+                CompileNode const & child = Hoist(loadRow.GetChild());
+                if (&child == &loadRow.GetChild())
+                {
+                    return node;
+                }
+                return *new (m_allocator.Allocate(sizeof(CompileNode::LoadRowJz)))
+                            CompileNode::LoadRowJz(loadRow.GetRow(), child);
+            }
+        case CompileNode::opRankDown:
+            {
+                CompileNode::RankDown const & rankDown =
+                    static_cast<CompileNode::RankDown const &>(node);
+                CompileNode const & child = Hoist(rankDown.GetChild());
+                if (&child == &rankDown.GetChild())
+                {
+                    return node;
+                }
+                return *new (m_allocator.Allocate(sizeof(CompileNode::RankDown)))
+                            CompileNode::RankDown(rankDown.GetDelta(), child);
+            }
+        case CompileNode::opOr:
+            {
+                std::vector<CompileNode const *> branches;
+                FlattenOr(node, branches);
+                bool changed = false;
+                CompileNode const & factored = Factor(branches, changed);
+                return changed ? factored : node;
+            }
+        default:
+            // Report nodes and the RankZero trees below them have no
+            // branches that share rows.
+            return node;
+        }
+    }
+
+
+    CompileNode const &
+        CommonRowHoister::Factor(std::vector<CompileNode const *> const & branches,
+                                 bool & changed) const
+    {
+        LogAssertB(branches.size() > 0, "Factor() called with no branches.");
+
+        if (branches.size() == 1)
+        {
+            CompileNode const & branch = Hoist(*branches[0]);
+            if (&branch != branches[0])
+            {
+                changed = true;
+            }
+            return branch;
+        }
+
+        // Find the row that starts the and-expressions of the most branches.
+        // Rows are only hoisted out of branches that agree on whether their
+        // first row loads or ands the accumulator. Ties go to the row seen
+        // first, which keeps the density order chosen by RowDensityOrderer.
+        struct Candidate
+        {
+            AbstractRow const * m_row;
+            bool m_load;
+            size_t m_count;
+            size_t m_lastBranch;
+        };
+        std::vector<Candidate> candidates;
+
+        for (size_t i = 0; i < branches.size(); ++i)
+        {
+            bool load = branches[i]->GetType() == CompileNode::opLoadRowJz;
+            for (CompileNode const * n = branches[i]; IsRowNode(*n); n = &GetChild(*n))
+            {
+                AbstractRow const & row = GetRow(*n);
+                bool found = false;
+                for (auto & candidate : candidates)
+                {
+                    if (candidate.m_load == load && SameRow(*candidate.m_row, row))
+                    {
+                        if (candidate.m_lastBranch != i)
+                        {
+                            ++candidate.m_count;
+                            candidate.m_lastBranch = i;
+                        }
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found)
+                {
+                    candidates.push_back({ &row, load, 1, i });
+                }
+            }
+        }
+
+        Candidate const * best = nullptr;
+        for (auto const & candidate : candidates)
+        {
+            if (best == nullptr || candidate.m_count > best->m_count)
+            {
+                best = &candidate;
+            }
+        }
+
+        std::vector<CompileNode const *> rest;
+        CompileNode const * factored = nullptr;
+
+        if (best != nullptr && best->m_count > 1)
+        {
+            // ab + ac + d => a(b + c) + d.
+            std::vector<CompileNode const *> residuals;
+            CompileNode const * report = nullptr;
+            for (auto branch : branches)
+            {
+                bool load = branch->GetType() == CompileNode::opLoadRowJz;
+                if (load == best->m_load && ContainsRow(*branch, *best->m_row))
+                {
+                    FlattenOr(RemoveRow(*branch, *best->m_row), residuals);
+                }
+                else
+                {
+                    rest.push_back(branch);
+                }
+            }
+
+            // a + ab => a. Every other residual reports a subset of the
+            // accumulator at the same offset, so an unconditional report
+            // subsumes them.
+            for (auto residual : residuals)
+            {
+                if (IsUnconditionalReport(*residual))
+                {
+                    report = residual;
+                }
+            }
+
+            CompileNode const & child =
+                (report != nullptr) ? *report : Factor(residuals, changed);
+
+            if (best->m_load)
+            {
+                factored = new (m_allocator.Allocate(sizeof(CompileNode::LoadRowJz)))
+                               CompileNode::LoadRowJz(*best->m_row, child);
+            }
+            else
+            {
+                factored = new (m_allocator.Allocate(sizeof(CompileNode::AndRowJz)))
+                               CompileNode::AndRowJz(*best->m_row, child);
+            }
+        }
+        else
+        {
+            // No row is shared, but branches that rank down before loading
+            // their first row can share the RankDown loop. The loop with the
+            // smallest delta is split out of the others.
+            std::vector<CompileNode::RankDown const *> rankDowns;
+            Rank delta = 0;
+            for (auto branch : branches)
+            {
+                if (branch->GetType() == CompileNode::opRankDown)
+                {
+                    CompileNode::RankDown const & rankDown =
+                        static_cast<CompileNode::RankDown const &>(*branch);
+                    if (rankDowns.size() == 0 || rankDown.GetDelta() < delta)
+                    {
+                        delta = rankDown.GetDelta();
+                    }
+                    rankDowns.push_back(&rankDown);
+                }
+                else
+                {
+                    rest.push_back(branch);
+                }
+            }
+
+            if (rankDowns.size() < 2)
+            {
+                // Nothing to factor. Rebuild the or-expression from its
+                // branches, hoisting rows within each of them.
+                CompileNode const * tree = &Factor({ branches.back() }, changed);
+                for (size_t i = branches.size() - 1; i > 0; --i)
+                {
+                    tree = &CreateOr(Factor({ branches[i - 1] }, changed), *tree);
+                }
+                return *tree;
+            }
+
+            std::vector<CompileNode const *> children;
+            for (auto rankDown : rankDowns)
+            {
+                if (rankDown->GetDelta() == delta)
+                {
+                    FlattenOr(rankDown->GetChild(), children);
+                }
+                else
+                {
+                    children.push_back(
+                        new (m_allocator.Allocate(sizeof(CompileNode::RankDown)))
+                            CompileNode::RankDown(rankDown->GetDelta() - delta,
+                                                  rankDown->GetChild()));
+                }
+            }
+
+            factored = new (m_allocator.Allocate(sizeof(CompileNode::RankDown)))
+                           CompileNode::RankDown(delta, Factor(children, changed));
+        }
+
+        changed = true;
+
+        if (rest.size() == 0)
+        {
+            return *factored;
+        }
+        return CreateOr(*factored, Factor(rest, changed));
+    }
+
+
+    CompileNode const & CommonRowHoister::RemoveRow(CompileNode const & node,
+                                                    AbstractRow const & row) const
+    {
+        LogAssertB(IsRowNode(node), "Row not found in and-expression.");
+
+        AbstractRow const & current = GetRow(node);
+        if (SameRow(current, row))
+        {
+            // Only the first row of a chain can be a LoadRowJz, so the rest
+            // of the chain already ands into the accumulator.
+            return GetChild(node);
+        }
+
+        return *new (m_allocator.Allocate(sizeof(CompileNode::AndRowJz)))
+                    CompileNode::AndRowJz(current, RemoveRow(GetChild(node), row));
+    }
+
+
+    bool CommonRowHoister::SameRow(AbstractRow const & a,
+                                   AbstractRow const & b) const
+    {
+        return m_rowClasses[a.GetId()] == m_rowClasses[b.GetId()] &&
+               a.GetRank() == b.GetRank() &&
+               a.GetRankDelta() == b.GetRankDelta() &&
+               a.IsInverted() == b.IsInverted();
+    }
+
+
+    bool CommonRowHoister::ContainsRow(CompileNode const & node,
+                                       AbstractRow const & row) const
+    {
+        for (CompileNode const * n = &node; IsRowNode(*n); n = &GetChild(*n))
+        {
+            if (SameRow(GetRow(*n), row))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    CompileNode const & CommonRowHoister::CreateOr(CompileNode const & left,
+                                                   CompileNode const & right) const
+    {
+        return *new (m_allocator.Allocate(sizeof(CompileNode::Or)))
+                    CompileNode::Or(left, right);
+    }
+
+
+    size_t CommonRowHoister::CountRowReads(CompileNode const & node)
+    {
+        switch (node.GetType())
+        {
+        case CompileNode::opAndRowJz:
+        case CompileNode::opLoadRowJz:
+            return 1 + CountRowReads(GetChild(node));
+        case CompileNode::opRankDown:
+            {
+                CompileNode::RankDown const & rankDown =
+                    static_cast<CompileNode::RankDown const &>(node);
+                return (static_cast<size_t>(1) << rankDown.GetDelta()) *
+                       CountRowReads(rankDown.GetChild());
+            }
+        case CompileNode::opOr:
+        case CompileNode::opAndTree:
+        case CompileNode::opOrTree:
+            {
+                CompileNode::Binary const & binary =
+                    static_cast<CompileNode::Binary const &>(node);
+                return CountRowReads(binary.GetLeft()) +
+                       CountRowReads(binary.GetRight());
+            }
+        case CompileNode::opReport:
+            {
+                CompileNode const * child =
+                    static_cast<CompileNode::Report const &>(node).GetChild();
+                return (child == nullptr) ? 0 : CountRowReads(*child);
+            }
+        case CompileNode::opLoadRow:
+            return 1;
+        case CompileNode::opNot:
+            return CountRowReads(static_cast<CompileNode::Not const &>(node).GetChild());
+        default:
+            LogAbortB("Bad CompileNode type.");
+            return 0;
+        }
+    }
+
+
+    //*************************************************************************
+    //
+    // RowTupleHash and RowTupleEqual identify an abstract row id by its tuple
+    // of physical RowIds, one for each shard, so that an unordered_map keyed
+    // on ids groups the ids that refer to the same rows in every shard.
+    //
+    //*************************************************************************
+    class RowTupleHash
+    {
+    public:
+        RowTupleHash(IPlanRows const & planRows)
+          : m_planRows(planRows)
+        {
+        }
+
+        size_t operator()(unsigned id) const
+        {
+            uint64_t hash = 0;
+            for (ShardId shard = 0; shard < m_planRows.GetShardCount(); ++shard)
+            {
+                RowId const & row = m_planRows.PhysicalRow(shard, id);
+                const uint64_t value =
+                    (static_cast<uint64_t>(row.GetIndex()) << 8) |
+                    (static_cast<uint64_t>(row.GetRank()) << 1) |
+                    (row.IsAdhoc() ? 1u : 0u);
+                hash = hash * 0x9e3779b97f4a7c15ull + value;
+            }
+            return static_cast<size_t>(hash ^ (hash >> 32));
+        }
+
+    private:
+        IPlanRows const & m_planRows;
+    };
+
+
+    class RowTupleEqual
+    {
+    public:
+        RowTupleEqual(IPlanRows const & planRows)
+          : m_planRows(planRows)
+        {
+        }
+
+        bool operator()(unsigned a, unsigned b) const
+        {
+            for (ShardId shard = 0; shard < m_planRows.GetShardCount(); ++shard)
+            {
+                if (m_planRows.PhysicalRow(shard, a) !=
+                    m_planRows.PhysicalRow(shard, b))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        IPlanRows const & m_planRows;
+    };
+
+
+    std::vector<unsigned> CommonRowHoister::GetRowClasses(IPlanRows const & planRows)
+    {
+        // Maps each row tuple to the first id that refers to it. Rows are
+        // added in increasing order of id, so emplace() keeps the smallest.
+        std::unordered_map<unsigned, unsigned, RowTupleHash, RowTupleEqual>
+            firstIds(planRows.GetRowCount(),
+                     RowTupleHash(planRows),
+                     RowTupleEqual(planRows));
+
+        std::vector<unsigned> rowClasses;
+        rowClasses.reserve(planRows.GetRowCount());
+        for (unsigned id = 0; id < planRows.GetRowCount(); ++id)
+        {
+            rowClasses.push_back(firstIds.emplace(id, id).first->second);
+        }
+        return rowClasses;
+    }
+}
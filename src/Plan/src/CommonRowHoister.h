@@ -0,0 +1,109 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <stddef.h>                 // size_t return value.
+#include <vector>                   // std::vector parameter.
+
+#include "BitFunnel/NonCopyable.h"  // Inherits from NonCopyable.
+
+
+namespace BitFunnel
+{
+    class AbstractRow;
+    class CompileNode;
+    class IAllocator;
+    class IPlanRows;
+
+    //*************************************************************************
+    //
+    // CommonRowHoister removes redundant row loads from a CompileNode tree
+    // produced by the RankDownCompiler.
+    //
+    // MatchTreeRewriter multiplies out and-expressions over or-expressions,
+    // so the branches of an Or node often start by intersecting the same
+    // rows (e.g. the document active row) and the RankDownCompiler compiles
+    // each branch independently. CommonRowHoister factors these shared rows
+    // out of the branches, using the identity ab + ac = a(b + c), so that
+    // each is loaded once before the Or. The partial result is then reused
+    // by every branch through the Or node's Push/Pop. Branches that rank
+    // down at the same point are merged into a single RankDown loop, which
+    // exposes the rows they share at the lower rank.
+    //
+    // TermPlanConverter gives each occurrence of a term in a query its own
+    // abstract rows, so rows are compared by the physical rows they refer
+    // to rather than by abstract row id.
+    //
+    //*************************************************************************
+    class CommonRowHoister : NonCopyable
+    {
+    public:
+        // The rowClasses parameter maps each abstract row id to the id of
+        // an equivalent abstract row. Two rows are hoisted as one if their
+        // ids map to the same value. Nodes created by Hoist() are allocated
+        // from allocator.
+        CommonRowHoister(std::vector<unsigned> const & rowClasses,
+                         IAllocator& allocator);
+
+        // Returns a tree equivalent to root with rows shared by the branches
+        // of its Or nodes hoisted above the Or. Returns root itself if no
+        // row can be hoisted.
+        CompileNode const & Hoist(CompileNode const & root) const;
+
+        // Returns the number of quadwords loaded by root in one iteration at
+        // its initial rank, assuming that no branch exits early. This
+        // worst-case count is used to compare trees before and after
+        // hoisting.
+        static size_t CountRowReads(CompileNode const & root);
+
+        // Returns a mapping from each abstract row id in planRows to the
+        // smallest id that refers to the same physical row in every shard.
+        // A tree hoisted with this mapping is valid for all shards.
+        static std::vector<unsigned> GetRowClasses(IPlanRows const & planRows);
+
+    private:
+        // Returns a tree equivalent to the disjunction of branches. Sets
+        // changed to true if any rows were hoisted.
+        CompileNode const & Factor(std::vector<CompileNode const *> const & branches,
+                                   bool & changed) const;
+
+        // Returns the row chain at the root of node with the first
+        // occurrence of row removed. The returned chain starts with an
+        // AndRowJz, since its accumulator is the hoisted row.
+        CompileNode const & RemoveRow(CompileNode const & node,
+                                      AbstractRow const & row) const;
+
+        CompileNode const & CreateOr(CompileNode const & left,
+                                     CompileNode const & right) const;
+
+        // Returns true if rows a and b load the same quadwords.
+        bool SameRow(AbstractRow const & a, AbstractRow const & b) const;
+
+        // Returns true if row appears in the chain of row nodes at the root
+        // of node.
+        bool ContainsRow(CompileNode const & node, AbstractRow const & row) const;
+
+        std::vector<unsigned> const & m_rowClasses;
+        IAllocator& m_allocator;
+    };
+}
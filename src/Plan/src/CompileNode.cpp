@@ -129,6 +129,15 @@ namespace BitFunnel
     }
 
 
+    // Returns true if node is a Report with no child. A LoadRowJz or AndRowJz
+    // with such a child compiles to a single fused instruction.
+    static bool IsUnconditionalReport(CompileNode const & node)
+    {
+        return node.GetType() == CompileNode::opReport &&
+            static_cast<CompileNode::Report const &>(node).GetChild() == nullptr;
+    }
+
+
     //*************************************************************************
     //
     // CompileNode::Binary
@@ -226,11 +235,22 @@ namespace BitFunnel
 
     void CompileNode::AndRowJz::Compile(ICodeGenerator & code) const
     {
-        code.AndRow(m_row.GetId(), m_row.IsInverted(), m_row.GetRankDelta());
-        ICodeGenerator::Label label = code.AllocateLabel();
-        code.Jz(label);
-        m_child.Compile(code);
-        code.PlaceLabel(label);
+        if (IsUnconditionalReport(m_child))
+        {
+            code.AndRowReport(m_row.GetId(),
+                              m_row.IsInverted(),
+                              m_row.GetRankDelta());
+        }
+        else
+        {
+            ICodeGenerator::Label label = code.AllocateLabel();
+            code.AndRowJz(m_row.GetId(),
+                          m_row.IsInverted(),
+                          m_row.GetRankDelta(),
+                          label);
+            m_child.Compile(code);
+            code.PlaceLabel(label);
+        }
     }
 
 
@@ -298,11 +318,22 @@ namespace BitFunnel
 
     void CompileNode::LoadRowJz::Compile(ICodeGenerator & code) const
     {
-        code.LoadRow(m_row.GetId(), m_row.IsInverted(), m_row.GetRankDelta());
-        ICodeGenerator::Label label = code.AllocateLabel();
-        code.Jz(label);
-        m_child.Compile(code);
-        code.PlaceLabel(label);
+        if (IsUnconditionalReport(m_child))
+        {
+            code.LoadRowReport(m_row.GetId(),
+                               m_row.IsInverted(),
+                               m_row.GetRankDelta());
+        }
+        else
+        {
+            ICodeGenerator::Label label = code.AllocateLabel();
+            code.LoadRowJz(m_row.GetId(),
+                           m_row.IsInverted(),
+                           m_row.GetRankDelta(),
+                           label);
+            m_child.Compile(code);
+            code.PlaceLabel(label);
+        }
     }
 
 
@@ -402,25 +433,14 @@ namespace BitFunnel
 
     void CompileNode::RankDown::Compile(ICodeGenerator & code) const
     {
-        code.LeftShiftOffset(m_delta);
         ICodeGenerator::Label label0 = code.AllocateLabel();
-
-        unsigned iterations = (1 << m_delta) - 1;
-        for (unsigned i = 0; i < iterations; ++i)
-        {
-            code.Push();
-            code.Call(label0);
-            code.Pop();
-            code.IncrementOffset();
-        }
-        code.Call(label0);
         ICodeGenerator::Label label1 = code.AllocateLabel();
+        code.RankDownLoop(m_delta, label0);
         code.Jmp(label1);
         code.PlaceLabel(label0);
         m_child.Compile(code);
         code.Return();
         code.PlaceLabel(label1);
-        code.RightShiftOffset(m_delta);
     }
 
 
@@ -67,5 +67,69 @@ namespace BitFunnel
         virtual void Jnz(Label label) = 0;
         virtual void Jz(Label label) = 0;
         virtual void Return() = 0;
+
+        // Fused primitives. Each has the same effect as the sequence of
+        // primitives in its default implementation. Code generators that can
+        // perform the combination in a single step override these methods.
+
+        // AndRow() followed by Jz(label).
+        virtual void AndRowJz(size_t id,
+                              bool inverted,
+                              size_t rankDelta,
+                              Label label)
+        {
+            AndRow(id, inverted, rankDelta);
+            Jz(label);
+        }
+
+        // LoadRow() followed by Jz(label).
+        virtual void LoadRowJz(size_t id,
+                               bool inverted,
+                               size_t rankDelta,
+                               Label label)
+        {
+            LoadRow(id, inverted, rankDelta);
+            Jz(label);
+        }
+
+        // AndRow() followed by a Report() that is skipped when the
+        // accumulator is zero.
+        virtual void AndRowReport(size_t id, bool inverted, size_t rankDelta)
+        {
+            AndRow(id, inverted, rankDelta);
+            Label label = AllocateLabel();
+            Jz(label);
+            Report();
+            PlaceLabel(label);
+        }
+
+        // LoadRow() followed by a Report() that is skipped when the
+        // accumulator is zero.
+        virtual void LoadRowReport(size_t id, bool inverted, size_t rankDelta)
+        {
+            LoadRow(id, inverted, rankDelta);
+            Label label = AllocateLabel();
+            Jz(label);
+            Report();
+            PlaceLabel(label);
+        }
+
+        // Calls the subroutine at label once for each of the (1 << delta)
+        // offsets at the lower rank, restoring the accumulator before each
+        // call. The offset is unchanged on exit.
+        virtual void RankDownLoop(size_t delta, Label label)
+        {
+            LeftShiftOffset(delta);
+            size_t iterations = (1ull << delta) - 1;
+            for (size_t i = 0; i < iterations; ++i)
+            {
+                Push();
+                Call(label);
+                Pop();
+                IncrementOffset();
+            }
+            Call(label);
+            RightShiftOffset(delta);
+        }
     };
 }
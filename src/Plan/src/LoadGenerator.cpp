@@ -0,0 +1,283 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <algorithm>                        // std::max().
+#include <chrono>                           // std::chrono::steady_clock.
+#include <condition_variable>               // std::condition_variable.
+#include <iomanip>                          // std::setw().
+#include <iostream>                         // std::ostream.
+#include <mutex>                            // std::mutex.
+#include <thread>                           // std::this_thread::sleep_until().
+
+#include "BitFunnel/Plan/IQueryService.h"
+#include "BitFunnel/Plan/LoadGenerator.h"
+#include "LoggerInterfaces/Check.h"
+
+
+namespace BitFunnel
+{
+    typedef std::chrono::steady_clock Clock;
+
+    static double Seconds(Clock::duration duration)
+    {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+
+    //*************************************************************************
+    //
+    // LoadGenerator::Step
+    //
+    //*************************************************************************
+    LoadGenerator::Step::Step(double offeredRate, double duration)
+      : m_offeredRate(offeredRate),
+        m_duration(duration),
+        m_elapsedTime(0.0),
+        m_issued(0),
+        m_completed(0),
+        m_failed(0),
+        m_dropped(0),
+        m_maxLag(0.0)
+    {
+    }
+
+
+    double LoadGenerator::Step::GetAchievedRate() const
+    {
+        return (m_elapsedTime > 0) ? m_completed / m_elapsedTime : 0.0;
+    }
+
+
+    //*************************************************************************
+    //
+    // LoadGenerator
+    //
+    //*************************************************************************
+    const double LoadGenerator::c_drainTolerance = 0.1;
+    const double LoadGenerator::c_lagTolerance = 0.1;
+
+
+    LoadGenerator::LoadGenerator(IQueryService & service,
+                                 std::vector<std::string> const & queries,
+                                 Arrivals arrivals,
+                                 uint64_t seed)
+      : m_service(service),
+        m_queries(queries),
+        m_arrivals(arrivals),
+        m_random(seed),
+        m_nextQuery(0)
+    {
+        CHECK_GT(queries.size(), 0u)
+            << "LoadGenerator requires at least one query.";
+    }
+
+
+    LoadGenerator::Step LoadGenerator::Run(double rate, double duration)
+    {
+        CHECK_GT(rate, 0.0)
+            << "Query rate must be positive.";
+
+        Step step(rate, duration);
+
+        std::exponential_distribution<double> poisson(rate);
+
+        // Guards step and outstanding, which are updated by the callbacks
+        // on the service's worker threads.
+        std::mutex mutex;
+        std::condition_variable allDone;
+        size_t outstanding = 0;
+
+        // Fixed arrivals are computed from their index rather than summed,
+        // since a running sum of 1 / rate drifts and can issue an extra
+        // query, as at rate 10 for 1 second.
+        const Clock::time_point start = Clock::now();
+        double scheduled = 0.0;
+        for (size_t i = 1; scheduled < duration; ++i)
+        {
+            const Clock::time_point when =
+                start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(scheduled));
+
+            // If the generator has fallen behind, the query is issued
+            // immediately and the lag counts towards its latency.
+            std::this_thread::sleep_until(when);
+            const double lag = Seconds(Clock::now() - when);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++outstanding;
+                ++step.m_issued;
+                step.m_maxLag = (std::max)(step.m_maxLag, lag);
+            }
+
+            auto const & query = m_queries[m_nextQuery];
+            m_nextQuery = (m_nextQuery + 1) % m_queries.size();
+
+            const bool accepted = m_service.TrySubmit(
+                query,
+                [&, when](QueryResponse && response)
+                {
+                    const double latency = Seconds(Clock::now() - when);
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (response.m_instrumentation.GetSucceeded())
+                    {
+                        ++step.m_completed;
+                        step.m_latencies.Record(latency);
+                    }
+                    else
+                    {
+                        ++step.m_failed;
+                    }
+
+                    // Notify while holding the lock, since Run() may return
+                    // and destroy allDone as soon as it can reacquire it.
+                    if (--outstanding == 0)
+                    {
+                        allDone.notify_all();
+                    }
+                });
+
+            if (!accepted)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --outstanding;
+                ++step.m_dropped;
+            }
+
+            scheduled = (m_arrivals == Poisson) ?
+                scheduled + poisson(m_random) :
+                static_cast<double>(i) / rate;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        allDone.wait(lock, [&] { return outstanding == 0; });
+        step.m_elapsedTime = Seconds(Clock::now() - start);
+
+        return step;
+    }
+
+
+    std::vector<LoadGenerator::Step>
+        LoadGenerator::Ramp(double startRate,
+                            double growth,
+                            size_t maxSteps,
+                            double duration,
+                            double latencyLimit)
+    {
+        CHECK_GT(growth, 1.0)
+            << "Rate growth factor must be greater than 1.";
+
+        std::vector<Step> steps;
+        double rate = startRate;
+        for (size_t i = 0; i < maxSteps; ++i)
+        {
+            steps.push_back(Run(rate, duration));
+            if (IsSaturated(steps.back(), latencyLimit) ||
+                IsBehindSchedule(steps.back()))
+            {
+                break;
+            }
+            rate *= growth;
+        }
+
+        return steps;
+    }
+
+
+    bool LoadGenerator::IsSaturated(Step const & step, double latencyLimit)
+    {
+        return step.m_dropped > 0
+            || step.m_completed + step.m_failed < step.m_issued
+            || step.m_elapsedTime > step.m_duration * (1 + c_drainTolerance)
+            || (latencyLimit > 0 && step.m_latencies.GetPercentile(99) > latencyLimit);
+    }
+
+
+    bool LoadGenerator::IsBehindSchedule(Step const & step)
+    {
+        return step.m_maxLag > step.m_duration * c_lagTolerance;
+    }
+
+
+    void LoadGenerator::Print(std::ostream & out,
+                              std::vector<Step> const & steps,
+                              double latencyLimit)
+    {
+        out << std::setw(10) << "offered"
+            << std::setw(10) << "achieved"
+            << std::setw(9) << "issued"
+            << std::setw(9) << "dropped"
+            << std::setw(9) << "failed"
+            << std::setw(12) << "p50"
+            << std::setw(12) << "p90"
+            << std::setw(12) << "p99"
+            << std::setw(12) << "p99.9"
+            << std::setw(12) << "max"
+            << std::setw(12) << "max lag"
+            << std::endl;
+
+        double sustained = 0.0;
+        for (auto const & step : steps)
+        {
+            out << std::setw(10) << step.m_offeredRate
+                << std::setw(10) << step.GetAchievedRate()
+                << std::setw(9) << step.m_issued
+                << std::setw(9) << step.m_dropped
+                << std::setw(9) << step.m_failed
+                << std::setw(12) << step.m_latencies.GetPercentile(50)
+                << std::setw(12) << step.m_latencies.GetPercentile(90)
+                << std::setw(12) << step.m_latencies.GetPercentile(99)
+                << std::setw(12) << step.m_latencies.GetPercentile(99.9)
+                << std::setw(12) << step.m_latencies.GetMax()
+                << std::setw(12) << step.m_maxLag;
+
+            // A generator that falls behind its schedule waits for the
+            // service, so the step is no longer open-loop and its rate is
+            // not trusted.
+            const bool saturated = IsSaturated(step, latencyLimit);
+            const bool behind = IsBehindSchedule(step);
+            if (saturated)
+            {
+                out << "  saturated";
+            }
+            if (behind)
+            {
+                out << "  behind schedule";
+            }
+            if (!saturated && !behind)
+            {
+                sustained = (std::max)(sustained, step.m_offeredRate);
+            }
+            out << std::endl;
+        }
+
+        if (sustained > 0)
+        {
+            out << "Highest sustained rate: " << sustained << " QPS" << std::endl;
+        }
+        else
+        {
+            out << "No rate was sustained." << std::endl;
+        }
+    }
+}
@@ -40,14 +40,22 @@ namespace BitFunnel
     // rbx: accumulator
     // rcx: slice + iteration
     // rdx: slice
-    // rsi: pointer to array of row offsets
+    // rsi: row offset pointer
     // rdi: pointer to parameters data structure
     // r8-r15: row offset pointers
+    // [rbp + x]: offsets of rows that were not assigned registers
+    //
+    // Code specialized for a single shard encodes row offsets as
+    // displacements and does not use rsi, r8-r15, or the stack slots.
 
 
     MachineCodeGenerator::MachineCodeGenerator(RegisterAllocator const & registers,
+                                               int32_t const * spillSlots,
+                                               int32_t const * rowOffsets,
                                                FunctionBuffer & code)
       : m_registers(registers),
+        m_spillSlots(spillSlots),
+        m_rowOffsets(rowOffsets),
         m_code(code),
         m_pushCount(0)
     {
@@ -83,33 +91,43 @@ namespace BitFunnel
 
             if (!inverted)
             {
-                if (m_registers.IsRegister(id))
+                if (m_rowOffsets != nullptr)
+                {
+                    // Case 9: rankDelta > 0 && !inverted && specialized
+                    m_code.Emit<OpCode::And>(rbx, rax, rdx, SIB::Scale1, m_rowOffsets[id]);
+                }
+                else if (m_registers.IsRegister(id))
                 {
                     // Case 1: rankDelta > 0 && !inverted && IsRegister
                     m_code.Emit<OpCode::Add>(rax, rdx);
                     unsigned reg = m_registers.GetRegister(id);
-                    m_code.Emit<OpCode::And>(rbx, rax, Register<8u, false>(reg), SIB::Scale1, 0);
+                    m_code.Emit<OpCode::And>(rbx, rax, GetRowRegister(reg), SIB::Scale1, 0);
                 }
                 else
                 {
                     // Case 2: rankDelta > 0 && !inverted && !IsRegister
-                    m_code.Emit<OpCode::Add>(rax, rsi, id * 8);
+                    m_code.Emit<OpCode::Add>(rax, rbp, m_spillSlots[id]);
                     m_code.Emit<OpCode::And>(rbx, rax, rdx, SIB::Scale1, 0);
                 }
             }
             else
             {
-                if (m_registers.IsRegister(id))
+                if (m_rowOffsets != nullptr)
+                {
+                    // Case 10: rankDelta > 0 && inverted && specialized
+                    m_code.Emit<OpCode::Mov>(rax, rax, rdx, SIB::Scale1, m_rowOffsets[id]);
+                }
+                else if (m_registers.IsRegister(id))
                 {
                     // Case 3: rankDelta > 0 && inverted && IsRegister
                     m_code.Emit<OpCode::Add>(rax, rdx);
                     unsigned reg = m_registers.GetRegister(id);
-                    m_code.Emit<OpCode::Mov>(rax, rax, Register<8u, false>(reg), SIB::Scale1, 0);
+                    m_code.Emit<OpCode::Mov>(rax, rax, GetRowRegister(reg), SIB::Scale1, 0);
                 }
                 else
                 {
                     // Case 4: rankDelta > 0 && inverted && !IsRegister
-                    m_code.Emit<OpCode::Add>(rax, rsi, id * 8);
+                    m_code.Emit<OpCode::Add>(rax, rbp, m_spillSlots[id]);
                     m_code.Emit<OpCode::Mov>(rax, rax, rdx, SIB::Scale1, 0);
                 }
 
@@ -122,35 +140,43 @@ namespace BitFunnel
         {
             if (!inverted)
             {
-                if (m_registers.IsRegister(id))
+                if (m_rowOffsets != nullptr)
+                {
+                    // Case 11: rankDelta == 0 && !inverted && specialized
+                    m_code.Emit<OpCode::And>(rbx, rcx, m_rowOffsets[id]);
+                }
+                else if (m_registers.IsRegister(id))
                 {
                     // Case 5: rankDelta == 0 && !inverted && IsRegister
                     unsigned reg = m_registers.GetRegister(id);
-                    m_code.Emit<OpCode::And>(rbx, rcx, Register<8u, false>(reg), SIB::Scale1, 0);
+                    m_code.Emit<OpCode::And>(rbx, rcx, GetRowRegister(reg), SIB::Scale1, 0);
                 }
                 else
                 {
                     // Case 6: rankDelta == 0 && !inverted && !IsRegister
-                    m_code.Emit<OpCode::Mov>(rax, rcx);
-                    m_code.Emit<OpCode::Add>(rax, rsi, id * 8);
-                    m_code.Emit<OpCode::And>(rbx, rax, 0);
+                    LoadSpilledRowOffset(id);
+                    m_code.Emit<OpCode::And>(rbx, rcx, rax, SIB::Scale1, 0);
                 }
             }
             else
             {
                 // Row is inverted.
-                if (m_registers.IsRegister(id))
+                if (m_rowOffsets != nullptr)
+                {
+                    // Case 12: rankDelta == 0 && inverted && specialized
+                    m_code.Emit<OpCode::Mov>(rax, rcx, m_rowOffsets[id]);
+                }
+                else if (m_registers.IsRegister(id))
                 {
                     // Case 7: rankDelta == 0 && inverted && IsRegister
                     unsigned reg = m_registers.GetRegister(id);
-                    m_code.Emit<OpCode::Mov>(rax, rcx, Register<8u, false>(reg), SIB::Scale1, 0);
+                    m_code.Emit<OpCode::Mov>(rax, rcx, GetRowRegister(reg), SIB::Scale1, 0);
                 }
                 else
                 {
                     // Case 8: rankDelta == 0 && inverted && !IsRegister
-                    m_code.Emit<OpCode::Mov>(rax, rcx);
-                    m_code.Emit<OpCode::Add>(rax, rsi, id * 8);
-                    m_code.Emit<OpCode::Mov>(rax, rax, 0);
+                    LoadSpilledRowOffset(id);
+                    m_code.Emit<OpCode::Mov>(rax, rcx, rax, SIB::Scale1, 0);
                 }
 
                 // Combine inverted row with accumulator(RBX).
@@ -183,34 +209,43 @@ namespace BitFunnel
             m_code.EmitImmediate<OpCode::Shr>(rax, static_cast<uint8_t>(rankDelta + 3));
             m_code.EmitImmediate<OpCode::Shl>(rax, static_cast<uint8_t>(3));
 
-            if (m_registers.IsRegister(id))
+            if (m_rowOffsets != nullptr)
+            {
+                // Case 5: rankDelta > 0, specialized
+                m_code.Emit<OpCode::Mov>(rbx, rax, rdx, SIB::Scale1, m_rowOffsets[id]);
+            }
+            else if (m_registers.IsRegister(id))
             {
                 // Case 1: rankDelta > 0, IsRegister
                 m_code.Emit<OpCode::Add>(rax, rdx);
                 unsigned reg = m_registers.GetRegister(id);
-                m_code.Emit<OpCode::Mov>(rbx, rax, Register<8u, false>(reg), SIB::Scale1, 0);
+                m_code.Emit<OpCode::Mov>(rbx, rax, GetRowRegister(reg), SIB::Scale1, 0);
             }
             else
             {
                 // Case 2: rankDelta > 0, !IsRegister
-                m_code.Emit<OpCode::Add>(rax, rsi, id * 8);
+                m_code.Emit<OpCode::Add>(rax, rbp, m_spillSlots[id]);
                 m_code.Emit<OpCode::Mov>(rbx, rax, rdx, SIB::Scale1, 0);
             }
         }
         else
         {
-            if (m_registers.IsRegister(id))
+            if (m_rowOffsets != nullptr)
+            {
+                // Case 6: rankDelta == 0, specialized
+                m_code.Emit<OpCode::Mov>(rbx, rcx, m_rowOffsets[id]);
+            }
+            else if (m_registers.IsRegister(id))
             {
                 // Case 3: rankDelta == 0, IsRegister
                 unsigned reg = m_registers.GetRegister(id);
-                m_code.Emit<OpCode::Mov>(rbx, rcx, Register<8u, false>(reg), SIB::Scale1, 0);
+                m_code.Emit<OpCode::Mov>(rbx, rcx, GetRowRegister(reg), SIB::Scale1, 0);
             }
             else
             {
                 // Case 4: rankDelta == 0, !IsRegister
-                m_code.Emit<OpCode::Mov>(rax, rcx);
-                m_code.Emit<OpCode::Add>(rax, rsi, id * 8);
-                m_code.Emit<OpCode::Mov>(rbx, rax, 0);
+                LoadSpilledRowOffset(id);
+                m_code.Emit<OpCode::Mov>(rbx, rcx, rax, SIB::Scale1, 0);
             }
         }
 
@@ -386,8 +421,23 @@ namespace BitFunnel
     }
 
 
+    Register<8u, false> MachineCodeGenerator::GetRowRegister(unsigned reg)
+    {
+        CHECK_LT(reg, c_registerBase + c_registerCount)
+            << "Row register " << reg << " out of range.";
+
+        return (reg < 16) ? Register<8u, false>(reg) : rsi;
+    }
+
+
     unsigned MachineCodeGenerator::GetSlotCount()
     {
         return c_slotCount;
     }
+
+
+    void MachineCodeGenerator::LoadSpilledRowOffset(unsigned id)
+    {
+        m_code.Emit<OpCode::Mov>(rax, rbp, m_spillSlots[id]);
+    }
 }
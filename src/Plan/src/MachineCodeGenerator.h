@@ -22,8 +22,11 @@
 
 #pragma once
 
+#include <stdint.h>                     // int32_t parameter.
+
 #include "BitFunnel/NonCopyable.h"      // Base class.
 #include "ICodeGenerator.h"             // Base class.
+#include "NativeJIT/CodeGen/Register.h" // Register return value.
 
 
 namespace NativeJIT
@@ -54,7 +57,16 @@ namespace BitFunnel
         // Constructs a MachineCodeGenerator which generates X64 code using the
         // supplied X64FunctionGenerator. The registers parameter supplies a
         // RegisterAllocator that provides register assignments for some rows.
+        // The offsets of the remaining rows are held in stack slots. The
+        // spillSlots parameter, indexed by row id, gives the offset of each
+        // such slot relative to rbp.
+        //
+        // If rowOffsets is not null, the code is specialized for a single
+        // shard. Each row is addressed with rowOffsets[id] as a displacement,
+        // and registers and spillSlots are not used.
         MachineCodeGenerator(RegisterAllocator const & registers,
+                             int32_t const * spillSlots,
+                             int32_t const * rowOffsets,
                              FunctionBuffer & code);
 
         //
@@ -106,18 +118,30 @@ namespace BitFunnel
         // allocator.
         static unsigned GetRegisterCount();
 
+        // Returns the X64 register corresponding to a register number
+        // assigned by the register allocator. Numbers GetRegisterBase()
+        // through 15 map to R8..R15. The next number maps to RSI.
+        static Register<8u, false> GetRowRegister(unsigned reg);
+
         // Returns the number of stack slots reserved for local variables and
         // parameter homes for calls to the static AddResultsHelper() and
         // FinishIterationHelper() methods.
         static unsigned GetSlotCount();
 
     protected:
+        // Loads the offset of a row that was not assigned a register into rax.
+        void LoadSpilledRowOffset(unsigned id);
+
         //
         // Constructor parameters
         //
 
         RegisterAllocator const & m_registers;
 
+        int32_t const * m_spillSlots;
+
+        int32_t const * m_rowOffsets;
+
         FunctionBuffer & m_code;
 
 
@@ -131,8 +155,10 @@ namespace BitFunnel
         // First available row pointer register is R8.
         static const unsigned c_registerBase = 8;
 
-        // Row pointers stored in the eight registers R8..R15.
-        static const unsigned c_registerCount = 8;
+        // Row pointers stored in the eight registers R8..R15, and in RSI.
+        // RSI is available because rows without registers are read from
+        // stack slots rather than from the row offsets array.
+        static const unsigned c_registerCount = 9;
 
         // The number of stack slots reserved for local variables and
         // parameter homes for calls to the static AddResultsHelper() and
@@ -0,0 +1,240 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <algorithm>                        // std::min.
+
+#include "BitFunnel/Exceptions.h"
+#include "BitFunnel/Index/IIngestor.h"
+#include "BitFunnel/Index/IShard.h"
+#include "BitFunnel/Index/ISimpleIndex.h"
+#include "BitFunnel/Index/Token.h"
+#include "BitFunnel/Plan/QueryInstrumentation.h"
+#include "BitFunnel/Plan/TermMatchNode.h"
+#include "LoggerInterfaces/Logging.h"
+#include "MatchEstimator.h"
+#include "QueryPlanCache.h"
+#include "WideDisjunctionPlan.h"
+
+
+namespace BitFunnel
+{
+    MatchEstimator::MatchEstimator(std::vector<double> const & densities,
+                                   std::vector<std::pair<unsigned, unsigned>> const & termRows)
+      : m_densities(densities),
+        m_termRows(termRows),
+        m_nextTerm(0)
+    {
+    }
+
+
+    double MatchEstimator::EstimateMatchDensity(TermMatchNode const & tree)
+    {
+        m_nextTerm = 0;
+        const double density = EstimateNodeDensity(tree);
+        LogAssertB(m_nextTerm == m_termRows.size(),
+                   "MatchEstimator: term count does not match tree.");
+        return density;
+    }
+
+
+    QueryEstimate MatchEstimator::Estimate(CompiledQuery const & plan,
+                                           ISimpleIndex const & index,
+                                           QueryInstrumentation & instrumentation)
+    {
+        QueryEstimate estimate;
+
+        auto wide = dynamic_cast<WideDisjunctionPlan const *>(&plan);
+        if (wide != nullptr)
+        {
+            estimate = Estimate(*wide, index);
+        }
+        else
+        {
+            estimate.m_matchCount =
+                plan.GetMatchDensityEstimate() *
+                static_cast<double>(index.GetIngestor().GetDocumentCount());
+            estimate.m_quadwordCount = plan.GetQuadwordEstimate();
+            estimate.m_rowCount = plan.GetRowCount();
+        }
+
+        instrumentation.SetMatchEstimate(estimate.m_matchCount);
+
+        return estimate;
+    }
+
+
+    double MatchEstimator::EstimateTermDensity(std::vector<double> const & densities)
+    {
+        // Every document maps to a single bit in each row, at any rank, so
+        // a document passes a row of density d with probability d. Documents
+        // that contain the term pass every row, so no row is sparser than
+        // the term.
+        double frequency = 1.0;
+        for (auto density : densities)
+        {
+            frequency = (std::min)(frequency, density);
+        }
+
+        if (frequency >= 1.0)
+        {
+            return 1.0;
+        }
+
+        // A document without the term matches if it is a false positive in
+        // every row.
+        double falsePositive = 1.0;
+        for (auto density : densities)
+        {
+            falsePositive *= (density - frequency) / (1.0 - frequency);
+        }
+
+        return frequency + (1.0 - frequency) * falsePositive;
+    }
+
+
+    double MatchEstimator::EstimateNodeDensity(TermMatchNode const & node)
+    {
+        // Children are visited left to right, in the order that the
+        // TermMatchTreeConverter added their rows.
+        switch (node.GetType())
+        {
+        case TermMatchNode::AndMatch:
+            {
+                auto & andNode = static_cast<TermMatchNode::And const &>(node);
+                const double left = EstimateNodeDensity(andNode.GetLeft());
+                const double right = EstimateNodeDensity(andNode.GetRight());
+                return left * right;
+            }
+        case TermMatchNode::OrMatch:
+            {
+                auto & orNode = static_cast<TermMatchNode::Or const &>(node);
+                const double left = EstimateNodeDensity(orNode.GetLeft());
+                const double right = EstimateNodeDensity(orNode.GetRight());
+                return 1.0 - (1.0 - left) * (1.0 - right);
+            }
+        case TermMatchNode::NotMatch:
+            {
+                auto & notNode = static_cast<TermMatchNode::Not const &>(node);
+                return 1.0 - EstimateNodeDensity(notNode.GetChild());
+            }
+        case TermMatchNode::PhraseMatch:
+        case TermMatchNode::UnigramMatch:
+        case TermMatchNode::FactMatch:
+            {
+                LogAssertB(m_nextTerm < m_termRows.size(),
+                           "MatchEstimator: term count does not match tree.");
+                auto const & rows = m_termRows[m_nextTerm++];
+
+                // A term whose rows did not fit in the plan has no rows, and
+                // does not restrict the matches.
+                std::vector<double> densities(m_densities.begin() + rows.first,
+                                              m_densities.begin() + rows.second);
+                return EstimateTermDensity(densities);
+            }
+        default:
+            RecoverableError error("MatchEstimator::EstimateNodeDensity: unexpected node type.");
+            throw error;
+        }
+    }
+
+
+    QueryEstimate MatchEstimator::Estimate(WideDisjunctionPlan const & plan,
+                                           ISimpleIndex const & index)
+    {
+        auto const & documentActive = plan.GetDocumentActiveRow();
+        std::vector<Rank> ranks(plan.GetRowCount(), 0);
+        ranks[documentActive.m_id] = documentActive.m_rank;
+        for (auto const & clause : plan.GetClauses())
+        {
+            for (auto const & disjunct : clause.m_disjuncts)
+            {
+                for (auto const & row : disjunct)
+                {
+                    ranks[row.m_id] = row.m_rank;
+                }
+            }
+        }
+
+        std::vector<double> const & densities = plan.GetRowDensities();
+
+        // Clauses are independent, as are the terms of a disjunct.
+        double matchDensity = 1.0;
+        for (auto const & clause : plan.GetClauses())
+        {
+            double miss = 1.0;
+            for (size_t d = 0; d < clause.m_disjuncts.size(); ++d)
+            {
+                auto const & rows = clause.m_disjuncts[d];
+                double disjunctDensity = 1.0;
+                size_t first = 0;
+                for (auto count : clause.m_termRowCounts[d])
+                {
+                    std::vector<double> termDensities;
+                    for (size_t i = first; i < first + count; ++i)
+                    {
+                        termDensities.push_back(densities[rows[i].m_id]);
+                    }
+                    disjunctDensity *= EstimateTermDensity(termDensities);
+                    first += count;
+                }
+                miss *= 1.0 - disjunctDensity;
+            }
+            matchDensity *= clause.m_negated ? miss : 1.0 - miss;
+        }
+
+        // The matcher reads every row except the match-all rows that pad
+        // terms with fewer rows in some shards. This is an upper bound, since
+        // the remaining clauses of a slice are skipped once it has no
+        // matches.
+        IIngestor & ingestor = index.GetIngestor();
+        double quadwordCount = 0.0;
+        {
+            auto token = ingestor.GetTokenManager().RequestToken();
+            for (ShardId shard = 0; shard < ingestor.GetShardCount(); ++shard)
+            {
+                IShard & s = ingestor.GetShard(shard);
+                const size_t quadwords = s.GetSliceCapacity() >> 6;
+                ptrdiff_t const * offsets = plan.GetRowOffsets(shard);
+
+                size_t sliceQuadwordCount = 0;
+                for (unsigned id = 0; id < plan.GetRowCount(); ++id)
+                {
+                    if (id == documentActive.m_id ||
+                        offsets[id] != plan.GetMatchAllOffset(shard))
+                    {
+                        sliceQuadwordCount += quadwords >> ranks[id];
+                    }
+                }
+                quadwordCount += static_cast<double>(s.GetSliceBuffers().size() *
+                                                     sliceQuadwordCount);
+            }
+        }
+
+        QueryEstimate estimate = {
+            matchDensity * static_cast<double>(ingestor.GetDocumentCount()),
+            quadwordCount,
+            plan.GetRowCount()
+        };
+
+        return estimate;
+    }
+}
@@ -0,0 +1,97 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <stddef.h>                         // size_t embedded.
+#include <utility>                          // std::pair parameter.
+#include <vector>                           // std::vector parameter.
+
+#include "BitFunnel/NonCopyable.h"          // Base class.
+#include "BitFunnel/Plan/IQueryEngine.h"    // QueryEstimate return value.
+
+
+namespace BitFunnel
+{
+    class CompiledQuery;
+    class ISimpleIndex;
+    class QueryInstrumentation;
+    class TermMatchNode;
+    class WideDisjunctionPlan;
+
+    //*************************************************************************
+    //
+    // MatchEstimator
+    //
+    // Predicts the number of documents that match a TermMatchNode tree from
+    // the sampled densities of the rows of each of its terms, without
+    // running the query.
+    //
+    // The rows of a single term are strongly correlated, so the estimator
+    // does not treat them as independent. Instead the density of the
+    // sparsest row is taken as the frequency of the term, and the excess
+    // density of each row as noise that produces false positives. Distinct
+    // terms are assumed to be independent.
+    //
+    //*************************************************************************
+    class MatchEstimator : NonCopyable
+    {
+    public:
+        // The densities parameter holds the density of each abstract row of
+        // a plan, and termRows the range of abstract row ids [first, second)
+        // of each Unigram, Phrase, and Fact node of the tree, in the order of
+        // a depth first, left to right traversal. These are the rows and
+        // densities already computed by the QueryPlanner, so no rows are
+        // looked up or sampled.
+        MatchEstimator(std::vector<double> const & densities,
+                       std::vector<std::pair<unsigned, unsigned>> const & termRows);
+
+        // Returns the expected fraction of documents that match tree,
+        // including false positives.
+        double EstimateMatchDensity(TermMatchNode const & tree);
+
+        // Returns the estimate for a plan returned by a query engine for the
+        // query, and records the expected match count in instrumentation.
+        // Plans made by the QueryPlanner carry its estimates. Estimates for
+        // a WideDisjunctionPlan use the row densities from its
+        // GetRowDensities(), which are sampled once when the plan is created.
+        static QueryEstimate Estimate(CompiledQuery const & plan,
+                                      ISimpleIndex const & index,
+                                      QueryInstrumentation & instrumentation);
+
+        // Returns the probability that a document matches a term whose rows
+        // have the specified densities.
+        static double EstimateTermDensity(std::vector<double> const & densities);
+
+    private:
+        double EstimateNodeDensity(TermMatchNode const & node);
+
+        static QueryEstimate Estimate(WideDisjunctionPlan const & plan,
+                                      ISimpleIndex const & index);
+
+        std::vector<double> const & m_densities;
+        std::vector<std::pair<unsigned, unsigned>> const & m_termRows;
+
+        // Index in m_termRows of the next term visited.
+        size_t m_nextTerm;
+    };
+}
@@ -21,6 +21,9 @@
 // THE SOFTWARE.
 
 
+#include <limits>                               // std::numeric_limits.
+
+#include "BitFunnel/Plan/QueryCancellation.h"
 #include "BitFunnel/Utilities/Allocator.h"
 #include "MatchTreeCompiler.h"
 
@@ -29,6 +32,18 @@ using namespace NativeJIT;
 
 namespace BitFunnel
 {
+    // Cancellation flag for code that runs without a QueryCancellation.
+    static const uint64_t c_notCancelled = 0;
+
+
+    // Called by the generated code at its cancellation checks when the
+    // QueryCancellation has a deadline.
+    static uint64_t CheckDeadline(QueryCancellation const * cancellation)
+    {
+        return cancellation->IsCancelled() ? 1 : 0;
+    }
+
+
     //*************************************************************************
     //
     // MatchTreeCompiler
@@ -38,7 +53,10 @@ namespace BitFunnel
                                          NativeJIT::FunctionBuffer & code,
                                          CompileNode const & tree,
                                          RegisterAllocator const & registers,
-                                         Rank initialRank)
+                                         Rank initialRank,
+                                         bool countOnly,
+                                         NativeCodeGenerator::PrefetchOptions const & prefetch,
+                                         int32_t const * rowOffsets)
     {
         NativeCodeGenerator::Prototype expression(expressionTreeAllocator,
                                                   code);
@@ -49,7 +67,10 @@ namespace BitFunnel
             expression.PlacementConstruct<NativeCodeGenerator>(expression,
                                                                tree,
                                                                registers,
-                                                               initialRank);
+                                                               initialRank,
+                                                               countOnly,
+                                                               prefetch,
+                                                               rowOffsets);
         m_function = expression.Compile(node);
     }
 
@@ -58,8 +79,21 @@ namespace BitFunnel
                                   void * const * sliceBuffers,
                                   size_t iterationsPerSlice,
                                   ptrdiff_t const * rowOffsets,
-                                  ResultsBuffer & results)
+                                  ResultsBuffer & results,
+                                  size_t maxMatches,
+                                  QueryCancellation const * cancellation,
+                                  bool * wasCancelled) const
     {
+        if (wasCancelled != nullptr)
+        {
+            *wasCancelled = false;
+        }
+
+        if (maxMatches == 0 || results.m_size == results.m_capacity)
+        {
+            return 0;
+        }
+
         NativeCodeGenerator::Parameters parameters = {
             sliceCount,
             sliceBuffers,
@@ -67,10 +101,23 @@ namespace BitFunnel
             rowOffsets,
             0,
             { 0 },
-            results.m_capacity,
+            (maxMatches < results.m_capacity - results.m_size) ?
+                results.m_size + maxMatches :
+                results.m_capacity,
             results.m_size,
             results.m_buffer,
-            0
+            0,
+            (cancellation != nullptr) ?
+                reinterpret_cast<uint64_t const *>(&cancellation->GetFlag()) :
+                &c_notCancelled,
+            // The mask applies to byte offsets into the slice.
+            (cancellation != nullptr) ?
+                (cancellation->GetStride() << 3) - 1 :
+                (std::numeric_limits<size_t>::max)(),
+            cancellation,
+            (cancellation != nullptr && cancellation->HasDeadline()) ?
+                &CheckDeadline :
+                nullptr
         };
 
         // For now ignore return value.
@@ -96,6 +143,42 @@ namespace BitFunnel
 
         results.m_size = parameters.m_matchCount;
 
+        // The generated code counts m_sliceCount down to zero as it finishes
+        // each slice. It only leaves slices unscanned when it is cancelled or
+        // when it fills results up to m_capacity.
+        if (wasCancelled != nullptr)
+        {
+            *wasCancelled = parameters.m_sliceCount != 0
+                && parameters.m_matchCount < parameters.m_capacity;
+        }
+
         return parameters.m_quadwordCount;
     }
+
+
+    size_t MatchTreeCompiler::Count(size_t sliceCount,
+                                    void * const * sliceBuffers,
+                                    size_t iterationsPerSlice,
+                                    ptrdiff_t const * rowOffsets,
+                                    size_t & quadwordCount) const
+    {
+        NativeCodeGenerator::Parameters parameters = {
+            sliceCount,
+            sliceBuffers,
+            iterationsPerSlice,
+            rowOffsets,
+            0,
+            { 0 },
+            (std::numeric_limits<size_t>::max)(),
+            0,
+            nullptr,
+            0,
+            &c_notCancelled,
+            (std::numeric_limits<size_t>::max)()
+        };
+
+        quadwordCount += m_function(&parameters);
+
+        return parameters.m_matchCount;
+    }
 }
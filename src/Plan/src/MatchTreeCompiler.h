@@ -23,6 +23,7 @@
 #pragma once
 
 #include <stddef.h>                             // size_t, ptrdiff_t parameters.
+#include <stdint.h>                             // int32_t parameter.
 
 #include "BitFunnel/BitFunnelTypes.h"           // Rank parameter.
 #include "NativeCodeGenerator.h"                // MatcherNode::Prototype::FunctionType type.
@@ -39,6 +40,7 @@ namespace NativeJIT
 namespace BitFunnel
 {
     class CompileNode;
+    class QueryCancellation;
     class RegisterAllocator;
     class ResultsBuffer;
 
@@ -50,17 +52,44 @@ namespace BitFunnel
     class MatchTreeCompiler
     {
     public:
+        // If rowOffsets is not null, the function is specialized for the
+        // shard whose row offsets, indexed by row id, are rowOffsets. Such a
+        // function must only be run on slices from that shard, and ignores
+        // the row offsets passed to Run() and Count().
         MatchTreeCompiler(Allocators::IAllocator & resources,
                           NativeJIT::FunctionBuffer & code,
                           CompileNode const & tree,
                           RegisterAllocator const & registers,
-                          Rank initialRank);
+                          Rank initialRank,
+                          bool countOnly,
+                          NativeCodeGenerator::PrefetchOptions const & prefetch,
+                          int32_t const * rowOffsets = nullptr);
 
+        // Runs the compiled code, appending at most maxMatches matches to
+        // results. Scanning stops at the end of the iteration in which this
+        // limit or the capacity of results is reached. If cancellation is
+        // not null, scanning also stops once it is cancelled or its deadline
+        // passes, which is checked at the start of each slice and every
+        // stride iterations. If wasCancelled is not null, it is set to
+        // whether scanning stopped because of the cancellation. Returns the
+        // number of quadwords processed when compiled with QUADWORDCOUNT.
         size_t Run(size_t slicecount,
                    void * const * slicebuffers,
                    size_t iterationsperslice,
                    ptrdiff_t const * rowoffsets,
-                   ResultsBuffer & results);
+                   ResultsBuffer & results,
+                   size_t maxMatches,
+                   QueryCancellation const * cancellation = nullptr,
+                   bool * wasCancelled = nullptr) const;
+
+        // Runs code compiled with countOnly set and returns the number of
+        // matches. The number of quadwords processed is added to
+        // quadwordCount when compiled with QUADWORDCOUNT.
+        size_t Count(size_t sliceCount,
+                     void * const * sliceBuffers,
+                     size_t iterationsPerSlice,
+                     ptrdiff_t const * rowOffsets,
+                     size_t & quadwordCount) const;
 
     private:
         NativeCodeGenerator::Prototype::FunctionType m_function;
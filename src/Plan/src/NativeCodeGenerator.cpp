@@ -23,6 +23,7 @@
 #include <iostream>
 
 #include "BitFunnel/Index/DocumentHandle.h"
+#include "AbstractRow.h"
 #include "CompileNode.h"
 #include "MachineCodeGenerator.h"
 #include "NativeJIT/CodeGen/ExecutionBuffer.h"
@@ -35,6 +36,16 @@
 
 namespace BitFunnel
 {
+    // Ids of the registers other than rax that the System V ABI allows a
+    // callee to overwrite: rcx, rdx, rsi, rdi and r8 through r11.
+    static const unsigned c_savedRegisters[] =
+    {
+        1, 2, 6, 7, 8, 9, 10, 11
+    };
+    static const unsigned c_savedRegisterCount =
+        sizeof(c_savedRegisters) / sizeof(c_savedRegisters[0]);
+
+
     //*************************************************************************
     //
     // NativeCodeGenerator
@@ -44,11 +55,17 @@ namespace BitFunnel
         Prototype& expression,
         CompileNode const & compileNodeTree,
         RegisterAllocator const & registers,
-        Rank initialRank)
+        Rank initialRank,
+        bool countOnly,
+        PrefetchOptions const & prefetch,
+        int32_t const * rowOffsets)
       : Node(expression),
         m_compileNodeTree(compileNodeTree),
         m_registers(registers),
-        m_initialRank(initialRank)
+        m_initialRank(initialRank),
+        m_countOnly(countOnly),
+        m_prefetch(prefetch),
+        m_rowOffsetImmediates(rowOffsets)
     {
     }
 
@@ -75,6 +92,10 @@ namespace BitFunnel
             }
         }
 
+        // The deadline check calls out of the generated code. Reporting the
+        // call makes NativeJIT reserve home space and align the stack.
+        tree.ReportFunctionCallNode(1);
+
         EmitRegisterInitialization(tree);
         EmitOuterLoop(tree);
 
@@ -110,25 +131,48 @@ namespace BitFunnel
 
         // Allocate temporary variables.
         m_innerLoopLimit = tree.Temporary<size_t>();
+        for (unsigned i = 0; i < c_savedRegisterCount; ++i)
+        {
+            m_savedRegisters.push_back(tree.Temporary<size_t>());
+        }
+
+        // Specialized code addresses rows with displacements, so there are
+        // no row registers to load.
+        if (m_rowOffsetImmediates != nullptr)
+        {
+            return;
+        }
 
         // Initialize row pointers.
         // RSI has pointer to row offsets.
         code.Emit<OpCode::Mov>(rsi, rdi, m_rowOffsets);
 
-        // Load row offsets into R8..R8 + m_registers.GetRegistersAllocated()
-        // TODO: Should we use GetRegister() or explicitly use r+8?
-        // The former offers an opportunity to misconfigure the register allocator
-        // to use registers that conflict with other matcher registers.
+        // Copy the offsets of rows that did not get registers into stack
+        // slots. The matching code reads them with rbp-relative addressing,
+        // which leaves RSI free to hold a row offset of its own.
+        m_spillSlots.assign(m_registers.GetRowCount(), 0);
+        for (unsigned id = 0; id < m_registers.GetRowCount(); ++id)
+        {
+            if (m_registers.IsUsed(id) && !m_registers.IsRegister(id))
+            {
+                m_spills.push_back(tree.Temporary<size_t>());
+                auto const & slot = m_spills.back();
+                m_spillSlots[id] = slot.GetOffset();
+
+                code.Emit<OpCode::Mov>(rax, rsi, id * 8);
+                code.Emit<OpCode::Mov>(rbp, slot.GetOffset(), rax);
+            }
+        }
+
+        // Load row offsets into the row registers, in register number order.
+        // RSI has the highest register number, so it is overwritten last.
         for (unsigned r = 0; r < m_registers.GetRegistersAllocated(); ++r)
         {
-            code.Emit<OpCode::Mov>(Register<8u, false>(r + 8),
-                                   rsi,
-                                   m_registers.GetRowIdFromRegister(r) * 8);
-            // TODO: Would the following alternative be better?
-            // This code may not work with the existing CompileNode compiler.
-            //code.Emit<OpCode::Mov>(Register<8u, false>(m_registers.GetRegister(r)),
-            //                       rsi,
-            //                       m_registers.GetRowIdFromRegister(r) * 8);
+            code.Emit<OpCode::Mov>(
+                MachineCodeGenerator::GetRowRegister(
+                    r + MachineCodeGenerator::GetRegisterBase()),
+                rsi,
+                m_registers.GetRowIdFromRegister(r) * 8);
         }
     }
 
@@ -139,6 +183,7 @@ namespace BitFunnel
 
         auto topOfLoop = code.AllocateLabel();
         auto bottomOfLoop = code.AllocateLabel();
+        m_terminate = code.AllocateLabel();
 
 
         //
@@ -166,6 +211,7 @@ namespace BitFunnel
         // Bottom of loop
         //
         code.PlaceLabel(bottomOfLoop);
+        code.PlaceLabel(m_terminate);
     }
 
 
@@ -198,12 +244,36 @@ namespace BitFunnel
         CodeGenHelpers::Emit<OpCode::Cmp>(code, rcx, m_innerLoopLimit);
         code.EmitConditionalJump<JccType::JE>(exitLoop);    // TODO: Original code passed X64::Long.
 
+        // Check for cancellation at the start of the slice and every
+        // m_cancellationMask + 1 bytes thereafter.
+        {
+            auto notCancelled = code.AllocateLabel();
+            code.Emit<OpCode::Mov>(rax, rcx);
+            code.Emit<OpCode::Sub>(rax, rdx);
+            code.Emit<OpCode::And>(rax, rdi, m_cancellationMask);
+            code.EmitConditionalJump<JccType::JNZ>(notCancelled);
+            code.Emit<OpCode::Mov>(rax, rdi, m_cancelled);
+            code.Emit<OpCode::Mov>(rax, rax, 0);
+            code.Emit<OpCode::Or>(rax, rax);
+            code.EmitConditionalJump<JccType::JNZ>(m_terminate);
+
+            // Only tokens with a deadline have a deadline check.
+            code.Emit<OpCode::Mov>(rax, rdi, m_checkDeadline);
+            code.Emit<OpCode::Or>(rax, rax);
+            code.EmitConditionalJump<JccType::JZ>(notCancelled);
+            EmitDeadlineCheck(tree);
+
+            code.PlaceLabel(notCancelled);
+        }
+
         //
         // Body of loop
         //
 
         // TODO: Handle case where there are no rows.
 
+        EmitPrefetch(tree);
+
         // Store this iteration's base offset in m_base.
         code.Emit<OpCode::Push>(rcx);
         code.Emit<OpCode::Mov>(rax, rcx);
@@ -215,11 +285,21 @@ namespace BitFunnel
         code.Emit<OpCode::Pop>(rcx);
 
         {
-            MachineCodeGenerator generator(m_registers, tree.GetCodeGenerator());
+            MachineCodeGenerator generator(m_registers,
+                                           m_spillSlots.data(),
+                                           m_rowOffsetImmediates,
+                                           tree.GetCodeGenerator());
             m_compileNodeTree.Compile(generator);
         }
 
-        EmitFinishIteration(tree);
+        if (m_countOnly)
+        {
+            EmitCountIteration(tree);
+        }
+        else
+        {
+            EmitFinishIteration(tree);
+        }
 
         //
         // Bottom of loop
@@ -233,6 +313,137 @@ namespace BitFunnel
     }
 
 
+    // Emits PREFETCHT0 [rax] or PREFETCHNTA [rax]. NativeJIT has no opcode
+    // for prefetch instructions.
+    static void EmitPrefetchRax(X64CodeGenerator & code, bool nonTemporal)
+    {
+        code.Emit8(0x0f);
+        code.Emit8(0x18);
+        code.Emit8(nonTemporal ? 0x00 : 0x08);
+    }
+
+
+    // Prefetches the registered rows m_prefetch.m_distance cache lines
+    // ahead of the current iteration. Registered rows are the ones closest
+    // to the root of the plan, so they are loaded on every iteration. The
+    // prefetches are issued once per cache line at the initial rank; rows
+    // at lower ranks advance faster and rely on the hardware prefetcher to
+    // follow the stream once it has started.
+    void NativeCodeGenerator::EmitDeadlineCheck(ExpressionTree& tree)
+    {
+        auto & code = tree.GetCodeGenerator();
+
+        // Calls the function whose address is in rax and terminates if it
+        // returns nonzero. The loop state and the row registers are in
+        // volatile registers, so they are saved to the stack around the
+        // call. The Windows ABI would preserve rsi and rdi.
+        for (unsigned i = 0; i < c_savedRegisterCount; ++i)
+        {
+            CodeGenHelpers::Emit<OpCode::Mov>(code,
+                                              m_savedRegisters[i],
+                                              Register<8u, false>(c_savedRegisters[i]));
+        }
+
+        code.Emit<OpCode::Mov>(m_param1, rdi, m_cancellation);
+        code.Emit<OpCode::Call>(rax);
+
+        for (unsigned i = 0; i < c_savedRegisterCount; ++i)
+        {
+            CodeGenHelpers::Emit<OpCode::Mov>(code,
+                                              Register<8u, false>(c_savedRegisters[i]),
+                                              m_savedRegisters[i]);
+        }
+
+        code.Emit<OpCode::Or>(rax, rax);
+        code.EmitConditionalJump<JccType::JNZ>(m_terminate);
+    }
+
+
+    void NativeCodeGenerator::EmitPrefetch(ExpressionTree& tree)
+    {
+        if (m_prefetch.m_distance == 0 || m_registers.GetRegistersAllocated() == 0)
+        {
+            return;
+        }
+
+        auto & code = tree.GetCodeGenerator();
+
+        auto skipPrefetch = code.AllocateLabel();
+        auto issuePrefetch = code.AllocateLabel();
+        auto restoreRcx = code.AllocateLabel();
+
+        // Only prefetch on the first iteration in each cache line.
+        code.Emit<OpCode::Mov>(rax, rcx);
+        code.Emit<OpCode::Sub>(rax, rdx);
+        code.EmitImmediate<OpCode::And>(rax, static_cast<int32_t>(0x38));
+        code.EmitConditionalJump<JccType::JNZ>(skipPrefetch);
+
+        // rcx: offset of the prefetch target in a row at the initial rank.
+        // rbx: slice buffer holding the prefetch target.
+        code.Emit<OpCode::Push>(rcx);
+        code.Emit<OpCode::Sub>(rcx, rdx);
+        code.EmitImmediate<OpCode::Add>(rcx,
+                                        static_cast<int32_t>(m_prefetch.m_distance * 64));
+        code.Emit<OpCode::Mov>(rbx, rdx);
+
+        // If the target is past the end of the row, move it to the next
+        // slice, if there is one.
+        code.Emit<OpCode::Mov>(rax, rdi, m_iterationsPerSlice);
+        code.EmitImmediate<OpCode::Shl>(rax, static_cast<uint8_t>(3));
+        code.Emit<OpCode::Cmp>(rcx, rax);
+        code.EmitConditionalJump<JccType::JB>(issuePrefetch);
+
+        code.Emit<OpCode::Sub>(rcx, rax);
+        code.Emit<OpCode::Mov>(rax, rdi, m_sliceCount);
+        code.EmitImmediate<OpCode::Cmp>(rax, static_cast<int32_t>(1));
+        code.EmitConditionalJump<JccType::JBE>(restoreRcx);
+        code.Emit<OpCode::Mov>(rbx, rdi, m_sliceBuffers);
+        code.Emit<OpCode::Mov>(rbx, rbx, 8);
+
+        code.PlaceLabel(issuePrefetch);
+        for (unsigned r = 0; r < m_registers.GetRegistersAllocated(); ++r)
+        {
+            const unsigned id = m_registers.GetRowIdFromRegister(r);
+            AbstractRow const & row = m_registers.GetRow(id);
+
+            // Offsets at the initial rank are shifted left by the number of
+            // rank down steps needed to reach the row's rank, and shifted
+            // right by the row's rank delta.
+            const int shift =
+                static_cast<int>(m_initialRank) -
+                static_cast<int>(row.GetRank()) -
+                static_cast<int>(row.GetRankDelta());
+
+            code.Emit<OpCode::Mov>(rax, rcx);
+            if (shift > 0)
+            {
+                code.EmitImmediate<OpCode::Shl>(rax, static_cast<uint8_t>(shift));
+            }
+            else if (shift < 0)
+            {
+                code.EmitImmediate<OpCode::Shr>(rax, static_cast<uint8_t>(-shift));
+            }
+            code.Emit<OpCode::Add>(rax, rbx);
+            if (m_rowOffsetImmediates != nullptr)
+            {
+                code.EmitImmediate<OpCode::Add>(rax, m_rowOffsetImmediates[id]);
+            }
+            else
+            {
+                code.Emit<OpCode::Add>(
+                    rax,
+                    MachineCodeGenerator::GetRowRegister(m_registers.GetRegister(id)));
+            }
+            EmitPrefetchRax(code, m_prefetch.m_nonTemporal);
+        }
+
+        code.PlaceLabel(restoreRcx);
+        code.Emit<OpCode::Pop>(rcx);
+
+        code.PlaceLabel(skipPrefetch);
+    }
+
+
     // WARNING: The design of the dedupe buffer in EmitFinishIteration()
     // only supports ranks up to 6. The reason is that a single quadword
     // is used as a bitmap to 64 quadwords. In the worst case, with a
@@ -343,6 +554,87 @@ namespace BitFunnel
         code.Emit<OpCode::Pop>(r10);
         code.Emit<OpCode::Pop>(r9);
 
+        // Stop scanning once the match limit has been reached.
+        code.Emit<OpCode::Mov>(rax, rdi, m_matchCount);
+        code.Emit<OpCode::Cmp>(rax, rdi, m_capacity);
+        code.EmitConditionalJump<JccType::JZ>(m_terminate);
+
+        code.PlaceLabel(noMatches);
+    }
+
+
+    // NativeJIT does not implement popcnt. Emits the register to register
+    // form, popcnt dest, src, directly.
+    static void EmitPopcnt(X64CodeGenerator & code,
+                           Register<8u, false> dest,
+                           Register<8u, false> src)
+    {
+        code.Emit8(0xf3);
+        code.Emit8(static_cast<uint8_t>(0x48 |
+                                        (dest.IsExtended() ? 4 : 0) |
+                                        (src.IsExtended() ? 1 : 0)));
+        code.Emit8(0x0f);
+        code.Emit8(0xb8);
+        code.Emit8(static_cast<uint8_t>(0xc0 | (dest.GetId8() << 3) | src.GetId8()));
+    }
+
+
+    // Count-only counterpart of EmitFinishIteration(). Adds the population
+    // count of each quadword in the dedupe buffer to m_matchCount instead of
+    // extracting the positions of the matches.
+    void NativeCodeGenerator::EmitCountIteration(ExpressionTree& tree)
+    {
+        auto & code = tree.GetCodeGenerator();
+
+        // Check whether there are any matches.
+        auto noMatches = code.AllocateLabel();
+        code.Emit<OpCode::Mov>(rax, rdi, m_dedupe);
+        code.Emit<OpCode::Or>(rax, rax);
+        code.EmitConditionalJump<JccType::JZ>(noMatches);
+
+        // Save registers.
+        code.Emit<OpCode::Push>(r13);
+        code.Emit<OpCode::Push>(r14);
+        code.Emit<OpCode::Push>(r15);
+
+        // r13 is zero, for clearing dedupe entries.
+        code.Emit<OpCode::Xor>(r13, r13);
+
+        auto quadwordLoopTop = code.AllocateLabel();
+        auto quadwordLoopExit = code.AllocateLabel();
+
+        //
+        // Top of quadword loop.
+        //
+
+        // Each bit in rax corresponds to a quadword with a match.
+        code.PlaceLabel(quadwordLoopTop);
+        code.Emit<OpCode::Bsf>(r15, rax);
+        code.EmitConditionalJump<JccType::JZ>(quadwordLoopExit);
+
+        code.Emit<OpCode::Mov>(r14, rdi, r15, SIB::Scale8, 8 + m_dedupe);
+        EmitPopcnt(code, r14, r14);
+        code.Emit<OpCode::Add>(rdi, m_matchCount, r14);
+        code.Emit<OpCode::Mov>(rdi, r15, SIB::Scale8, 8 + m_dedupe, r13);
+
+        code.Emit<OpCode::Btr>(rax, r15);
+        code.Jmp(quadwordLoopTop);
+
+        //
+        // Exit quadword loop.
+        //
+
+        code.PlaceLabel(quadwordLoopExit);
+
+        // Write zero'd out rax to m_dedupe in preparation
+        // for next matcher iteration.
+        code.Emit<OpCode::Mov>(rdi, m_dedupe, rax);
+
+        // Restore registers.
+        code.Emit<OpCode::Pop>(r15);
+        code.Emit<OpCode::Pop>(r14);
+        code.Emit<OpCode::Pop>(r13);
+
         code.PlaceLabel(noMatches);
     }
 
@@ -22,7 +22,10 @@
 
 #pragma once
 
-#include <stddef.h>     // size_t, ptrdiff_t parameters.
+#include <stddef.h>     // offsetof, size_t, ptrdiff_t parameters.
+#include <stdint.h>     // uint64_t embedded.
+#include <type_traits>  // std::is_standard_layout.
+#include <vector>       // std::vector embedded.
 
 #include "BitFunnel/BitFunnelTypes.h"           // Rank parameter.
 #include "BitFunnel/Plan/ResultsBuffer.h"       // ResultsBuffer::Result type.
@@ -44,17 +47,15 @@ namespace BitFunnel
 {
     class CompileNode;
     class DocumentHandle;
+    class QueryCancellation;
     class RegisterAllocator;
 
 
-    template <typename OBJECT, typename FIELD>
-    constexpr int32_t OffsetOf(FIELD OBJECT::*field)
-    {
-        return static_cast<int32_t>(reinterpret_cast<uint64_t>(&((static_cast<OBJECT*>(nullptr))->*field)));
-    }
-
+    // DESIGN NOTE: offsetof is used rather than the address of a field of a
+    // null pointer, which is not a constant expression and is rejected by
+    // newer compilers. offsetof requires a standard layout type.
 #define OFFSET_OF(object, field) \
-static_cast<int32_t>(reinterpret_cast<uint64_t>(&((static_cast<object*>(nullptr))->field)))
+static_cast<int32_t>(offsetof(object, field))
 
 
     //*************************************************************************
@@ -80,12 +81,26 @@ static_cast<int32_t>(reinterpret_cast<uint64_t>(&((static_cast<object*>(nullptr)
             size_t m_base;
             size_t m_dedupe[65];
 
-            // Matches
+            // Matches. Matching terminates at the end of the iteration in
+            // which m_matchCount reaches m_capacity.
             size_t m_capacity;
             size_t m_matchCount;
             ResultsBuffer::Result* m_matches;
 
             size_t m_quadwordCount;
+
+            // Cancellation. Matching terminates at the start of an
+            // iteration whose byte offset into the slice has no bits in
+            // common with m_cancellationMask if the quadword at m_cancelled
+            // is nonzero.
+            uint64_t const * m_cancelled;
+            size_t m_cancellationMask;
+
+            // Deadline. When m_checkDeadline is not null, the checks above
+            // that find the flag clear go on to call m_checkDeadline, which
+            // returns nonzero once m_cancellation's deadline has passed.
+            QueryCancellation const * m_cancellation;
+            uint64_t (*m_checkDeadline)(QueryCancellation const *);
         };
         static_assert(std::is_standard_layout<Parameters>::value,
                       "Generated code requires that Parameters be standard layout.");
@@ -93,10 +108,30 @@ static_cast<int32_t>(reinterpret_cast<uint64_t>(&((static_cast<object*>(nullptr)
         typedef Function<size_t, Parameters const *> Prototype;
         Prototype::FunctionType m_function;
 
+        // Software prefetching of row data. When m_distance is nonzero, the
+        // generated code prefetches the rows held in registers m_distance
+        // cache lines ahead of the current iteration. Near the end of a
+        // slice, prefetching continues at the start of the next slice.
+        struct PrefetchOptions
+        {
+            size_t m_distance;
+
+            // Use prefetchnta instead of prefetcht0. Reduces cache pollution
+            // when the index is much larger than the last level cache.
+            bool m_nonTemporal;
+        };
+
+        // When countOnly is true, the generated code adds the number of
+        // matches to m_matchCount without writing to m_matches. When
+        // rowOffsets is not null, the row offsets are encoded in the
+        // generated code, which then ignores m_rowOffsets.
         NativeCodeGenerator(Prototype& expression,
                             CompileNode const & compileNodeTree,
                             RegisterAllocator const & registers,
-                            Rank initialRank);
+                            Rank initialRank,
+                            bool countOnly,
+                            PrefetchOptions const & prefetch,
+                            int32_t const * rowOffsets);
 
         virtual ExpressionTree::Storage<size_t>
             CodeGenValue(ExpressionTree& tree) override;
@@ -113,22 +148,47 @@ static_cast<int32_t>(reinterpret_cast<uint64_t>(&((static_cast<object*>(nullptr)
         static const int32_t m_matchCount = OFFSET_OF(Parameters, m_matchCount);
         static const int32_t m_matches = OFFSET_OF(Parameters, m_matches);
         static const int32_t m_quadwordCount = OFFSET_OF(Parameters, m_quadwordCount);
+        static const int32_t m_cancelled = OFFSET_OF(Parameters, m_cancelled);
+        static const int32_t m_cancellationMask = OFFSET_OF(Parameters, m_cancellationMask);
+        static const int32_t m_cancellation = OFFSET_OF(Parameters, m_cancellation);
+        static const int32_t m_checkDeadline = OFFSET_OF(Parameters, m_checkDeadline);
 
 
     private:
         void EmitRegisterInitialization(ExpressionTree& tree);
         void EmitOuterLoop(ExpressionTree& tree);
         void EmitInnerLoop(ExpressionTree& tree);
+        void EmitDeadlineCheck(ExpressionTree& tree);
+        void EmitPrefetch(ExpressionTree& tree);
         void EmitFinishIteration(ExpressionTree& tree);
+        void EmitCountIteration(ExpressionTree& tree);
         void EmitStoreMatch(ExpressionTree & tree);
 
         CompileNode const & m_compileNodeTree;
         RegisterAllocator const & m_registers;
         const Rank m_initialRank;
+        const bool m_countOnly;
+        const PrefetchOptions m_prefetch;
+
+        // Row offsets for code specialized to a single shard, or nullptr.
+        int32_t const * m_rowOffsetImmediates;
 
         Register<8u, false> m_param1;
         Register<8u, false> m_return;
 
         Storage<size_t> m_innerLoopLimit;
+
+        // Stack slots that preserve the volatile registers across the call
+        // made by EmitDeadlineCheck().
+        std::vector<Storage<size_t>> m_savedRegisters;
+
+        // Stack slots holding the offsets of rows that were not assigned
+        // registers. m_spillSlots maps row ids to rbp-relative offsets.
+        std::vector<Storage<size_t>> m_spills;
+        std::vector<int32_t> m_spillSlots;
+
+        // Target of the jump taken when m_matchCount reaches m_capacity or
+        // the query is cancelled. Placed after the outer loop.
+        Label m_terminate;
     };
 }
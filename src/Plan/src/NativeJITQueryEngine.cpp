@@ -20,29 +20,345 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#include <algorithm>                                // std::find().
 #include <iostream>
+#include <limits>                                   // std::numeric_limits.
+#include <string>                                   // std::to_string().
+#include <vector>                                   // std::vector.
 
 #include "BitFunnel/Configuration/Factories.h"
 #include "BitFunnel/Plan/Factories.h"
 #include "BitFunnel/Index/IIngestor.h"
 #include "BitFunnel/Index/IShard.h"
 #include "BitFunnel/Index/Token.h"
+#include "BitFunnel/Plan/IResultsSink.h"
+#include "BitFunnel/Plan/QueryCancellation.h"
 #include "BitFunnel/Plan/QueryInstrumentation.h"
 #include "BitFunnel/Plan/QueryParser.h"
 #include "BitFunnel/Plan/ResultsBuffer.h"
 #include "BitFunnel/Utilities/Allocator.h"
 #include "BitFunnel/Utilities/Factories.h"
+#include "LoggerInterfaces/Check.h"
 #include "NativeJITQueryEngine.h"
 #include "CompileNode.h"
+#include "MachineCodeGenerator.h"
+#include "MatchEstimator.h"
 #include "MatchTreeCompiler.h"
 #include "NativeCodeGenerator.h"
+#include "QueryPlanCache.h"
 #include "QueryPlanner.h"
 #include "RegisterAllocator.h"
 #include "RowSet.h"
+#include "WideDisjunctionPlan.h"
 
 
 namespace BitFunnel
 {
+    //*************************************************************************
+    //
+    // NativeCodePlan
+    //
+    // A CompiledQuery whose code is a native function generated by the
+    // MatchTreeCompiler.
+    //
+    //*************************************************************************
+    class NativeCodePlan : public CompiledQuery
+    {
+    public:
+        // Compiles one function for each distinct CompileNode tree in the
+        // plan. Shards that share a tree share its function. If
+        // specializeShards is set, each shard instead gets its own function
+        // with the shard's row offsets encoded as displacements.
+        //
+        // The functions are first compiled into the slots of code, which is
+        // owned by the caller. This is all that is done for queries that are
+        // not cached, so that the engine's code buffers can be reused from
+        // one query to the next. If privateCode is set, the functions are
+        // then compiled again into FunctionBuffers owned by the plan, sized
+        // to the code emitted the first time and packed into a single
+        // ExecutionBuffer, so that queries added to a QueryPlanCache can
+        // outlive the engine that compiled them without pinning a full code
+        // buffer for each shard.
+        NativeCodePlan(QueryPlanner const & planner,
+                       IAllocator & matchTreeAllocator,
+                       NativeJIT::Allocator & expressionTreeAllocator,
+                       NativeCodeBuffers & code,
+                       bool privateCode,
+                       bool countOnly,
+                       NativeCodeGenerator::PrefetchOptions const & prefetch,
+                       bool specializeShards)
+          : CompiledQuery(planner)
+        {
+            // Find the distinct functions. Specialized functions are
+            // recorded with a null tree so that they are never shared.
+            std::vector<CompileNode const *> trees;
+            std::vector<ShardId> functionShards;
+            std::vector<std::vector<int32_t>> functionImmediates;
+            std::vector<size_t> shardFunctions;
+            std::vector<int32_t> immediates;
+            for (ShardId shard = 0; shard < planner.GetRowSet().GetShardCount(); ++shard)
+            {
+                CompileNode const & tree = planner.GetCompileTree(shard);
+                const bool specialized =
+                    specializeShards &&
+                    GetRowOffsetImmediates(GetRowOffsets(shard), immediates);
+
+                auto it = specialized ?
+                    trees.end() :
+                    std::find(trees.begin(), trees.end(), &tree);
+                if (it == trees.end())
+                {
+                    trees.push_back(specialized ? nullptr : &tree);
+                    functionShards.push_back(shard);
+                    functionImmediates.push_back(specialized ?
+                                                 immediates :
+                                                 std::vector<int32_t>());
+                    it = trees.end() - 1;
+                }
+                shardFunctions.push_back(static_cast<size_t>(it - trees.begin()));
+            }
+
+            std::vector<unsigned> sizes;
+            for (size_t function = 0; function < trees.size(); ++function)
+            {
+                NativeJIT::FunctionBuffer & buffer = code.Get(function);
+                Compile(function,
+                        planner,
+                        functionShards,
+                        functionImmediates,
+                        matchTreeAllocator,
+                        expressionTreeAllocator,
+                        buffer,
+                        countOnly,
+                        prefetch);
+
+                // Round up so that every packed function starts on a cache
+                // line, as it does at the start of its own buffer.
+                sizes.push_back((buffer.CurrentPosition() + c_functionAlignment - 1) &
+                                ~(c_functionAlignment - 1));
+            }
+
+            if (privateCode)
+            {
+                // Code generation does not depend on the address of the
+                // buffer, so each function compiles to the same size again.
+                size_t totalSize = 0;
+                for (auto size : sizes)
+                {
+                    totalSize += size;
+                }
+                m_codeAllocator.reset(new NativeJIT::ExecutionBuffer(totalSize));
+
+                m_compilers.clear();
+                for (size_t function = 0; function < trees.size(); ++function)
+                {
+                    m_code.emplace_back(
+                        new NativeJIT::FunctionBuffer(*m_codeAllocator,
+                                                      sizes[function]));
+                    Compile(function,
+                            planner,
+                            functionShards,
+                            functionImmediates,
+                            matchTreeAllocator,
+                            expressionTreeAllocator,
+                            *m_code.back(),
+                            countOnly,
+                            prefetch);
+                }
+            }
+
+            for (auto function : shardFunctions)
+            {
+                m_shardCompilers.push_back(m_compilers[function].get());
+            }
+        }
+
+        MatchTreeCompiler const & GetCompiler(ShardId shard) const
+        {
+            return *m_shardCompilers[shard];
+        }
+
+    private:
+        // Converts a shard's row offsets to 32-bit displacements. Returns
+        // false if any offset is out of range, in which case the shard
+        // cannot be specialized.
+        bool GetRowOffsetImmediates(ptrdiff_t const * offsets,
+                                    std::vector<int32_t> & immediates) const
+        {
+            immediates.clear();
+            for (unsigned id = 0; id < GetRowCount(); ++id)
+            {
+                if (offsets[id] < (std::numeric_limits<int32_t>::min)() ||
+                    offsets[id] > (std::numeric_limits<int32_t>::max)())
+                {
+                    return false;
+                }
+                immediates.push_back(static_cast<int32_t>(offsets[id]));
+            }
+            return true;
+        }
+
+        // Compiles a function for the shards in functionShards[function]'s
+        // CompileNode tree into code.
+        void Compile(size_t function,
+                     QueryPlanner const & planner,
+                     std::vector<ShardId> const & functionShards,
+                     std::vector<std::vector<int32_t>> const & functionImmediates,
+                     IAllocator & matchTreeAllocator,
+                     NativeJIT::Allocator & expressionTreeAllocator,
+                     NativeJIT::FunctionBuffer & code,
+                     bool countOnly,
+                     NativeCodeGenerator::PrefetchOptions const & prefetch)
+        {
+            const ShardId shard = functionShards[function];
+            CompileNode const & compileTree = planner.GetCompileTree(shard);
+            std::vector<int32_t> const & immediates = functionImmediates[function];
+
+            // Perform register allocation on the compile tree.
+            RegisterAllocator const registers(compileTree,
+                                              GetRowCount(),
+                                              MachineCodeGenerator::GetRegisterBase(),
+                                              MachineCodeGenerator::GetRegisterCount(),
+                                              matchTreeAllocator);
+
+            // The expression tree for the previous function is no longer
+            // needed once it has been compiled.
+            expressionTreeAllocator.Reset();
+
+            m_compilers.emplace_back(new MatchTreeCompiler(expressionTreeAllocator,
+                                                           code,
+                                                           compileTree,
+                                                           registers,
+                                                           GetInitialRank(shard),
+                                                           countOnly,
+                                                           prefetch,
+                                                           immediates.empty() ?
+                                                               nullptr :
+                                                               immediates.data()));
+        }
+
+        static const unsigned c_functionAlignment = 64;
+
+        std::unique_ptr<NativeJIT::ExecutionBuffer> m_codeAllocator;
+        std::vector<std::unique_ptr<NativeJIT::FunctionBuffer>> m_code;
+        std::vector<std::unique_ptr<MatchTreeCompiler>> m_compilers;
+        std::vector<MatchTreeCompiler const *> m_shardCompilers;
+    };
+
+
+    //*************************************************************************
+    //
+    // NativeMorselMatcher
+    //
+    // Runs the compiled native code over the slices of a single SliceMorsel.
+    // The generated function keeps all of its state in its Parameters block
+    // and on the stack, so it may be invoked from several threads at once.
+    //
+    //*************************************************************************
+    class NativeMorselMatcher : public IMorselMatcher
+    {
+    public:
+        NativeMorselMatcher(IIngestor const & ingestor,
+                            NativeCodePlan const & plan)
+          : m_ingestor(ingestor),
+            m_plan(plan)
+        {
+        }
+
+        virtual bool MatchMorsel(SliceMorsel const & morsel,
+                                 ResultsBuffer & results,
+                                 size_t maxMatches,
+                                 QueryCancellation const & cancellation,
+                                 QueryInstrumentation & instrumentation) override
+        {
+            auto & shard = m_ingestor.GetShard(morsel.m_shard);
+
+            // Iterations per slice calculation.
+            auto iterationsPerSlice =
+                shard.GetSliceCapacity() >> 6 >> m_plan.GetInitialRank(morsel.m_shard);
+
+            bool wasCancelled = false;
+            size_t quadwordCount = m_plan.GetCompiler(morsel.m_shard).Run(morsel.m_sliceCount,
+                morsel.m_sliceBuffers,
+                iterationsPerSlice,
+                m_plan.GetRowOffsets(morsel.m_shard),
+                results,
+                maxMatches,
+                &cancellation,
+                &wasCancelled);
+
+            instrumentation.IncrementQuadwordCount(quadwordCount);
+
+            return wasCancelled;
+        }
+
+        virtual size_t CountMorsel(SliceMorsel const & morsel,
+                                   QueryInstrumentation & instrumentation) override
+        {
+            auto & shard = m_ingestor.GetShard(morsel.m_shard);
+
+            // Iterations per slice calculation.
+            auto iterationsPerSlice =
+                shard.GetSliceCapacity() >> 6 >> m_plan.GetInitialRank(morsel.m_shard);
+
+            size_t quadwordCount = 0;
+            size_t matchCount = m_plan.GetCompiler(morsel.m_shard).Count(morsel.m_sliceCount,
+                morsel.m_sliceBuffers,
+                iterationsPerSlice,
+                m_plan.GetRowOffsets(morsel.m_shard),
+                quadwordCount);
+
+            instrumentation.IncrementQuadwordCount(quadwordCount);
+
+            return matchCount;
+        }
+
+    private:
+        IIngestor const & m_ingestor;
+        NativeCodePlan const & m_plan;
+    };
+
+
+    //*************************************************************************
+    //
+    // NativeCodeBuffers
+    //
+    //*************************************************************************
+    NativeCodeBuffers::NativeCodeBuffers(size_t bytesPerBuffer)
+      : m_bytesPerBuffer(bytesPerBuffer)
+    {
+    }
+
+
+    NativeJIT::FunctionBuffer & NativeCodeBuffers::Get(size_t slot)
+    {
+        while (m_buffers.size() <= slot)
+        {
+            m_allocators.emplace_back(
+                new NativeJIT::ExecutionBuffer(m_bytesPerBuffer));
+            m_buffers.emplace_back(
+                new NativeJIT::FunctionBuffer(*m_allocators.back(),
+                                              static_cast<unsigned>(m_bytesPerBuffer)));
+        }
+        return *m_buffers[slot];
+    }
+
+
+    void NativeCodeBuffers::Reset()
+    {
+        // WARNING: Do not reset m_allocators. They provision m_buffers.
+        for (auto & buffer : m_buffers)
+        {
+            buffer->Reset();
+        }
+    }
+
+
+    //*************************************************************************
+    //
+    // NativeJITQueryEngine
+    //
+    //*************************************************************************
     std::unique_ptr<IQueryEngine> Factories::CreateQueryEngine(ISimpleIndex const & index,
                                                                IStreamConfiguration const & config)
     {
@@ -53,16 +369,25 @@ namespace BitFunnel
     NativeJITQueryEngine::NativeJITQueryEngine(ISimpleIndex const & index,
                                                IStreamConfiguration const & config,
                                                size_t treeAllocatorBytes,
-                                               size_t codeAllocatorBytes)
+                                               size_t codeAllocatorBytes,
+                                               QueryPlanCache * planCache,
+                                               TermRowCache * termRowCache)
         : m_index(index),
           m_config(config),
           m_diagnostic(Factories::CreateDiagnosticStream(std::cout)),
           m_matchTreeAllocator(new BitFunnel::Allocator(treeAllocatorBytes)),
           m_expressionTreeAllocator(new NativeJIT::Allocator(treeAllocatorBytes)),
-          m_codeAllocator(new NativeJIT::ExecutionBuffer(codeAllocatorBytes))
+          m_code(codeAllocatorBytes),
+          m_planCache(planCache),
+          m_termRowCache(termRowCache),
+          m_prefetchDistance(0),
+          m_prefetchNonTemporal(false),
+          m_wideDisjunctionRowCount(c_maxRowsPerQuery),
+          m_specializeShards(false)
     {
-        m_code.reset(new NativeJIT::FunctionBuffer(*m_codeAllocator,
-                                                   static_cast<unsigned>(codeAllocatorBytes)));
+        // Provision the first slot up front, since every query that is not
+        // cached uses it.
+        m_code.Get(0);
     }
 
     // Parse a query
@@ -70,8 +395,7 @@ namespace BitFunnel
     {
         m_matchTreeAllocator->Reset();
         m_expressionTreeAllocator->Reset();
-        // WARNING: Do not reset m_codeAllocator. It is used to provision m_code.
-        m_code->Reset();
+        m_code.Reset();
 
         QueryParser parser(query,
             m_config,
@@ -82,63 +406,292 @@ namespace BitFunnel
     // Runs a parsed query
     void NativeJITQueryEngine::Run(TermMatchNode const * tree,
         QueryInstrumentation & instrumentation,
-        ResultsBuffer & resultsBuffer)
-    {
-        const int c_arbitraryRowCount = 500;
-        QueryPlanner planner(*tree,
-                             c_arbitraryRowCount,
-                             m_index,
-                             *m_matchTreeAllocator,
-                             *m_diagnostic,
-                             instrumentation);
-        CompileNode const & compileTree = planner.GetCompileTree();
-        const Rank initialRank = planner.GetInitialRank();
-        const RowSet & rowSet = planner.GetRowSet();
-
-        // Perform register allocation on the compile tree.
-        RegisterAllocator const registers(compileTree,
-                                          rowSet.GetRowCount(),
-                                          c_registerBase,
-                                          c_registerCount,
-                                          *m_matchTreeAllocator);
-
-        MatchTreeCompiler compiler(*m_expressionTreeAllocator,
-                                   *m_code,
-                                   compileTree,
-                                   registers,
-                                   initialRank);
+        IResultsSink & results)
+    {
+        QueryCancellation none;
+        Run(tree, instrumentation, results, none);
+    }
+
 
+    // Runs a parsed query until it completes or is cancelled.
+    void NativeJITQueryEngine::Run(TermMatchNode const * tree,
+        QueryInstrumentation & instrumentation,
+        IResultsSink & results,
+        QueryCancellation const & cancellation)
+    {
+        auto plan = GetPlan(*tree, false, false, instrumentation);
 
         instrumentation.FinishPlanning();
 
-        resultsBuffer.Reset();
+        results.Reset();
 
         // Get token before we GetSliceBuffers.
         {
             auto token = m_index.GetIngestor().GetTokenManager().RequestToken();
 
-            for (ShardId shardId = 0; shardId < m_index.GetIngestor().GetShardCount(); ++shardId)
+            auto matcher = CreateMatcher(*plan);
+
+            const bool truncated = m_matcher.Run(m_index.GetIngestor(),
+                                                 *matcher,
+                                                 instrumentation,
+                                                 results,
+                                                 cancellation);
+
+            instrumentation.FinishMatching();
+            instrumentation.SetMatchCount(results.GetMatchCount());
+            if (truncated)
             {
-                auto & shard = m_index.GetIngestor().GetShard(shardId);
-                auto & sliceBuffers = shard.GetSliceBuffers();
+                instrumentation.QueryTruncated();
+            }
+            instrumentation.QuerySucceeded();
+        } // End of token lifetime.
+    }
 
-                // Iterations per slice calculation.
-                auto iterationsPerSlice = shard.GetSliceCapacity() >> 6 >> initialRank;
 
+    // Counts the matches for a parsed query
+    size_t NativeJITQueryEngine::Count(TermMatchNode const * tree,
+                                       QueryInstrumentation & instrumentation)
+    {
+        auto plan = GetPlan(*tree, true, false, instrumentation);
 
-                size_t quadwordCount = compiler.Run(sliceBuffers.size(),
-                    sliceBuffers.data(),
-                    iterationsPerSlice,
-                    rowSet.GetRowOffsets(shardId),
-                    resultsBuffer);
+        instrumentation.FinishPlanning();
 
-                instrumentation.IncrementQuadwordCount(quadwordCount);
-            }
+        size_t matchCount = 0;
+
+        // Get token before we GetSliceBuffers.
+        {
+            auto token = m_index.GetIngestor().GetTokenManager().RequestToken();
+
+            auto matcher = CreateMatcher(*plan);
+
+            matchCount = m_matcher.Count(m_index.GetIngestor(),
+                                         *matcher,
+                                         instrumentation);
 
             instrumentation.FinishMatching();
-            instrumentation.SetMatchCount(resultsBuffer.size());
+            instrumentation.SetMatchCount(matchCount);
             instrumentation.QuerySucceeded();
         } // End of token lifetime.
+
+        return matchCount;
+    }
+
+
+    // Estimates the matches for a parsed query
+    QueryEstimate NativeJITQueryEngine::Estimate(TermMatchNode const * tree,
+                                                 QueryInstrumentation & instrumentation)
+    {
+        // The query is planned as Run() plans it, so the estimate describes
+        // the plan that would run, and a cached plan is shared with Run().
+        auto plan = GetPlan(*tree, false, false, instrumentation);
+
+        instrumentation.FinishPlanning();
+
+        QueryEstimate estimate =
+            MatchEstimator::Estimate(*plan, m_index, instrumentation);
+        instrumentation.QuerySucceeded();
+
+        return estimate;
+    }
+
+
+    void NativeJITQueryEngine::RunBatch(std::vector<char const *> const & queries,
+                                        std::vector<QueryInstrumentation *> const & instrumentation,
+                                        std::vector<IResultsSink *> const & results)
+    {
+        CHECK_EQ(queries.size(), instrumentation.size())
+            << "RunBatch() requires one QueryInstrumentation per query.";
+        CHECK_EQ(queries.size(), results.size())
+            << "RunBatch() requires one IResultsSink per query.";
+
+        // Each query is planned immediately after it is parsed, since Parse()
+        // resets the allocators. Each plan owns its code because the
+        // engine's NativeCodeBuffers can hold only one query.
+        std::vector<std::shared_ptr<CompiledQuery const>> plans;
+        std::vector<std::unique_ptr<IMorselMatcher>> matchers;
+        std::vector<IMorselMatcher *> batchMatchers;
+        std::vector<QueryInstrumentation *> batchInstrumentation;
+        std::vector<IResultsSink *> batchResults;
+
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            results[i]->Reset();
+
+            auto tree = Parse(queries[i]);
+            instrumentation[i]->FinishParsing();
+
+            if (tree != nullptr)
+            {
+                plans.push_back(GetPlan(*tree, false, true, *instrumentation[i]));
+                instrumentation[i]->FinishPlanning();
+
+                matchers.push_back(CreateMatcher(*plans.back()));
+                batchMatchers.push_back(matchers.back().get());
+                batchInstrumentation.push_back(instrumentation[i]);
+                batchResults.push_back(results[i]);
+            }
+        }
+
+        // Get token before we GetSliceBuffers.
+        {
+            auto token = m_index.GetIngestor().GetTokenManager().RequestToken();
+
+            m_matcher.RunBatch(m_index.GetIngestor(),
+                               batchMatchers,
+                               batchInstrumentation,
+                               batchResults);
+
+            for (size_t i = 0; i < batchResults.size(); ++i)
+            {
+                batchInstrumentation[i]->FinishMatching();
+                batchInstrumentation[i]->SetMatchCount(batchResults[i]->GetMatchCount());
+                batchInstrumentation[i]->QuerySucceeded();
+            }
+        } // End of token lifetime.
+    }
+
+
+    std::shared_ptr<CompiledQuery const>
+        NativeJITQueryEngine::GetPlan(TermMatchNode const & tree,
+                                      bool countOnly,
+                                      bool ownCode,
+                                      QueryInstrumentation & instrumentation)
+    {
+        const QueryPlanCache::Engine engine =
+            countOnly ?
+                QueryPlanCache::Engine::NativeCodeCount :
+                QueryPlanCache::Engine::NativeCode;
+
+        const NativeCodeGenerator::PrefetchOptions prefetch = {
+            m_prefetchDistance,
+            m_prefetchNonTemporal
+        };
+
+        std::shared_ptr<CompiledQuery const> plan;
+        std::string key;
+
+        if (m_planCache != nullptr)
+        {
+            // Code compiled with different prefetch or specialization
+            // options is not interchangeable.
+            key = QueryPlanCache::CreateKey(tree);
+            if (prefetch.m_distance > 0)
+            {
+                key += (prefetch.m_nonTemporal ? "|pn" : "|p") +
+                       std::to_string(prefetch.m_distance);
+            }
+            if (m_specializeShards)
+            {
+                key += "|s";
+            }
+            if (m_wideDisjunctionRowCount != c_maxRowsPerQuery)
+            {
+                key += "|w" + std::to_string(m_wideDisjunctionRowCount);
+            }
+            plan = m_planCache->Find(engine, key, m_index);
+        }
+
+        if (plan == nullptr)
+        {
+            plan = WideDisjunctionPlan::TryCreate(tree,
+                                                  m_index,
+                                                  m_wideDisjunctionRowCount,
+                                                  *m_diagnostic,
+                                                  m_termRowCache);
+            if (plan != nullptr)
+            {
+                instrumentation.SetRowCount(plan->GetRowCount());
+                if (m_planCache != nullptr)
+                {
+                    m_planCache->Add(engine, key, plan, m_index);
+                }
+                return plan;
+            }
+
+            const int c_arbitraryRowCount = 500;
+            QueryPlanner planner(tree,
+                                 c_arbitraryRowCount,
+                                 m_index,
+                                 *m_matchTreeAllocator,
+                                 *m_diagnostic,
+                                 instrumentation,
+                                 m_termRowCache);
+
+            const bool privateCode = (m_planCache != nullptr || ownCode);
+            plan = std::make_shared<NativeCodePlan>(planner,
+                                                    *m_matchTreeAllocator,
+                                                    *m_expressionTreeAllocator,
+                                                    m_code,
+                                                    privateCode,
+                                                    countOnly,
+                                                    prefetch,
+                                                    m_specializeShards);
+            if (m_planCache != nullptr)
+            {
+                m_planCache->Add(engine, key, plan, m_index);
+            }
+        }
+        else
+        {
+            instrumentation.SetRowCount(plan->GetRowCount());
+        }
+
+        return plan;
+    }
+
+
+    std::unique_ptr<IMorselMatcher>
+        NativeJITQueryEngine::CreateMatcher(CompiledQuery const & plan) const
+    {
+        auto wide = dynamic_cast<WideDisjunctionPlan const *>(&plan);
+        if (wide != nullptr)
+        {
+            return std::unique_ptr<IMorselMatcher>(
+                new WideDisjunctionMatcher(m_index.GetIngestor(), *wide));
+        }
+
+        return std::unique_ptr<IMorselMatcher>(
+            new NativeMorselMatcher(m_index.GetIngestor(),
+                                    static_cast<NativeCodePlan const &>(plan)));
+    }
+
+
+    void NativeJITQueryEngine::SetPrefetch(size_t distance, bool nonTemporal)
+    {
+        m_prefetchDistance = distance;
+        m_prefetchNonTemporal = nonTemporal;
+    }
+
+
+    void NativeJITQueryEngine::SetShardSpecialization(bool enabled)
+    {
+        m_specializeShards = enabled;
+    }
+
+
+    void NativeJITQueryEngine::SetMatchingThreads(size_t threadCount,
+                                                  size_t slicesPerMorsel)
+    {
+        m_matcher.Configure(threadCount, slicesPerMorsel);
+    }
+
+
+    void NativeJITQueryEngine::SetMatchLimit(size_t matchLimit,
+                                             size_t shardMatchLimit)
+    {
+        m_matcher.SetMatchLimit(matchLimit, shardMatchLimit);
+    }
+
+
+    void NativeJITQueryEngine::SetWideDisjunctionRowCount(size_t rowCount)
+    {
+        m_wideDisjunctionRowCount = rowCount;
+    }
+
+
+    size_t NativeJITQueryEngine::GetMatchTreeHighWaterMark() const
+    {
+        return m_matchTreeAllocator->GetHighWaterMark();
     }
 
 
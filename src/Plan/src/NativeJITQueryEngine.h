@@ -23,23 +23,69 @@
 #pragma once
 
 #include <memory>                                   // std::unique_ptr embedded.
+#include <vector>                                   // std::vector embedded.
 
 #include "BitFunnel/Configuration/IStreamConfiguration.h"
 #include "BitFunnel/Index/ISimpleIndex.h"
 #include "BitFunnel/IDiagnosticStream.h"
 #include "BitFunnel/Plan/IQueryEngine.h"
+#include "BitFunnel/Utilities/Allocator.h"       // Template parameter.
 #include "NativeJIT/CodeGen/ExecutionBuffer.h"  // Template parameter.
 #include "NativeJIT/CodeGen/FunctionBuffer.h"   // Template parameter.
+#include "ParallelMatcher.h"                    // ParallelMatcher embedded.
 #include "Temporary/Allocator.h"                // Template parameter.
 
 
 namespace BitFunnel
 {
+    class CompiledQuery;
+    class QueryPlanCache;
+    class TermRowCache;
+
+
     //*************************************************************************
     //
-    // ByteCodeQueryEngine
+    // NativeCodeBuffers
     //
-    // The class used to run parsed queries using the ByteCodeInterpreter.
+    // The FunctionBuffers into which a NativeJITQueryEngine compiles queries
+    // that are not cached, so that executable memory is mapped once and
+    // reused from one query to the next. A query compiles one function for
+    // each distinct CompileNode tree in its plan, and the i-th function goes
+    // into slot i. Slots are created the first time they are used. Queries
+    // that are cached are also compiled here first, to size their own code.
+    //
+    //*************************************************************************
+    class NativeCodeBuffers
+    {
+    public:
+        NativeCodeBuffers(size_t bytesPerBuffer);
+
+        // Returns the FunctionBuffer for slot, creating it if necessary.
+        NativeJIT::FunctionBuffer & Get(size_t slot);
+
+        // Resets every FunctionBuffer. Code compiled into them may no longer
+        // be run.
+        void Reset();
+
+    private:
+        const size_t m_bytesPerBuffer;
+        std::vector<std::unique_ptr<NativeJIT::ExecutionBuffer>> m_allocators;
+        std::vector<std::unique_ptr<NativeJIT::FunctionBuffer>> m_buffers;
+    };
+
+
+    //*************************************************************************
+    //
+    // NativeJITQueryEngine
+    //
+    // The class used to run parsed queries using code generated by NativeJIT.
+    //
+    // If a QueryPlanCache is supplied, compiled queries are looked up in and
+    // added to the cache, skipping planning and code generation for queries
+    // that have been seen before. Each cached query owns its code, in a buffer
+    // sized to fit.
+    // If a TermRowCache is supplied, queries that must be planned look up the
+    // rows for their terms in the cache.
     //
     //*************************************************************************
     class NativeJITQueryEngine : public IQueryEngine
@@ -48,7 +94,9 @@ namespace BitFunnel
         NativeJITQueryEngine(ISimpleIndex const & index,
                              IStreamConfiguration const & config,
                              size_t treeAllocatorBytes,
-                             size_t codeAllocatorBytes);
+                             size_t codeAllocatorBytes,
+                             QueryPlanCache * planCache = nullptr,
+                             TermRowCache * termRowCache = nullptr);
 
         // Parse a query
         virtual TermMatchNode const *Parse(const char *query) override;
@@ -56,7 +104,77 @@ namespace BitFunnel
         // Runs a parsed query
         virtual void Run(TermMatchNode const * tree,
                          QueryInstrumentation & instrumentation,
-                         ResultsBuffer & resultsBuffer) override;
+                         IResultsSink & results) override;
+
+        // Runs a parsed query until it completes or is cancelled.
+        virtual void Run(TermMatchNode const * tree,
+                         QueryInstrumentation & instrumentation,
+                         IResultsSink & results,
+                         QueryCancellation const & cancellation) override;
+
+        // Returns the number of matches for a parsed query without writing
+        // them to an IResultsSink. The count is the same as the number of
+        // results Run() would return without a match limit. Match limits do
+        // not apply.
+        virtual size_t Count(TermMatchNode const * tree,
+                             QueryInstrumentation & instrumentation) override;
+
+        // Plans a parsed query and predicts its match count and matching
+        // cost from the sampled densities of its rows, without scanning the
+        // index. The estimate is also recorded in instrumentation. Intended
+        // for admission control of expensive queries.
+        virtual QueryEstimate Estimate(TermMatchNode const * tree,
+                                       QueryInstrumentation & instrumentation) override;
+
+        // Parses, plans and runs a batch of queries with a single pass over
+        // the index. Every slice is matched against all of the queries
+        // before the next slice is read. The matches for queries[i] are
+        // written to results[i], which is reset first, and its statistics
+        // to instrumentation[i]. Throws if any query fails to parse or plan,
+        // in which case the contents of results are undefined. Invalidates
+        // trees returned by Parse().
+        virtual void RunBatch(std::vector<char const *> const & queries,
+                              std::vector<QueryInstrumentation *> const & instrumentation,
+                              std::vector<IResultsSink *> const & results) override;
+
+        // Configures intra-query parallelism. The slice buffers of each shard
+        // are divided into morsels of slicesPerMorsel slices which are
+        // matched by threadCount worker threads. A threadCount of 1, the
+        // default, matches all slices on the thread that calls Run().
+        virtual void SetMatchingThreads(size_t threadCount,
+                                        size_t slicesPerMorsel) override;
+
+        // Limits the number of matches returned by Run() to matchLimit in
+        // total and to shardMatchLimit from any single shard. Scanning stops
+        // as soon as the limits are reached. A value of zero, the default,
+        // means no limit.
+        virtual void SetMatchLimit(size_t matchLimit,
+                                   size_t shardMatchLimit) override;
+
+        // Queries in conjunctive normal form that need more than rowCount
+        // rows are run by the WideDisjunctionMatcher instead of being
+        // compiled. The default is c_maxRowsPerQuery.
+        virtual void SetWideDisjunctionRowCount(size_t rowCount) override;
+
+        // Configures software prefetching in the generated code. Rows are
+        // prefetched distance cache lines ahead of the current position
+        // with prefetchnta if nonTemporal is true and prefetcht0
+        // otherwise. A distance of zero, the default, disables prefetching.
+        // Applies to queries compiled after the call.
+        void SetPrefetch(size_t distance, bool nonTemporal);
+
+        // When enabled, a separate function is compiled for each shard with
+        // the shard's row offsets encoded in the instructions as
+        // displacements. This removes the loads of row offsets and frees
+        // the row registers, at the cost of compiling one function per
+        // shard. Most useful with a QueryPlanCache, which amortizes the
+        // compilation. Applies to queries compiled after the call.
+        void SetShardSpecialization(bool enabled);
+
+        // Returns the largest number of bytes that the match tree arena has
+        // held for one query, which shows whether its initial size is large
+        // enough for the query log.
+        virtual size_t GetMatchTreeHighWaterMark() const override;
 
         // Adds the diagnostic keyword prefix to the list of prefixes that
         // enable diagnostics.
@@ -67,20 +185,45 @@ namespace BitFunnel
         virtual void DisableDiagnostic(char const * prefix) override;
 
     private:
+        // Returns the compiled query for tree, from the QueryPlanCache if
+        // possible. Code compiled with countOnly set may only be used with
+        // MatchTreeCompiler::Count(). A plan that is not cached is compiled
+        // into the engine's NativeCodeBuffers unless ownCode is set, in
+        // which case it has private FunctionBuffers.
+        std::shared_ptr<CompiledQuery const>
+            GetPlan(TermMatchNode const & tree,
+                    bool countOnly,
+                    bool ownCode,
+                    QueryInstrumentation & instrumentation);
+
+        // Returns the IMorselMatcher that runs plan.
+        std::unique_ptr<IMorselMatcher>
+            CreateMatcher(CompiledQuery const & plan) const;
+
         ISimpleIndex const & m_index;
         IStreamConfiguration const & m_config;
         std::unique_ptr<IDiagnosticStream> m_diagnostic;
-        std::unique_ptr<IAllocator> m_matchTreeAllocator;
+        std::unique_ptr<Allocator> m_matchTreeAllocator;
         std::unique_ptr<NativeJIT::Allocator> m_expressionTreeAllocator;
-        std::unique_ptr<NativeJIT::ExecutionBuffer> m_codeAllocator;
-        std::unique_ptr<NativeJIT::FunctionBuffer> m_code;
+        NativeCodeBuffers m_code;
+
+        // Optional cache of compiled queries, shared with other engines.
+        QueryPlanCache * m_planCache;
+
+        // Optional cache of the rows for each term, shared with other
+        // engines.
+        TermRowCache * m_termRowCache;
+
+        // Software prefetch options for generated code.
+        size_t m_prefetchDistance;
+        bool m_prefetchNonTemporal;
+
+        // Row count above which queries use a WideDisjunctionPlan.
+        size_t m_wideDisjunctionRowCount;
 
-        // First available row pointer register is R8.
-        // TODO: is this valid on all platforms or only on Windows?
-        static const unsigned c_registerBase = 8;
+        // Compile one function per shard with row offsets as immediates.
+        bool m_specializeShards;
 
-        // Row pointers stored in the eight registers R8..R15.
-        // TODO: is this valid on all platforms or only on Windows?
-        static const unsigned c_registerCount = 8;
+        ParallelMatcher m_matcher;
     };
 }
@@ -0,0 +1,874 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <algorithm>                            // std::min().
+#include <atomic>                               // std::atomic embedded.
+#include <exception>                            // std::exception_ptr embedded.
+#include <limits>                               // std::numeric_limits.
+
+#include "BitFunnel/Index/IIngestor.h"
+#include "BitFunnel/Index/IShard.h"
+#include "BitFunnel/Plan/ChunkedResultsSink.h"
+#include "BitFunnel/Plan/QueryCancellation.h"
+#include "BitFunnel/Plan/QueryInstrumentation.h"
+#include "BitFunnel/Plan/ResultsBuffer.h"
+#include "BitFunnel/Utilities/Factories.h"
+#include "BitFunnel/Utilities/ITaskProcessor.h"
+#include "LoggerInterfaces/Check.h"
+#include "ParallelMatcher.h"
+
+
+namespace BitFunnel
+{
+    namespace
+    {
+        // A run of consecutive matches from a single shard in a worker's
+        // private match buffer.
+        struct MatchRun
+        {
+            ShardId m_shard;
+            size_t m_count;
+        };
+
+
+        void AddRun(std::vector<MatchRun> & runs, ShardId shard, size_t count)
+        {
+            if (runs.size() > 0 && runs.back().m_shard == shard)
+            {
+                runs.back().m_count += count;
+            }
+            else
+            {
+                runs.push_back({ shard, count });
+            }
+        }
+
+
+        // Appends matches, described by runs, to results. Matches are dropped
+        // once remaining, the number of matches that may still be appended,
+        // reaches zero or once shardCounts, the number of matches appended
+        // so far from each shard, reaches shardMatchLimit.
+        void AppendRuns(std::vector<MatchRun> const & runs,
+                        ChunkedResultsSink const & matches,
+                        IResultsSink & results,
+                        size_t & remaining,
+                        size_t shardMatchLimit,
+                        std::vector<size_t> & shardCounts)
+        {
+            size_t start = 0;
+            for (auto const & run : runs)
+            {
+                size_t & shardCount = shardCounts[run.m_shard];
+                const size_t count = (std::min)((std::min)(run.m_count, remaining),
+                                                shardMatchLimit - shardCount);
+                matches.CopyTo(start, count, results);
+
+                remaining -= count;
+                shardCount += count;
+                start += run.m_count;
+            }
+        }
+    }
+
+
+    //*************************************************************************
+    //
+    // ParallelMatcher::MatchBudget
+    //
+    // Tracks the number of matches found so far, in total and for each
+    // shard, so that workers can skip or shorten morsels once the match
+    // limits have been reached.
+    //
+    //*************************************************************************
+    class ParallelMatcher::MatchBudget
+    {
+    public:
+        MatchBudget(size_t shardCount,
+                    size_t matchLimit,
+                    size_t shardMatchLimit)
+          : m_matchLimit(matchLimit),
+            m_shardMatchLimit(shardMatchLimit),
+            m_total(0),
+            m_shards(new std::atomic<size_t>[shardCount])
+        {
+            for (size_t i = 0; i < shardCount; ++i)
+            {
+                m_shards[i] = 0;
+            }
+        }
+
+        // Returns the number of matches the next morsel from shard may add.
+        size_t GetRemaining(ShardId shard) const
+        {
+            return (std::min)(Remaining(m_matchLimit, m_total),
+                              Remaining(m_shardMatchLimit, m_shards[shard]));
+        }
+
+        void Consume(ShardId shard, size_t count)
+        {
+            m_total += count;
+            m_shards[shard] += count;
+        }
+
+    private:
+        static size_t Remaining(size_t limit, size_t used)
+        {
+            return (used < limit) ? limit - used : 0;
+        }
+
+        const size_t m_matchLimit;
+        const size_t m_shardMatchLimit;
+        std::atomic<size_t> m_total;
+        std::unique_ptr<std::atomic<size_t>[]> m_shards;
+    };
+
+
+    //*************************************************************************
+    //
+    // ParallelMatcher::Worker
+    //
+    // ITaskProcessor that matches the morsel whose index is the task id.
+    //
+    //*************************************************************************
+    class ParallelMatcher::Worker : public ITaskProcessor
+    {
+    public:
+        Worker(ParallelMatcher const & parent,
+               IMorselMatcher & matcher,
+               MatchBudget & budget,
+               QueryCancellation const & cancellation,
+               ResultsBuffer & scratch,
+               ChunkedResultsSink & results)
+          : m_parent(parent),
+            m_matcher(matcher),
+            m_budget(budget),
+            m_cancellation(cancellation),
+            m_scratch(scratch),
+            m_results(results),
+            m_wasCancelled(false)
+        {
+            m_results.Reset();
+        }
+
+        //
+        // ITaskProcessor methods
+        //
+
+        virtual void ProcessTask(size_t taskId) override
+        {
+            // An exception must not escape the worker thread. Record the
+            // first one and skip the remaining morsels. It will be rethrown
+            // on the thread that called ParallelMatcher::Run().
+            if (m_error == nullptr)
+            {
+                try
+                {
+                    auto & morsel = m_parent.m_morsels[taskId];
+                    const size_t maxMatches = m_budget.GetRemaining(morsel.m_shard);
+                    if (maxMatches > 0)
+                    {
+                        const size_t count =
+                            m_parent.MatchWindows(m_matcher,
+                                                  morsel,
+                                                  m_scratch,
+                                                  m_results,
+                                                  maxMatches,
+                                                  m_cancellation,
+                                                  m_instrumentation,
+                                                  m_wasCancelled);
+                        m_budget.Consume(morsel.m_shard, count);
+                        m_runs.push_back({ morsel.m_shard, count });
+                    }
+                }
+                catch (...)
+                {
+                    m_error = std::current_exception();
+                }
+            }
+        }
+
+        virtual void Finished() override
+        {
+        }
+
+        // Appends this worker's matches to results and adds its quadword and
+        // cache line counts to instrumentation. Matches are dropped once
+        // remaining, the number of matches that may still be appended,
+        // reaches zero or once shardCounts, the number of matches appended
+        // so far from each shard, reaches shardMatchLimit. Rethrows any
+        // exception captured on the worker thread.
+        void Merge(IResultsSink & results,
+                   size_t & remaining,
+                   size_t shardMatchLimit,
+                   std::vector<size_t> & shardCounts,
+                   QueryInstrumentation & instrumentation)
+        {
+            if (m_error != nullptr)
+            {
+                std::rethrow_exception(m_error);
+            }
+
+            AppendRuns(m_runs,
+                       m_results,
+                       results,
+                       remaining,
+                       shardMatchLimit,
+                       shardCounts);
+
+            auto & data = m_instrumentation.GetData();
+            instrumentation.IncrementQuadwordCount(data.GetQuadwordCount());
+            instrumentation.IncrementCacheLineCount(data.GetCacheLineCount());
+        }
+
+        // Returns true if cancellation left slices of any of this worker's
+        // morsels unscanned.
+        bool WasCancelled() const
+        {
+            return m_wasCancelled;
+        }
+
+    private:
+        ParallelMatcher const & m_parent;
+        IMorselMatcher & m_matcher;
+        MatchBudget & m_budget;
+        QueryCancellation const & m_cancellation;
+        ResultsBuffer & m_scratch;
+        ChunkedResultsSink & m_results;
+        std::vector<MatchRun> m_runs;
+        QueryInstrumentation m_instrumentation;
+        std::exception_ptr m_error;
+        bool m_wasCancelled;
+    };
+
+
+    //*************************************************************************
+    //
+    // ParallelMatcher::BatchWorker
+    //
+    // ITaskProcessor that matches every query in a batch against the morsel
+    // whose index is the task id, one slice at a time. Matches for each
+    // query are collected in a private ChunkedResultsSink until Merge().
+    //
+    //*************************************************************************
+    class ParallelMatcher::BatchWorker : public ITaskProcessor
+    {
+    public:
+        BatchWorker(std::vector<SliceMorsel> const & morsels,
+                    std::vector<IMorselMatcher *> const & matchers,
+                    std::vector<std::unique_ptr<MatchBudget>> & budgets,
+                    ResultsBuffer & scratch)
+          : m_morsels(morsels),
+            m_matchers(matchers),
+            m_budgets(budgets),
+            m_scratch(scratch),
+            m_runs(matchers.size()),
+            m_instrumentation(matchers.size())
+        {
+            for (size_t i = 0; i < matchers.size(); ++i)
+            {
+                m_matches.emplace_back(new ChunkedResultsSink());
+            }
+        }
+
+        //
+        // ITaskProcessor methods
+        //
+
+        virtual void ProcessTask(size_t taskId) override
+        {
+            // See Worker::ProcessTask() regarding exceptions.
+            if (m_error == nullptr)
+            {
+                try
+                {
+                    auto & morsel = m_morsels[taskId];
+                    for (size_t slice = 0; slice < morsel.m_sliceCount; ++slice)
+                    {
+                        const SliceMorsel single = {
+                            morsel.m_shard,
+                            morsel.m_sliceBuffers + slice,
+                            1
+                        };
+                        for (size_t query = 0; query < m_matchers.size(); ++query)
+                        {
+                            MatchSlice(single, query);
+                        }
+                    }
+                }
+                catch (...)
+                {
+                    m_error = std::current_exception();
+                }
+            }
+        }
+
+        virtual void Finished() override
+        {
+        }
+
+        // Appends this worker's matches for query to results and adds its
+        // quadword and cache line counts to instrumentation. See
+        // Worker::Merge() for the meaning of the limits.
+        void Merge(size_t query,
+                   IResultsSink & results,
+                   size_t & remaining,
+                   size_t shardMatchLimit,
+                   std::vector<size_t> & shardCounts,
+                   QueryInstrumentation & instrumentation)
+        {
+            if (m_error != nullptr)
+            {
+                std::rethrow_exception(m_error);
+            }
+
+            AppendRuns(m_runs[query],
+                       *m_matches[query],
+                       results,
+                       remaining,
+                       shardMatchLimit,
+                       shardCounts);
+
+            auto & data = m_instrumentation[query].GetData();
+            instrumentation.IncrementQuadwordCount(data.GetQuadwordCount());
+            instrumentation.IncrementCacheLineCount(data.GetCacheLineCount());
+        }
+
+    private:
+        void MatchSlice(SliceMorsel const & slice, size_t query)
+        {
+            auto & budget = *m_budgets[query];
+            const size_t maxMatches = budget.GetRemaining(slice.m_shard);
+            if (maxMatches > 0)
+            {
+                m_scratch.Reset();
+                m_matchers[query]->MatchMorsel(slice,
+                                               m_scratch,
+                                               maxMatches,
+                                               m_noCancellation,
+                                               m_instrumentation[query]);
+
+                const size_t count = m_scratch.size();
+                if (count > 0)
+                {
+                    m_matches[query]->Add(m_scratch.m_buffer, count);
+                    budget.Consume(slice.m_shard, count);
+                    AddRun(m_runs[query], slice.m_shard, count);
+                }
+            }
+        }
+
+        std::vector<SliceMorsel> const & m_morsels;
+        std::vector<IMorselMatcher *> const & m_matchers;
+        std::vector<std::unique_ptr<MatchBudget>> & m_budgets;
+        ResultsBuffer & m_scratch;
+        QueryCancellation m_noCancellation;
+        std::vector<std::unique_ptr<ChunkedResultsSink>> m_matches;
+        std::vector<std::vector<MatchRun>> m_runs;
+        std::vector<QueryInstrumentation> m_instrumentation;
+        std::exception_ptr m_error;
+    };
+
+
+    //*************************************************************************
+    //
+    // ParallelMatcher::Counter
+    //
+    // ITaskProcessor that counts the matches in the morsel whose index is the
+    // task id.
+    //
+    //*************************************************************************
+    class ParallelMatcher::Counter : public ITaskProcessor
+    {
+    public:
+        Counter(std::vector<SliceMorsel> const & morsels,
+                IMorselMatcher & matcher)
+          : m_morsels(morsels),
+            m_matcher(matcher),
+            m_matchCount(0)
+        {
+        }
+
+        //
+        // ITaskProcessor methods
+        //
+
+        virtual void ProcessTask(size_t taskId) override
+        {
+            // See Worker::ProcessTask() regarding exceptions.
+            if (m_error == nullptr)
+            {
+                try
+                {
+                    m_matchCount += m_matcher.CountMorsel(m_morsels[taskId],
+                                                          m_instrumentation);
+                }
+                catch (...)
+                {
+                    m_error = std::current_exception();
+                }
+            }
+        }
+
+        virtual void Finished() override
+        {
+        }
+
+        // Returns this counter's match count and adds its quadword and cache
+        // line counts to instrumentation. Rethrows any exception captured on
+        // the worker thread.
+        size_t Merge(QueryInstrumentation & instrumentation)
+        {
+            if (m_error != nullptr)
+            {
+                std::rethrow_exception(m_error);
+            }
+
+            auto & data = m_instrumentation.GetData();
+            instrumentation.IncrementQuadwordCount(data.GetQuadwordCount());
+            instrumentation.IncrementCacheLineCount(data.GetCacheLineCount());
+
+            return m_matchCount;
+        }
+
+    private:
+        std::vector<SliceMorsel> const & m_morsels;
+        IMorselMatcher & m_matcher;
+        size_t m_matchCount;
+        QueryInstrumentation m_instrumentation;
+        std::exception_ptr m_error;
+    };
+
+
+    //*************************************************************************
+    //
+    // ParallelMatcher
+    //
+    //*************************************************************************
+    ParallelMatcher::ParallelMatcher()
+      : m_threadCount(1),
+        m_slicesPerMorsel(1),
+        m_matchLimit((std::numeric_limits<size_t>::max)()),
+        m_shardMatchLimit((std::numeric_limits<size_t>::max)()),
+        m_scratchCapacity(0)
+    {
+    }
+
+
+    void ParallelMatcher::Configure(size_t threadCount, size_t slicesPerMorsel)
+    {
+        CHECK_GT(threadCount, 0u)
+            << "ParallelMatcher requires at least one thread.";
+        CHECK_GT(slicesPerMorsel, 0u)
+            << "SliceMorsels must contain at least one slice.";
+
+        m_threadCount = threadCount;
+        m_slicesPerMorsel = slicesPerMorsel;
+    }
+
+
+    size_t ParallelMatcher::GetThreadCount() const
+    {
+        return m_threadCount;
+    }
+
+
+    void ParallelMatcher::SetMatchLimit(size_t matchLimit,
+                                        size_t shardMatchLimit)
+    {
+        const size_t c_noLimit = (std::numeric_limits<size_t>::max)();
+        m_matchLimit = (matchLimit == 0) ? c_noLimit : matchLimit;
+        m_shardMatchLimit = (shardMatchLimit == 0) ? c_noLimit : shardMatchLimit;
+    }
+
+
+    bool ParallelMatcher::Run(IIngestor const & ingestor,
+                              IMorselMatcher & matcher,
+                              QueryInstrumentation & instrumentation,
+                              IResultsSink & results,
+                              QueryCancellation const & cancellation)
+    {
+        CreateMorsels(ingestor);
+        EnsureBuffers();
+
+        if (m_threadCount == 1)
+        {
+            return RunSerial(matcher, instrumentation, results, cancellation);
+        }
+        else
+        {
+            return RunParallel(ingestor, matcher, instrumentation, results, cancellation);
+        }
+    }
+
+
+    size_t ParallelMatcher::Count(IIngestor const & ingestor,
+                                  IMorselMatcher & matcher,
+                                  QueryInstrumentation & instrumentation)
+    {
+        CreateMorsels(ingestor);
+
+        size_t matchCount = 0;
+
+        if (m_threadCount == 1)
+        {
+            for (auto const & morsel : m_morsels)
+            {
+                matchCount += matcher.CountMorsel(morsel, instrumentation);
+            }
+        }
+        else
+        {
+            const size_t threadCount = (std::min)(m_threadCount,
+                                                  m_morsels.size());
+
+            std::vector<std::unique_ptr<ITaskProcessor>> counters;
+            for (size_t i = 0; i < threadCount; ++i)
+            {
+                counters.push_back(
+                    std::unique_ptr<ITaskProcessor>(
+                        new Counter(m_morsels, matcher)));
+            }
+
+            auto distributor =
+                Factories::CreateTaskDistributor(counters, m_morsels.size());
+            distributor->WaitForCompletion();
+
+            for (auto & counter : counters)
+            {
+                matchCount += static_cast<Counter&>(*counter).Merge(instrumentation);
+            }
+        }
+
+        return matchCount;
+    }
+
+
+    bool ParallelMatcher::RunSerial(IMorselMatcher & matcher,
+                                    QueryInstrumentation & instrumentation,
+                                    IResultsSink & results,
+                                    QueryCancellation const & cancellation)
+    {
+        // Each morsel is an entire shard.
+        size_t remaining = m_matchLimit;
+        bool wasCancelled = false;
+        for (auto const & morsel : m_morsels)
+        {
+            if (remaining == 0 || wasCancelled)
+            {
+                break;
+            }
+
+            remaining -= MatchWindows(matcher,
+                                      morsel,
+                                      *m_scratch[0],
+                                      results,
+                                      (std::min)(remaining, m_shardMatchLimit),
+                                      cancellation,
+                                      instrumentation,
+                                      wasCancelled);
+        }
+
+        return wasCancelled;
+    }
+
+
+    bool ParallelMatcher::RunParallel(IIngestor const & ingestor,
+                                      IMorselMatcher & matcher,
+                                      QueryInstrumentation & instrumentation,
+                                      IResultsSink & results,
+                                      QueryCancellation const & cancellation)
+    {
+        // No point in starting more threads than there are morsels.
+        const size_t threadCount = (std::min)(m_threadCount,
+                                              m_morsels.size());
+
+        MatchBudget budget(ingestor.GetShardCount(),
+                           m_matchLimit,
+                           m_shardMatchLimit);
+
+        std::vector<std::unique_ptr<ITaskProcessor>> workers;
+        for (size_t i = 0; i < threadCount; ++i)
+        {
+            workers.push_back(
+                std::unique_ptr<ITaskProcessor>(
+                    new Worker(*this,
+                               matcher,
+                               budget,
+                               cancellation,
+                               *m_scratch[i],
+                               *m_partitions[i])));
+        }
+
+        auto distributor =
+            Factories::CreateTaskDistributor(workers, m_morsels.size());
+        distributor->WaitForCompletion();
+
+        size_t remaining = m_matchLimit;
+        std::vector<size_t> shardCounts(ingestor.GetShardCount(), 0);
+        bool wasCancelled = false;
+        for (auto & worker : workers)
+        {
+            auto & w = static_cast<Worker&>(*worker);
+            w.Merge(results,
+                    remaining,
+                    m_shardMatchLimit,
+                    shardCounts,
+                    instrumentation);
+            wasCancelled = wasCancelled || w.WasCancelled();
+        }
+
+        return wasCancelled;
+    }
+
+
+    void ParallelMatcher::RunBatch(IIngestor const & ingestor,
+                                   std::vector<IMorselMatcher *> const & matchers,
+                                   std::vector<QueryInstrumentation *> const & instrumentation,
+                                   std::vector<IResultsSink *> const & results)
+    {
+        CHECK_EQ(matchers.size(), instrumentation.size())
+            << "RunBatch() requires one QueryInstrumentation per query.";
+        CHECK_EQ(matchers.size(), results.size())
+            << "RunBatch() requires one IResultsSink per query.";
+
+        if (matchers.size() == 0)
+        {
+            return;
+        }
+
+        CreateMorsels(ingestor);
+        EnsureBuffers();
+
+        if (m_threadCount == 1)
+        {
+            RunBatchSerial(matchers, instrumentation, results);
+        }
+        else
+        {
+            RunBatchParallel(ingestor, matchers, instrumentation, results);
+        }
+    }
+
+
+    void ParallelMatcher::RunBatchSerial(std::vector<IMorselMatcher *> const & matchers,
+                                         std::vector<QueryInstrumentation *> const & instrumentation,
+                                         std::vector<IResultsSink *> const & results)
+    {
+        const size_t queryCount = matchers.size();
+        std::vector<size_t> remaining(queryCount, m_matchLimit);
+        std::vector<size_t> shardRemaining(queryCount);
+        auto & scratch = *m_scratch[0];
+        QueryCancellation noCancellation;
+
+        // Each morsel is an entire shard.
+        for (auto const & morsel : m_morsels)
+        {
+            std::fill(shardRemaining.begin(), shardRemaining.end(), m_shardMatchLimit);
+
+            for (size_t slice = 0; slice < morsel.m_sliceCount; ++slice)
+            {
+                const SliceMorsel single = {
+                    morsel.m_shard,
+                    morsel.m_sliceBuffers + slice,
+                    1
+                };
+
+                for (size_t query = 0; query < queryCount; ++query)
+                {
+                    const size_t maxMatches = (std::min)(remaining[query],
+                                                         shardRemaining[query]);
+                    if (maxMatches > 0)
+                    {
+                        scratch.Reset();
+                        matchers[query]->MatchMorsel(single,
+                                                     scratch,
+                                                     maxMatches,
+                                                     noCancellation,
+                                                     *instrumentation[query]);
+                        results[query]->Add(scratch.m_buffer, scratch.size());
+
+                        const size_t count = scratch.size();
+                        remaining[query] -= count;
+                        shardRemaining[query] -= count;
+                    }
+                }
+            }
+        }
+    }
+
+
+    void ParallelMatcher::RunBatchParallel(IIngestor const & ingestor,
+                                           std::vector<IMorselMatcher *> const & matchers,
+                                           std::vector<QueryInstrumentation *> const & instrumentation,
+                                           std::vector<IResultsSink *> const & results)
+    {
+        const size_t threadCount = (std::min)(m_threadCount,
+                                              m_morsels.size());
+
+        std::vector<std::unique_ptr<MatchBudget>> budgets;
+        for (size_t query = 0; query < matchers.size(); ++query)
+        {
+            budgets.push_back(
+                std::unique_ptr<MatchBudget>(
+                    new MatchBudget(ingestor.GetShardCount(),
+                                    m_matchLimit,
+                                    m_shardMatchLimit)));
+        }
+
+        std::vector<std::unique_ptr<ITaskProcessor>> workers;
+        for (size_t i = 0; i < threadCount; ++i)
+        {
+            workers.push_back(
+                std::unique_ptr<ITaskProcessor>(
+                    new BatchWorker(m_morsels, matchers, budgets, *m_scratch[i])));
+        }
+
+        auto distributor =
+            Factories::CreateTaskDistributor(workers, m_morsels.size());
+        distributor->WaitForCompletion();
+
+        for (size_t query = 0; query < matchers.size(); ++query)
+        {
+            size_t remaining = m_matchLimit;
+            std::vector<size_t> shardCounts(ingestor.GetShardCount(), 0);
+            for (auto & worker : workers)
+            {
+                static_cast<BatchWorker&>(*worker).Merge(query,
+                                                         *results[query],
+                                                         remaining,
+                                                         m_shardMatchLimit,
+                                                         shardCounts,
+                                                         *instrumentation[query]);
+            }
+        }
+    }
+
+
+    size_t ParallelMatcher::MatchWindows(IMorselMatcher & matcher,
+                                         SliceMorsel const & morsel,
+                                         ResultsBuffer & scratch,
+                                         IResultsSink & results,
+                                         size_t maxMatches,
+                                         QueryCancellation const & cancellation,
+                                         QueryInstrumentation & instrumentation,
+                                         bool & wasCancelled) const
+    {
+        // The sink receives matches a window at a time. When there is a
+        // deadline, each window is a single slice so that matches reach the
+        // sink soon after they are found.
+        const size_t slicesPerWindow =
+            cancellation.HasDeadline() ? 1 : m_slicesPerWindow[morsel.m_shard];
+
+        size_t matchCount = 0;
+        for (size_t slice = 0;
+             slice < morsel.m_sliceCount && matchCount < maxMatches;
+             slice += slicesPerWindow)
+        {
+            if (cancellation.IsCancelled())
+            {
+                wasCancelled = true;
+                break;
+            }
+
+            const SliceMorsel window = {
+                morsel.m_shard,
+                morsel.m_sliceBuffers + slice,
+                (std::min)(slicesPerWindow, morsel.m_sliceCount - slice)
+            };
+
+            scratch.Reset();
+            const bool stopped = matcher.MatchMorsel(window,
+                                                     scratch,
+                                                     maxMatches - matchCount,
+                                                     cancellation,
+                                                     instrumentation);
+            results.Add(scratch.m_buffer, scratch.size());
+            matchCount += scratch.size();
+
+            if (stopped)
+            {
+                wasCancelled = true;
+                break;
+            }
+        }
+
+        return matchCount;
+    }
+
+
+    void ParallelMatcher::CreateMorsels(IIngestor const & ingestor)
+    {
+        m_morsels.clear();
+        m_slicesPerWindow.clear();
+
+        size_t scratchCapacity = c_minScratchCapacity;
+        for (ShardId shardId = 0; shardId < ingestor.GetShardCount(); ++shardId)
+        {
+            scratchCapacity = (std::max)(scratchCapacity,
+                                         ingestor.GetShard(shardId).GetSliceCapacity());
+        }
+
+        if (scratchCapacity != m_scratchCapacity)
+        {
+            m_scratch.clear();
+            m_scratchCapacity = scratchCapacity;
+        }
+
+        for (ShardId shardId = 0; shardId < ingestor.GetShardCount(); ++shardId)
+        {
+            auto & shard = ingestor.GetShard(shardId);
+            m_slicesPerWindow.push_back(m_scratchCapacity / shard.GetSliceCapacity());
+
+            auto & sliceBuffers = shard.GetSliceBuffers();
+            const size_t sliceCount = sliceBuffers.size();
+
+            // A single thread processes the whole shard as one morsel.
+            const size_t slicesPerMorsel =
+                (m_threadCount == 1) ? sliceCount : m_slicesPerMorsel;
+
+            for (size_t slice = 0; slice < sliceCount; slice += slicesPerMorsel)
+            {
+                m_morsels.push_back({
+                    shardId,
+                    sliceBuffers.data() + slice,
+                    (std::min)(slicesPerMorsel, sliceCount - slice)
+                });
+            }
+        }
+    }
+
+
+    void ParallelMatcher::EnsureBuffers()
+    {
+        while (m_scratch.size() < m_threadCount)
+        {
+            m_scratch.push_back(
+                std::unique_ptr<ResultsBuffer>(new ResultsBuffer(m_scratchCapacity)));
+        }
+
+        while (m_partitions.size() < m_threadCount)
+        {
+            m_partitions.push_back(
+                std::unique_ptr<ChunkedResultsSink>(new ChunkedResultsSink()));
+        }
+    }
+}
@@ -0,0 +1,243 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <memory>                           // std::unique_ptr embedded.
+#include <stddef.h>                         // size_t embedded.
+#include <vector>                           // std::vector embedded.
+
+#include "BitFunnel/BitFunnelTypes.h"       // ShardId embedded.
+#include "BitFunnel/NonCopyable.h"          // Base class.
+#include "BitFunnel/Plan/ChunkedResultsSink.h"  // ChunkedResultsSink embedded.
+
+
+namespace BitFunnel
+{
+    class IIngestor;
+    class QueryCancellation;
+    class QueryInstrumentation;
+
+    //*************************************************************************
+    //
+    // SliceMorsel
+    //
+    // A contiguous run of slice buffers from a single shard. SliceMorsels are
+    // the unit of work handed out to the ParallelMatcher worker threads.
+    //
+    // The slice buffer pointers are taken from a single call to
+    // IShard::GetSliceBuffers() so that every morsel of a query sees the
+    // same snapshot of the shard.
+    //
+    //*************************************************************************
+    struct SliceMorsel
+    {
+        ShardId m_shard;
+        void * const * m_sliceBuffers;
+        size_t m_sliceCount;
+    };
+
+
+    //*************************************************************************
+    //
+    // IMorselMatcher
+    //
+    // An abstract base class or interface for the engine specific code that
+    // runs a compiled query against a single SliceMorsel.
+    //
+    // Thread safety: MatchMorsel() may be called concurrently from multiple
+    // threads, each with its own ResultsBuffer and QueryInstrumentation.
+    //
+    //*************************************************************************
+    class IMorselMatcher
+    {
+    public:
+        virtual ~IMorselMatcher() {}
+
+        // Matches the slices in morsel, appending at most maxMatches matches
+        // to results. Implementations should stop scanning as soon as the
+        // limit is reached. The ParallelMatcher guarantees that results has
+        // room for every document in the morsel. Implementations should
+        // also stop once cancellation.IsCancelled(), checking it before
+        // each slice and every cancellation.GetStride() iterations. Returns
+        // true if matching stopped because of the cancellation, leaving
+        // slices or iterations unscanned.
+        virtual bool MatchMorsel(SliceMorsel const & morsel,
+                                 ResultsBuffer & results,
+                                 size_t maxMatches,
+                                 QueryCancellation const & cancellation,
+                                 QueryInstrumentation & instrumentation) = 0;
+
+        // Returns the number of matches in morsel without extracting them.
+        virtual size_t CountMorsel(SliceMorsel const & morsel,
+                                   QueryInstrumentation & instrumentation) = 0;
+    };
+
+
+    //*************************************************************************
+    //
+    // ParallelMatcher
+    //
+    // Divides the slice buffers of every shard into SliceMorsels and runs an
+    // IMorselMatcher over each of them.
+    //
+    // The IMorselMatchers write into a fixed size scratch ResultsBuffer. To
+    // bound its size, morsels are matched in windows of as many slices as
+    // the scratch buffer can hold, and the matches from each window are
+    // passed on to an IResultsSink.
+    //
+    // With a single thread, each shard is one morsel and the morsels are
+    // matched in order on the calling thread, directly into the caller's
+    // IResultsSink. With more than one thread, morsels of slicesPerMorsel
+    // slices are distributed to worker threads. Each worker matches into a
+    // private ChunkedResultsSink partition which is appended to the caller's
+    // IResultsSink once all of the morsels have been processed.
+    //
+    // Run() checks its QueryCancellation, including the deadline, before
+    // each window. When there is a deadline, each window is a single slice.
+    //
+    // Matching may be limited to a total number of matches and to a number
+    // of matches from each shard. Once a limit is reached, the remaining
+    // slices that it covers are not scanned. With multiple threads, morsels
+    // that are already in flight when a limit is reached may overshoot it;
+    // their excess matches are discarded when the partitions are appended.
+    //
+    // The caller must hold a Token for the duration of Run() to ensure that
+    // the slice buffers are not recycled while the workers are using them.
+    //
+    //*************************************************************************
+    class ParallelMatcher : public NonCopyable
+    {
+    public:
+        ParallelMatcher();
+
+        // Sets the number of worker threads and the number of slices in
+        // each morsel. A threadCount of 1 disables parallel matching.
+        void Configure(size_t threadCount, size_t slicesPerMorsel);
+
+        size_t GetThreadCount() const;
+
+        // Limits the number of matches returned by Run() to matchLimit in
+        // total and to shardMatchLimit from any single shard. A value of
+        // zero means no limit.
+        void SetMatchLimit(size_t matchLimit, size_t shardMatchLimit);
+
+        // Stops early, with the matches found so far in results, once
+        // cancellation is cancelled. Returns true if it stopped early, that
+        // is, if cancellation left slices unscanned. A cancellation that
+        // arrives after the last slice has been matched does not count.
+        bool Run(IIngestor const & ingestor,
+                 IMorselMatcher & matcher,
+                 QueryInstrumentation & instrumentation,
+                 IResultsSink & results,
+                 QueryCancellation const & cancellation);
+
+        // Returns the number of matches in all of the slices of every shard.
+        // Match limits do not apply.
+        size_t Count(IIngestor const & ingestor,
+                     IMorselMatcher & matcher,
+                     QueryInstrumentation & instrumentation);
+
+        // Runs a batch of queries in a single pass over the slices. Each
+        // slice is matched against every query in the batch before moving
+        // on to the next slice, so that rows shared by the queries are read
+        // from memory once while they are still in cache. The matches for
+        // matchers[i] are appended to results[i] and its quadword and cache
+        // line counts go to instrumentation[i]. Match limits apply to each
+        // query independently.
+        void RunBatch(IIngestor const & ingestor,
+                      std::vector<IMorselMatcher *> const & matchers,
+                      std::vector<QueryInstrumentation *> const & instrumentation,
+                      std::vector<IResultsSink *> const & results);
+
+    private:
+        class BatchWorker;
+        class Counter;
+        class MatchBudget;
+        class Worker;
+
+        bool RunSerial(IMorselMatcher & matcher,
+                       QueryInstrumentation & instrumentation,
+                       IResultsSink & results,
+                       QueryCancellation const & cancellation);
+
+        bool RunParallel(IIngestor const & ingestor,
+                         IMorselMatcher & matcher,
+                         QueryInstrumentation & instrumentation,
+                         IResultsSink & results,
+                         QueryCancellation const & cancellation);
+
+        void RunBatchSerial(std::vector<IMorselMatcher *> const & matchers,
+                            std::vector<QueryInstrumentation *> const & instrumentation,
+                            std::vector<IResultsSink *> const & results);
+
+        void RunBatchParallel(IIngestor const & ingestor,
+                              std::vector<IMorselMatcher *> const & matchers,
+                              std::vector<QueryInstrumentation *> const & instrumentation,
+                              std::vector<IResultsSink *> const & results);
+
+        // Matches the slices of morsel in windows that fit in scratch,
+        // passing at most maxMatches matches on to results. Stops before
+        // the next window once cancellation is cancelled, and sets
+        // wasCancelled if this left slices unscanned. Returns the number of
+        // matches passed on.
+        size_t MatchWindows(IMorselMatcher & matcher,
+                            SliceMorsel const & morsel,
+                            ResultsBuffer & scratch,
+                            IResultsSink & results,
+                            size_t maxMatches,
+                            QueryCancellation const & cancellation,
+                            QueryInstrumentation & instrumentation,
+                            bool & wasCancelled) const;
+
+        // Also sizes the scratch buffers for the slice capacity of the
+        // shards.
+        void CreateMorsels(IIngestor const & ingestor);
+
+        // Ensures that there are scratch buffers and partitions for
+        // m_threadCount threads.
+        void EnsureBuffers();
+
+        // Minimum number of matches held by a scratch buffer. Scratch
+        // buffers also hold at least one slice.
+        static const size_t c_minScratchCapacity = 1ull << 16;
+
+        size_t m_threadCount;
+        size_t m_slicesPerMorsel;
+
+        // Match limits. Set to the maximum size_t value when there is no
+        // limit.
+        size_t m_matchLimit;
+        size_t m_shardMatchLimit;
+
+        std::vector<SliceMorsel> m_morsels;
+
+        // Number of slices from each shard that fit in a scratch buffer.
+        std::vector<size_t> m_slicesPerWindow;
+
+        // Per-thread scratch buffers and per-worker partitions are retained
+        // between calls to Run() to avoid reallocating them for every query.
+        size_t m_scratchCapacity;
+        std::vector<std::unique_ptr<ResultsBuffer>> m_scratch;
+        std::vector<std::unique_ptr<ChunkedResultsSink>> m_partitions;
+    };
+}
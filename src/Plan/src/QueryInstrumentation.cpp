@@ -38,6 +38,10 @@ namespace BitFunnel
         formatter.WriteField("parse");
         formatter.WriteField("plan");
         formatter.WriteField("match");
+        formatter.WriteField("estimate-unordered");
+        formatter.WriteField("estimate-ordered");
+        formatter.WriteField("estimate-matches");
+        formatter.WriteField("truncated");
         formatter.WriteRowEnd();
     }
 
@@ -53,6 +57,10 @@ namespace BitFunnel
         formatter.WriteField(m_parsingTime);
         formatter.WriteField(m_planningTime);
         formatter.WriteField(m_matchingTime);
+        formatter.WriteField(m_unorderedQuadwordEstimate);
+        formatter.WriteField(m_orderedQuadwordEstimate);
+        formatter.WriteField(m_matchEstimate);
+        formatter.WriteField(m_truncated);
         formatter.WriteRowEnd();
     }
 }
@@ -0,0 +1,465 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <algorithm>                        // std::sort().
+#include <mutex>                            // std::lock_guard, std::unique_lock.
+
+#include "BitFunnel/Exceptions.h"
+#include "BitFunnel/Index/IIngestor.h"
+#include "BitFunnel/Index/IShard.h"
+#include "BitFunnel/Index/ISimpleIndex.h"
+#include "BitFunnel/Plan/TermMatchNode.h"
+#include "LoggerInterfaces/Check.h"
+#include "IPlanRows.h"
+#include "QueryPlanCache.h"
+#include "QueryPlanner.h"
+#include "RowSet.h"
+#include "StringVector.h"
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // CompiledQuery
+    //
+    //*************************************************************************
+    CompiledQuery::CompiledQuery(QueryPlanner const & planner)
+      : m_rowCount(planner.GetRowSet().GetRowCount()),
+        m_matchDensityEstimate(planner.GetMatchDensityEstimate()),
+        m_quadwordEstimate(planner.GetQuadwordEstimate())
+    {
+        RowSet const & rowSet = planner.GetRowSet();
+        for (ShardId shard = 0; shard < rowSet.GetShardCount(); ++shard)
+        {
+            ptrdiff_t const * offsets = rowSet.GetRowOffsets(shard);
+            m_rowOffsets.emplace_back(offsets, offsets + m_rowCount);
+            m_initialRanks.push_back(planner.GetInitialRank(shard));
+        }
+    }
+
+
+    CompiledQuery::CompiledQuery(unsigned rowCount,
+                                 std::vector<std::vector<ptrdiff_t>> const & rowOffsets)
+      : m_rowCount(rowCount),
+        m_initialRanks(rowOffsets.size(), 0),
+        m_rowOffsets(rowOffsets),
+        m_matchDensityEstimate(0.0),
+        m_quadwordEstimate(0.0)
+    {
+    }
+
+
+    CompiledQuery::~CompiledQuery()
+    {
+    }
+
+
+    Rank CompiledQuery::GetInitialRank(ShardId shard) const
+    {
+        return m_initialRanks[shard];
+    }
+
+
+    unsigned CompiledQuery::GetRowCount() const
+    {
+        return m_rowCount;
+    }
+
+
+    ptrdiff_t const * CompiledQuery::GetRowOffsets(ShardId shard) const
+    {
+        return m_rowOffsets[shard].data();
+    }
+
+
+    double CompiledQuery::GetMatchDensityEstimate() const
+    {
+        return m_matchDensityEstimate;
+    }
+
+
+    double CompiledQuery::GetQuadwordEstimate() const
+    {
+        return m_quadwordEstimate;
+    }
+
+
+    //*************************************************************************
+    //
+    // Key normalization
+    //
+    // Each node is written in a self-delimiting form. Terms are prefixed with
+    // their length so that arbitrary term text cannot be confused with the
+    // punctuation used for AND, OR, and NOT.
+    //
+    //*************************************************************************
+    static void AppendCanonicalForm(TermMatchNode const & node,
+                                    std::string & out);
+
+
+    static void AppendText(char const * text, std::string & out)
+    {
+        std::string s(text);
+        out.append(std::to_string(s.size()));
+        out.push_back(':');
+        out.append(s);
+    }
+
+
+    // Gathers the canonical forms of the operands of a chain of nested nodes
+    // of the same type. For example, And(a, And(b, c)) has operands a, b,
+    // and c.
+    static void GatherOperands(TermMatchNode const & node,
+                               TermMatchNode::NodeType type,
+                               std::vector<std::string> & operands)
+    {
+        if (node.GetType() == type && type == TermMatchNode::AndMatch)
+        {
+            auto & andNode = static_cast<TermMatchNode::And const &>(node);
+            GatherOperands(andNode.GetLeft(), type, operands);
+            GatherOperands(andNode.GetRight(), type, operands);
+        }
+        else if (node.GetType() == type && type == TermMatchNode::OrMatch)
+        {
+            auto & orNode = static_cast<TermMatchNode::Or const &>(node);
+            GatherOperands(orNode.GetLeft(), type, operands);
+            GatherOperands(orNode.GetRight(), type, operands);
+        }
+        else
+        {
+            operands.push_back(std::string());
+            AppendCanonicalForm(node, operands.back());
+        }
+    }
+
+
+    static void AppendCanonicalForm(TermMatchNode const & node,
+                                    std::string & out)
+    {
+        switch (node.GetType())
+        {
+        case TermMatchNode::AndMatch:
+        case TermMatchNode::OrMatch:
+            {
+                std::vector<std::string> operands;
+                GatherOperands(node, node.GetType(), operands);
+                std::sort(operands.begin(), operands.end());
+
+                out.append(node.GetType() == TermMatchNode::AndMatch ? "&(" : "|(");
+                for (auto const & operand : operands)
+                {
+                    out.append(operand);
+                }
+                out.push_back(')');
+            }
+            break;
+        case TermMatchNode::NotMatch:
+            out.append("!(");
+            AppendCanonicalForm(
+                static_cast<TermMatchNode::Not const &>(node).GetChild(),
+                out);
+            out.push_back(')');
+            break;
+        case TermMatchNode::PhraseMatch:
+            {
+                auto & phrase = static_cast<TermMatchNode::Phrase const &>(node);
+                auto & grams = phrase.GetGrams();
+                out.push_back('P');
+                out.append(std::to_string(static_cast<unsigned>(phrase.GetStreamId())));
+                out.push_back('(');
+                for (unsigned i = 0; i < grams.GetSize(); ++i)
+                {
+                    AppendText(grams[i], out);
+                }
+                out.push_back(')');
+            }
+            break;
+        case TermMatchNode::UnigramMatch:
+            {
+                auto & unigram = static_cast<TermMatchNode::Unigram const &>(node);
+                out.push_back('U');
+                out.append(std::to_string(static_cast<unsigned>(unigram.GetStreamId())));
+                out.push_back(':');
+                AppendText(unigram.GetText(), out);
+            }
+            break;
+        case TermMatchNode::FactMatch:
+            out.push_back('F');
+            out.append(std::to_string(
+                static_cast<TermMatchNode::Fact const &>(node).GetFact()));
+            out.push_back(';');
+            break;
+        default:
+            RecoverableError error("QueryPlanCache::CreateKey: unexpected node type.");
+            throw error;
+        }
+    }
+
+
+    //*************************************************************************
+    //
+    // QueryPlanCache
+    //
+    //*************************************************************************
+    QueryPlanCache::QueryPlanCache(size_t capacity)
+      : m_capacity(capacity),
+        m_clock(0),
+        m_hitCount(0),
+        m_missCount(0),
+        m_ingestor(nullptr),
+        m_entryCount(0),
+        m_invalidationCount(0)
+    {
+        CHECK_GT(capacity, 0u)
+            << "QueryPlanCache capacity must be at least one entry.";
+    }
+
+
+    std::string QueryPlanCache::CreateKey(TermMatchNode const & tree)
+    {
+        std::string key;
+        AppendCanonicalForm(tree, key);
+        return key;
+    }
+
+
+    std::shared_ptr<CompiledQuery const>
+        QueryPlanCache::Find(Engine engine,
+                             std::string const & key,
+                             ISimpleIndex const & index)
+    {
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(m_lock);
+
+            if (IsLayoutCurrent(index))
+            {
+                EntryMap const & entries = m_entries[static_cast<size_t>(engine)];
+                auto it = entries.find(key);
+                if (it == entries.end())
+                {
+                    ++m_missCount;
+                    return nullptr;
+                }
+
+                ++m_hitCount;
+                it->second->m_lastUsed.store(++m_clock, std::memory_order_relaxed);
+
+                return it->second->m_query;
+            }
+        }
+
+        // The entries were compiled for another layout.
+        UpdateLayout(index);
+        ++m_missCount;
+        return nullptr;
+    }
+
+
+    void QueryPlanCache::Add(Engine engine,
+                             std::string const & key,
+                             std::shared_ptr<CompiledQuery const> query,
+                             ISimpleIndex const & index)
+    {
+        std::string entryKey(key);
+        std::unique_ptr<Entry> entry(new Entry(query, ++m_clock));
+
+        std::unique_lock<std::shared_timed_mutex> lock(m_lock);
+
+        if (!IsLayoutCurrent(index))
+        {
+            lock.unlock();
+            UpdateLayout(index);
+            lock.lock();
+
+            // Another thread switched the cache to a different layout in
+            // the meantime.
+            if (!IsLayoutCurrent(index))
+            {
+                return;
+            }
+        }
+
+        EntryMap & entries = m_entries[static_cast<size_t>(engine)];
+        if (entries.find(entryKey) != entries.end())
+        {
+            return;
+        }
+
+        if (m_entryCount == m_capacity)
+        {
+            EvictLeastRecentlyUsed();
+        }
+
+        entries.emplace(std::move(entryKey), std::move(entry));
+        ++m_entryCount;
+    }
+
+
+    void QueryPlanCache::Clear()
+    {
+        std::lock_guard<std::shared_timed_mutex> lock(m_lock);
+        ClearEntries();
+    }
+
+
+    size_t QueryPlanCache::GetCapacity() const
+    {
+        return m_capacity;
+    }
+
+
+    size_t QueryPlanCache::GetEntryCount() const
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(m_lock);
+        return m_entryCount;
+    }
+
+
+    size_t QueryPlanCache::GetHitCount() const
+    {
+        return m_hitCount;
+    }
+
+
+    size_t QueryPlanCache::GetMissCount() const
+    {
+        return m_missCount;
+    }
+
+
+    size_t QueryPlanCache::GetInvalidationCount() const
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(m_lock);
+        return m_invalidationCount;
+    }
+
+
+    bool QueryPlanCache::ShardLayout::operator==(ShardLayout const & other) const
+    {
+        return m_termTable == other.m_termTable
+            && m_sliceCapacity == other.m_sliceCapacity
+            && m_sliceBufferSize == other.m_sliceBufferSize;
+    }
+
+
+    QueryPlanCache::Entry::Entry(std::shared_ptr<CompiledQuery const> query,
+                                 uint64_t stamp)
+      : m_query(query),
+        m_lastUsed(stamp)
+    {
+    }
+
+
+    bool QueryPlanCache::IsLayoutCurrent(ISimpleIndex const & index) const
+    {
+        IIngestor const & ingestor = index.GetIngestor();
+
+        if (m_ingestor != &ingestor || m_layout.size() != ingestor.GetShardCount())
+        {
+            return false;
+        }
+
+        for (ShardId shardId = 0; shardId < m_layout.size(); ++shardId)
+        {
+            IShard const & shard = ingestor.GetShard(shardId);
+            ShardLayout const & layout = m_layout[shardId];
+            if (layout.m_termTable != &index.GetTermTable(shardId)
+                || layout.m_sliceCapacity != shard.GetSliceCapacity()
+                || layout.m_sliceBufferSize != shard.GetSliceBufferSize())
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+
+    void QueryPlanCache::UpdateLayout(ISimpleIndex const & index)
+    {
+        IIngestor const & ingestor = index.GetIngestor();
+
+        std::vector<ShardLayout> layout;
+        for (ShardId shardId = 0; shardId < ingestor.GetShardCount(); ++shardId)
+        {
+            IShard const & shard = ingestor.GetShard(shardId);
+            layout.push_back({
+                &index.GetTermTable(shardId),
+                shard.GetSliceCapacity(),
+                shard.GetSliceBufferSize()
+            });
+        }
+
+        std::lock_guard<std::shared_timed_mutex> lock(m_lock);
+
+        if (m_ingestor != &ingestor || !(m_layout == layout))
+        {
+            if (m_entryCount > 0)
+            {
+                ++m_invalidationCount;
+            }
+            ClearEntries();
+            m_ingestor = &ingestor;
+            m_layout.swap(layout);
+        }
+    }
+
+
+    void QueryPlanCache::EvictLeastRecentlyUsed()
+    {
+        EntryMap * oldestMap = nullptr;
+        EntryMap::iterator oldest;
+        uint64_t oldestStamp = 0;
+
+        for (auto & entries : m_entries)
+        {
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+            {
+                const uint64_t stamp =
+                    it->second->m_lastUsed.load(std::memory_order_relaxed);
+                if (oldestMap == nullptr || stamp < oldestStamp)
+                {
+                    oldestMap = &entries;
+                    oldest = it;
+                    oldestStamp = stamp;
+                }
+            }
+        }
+
+        if (oldestMap != nullptr)
+        {
+            oldestMap->erase(oldest);
+            --m_entryCount;
+        }
+    }
+
+
+    void QueryPlanCache::ClearEntries()
+    {
+        for (auto & entries : m_entries)
+        {
+            entries.clear();
+        }
+        m_entryCount = 0;
+    }
+}
@@ -0,0 +1,225 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <atomic>                           // std::atomic embedded.
+#include <memory>                           // std::shared_ptr embedded.
+#include <shared_mutex>                     // std::shared_timed_mutex embedded.
+#include <stddef.h>                         // size_t, ptrdiff_t embedded.
+#include <stdint.h>                         // uint64_t embedded.
+#include <string>                           // std::string embedded.
+#include <unordered_map>                    // std::unordered_map embedded.
+#include <vector>                           // std::vector embedded.
+
+#include "BitFunnel/BitFunnelTypes.h"       // Rank, ShardId embedded.
+#include "BitFunnel/NonCopyable.h"          // Base class.
+
+
+namespace BitFunnel
+{
+    class IIngestor;
+    class ISimpleIndex;
+    class ITermTable;
+    class QueryPlanner;
+    class TermMatchNode;
+
+    //*************************************************************************
+    //
+    // CompiledQuery
+    //
+    // The engine independent portion of a planned and compiled query. Holds a
+    // private copy of the per-shard row offsets from the RowSet and of the
+    // per-shard initial ranks so that the CompiledQuery outlives the
+    // allocator used during planning. The
+    // ByteCodeQueryEngine and NativeJITQueryEngine derive from this class to
+    // add their sealed ByteCodeGenerator or native function.
+    // WideDisjunctionPlan derives from it to run queries that need too many
+    // rows for the QueryPlanner.
+    //
+    // A CompiledQuery is immutable once constructed and may be run from
+    // several threads at once.
+    //
+    //*************************************************************************
+    class CompiledQuery : public NonCopyable
+    {
+    public:
+        CompiledQuery(QueryPlanner const & planner);
+
+        virtual ~CompiledQuery();
+
+        Rank GetInitialRank(ShardId shard) const;
+        unsigned GetRowCount() const;
+        ptrdiff_t const * GetRowOffsets(ShardId shard) const;
+
+        // The QueryPlanner's estimates of the fraction of documents that
+        // match and of the row quadwords read. Both are 0 for plans not made
+        // by the QueryPlanner. Used by MatchEstimator.
+        double GetMatchDensityEstimate() const;
+        double GetQuadwordEstimate() const;
+
+    protected:
+        // Constructs a CompiledQuery that is not based on a QueryPlanner.
+        // The rowOffsets parameter holds the offsets of rowCount rows for
+        // each shard. Matching starts at rank 0 in every shard.
+        CompiledQuery(unsigned rowCount,
+                      std::vector<std::vector<ptrdiff_t>> const & rowOffsets);
+
+    private:
+        const unsigned m_rowCount;
+        std::vector<Rank> m_initialRanks;
+        std::vector<std::vector<ptrdiff_t>> m_rowOffsets;
+        const double m_matchDensityEstimate;
+        const double m_quadwordEstimate;
+    };
+
+
+    //*************************************************************************
+    //
+    // QueryPlanCache
+    //
+    // A thread-safe, least recently used cache of CompiledQueries which may
+    // be shared by any number of query engines running against the same
+    // index.
+    //
+    // Entries are keyed on a normalized form of the TermMatchNode tree in
+    // which the children of nested AND and OR nodes are flattened and sorted.
+    // Queries that differ only in the order of their conjuncts or disjuncts
+    // therefore share a single entry.
+    //
+    // CompiledQueries embed row offsets which depend on the TermTables and
+    // slice layout of each shard. The cache records a signature of this
+    // layout and discards all of its entries when it changes. Entries are
+    // held by std::shared_ptr so that a query that is running while its
+    // entry is evicted or invalidated is unaffected.
+    //
+    // Find() runs on every query, so it only takes a shared lock and does
+    // not allocate. Instead of moving entries within a least recently used
+    // list, a hit stamps its entry with the value of a counter. Add() takes
+    // the exclusive lock and evicts the entry with the oldest stamp.
+    //
+    //*************************************************************************
+    class QueryPlanCache : public NonCopyable
+    {
+    public:
+        // The kind of engine that compiled an entry. Entries for different
+        // engines are stored under different keys. NativeCodeCount entries
+        // hold code compiled for IQueryEngine::Count().
+        enum class Engine
+        {
+            ByteCode,
+            NativeCode,
+            NativeCodeCount
+        };
+
+        // Constructs a cache that holds at most capacity entries.
+        QueryPlanCache(size_t capacity);
+
+        // Returns the normalized key for a TermMatchNode tree.
+        static std::string CreateKey(TermMatchNode const & tree);
+
+        // Returns the CompiledQuery for key or nullptr if there is none. If
+        // the layout of index has changed since the last call, the cache is
+        // cleared before the lookup.
+        std::shared_ptr<CompiledQuery const>
+            Find(Engine engine,
+                 std::string const & key,
+                 ISimpleIndex const & index);
+
+        // Adds a CompiledQuery for key, evicting the least recently used
+        // entry if the cache is full. If another thread has already added
+        // an entry for key, the existing entry is kept.
+        void Add(Engine engine,
+                 std::string const & key,
+                 std::shared_ptr<CompiledQuery const> query,
+                 ISimpleIndex const & index);
+
+        // Discards all entries.
+        void Clear();
+
+        size_t GetCapacity() const;
+        size_t GetEntryCount() const;
+        size_t GetHitCount() const;
+        size_t GetMissCount() const;
+        size_t GetInvalidationCount() const;
+
+    private:
+        // Per-shard properties that determine the row offsets embedded in a
+        // CompiledQuery.
+        struct ShardLayout
+        {
+            ITermTable const * m_termTable;
+            size_t m_sliceCapacity;
+            size_t m_sliceBufferSize;
+
+            bool operator==(ShardLayout const & other) const;
+        };
+
+        class Entry : public NonCopyable
+        {
+        public:
+            Entry(std::shared_ptr<CompiledQuery const> query, uint64_t stamp);
+
+            std::shared_ptr<CompiledQuery const> m_query;
+
+            // Value of m_clock when the entry was last used. Updated by
+            // Find() under the shared lock.
+            std::atomic<uint64_t> m_lastUsed;
+        };
+
+        // There is one map for each value of Engine so that lookups do not
+        // have to build a combined key.
+        typedef std::unordered_map<std::string, std::unique_ptr<Entry>> EntryMap;
+        static const size_t c_engineCount = 3;
+
+        // Returns true if the layout of index is the same as m_layout. Does
+        // not allocate. Must be called with m_lock held in either mode.
+        bool IsLayoutCurrent(ISimpleIndex const & index) const;
+
+        // Clears the cache and records the layout of index if it differs
+        // from m_layout. The new layout is built before the exclusive lock
+        // is taken.
+        void UpdateLayout(ISimpleIndex const & index);
+
+        // Must be called with m_lock held exclusively.
+        void EvictLeastRecentlyUsed();
+        void ClearEntries();
+
+        const size_t m_capacity;
+
+        std::atomic<uint64_t> m_clock;
+        std::atomic<size_t> m_hitCount;
+        std::atomic<size_t> m_missCount;
+
+        // m_lock protects all of the members below. Entries are only added
+        // and removed with the lock held exclusively.
+        mutable std::shared_timed_mutex m_lock;
+
+        IIngestor const * m_ingestor;
+        std::vector<ShardLayout> m_layout;
+
+        EntryMap m_entries[c_engineCount];
+        size_t m_entryCount;
+
+        size_t m_invalidationCount;
+    };
+}
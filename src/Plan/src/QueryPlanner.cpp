@@ -20,22 +20,32 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#include <new>                                  // For placement new.
+#include <utility>                              // std::pair.
+#include <vector>                               // std::vector.
+
 #include "BitFunnel/Allocators/IAllocator.h"
 #include "BitFunnel/IDiagnosticStream.h"
 #include "BitFunnel/Index/IIngestor.h"
 #include "BitFunnel/Index/ISimpleIndex.h"
 #include "BitFunnel/Index/IShard.h"
+#include "BitFunnel/Index/ITermTable.h"
+#include "BitFunnel/Index/RowIdSequence.h"
 #include "BitFunnel/Index/Token.h"
 #include "BitFunnel/Plan/Factories.h"
 #include "BitFunnel/Plan/QueryInstrumentation.h"
 #include "BitFunnel/Plan/TermMatchNode.h"
 #include "BitFunnel/Utilities/Factories.h"
 #include "BitFunnel/Utilities/IObjectFormatter.h"
+#include "CommonRowHoister.h"
 #include "CompileNode.h"
 #include "IPlanRows.h"
+#include "MatchEstimator.h"
 #include "MatchTreeRewriter.h"
 #include "QueryPlanner.h"
 #include "RankDownCompiler.h"
+#include "RowDensityOrderer.h"
+#include "RowMatchNode.h"
 #include "RowSet.h"
 #include "TermPlan.h"
 #include "TermPlanConverter.h"
@@ -46,6 +56,174 @@ namespace BitFunnel
 
     unsigned const c_targetCrossProductTermCount = 180;
 
+
+    static void FlattenAnd(RowMatchNode const & node,
+                           std::vector<RowMatchNode const *> & operands)
+    {
+        if (node.GetType() == RowMatchNode::AndMatch)
+        {
+            RowMatchNode::And const & andNode =
+                static_cast<RowMatchNode::And const &>(node);
+            FlattenAnd(andNode.GetLeft(), operands);
+            FlattenAnd(andNode.GetRight(), operands);
+        }
+        else
+        {
+            operands.push_back(&node);
+        }
+    }
+
+
+    // Returns a copy of node without the rows that are redundant in shard.
+    // A row is redundant in an and-expression if it maps to the shard's
+    // match-all row or to the same physical row as an earlier operand. These
+    // rows are introduced by AbstractRowEnumerator to pad terms that have
+    // fewer rows at some rank in shard than in other shards. Each
+    // and-expression keeps at least one row so that the tree retains the
+    // form expected by the RankDownCompiler. Returns node itself if there
+    // is nothing to remove.
+    static RowMatchNode const & SpecializeForShard(RowMatchNode const & node,
+                                                   IPlanRows const & planRows,
+                                                   ShardId shard,
+                                                   RowId const & matchAll,
+                                                   IAllocator & allocator)
+    {
+        switch (node.GetType())
+        {
+        case RowMatchNode::AndMatch:
+            {
+                std::vector<RowMatchNode const *> operands;
+                FlattenAnd(node, operands);
+
+                std::vector<bool> redundant(operands.size(), false);
+                std::vector<AbstractRow> kept;
+                size_t lastRedundant = operands.size();
+                bool changed = false;
+
+                for (size_t i = 0; i < operands.size(); ++i)
+                {
+                    if (operands[i]->GetType() == RowMatchNode::RowMatch)
+                    {
+                        AbstractRow const & row =
+                            static_cast<RowMatchNode::Row const *>(operands[i])->GetRow();
+                        RowId const & physical = planRows.PhysicalRow(shard, row.GetId());
+
+                        redundant[i] = !row.IsInverted() && physical == matchAll;
+                        for (auto const & other : kept)
+                        {
+                            if (other.IsInverted() == row.IsInverted() &&
+                                planRows.PhysicalRow(shard, other.GetId()) == physical)
+                            {
+                                redundant[i] = true;
+                            }
+                        }
+
+                        if (redundant[i])
+                        {
+                            lastRedundant = i;
+                        }
+                        else
+                        {
+                            kept.push_back(row);
+                        }
+                    }
+                    else
+                    {
+                        RowMatchNode const & child =
+                            SpecializeForShard(*operands[i],
+                                               planRows,
+                                               shard,
+                                               matchAll,
+                                               allocator);
+                        if (&child != operands[i])
+                        {
+                            operands[i] = &child;
+                            changed = true;
+                        }
+                    }
+                }
+
+                if (kept.size() == 0 && lastRedundant < operands.size())
+                {
+                    redundant[lastRedundant] = false;
+                }
+
+                std::vector<RowMatchNode const *> remaining;
+                for (size_t i = 0; i < operands.size(); ++i)
+                {
+                    if (redundant[i])
+                    {
+                        changed = true;
+                    }
+                    else
+                    {
+                        remaining.push_back(operands[i]);
+                    }
+                }
+
+                if (!changed)
+                {
+                    return node;
+                }
+
+                RowMatchNode const * tree = remaining.back();
+                for (size_t i = remaining.size() - 1; i > 0; --i)
+                {
+                    tree = new (allocator.Allocate(sizeof(RowMatchNode::And)))
+                                RowMatchNode::And(*remaining[i - 1], *tree);
+                }
+                return *tree;
+            }
+        case RowMatchNode::OrMatch:
+            {
+                RowMatchNode::Or const & orNode =
+                    static_cast<RowMatchNode::Or const &>(node);
+                RowMatchNode const & left =
+                    SpecializeForShard(orNode.GetLeft(), planRows, shard, matchAll, allocator);
+                RowMatchNode const & right =
+                    SpecializeForShard(orNode.GetRight(), planRows, shard, matchAll, allocator);
+                if (&left == &orNode.GetLeft() && &right == &orNode.GetRight())
+                {
+                    return node;
+                }
+                return *new (allocator.Allocate(sizeof(RowMatchNode::Or)))
+                            RowMatchNode::Or(left, right);
+            }
+        case RowMatchNode::NotMatch:
+            {
+                RowMatchNode::Not const & notNode =
+                    static_cast<RowMatchNode::Not const &>(node);
+                RowMatchNode const & child =
+                    SpecializeForShard(notNode.GetChild(), planRows, shard, matchAll, allocator);
+                if (&child == &notNode.GetChild())
+                {
+                    return node;
+                }
+                return *new (allocator.Allocate(sizeof(RowMatchNode::Not)))
+                            RowMatchNode::Not(child);
+            }
+        case RowMatchNode::ReportMatch:
+            {
+                RowMatchNode::Report const & reportNode =
+                    static_cast<RowMatchNode::Report const &>(node);
+                if (reportNode.GetChild() == nullptr)
+                {
+                    return node;
+                }
+                RowMatchNode const & child =
+                    SpecializeForShard(*reportNode.GetChild(), planRows, shard, matchAll, allocator);
+                if (&child == reportNode.GetChild())
+                {
+                    return node;
+                }
+                return *new (allocator.Allocate(sizeof(RowMatchNode::Report)))
+                            RowMatchNode::Report(&child);
+            }
+        default:
+            return node;
+        }
+    }
+
     // TODO: this should take a TermPlan instead of a TermMatchNode when we have
     // scoring and query preferences.
     QueryPlanner::QueryPlanner(TermMatchNode const & tree,
@@ -53,7 +231,10 @@ namespace BitFunnel
                                ISimpleIndex const & index,
                                IAllocator & matchTreeAllocator,
                                IDiagnosticStream & diagnosticStream,
-                               QueryInstrumentation & instrumentation)
+                               QueryInstrumentation & instrumentation,
+                               TermRowCache * termRowCache)
+      : m_quadwordEstimate(0.0),
+        m_matchDensityEstimate(1.0)
     {
         if (diagnosticStream.IsEnabled("planning/term"))
         {
@@ -67,10 +248,13 @@ namespace BitFunnel
             out << std::endl;
         }
 
+        std::vector<std::pair<unsigned, unsigned>> termRows;
         RowPlan const & rowPlan =
             TermPlanConverter::BuildRowPlan(tree,
                                             index,
-                                            matchTreeAllocator);
+                                            matchTreeAllocator,
+                                            termRowCache,
+                                            &termRows);
 
         if (diagnosticStream.IsEnabled("planning/row"))
         {
@@ -129,11 +313,110 @@ namespace BitFunnel
             out << std::endl;
         }
 
-        // Compile the match tree into CompileNodes.
-        RankDownCompiler compiler(matchTreeAllocator);
-        compiler.Compile(rewritten);
-        m_initialRank = compiler.GetMaximumRank();
-        m_compileTree = &compiler.CreateTree(m_initialRank);
+        // Within each rank, order the rows of every and-expression so that
+        // the sparsest rows are intersected first.
+        std::vector<double> densities =
+            RowDensityOrderer::EstimateDensities(index, *m_planRows);
+        RowDensityOrderer orderer(densities, matchTreeAllocator);
+        RowMatchNode const & ordered = orderer.Reorder(rewritten);
+
+        MatchEstimator estimator(densities, termRows);
+        m_matchDensityEstimate = estimator.EstimateMatchDensity(tree);
+
+        // Scale the per-quadword estimates to the whole index so that they
+        // can be compared with the quadword count measured by the matcher.
+        double rankZeroQuadwordCount = 0.0;
+        {
+            IIngestor & ingestor = index.GetIngestor();
+            auto token = ingestor.GetTokenManager().RequestToken();
+            for (ShardId shard = 0; shard < ingestor.GetShardCount(); ++shard)
+            {
+                IShard & s = ingestor.GetShard(shard);
+                rankZeroQuadwordCount +=
+                    static_cast<double>(s.GetSliceBuffers().size() *
+                                        (s.GetSliceCapacity() >> 6));
+            }
+        }
+        m_quadwordEstimate =
+            rankZeroQuadwordCount * orderer.EstimateQuadwordCount(ordered);
+        instrumentation.SetQuadwordEstimates(
+            rankZeroQuadwordCount * orderer.EstimateQuadwordCount(rewritten),
+            m_quadwordEstimate);
+
+        if (diagnosticStream.IsEnabled("planning/reorder"))
+        {
+            std::ostream& out = diagnosticStream.GetStream();
+            std::unique_ptr<IObjectFormatter>
+                formatter(Factories::CreateObjectFormatter(diagnosticStream.GetStream()));
+
+            out << "--------------------" << std::endl;
+            out << "Reordered Plan:" << std::endl;
+            ordered.Format(*formatter);
+            out << std::endl;
+            out << "  Estimated quadwords (unordered): "
+                << instrumentation.GetData().GetUnorderedQuadwordEstimate()
+                << std::endl;
+            out << "  Estimated quadwords (ordered): "
+                << instrumentation.GetData().GetOrderedQuadwordEstimate()
+                << std::endl;
+        }
+
+        // Compile the match tree into CompileNodes for each shard. Shards
+        // that have no padding rows share the tree compiled for the first
+        // of them.
+        CompileNode const * sharedTree = nullptr;
+        Rank sharedRank = 0;
+        std::vector<unsigned> const rowClasses =
+            CommonRowHoister::GetRowClasses(*m_planRows);
+        for (ShardId shard = 0 ; shard < m_planRows->GetShardCount(); ++shard)
+        {
+            RowId const matchAll =
+                *RowIdSequence(ITermTable::GetMatchAllTerm(),
+                               m_planRows->GetTermTable(shard)).begin();
+            RowMatchNode const & specialized =
+                SpecializeForShard(ordered,
+                                   *m_planRows,
+                                   shard,
+                                   matchAll,
+                                   matchTreeAllocator);
+
+            if (&specialized == &ordered && sharedTree != nullptr)
+            {
+                m_compileTrees.push_back(sharedTree);
+                m_initialRanks.push_back(sharedRank);
+                continue;
+            }
+
+            RankDownCompiler compiler(matchTreeAllocator);
+            compiler.Compile(specialized);
+            const Rank initialRank = compiler.GetMaximumRank();
+            CompileNode const & branchTree = compiler.CreateTree(initialRank);
+
+            // Load rows shared by the branches of or-expressions once,
+            // before the branches.
+            CommonRowHoister hoister(rowClasses, matchTreeAllocator);
+            CompileNode const & compileTree = hoister.Hoist(branchTree);
+
+            if (diagnosticStream.IsEnabled("planning/hoist"))
+            {
+                std::ostream& out = diagnosticStream.GetStream();
+                out << "--------------------" << std::endl;
+                out << "Hoisted Rows (shard " << shard << "):" << std::endl;
+                out << "  Row reads (before): "
+                    << CommonRowHoister::CountRowReads(branchTree) << std::endl;
+                out << "  Row reads (after): "
+                    << CommonRowHoister::CountRowReads(compileTree) << std::endl;
+            }
+
+            if (&specialized == &ordered)
+            {
+                sharedTree = &compileTree;
+                sharedRank = initialRank;
+            }
+
+            m_compileTrees.push_back(&compileTree);
+            m_initialRanks.push_back(initialRank);
+        }
 
         if (diagnosticStream.IsEnabled("planning/compile"))
         {
@@ -143,8 +426,14 @@ namespace BitFunnel
 
             out << "--------------------" << std::endl;
             out << "Compile Nodes:" << std::endl;
-            m_compileTree->Format(*formatter);
-            out << std::endl;
+            for (ShardId shard = 0 ; shard < m_compileTrees.size(); ++shard)
+            {
+                out << "  Shard " << shard
+                    << " (initial rank " << m_initialRanks[shard] << "):"
+                    << std::endl;
+                m_compileTrees[shard]->Format(*formatter);
+                out << std::endl;
+            }
         }
 
         m_rowSet = std::unique_ptr<RowSet>(new RowSet(index, *m_planRows, matchTreeAllocator));
@@ -165,14 +454,14 @@ namespace BitFunnel
     }
 
 
-    CompileNode const & QueryPlanner::GetCompileTree() const
+    CompileNode const & QueryPlanner::GetCompileTree(ShardId shard) const
     {
-        return *m_compileTree;
+        return *m_compileTrees[shard];
     }
 
-    Rank QueryPlanner::GetInitialRank() const
+    Rank QueryPlanner::GetInitialRank(ShardId shard) const
     {
-        return m_initialRank;
+        return m_initialRanks[shard];
     }
 
     RowSet const & QueryPlanner::GetRowSet() const
@@ -184,4 +473,14 @@ namespace BitFunnel
     {
         return *m_planRows;
     }
+
+    double QueryPlanner::GetQuadwordEstimate() const
+    {
+        return m_quadwordEstimate;
+    }
+
+    double QueryPlanner::GetMatchDensityEstimate() const
+    {
+        return m_matchDensityEstimate;
+    }
 }
@@ -22,46 +22,87 @@
 
 #pragma once
 
+#include <vector>                         // std::vector embedded.
+
+#include "BitFunnel/BitFunnelTypes.h"     // Rank, ShardId embedded.
 #include "BitFunnel/NonCopyable.h"        // Inherits from NonCopyable.
 #include "RowSet.h"
 
 
 namespace BitFunnel
 {
+    class CompileNode;
+    class IDiagnosticStream;
     class IPlanRows;
     class ISimpleIndex;
     class IThreadResources;
     class QueryInstrumentation;
     class RowSet;
     class TermMatchNode;
-
+    class TermRowCache;
+
+    //*************************************************************************
+    //
+    // QueryPlanner
+    //
+    // Converts a TermMatchNode tree into a CompileNode tree for each shard.
+    //
+    // The shards of an index have different TermTables, so a term may have
+    // rows at a given rank in one shard and none in another. In the latter
+    // case the plan pads the missing rows with the shard's match-all row or
+    // with a copy of another row. The planner removes these padding rows
+    // from each shard's plan before compilation, so that every shard gets
+    // its own initial rank and avoids loading rows that cannot eliminate
+    // any matches. Shards whose plans need no specialization share a single
+    // CompileNode tree.
+    //
+    //*************************************************************************
     class QueryPlanner : public NonCopyable
     {
     public:
-        // Constructs a QueryPlanner with the specified resources.
+        // Constructs a QueryPlanner with the specified resources. If
+        // termRowCache is not nullptr, the rows for each term are taken from
+        // the cache when possible.
         QueryPlanner(TermMatchNode const & tree,
                      unsigned targetRowCount,
                      ISimpleIndex const & index,
                      IAllocator & matchTreeAllocator,
                      IDiagnosticStream& diagnosticStream,
-                     QueryInstrumentation & instrumentation);
+                     QueryInstrumentation & instrumentation,
+                     TermRowCache * termRowCache = nullptr);
 
-        CompileNode const & GetCompileTree() const;
+        // Returns the CompileNode tree for a shard. Shards that share a tree
+        // return the same reference.
+        CompileNode const & GetCompileTree(ShardId shard) const;
 
-        Rank GetInitialRank() const;
+        // Returns the rank at which matching starts in a shard.
+        Rank GetInitialRank(ShardId shard) const;
 
         RowSet const & GetRowSet() const;
 
         IPlanRows const & GetPlanRows() const;
 
+        // Returns the expected number of row quadwords the matcher will read
+        // across all shards, estimated from the sampled densities of the
+        // plan's rows.
+        double GetQuadwordEstimate() const;
+
+        // Returns the expected fraction of documents that match the plan,
+        // estimated by a MatchEstimator from the same densities.
+        double GetMatchDensityEstimate() const;
+
     private:
-        CompileNode const * m_compileTree;
+        std::vector<CompileNode const *> m_compileTrees;
 
-        Rank m_initialRank;
+        std::vector<Rank> m_initialRanks;
 
         std::unique_ptr<RowSet> m_rowSet;
         
         IPlanRows const * m_planRows;
 
+        double m_quadwordEstimate;
+
+        double m_matchDensityEstimate;
+
     };
 }
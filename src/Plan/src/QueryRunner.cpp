@@ -20,29 +20,40 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#include <algorithm>            // std::max(), std::min().
 #include <condition_variable>
+#include <iomanip>              // std::setw().
 #include <iostream>             // Used for DiagnosticStream ref; not actually used.
+#include <sstream>              // std::stringstream.
+#include <utility>              // std::pair.
 
 #include "BitFunnel/Configuration/Factories.h"
 #include "BitFunnel/Configuration/IStreamConfiguration.h"
 #include "BitFunnel/IDiagnosticStream.h"
 #include "BitFunnel/Index/IIngestor.h"
 #include "BitFunnel/Index/ISimpleIndex.h"
+#include "BitFunnel/Plan/ChunkedResultsSink.h"
 #include "BitFunnel/Plan/Factories.h"
 #include "BitFunnel/Plan/QueryInstrumentation.h"
 #include "BitFunnel/Plan/IQueryEngine.h"
 #include "BitFunnel/Plan/QueryParser.h"
 #include "BitFunnel/Plan/QueryRunner.h"
-#include "BitFunnel/Plan/ResultsBuffer.h"
 #include "BitFunnel/Utilities/Factories.h"
 #include "BitFunnel/Utilities/Allocator.h"
+#include "BitFunnel/Utilities/LatencyHistogram.h"
 #include "ByteCodeQueryEngine.h"
 #include "CsvTsv/Csv.h"
+#include "LoggerInterfaces/Check.h"
 #include "NativeJITQueryEngine.h"
+#include "QueryPlanCache.h"
+#include "TermRowCache.h"
 
 
 namespace BitFunnel
 {
+    // Percentiles reported for the latency of each phase.
+    static const double c_latencyPercentiles[] = { 50, 90, 99, 99.9 };
+
     QueryRunner::Statistics::Statistics(
         size_t threadCount,
         size_t uniqueQueryCount,
@@ -51,7 +62,13 @@ namespace BitFunnel
         double elapsedTime,
         double parsingTime,
         double planningTime,
-        double matchingTime)
+        double matchingTime,
+        size_t planCacheHits,
+        size_t planCacheMisses,
+        size_t matchTreeHighWaterMark,
+        LatencyHistogram const & parsingLatencies,
+        LatencyHistogram const & planningLatencies,
+        LatencyHistogram const & matchingLatencies)
       : m_threadCount(threadCount),
         m_uniqueQueryCount(uniqueQueryCount),
         m_processedCount(processedCount),
@@ -59,7 +76,13 @@ namespace BitFunnel
         m_elapsedTime(elapsedTime),
         m_parsingLatency(parsingTime),
         m_planningLatency(planningTime),
-        m_matchingLatency(matchingTime)
+        m_matchingLatency(matchingTime),
+        m_planCacheHits(planCacheHits),
+        m_planCacheMisses(planCacheMisses),
+        m_matchTreeHighWaterMark(matchTreeHighWaterMark),
+        m_parsingLatencies(parsingLatencies),
+        m_planningLatencies(planningLatencies),
+        m_matchingLatencies(matchingLatencies)
     {
     }
 
@@ -89,6 +112,82 @@ namespace BitFunnel
             << "QPS: " << m_processedCount / m_elapsedTime << std::endl
             << "MPS: " << m_matchCount / m_elapsedTime << std::endl
             << "MPQ: " << static_cast<double>(m_matchCount) / m_processedCount << std::endl;
+
+        if (m_planCacheHits + m_planCacheMisses > 0)
+        {
+            out
+                << "Plan cache hits: " << m_planCacheHits << std::endl
+                << "Plan cache misses: " << m_planCacheMisses << std::endl;
+        }
+
+        out << "Match tree arena high water mark (bytes): "
+            << m_matchTreeHighWaterMark << std::endl;
+
+        const std::vector<Phase> phases = GetPhases();
+
+        out << "Latency percentiles (seconds):" << std::endl
+            << std::setw(10) << "phase";
+        for (auto p : c_latencyPercentiles)
+        {
+            std::stringstream label;
+            label << "p" << p;
+            out << std::setw(14) << label.str();
+        }
+        out << std::setw(14) << "max" << std::endl;
+
+        for (auto const & phase : phases)
+        {
+            out << std::setw(10) << phase.first;
+            for (auto p : c_latencyPercentiles)
+            {
+                out << std::setw(14) << phase.second->GetPercentile(p);
+            }
+            out << std::setw(14) << phase.second->GetMax() << std::endl;
+        }
+    }
+
+
+    void QueryRunner::Statistics::WriteLatencyPercentiles(std::ostream& out) const
+    {
+        const std::vector<Phase> phases = GetPhases();
+
+        CsvTsv::CsvTableFormatter formatter(out);
+
+        formatter.WriteField("phase");
+        formatter.WriteField("count");
+        for (auto p : c_latencyPercentiles)
+        {
+            std::stringstream label;
+            label << "p" << p;
+            formatter.WriteField(label.str());
+        }
+        formatter.WriteField("max");
+        formatter.WriteField("mean");
+        formatter.WriteRowEnd();
+
+        for (auto const & phase : phases)
+        {
+            formatter.WriteField(phase.first);
+            formatter.WriteField(phase.second->GetCount());
+            for (auto p : c_latencyPercentiles)
+            {
+                formatter.WriteField(phase.second->GetPercentile(p));
+            }
+            formatter.WriteField(phase.second->GetMax());
+            formatter.WriteField(phase.second->GetMean());
+            formatter.WriteRowEnd();
+        }
+    }
+
+
+    std::vector<QueryRunner::Statistics::Phase>
+        QueryRunner::Statistics::GetPhases() const
+    {
+        return {
+            { "parsing", &m_parsingLatencies },
+            { "planning", &m_planningLatencies },
+            { "matching", &m_matchingLatencies }
+        };
     }
 
 
@@ -166,9 +265,14 @@ namespace BitFunnel
                        IStreamConfiguration const & config,
                        std::vector<std::string> const & queries,
                        std::vector<QueryInstrumentation::Data> & results,
-                       size_t maxResultCount,
                        bool useNativeCode,
                        bool countCacheLines,
+                       QueryPlanCache * planCache,
+                       TermRowCache * termRowCache,
+                       size_t batchSize,
+                       size_t prefetchDistance,
+                       bool prefetchNonTemporal,
+                       bool specializeShards,
                        ThreadSynchronizer& synchronizer);
 
         //
@@ -178,24 +282,59 @@ namespace BitFunnel
         virtual void ProcessTask(size_t taskId) override;
         virtual void Finished() override;
 
+        // Adds the latencies of the queries run by this processor to the
+        // histograms passed in.
+        void MergeLatencies(LatencyHistogram & parsing,
+                            LatencyHistogram & planning,
+                            LatencyHistogram & matching) const;
+
+        // Returns the largest number of bytes that this processor's match
+        // tree arena has held for one query.
+        size_t GetMatchTreeHighWaterMark() const;
+
     private:
+        // Runs the query for m_results[resultId] by itself.
+        void RunOne(size_t resultId);
+
+        // Runs the queries for m_results[firstResultId] onwards as a single
+        // batch. Returns false if any query in the batch failed.
+        bool RunBatch(size_t firstResultId, size_t count);
+
+        // Records the latencies of a successful query.
+        void RecordLatencies(QueryInstrumentation::Data & data);
+
         //
         // constructor parameters
         //
         std::vector<std::string> const & m_queries;
         std::vector<QueryInstrumentation::Data> & m_results;
+        size_t m_batchSize;
         ThreadSynchronizer& m_synchronizer;
 
-        std::vector<ResultsBuffer::Result> m_matches;
+        ChunkedResultsSink m_matches;
 
-        ResultsBuffer m_resultsBuffer;
+        // One ChunkedResultsSink for each query in a batch. Only used when
+        // m_batchSize is greater than one.
+        std::vector<std::unique_ptr<ChunkedResultsSink>> m_batchResults;
 
         std::unique_ptr<IQueryEngine> m_queryEngine;
 
         size_t m_queriesProcessed;
 
-        // TODO: Issue #390. Trec 2006 Efficiency Topic 43860 is too bit for
-        // c_allocatorSize == 1ull << 17 when using TreatmentClassicBitsliced:
+        // Per-query latencies of the queries run by this processor. Each
+        // processor keeps its own histograms so that recording does not
+        // contend with other threads.
+        LatencyHistogram m_parsingLatencies;
+        LatencyHistogram m_planningLatencies;
+        LatencyHistogram m_matchingLatencies;
+
+        // Initial size of the match tree arena, which grows to fit larger
+        // queries. Also the fixed size of the NativeJIT expression tree
+        // allocator and of each code buffer.
+        // TODO: Issue #390. With TreatmentClassicBitsliced, Trec 2006
+        // Efficiency Topic 43860 overflowed c_allocatorSize == 1ull << 17.
+        // The match tree arena now grows, but the fixed NativeJIT expression
+        // tree allocator and code buffers may still overflow for it:
         //     the nps air quality monitoring program provides information on ozone
         //     levels acid rain and visibility impairment in parks from 1990 1999
         //     of the 28 parks that were monitored for visibility
@@ -207,30 +346,57 @@ namespace BitFunnel
                                    IStreamConfiguration const & config,
                                    std::vector<std::string> const & queries,
                                    std::vector<QueryInstrumentation::Data> & results,
-                                   size_t maxResultCount,
                                    bool useNativeCode,
                                    bool countCacheLines,
+                                   QueryPlanCache * planCache,
+                                   TermRowCache * termRowCache,
+                                   size_t batchSize,
+                                   size_t prefetchDistance,
+                                   bool prefetchNonTemporal,
+                                   bool specializeShards,
                                    ThreadSynchronizer& synchronizer)
       : m_queries(queries),
         m_results(results),
+        m_batchSize(batchSize),
         m_synchronizer(synchronizer),
-        m_matches(maxResultCount, {nullptr, 0}),
-        m_resultsBuffer(index.GetIngestor().GetDocumentCount()),
         m_queriesProcessed(0)
     {
         if (useNativeCode)
         {
-            m_queryEngine = std::unique_ptr<IQueryEngine>(new NativeJITQueryEngine(index, config, c_allocatorSize, c_allocatorSize));
+            auto engine = new NativeJITQueryEngine(index,
+                                                   config,
+                                                   c_allocatorSize,
+                                                   c_allocatorSize,
+                                                   planCache,
+                                                   termRowCache);
+            engine->SetPrefetch(prefetchDistance, prefetchNonTemporal);
+            engine->SetShardSpecialization(specializeShards);
+            m_queryEngine = std::unique_ptr<IQueryEngine>(engine);
         }
         else
         {
-            m_queryEngine = std::unique_ptr<IQueryEngine>(new ByteCodeQueryEngine(index, config, c_allocatorSize));
+            m_queryEngine = std::unique_ptr<IQueryEngine>(
+                new ByteCodeQueryEngine(index,
+                                        config,
+                                        c_allocatorSize,
+                                        planCache,
+                                        termRowCache));
         }
 
         if (countCacheLines)
         {
             m_queryEngine->EnableDiagnostic("planning/countcachelines");
         }
+
+        if (m_batchSize > 1)
+        {
+            for (size_t i = 0; i < m_batchSize; ++i)
+            {
+                m_batchResults.push_back(
+                    std::unique_ptr<ChunkedResultsSink>(
+                        new ChunkedResultsSink()));
+            }
+        }
     }
 
 
@@ -243,9 +409,33 @@ namespace BitFunnel
         }
         ++m_queriesProcessed;
 
+        if (m_batchSize == 1)
+        {
+            RunOne(taskId);
+        }
+        else
+        {
+            // Each task is a batch of m_batchSize consecutive queries. If
+            // the batch fails, run its queries one at a time so that only
+            // the queries that caused the failure are counted as failed.
+            const size_t first = taskId * m_batchSize;
+            const size_t count = (std::min)(m_batchSize, m_results.size() - first);
+            if (!RunBatch(first, count))
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    RunOne(first + i);
+                }
+            }
+        }
+    }
+
+
+    void QueryProcessor::RunOne(size_t resultId)
+    {
         QueryInstrumentation instrumentation;
 
-        size_t queryId = taskId % m_queries.size();
+        size_t queryId = resultId % m_queries.size();
 
         // Parse and run the query, catching ParseError or other RecoverableError
         try
@@ -257,7 +447,7 @@ namespace BitFunnel
             {
                 m_queryEngine->Run(tree,
                                    instrumentation,
-                                   m_resultsBuffer);
+                                   m_matches);
             }
         }
         catch (RecoverableError e)
@@ -266,7 +456,52 @@ namespace BitFunnel
             // The instrumentation for this query will show that it didn't succeed.
         }
 
-        m_results[taskId] = instrumentation.GetData();
+        m_results[resultId] = instrumentation.GetData();
+        RecordLatencies(m_results[resultId]);
+    }
+
+
+    bool QueryProcessor::RunBatch(size_t firstResultId, size_t count)
+    {
+        std::vector<QueryInstrumentation> instrumentation(count);
+        std::vector<char const *> queries;
+        std::vector<QueryInstrumentation *> batchInstrumentation;
+        std::vector<IResultsSink *> batchResults;
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t queryId = (firstResultId + i) % m_queries.size();
+            queries.push_back(m_queries[queryId].c_str());
+            batchInstrumentation.push_back(&instrumentation[i]);
+            batchResults.push_back(m_batchResults[i].get());
+        }
+
+        try
+        {
+            m_queryEngine->RunBatch(queries, batchInstrumentation, batchResults);
+        }
+        catch (RecoverableError const & e)
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            m_results[firstResultId + i] = instrumentation[i].GetData();
+            RecordLatencies(m_results[firstResultId + i]);
+        }
+
+        return true;
+    }
+
+
+    void QueryProcessor::RecordLatencies(QueryInstrumentation::Data & data)
+    {
+        if (data.GetSucceeded())
+        {
+            m_parsingLatencies.Record(data.GetParsingTime());
+            m_planningLatencies.Record(data.GetPlanningTime());
+            m_matchingLatencies.Record(data.GetMatchingTime());
+        }
     }
 
 
@@ -274,6 +509,22 @@ namespace BitFunnel
     {
     }
 
+
+    void QueryProcessor::MergeLatencies(LatencyHistogram & parsing,
+                                        LatencyHistogram & planning,
+                                        LatencyHistogram & matching) const
+    {
+        parsing.Merge(m_parsingLatencies);
+        planning.Merge(m_planningLatencies);
+        matching.Merge(m_matchingLatencies);
+    }
+
+
+    size_t QueryProcessor::GetMatchTreeHighWaterMark() const
+    {
+        return m_queryEngine->GetMatchTreeHighWaterMark();
+    }
+
     //*************************************************************************
     //
     // QueryRunner
@@ -292,8 +543,6 @@ namespace BitFunnel
 
         auto config = Factories::CreateStreamConfiguration();
 
-        size_t maxResultCount = index.GetIngestor().GetDocumentCount();
-
         ThreadSynchronizer synchronizer(1);
 
         QueryProcessor
@@ -301,9 +550,14 @@ namespace BitFunnel
                       *config,
                       queries,
                       results,
-                      maxResultCount,
                       useNativeCode,
                       countCacheLines,
+                      nullptr,
+                      nullptr,
+                      1,
+                      0,
+                      false,
+                      false,
                       synchronizer);
         processor.ProcessTask(0);
         processor.Finished();
@@ -319,37 +573,79 @@ namespace BitFunnel
         std::vector<std::string> const & queries,
         size_t iterations,
         bool useNativeCode,
-        bool countCacheLines)
+        bool countCacheLines,
+        bool cachePlans,
+        size_t batchSize,
+        size_t prefetchDistance,
+        bool prefetchNonTemporal,
+        bool specializeShards)
     {
+        CHECK_GT(batchSize, 0u)
+            << "Batch size must be at least one.";
+
         std::vector<QueryInstrumentation::Data> results(queries.size() * iterations);
 
+        // All threads share a single cache so that a query planned by one
+        // thread may be run by the others. Queries that miss the plan cache
+        // share the rows looked up for their terms.
+        std::unique_ptr<QueryPlanCache> planCache;
+        std::unique_ptr<TermRowCache> termRowCache;
+        if (cachePlans)
+        {
+            planCache.reset(new QueryPlanCache(c_planCacheCapacity));
+            termRowCache.reset(new TermRowCache(c_termRowCacheCapacity));
+        }
+
         auto config = Factories::CreateStreamConfiguration();
 
-        size_t maxResultCount = index.GetIngestor().GetDocumentCount();
+        // Each task runs batchSize queries. The ThreadSynchronizer requires
+        // every thread to get at least one task.
+        const size_t taskCount = (results.size() + batchSize - 1) / batchSize;
+        const size_t processorCount =
+            (taskCount > 0) ? (std::min)(threadCount, taskCount) : threadCount;
 
-        ThreadSynchronizer synchronizer(threadCount);
+        ThreadSynchronizer synchronizer(processorCount);
 
         std::vector<std::unique_ptr<ITaskProcessor>> processors;
-        for (size_t i = 0; i < threadCount; ++i) {
+        for (size_t i = 0; i < processorCount; ++i) {
             processors.push_back(
                 std::unique_ptr<ITaskProcessor>(
                     new QueryProcessor(index,
                                        *config,
                                        queries,
                                        results,
-                                       maxResultCount,
                                        useNativeCode,
                                        countCacheLines,
+                                       planCache.get(),
+                                       termRowCache.get(),
+                                       batchSize,
+                                       prefetchDistance,
+                                       prefetchNonTemporal,
+                                       specializeShards,
                                        synchronizer)));
         }
 
         auto distributor =
-            Factories::CreateTaskDistributor(processors,
-                                             queries.size() * iterations);
+            Factories::CreateTaskDistributor(processors, taskCount);
 
         distributor->WaitForCompletion();
         double elapsedTime = synchronizer.GetElapsedTime();
 
+        LatencyHistogram parsingLatencies;
+        LatencyHistogram planningLatencies;
+        LatencyHistogram matchingLatencies;
+        size_t matchTreeHighWaterMark = 0;
+        for (auto const & processor : processors)
+        {
+            QueryProcessor const & p =
+                static_cast<QueryProcessor const &>(*processor);
+            p.MergeLatencies(parsingLatencies,
+                             planningLatencies,
+                             matchingLatencies);
+            matchTreeHighWaterMark =
+                (std::max)(matchTreeHighWaterMark, p.GetMatchTreeHighWaterMark());
+        }
+
         double totalParsingTime = 0;
         double totalPlanningTime = 0;
         double totalMatchingTime = 0;
@@ -375,7 +671,13 @@ namespace BitFunnel
                                                 elapsedTime,
                                                 totalParsingTime,
                                                 totalPlanningTime,
-                                                totalMatchingTime));
+                                                totalMatchingTime,
+                                                cachePlans ? planCache->GetHitCount() : 0,
+                                                cachePlans ? planCache->GetMissCount() : 0,
+                                                matchTreeHighWaterMark,
+                                                parsingLatencies,
+                                                planningLatencies,
+                                                matchingLatencies));
 
         {
             std::cout << "Writing results ..." << std::endl;
@@ -395,6 +697,9 @@ namespace BitFunnel
                 formatter.WriteField(queries[i % queries.size()]);
                 results[i].Format(formatter);
             }
+
+            auto percentiles = outFileManager->QueryLatencyPercentiles().OpenForWrite();
+            statistics.WriteLatencyPercentiles(*percentiles);
         }
 
         return statistics;
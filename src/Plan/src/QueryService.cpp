@@ -0,0 +1,405 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <exception>                            // std::exception.
+#include <memory>                               // std::make_shared().
+
+#include "BitFunnel/Exceptions.h"
+#include "BitFunnel/Index/DocumentHandle.h"
+#include "BitFunnel/Index/IIngestor.h"
+#include "BitFunnel/Index/ISimpleIndex.h"
+#include "BitFunnel/Plan/CallbackResultsSink.h"
+#include "BitFunnel/Plan/Factories.h"
+#include "BitFunnel/Plan/IQueryEngine.h"
+#include "BitFunnel/Plan/QueryInstrumentation.h"
+#include "BitFunnel/Utilities/Factories.h"
+#include "ByteCodeQueryEngine.h"
+#include "LoggerInterfaces/Check.h"
+#include "LoggerInterfaces/Logging.h"
+#include "NativeJITQueryEngine.h"
+#include "QueryPlanCache.h"
+#include "QueryService.h"
+#include "TermRowCache.h"
+
+
+namespace BitFunnel
+{
+    // The QueryService whose worker is running on this thread, if any. Used
+    // to reject calls to Shutdown() from callbacks, which would otherwise
+    // wait forever for their own thread to exit.
+    static thread_local QueryService const * t_workerService = nullptr;
+
+
+    std::unique_ptr<IQueryService>
+        Factories::CreateQueryService(ISimpleIndex const & index,
+                                      IStreamConfiguration const & config,
+                                      size_t threadCount,
+                                      size_t queueCapacity,
+                                      bool useNativeCode,
+                                      bool cachePlans)
+    {
+        return std::unique_ptr<IQueryService>(
+            new QueryService(index,
+                             config,
+                             threadCount,
+                             queueCapacity,
+                             useNativeCode,
+                             cachePlans));
+    }
+
+
+    //*************************************************************************
+    //
+    // QueryService::Worker
+    //
+    // Runs queries taken from the QueryService's queue until the service
+    // shuts down.
+    //
+    //*************************************************************************
+    class QueryService::Worker : public IThreadBase
+    {
+    public:
+        Worker(QueryService & service,
+               ISimpleIndex const & index,
+               IStreamConfiguration const & config,
+               bool useNativeCode,
+               QueryPlanCache * planCache,
+               TermRowCache * termRowCache);
+
+        //
+        // IThreadBase methods
+        //
+        virtual void EntryPoint() override;
+
+    private:
+        // Parses and runs request.m_query.
+        QueryResponse Run(Request & request);
+
+        QueryService & m_service;
+        std::unique_ptr<IQueryEngine> m_queryEngine;
+
+        // Same as QueryRunner's QueryProcessor.
+        static const size_t c_allocatorSize = 1ull << 17;
+    };
+
+
+    QueryService::Worker::Worker(QueryService & service,
+                                 ISimpleIndex const & index,
+                                 IStreamConfiguration const & config,
+                                 bool useNativeCode,
+                                 QueryPlanCache * planCache,
+                                 TermRowCache * termRowCache)
+      : m_service(service)
+    {
+        if (useNativeCode)
+        {
+            m_queryEngine = std::unique_ptr<IQueryEngine>(
+                new NativeJITQueryEngine(index,
+                                         config,
+                                         c_allocatorSize,
+                                         c_allocatorSize,
+                                         planCache,
+                                         termRowCache));
+        }
+        else
+        {
+            m_queryEngine = std::unique_ptr<IQueryEngine>(
+                new ByteCodeQueryEngine(index,
+                                        config,
+                                        c_allocatorSize,
+                                        planCache,
+                                        termRowCache));
+        }
+    }
+
+
+    void QueryService::Worker::EntryPoint()
+    {
+        t_workerService = &m_service;
+
+        Request request;
+        while (m_service.Dequeue(request))
+        {
+            // An exception that escaped the callback would terminate the
+            // process, since nothing above EntryPoint() catches it.
+            try
+            {
+                request.m_callback(Run(request));
+            }
+            catch (std::exception const & e)
+            {
+                LogB(Logging::Error,
+                     "QueryService",
+                     "Exception caught in query callback: %s",
+                     e.what());
+            }
+            catch (...)
+            {
+                LogB(Logging::Error,
+                     "QueryService",
+                     "Exception caught in query callback",
+                     "");
+            }
+        }
+
+        t_workerService = nullptr;
+    }
+
+
+    QueryResponse QueryService::Worker::Run(Request & request)
+    {
+        QueryResponse response;
+        response.m_queueTime = request.m_stopwatch.ElapsedTime();
+        response.m_query = std::move(request.m_query);
+
+        QueryInstrumentation instrumentation;
+
+        // Failures are reported in the response so that the worker can
+        // continue with the next query. An exception that escaped would
+        // terminate the service and leave the submitter waiting. This
+        // includes FatalErrors and failed CHECKs on the matching path.
+        try
+        {
+            auto tree = m_queryEngine->Parse(response.m_query.c_str());
+            instrumentation.FinishParsing();
+
+            if (tree != nullptr)
+            {
+                // DocIds are extracted as the matches stream out of the
+                // engine, so no per-worker results buffer is needed.
+                auto & matches = response.m_matches;
+                CallbackResultsSink results(
+                    [&matches](ResultsBuffer::Result const * batch, size_t count)
+                    {
+                        for (size_t i = 0; i < count; ++i)
+                        {
+                            matches.push_back(batch[i].GetHandle().GetDocId());
+                        }
+                    });
+
+                m_queryEngine->Run(tree, instrumentation, results);
+            }
+            else
+            {
+                response.m_error = "Empty query.";
+            }
+        }
+        catch (std::exception const & e)
+        {
+            response.m_error = e.what();
+        }
+        catch (Logging::CheckException const & e)
+        {
+            response.m_error = e.GetMessage();
+        }
+
+        response.m_instrumentation = instrumentation.GetData();
+        return response;
+    }
+
+
+    //*************************************************************************
+    //
+    // QueryService
+    //
+    //*************************************************************************
+    QueryService::QueryService(ISimpleIndex const & index,
+                               IStreamConfiguration const & config,
+                               size_t threadCount,
+                               size_t queueCapacity,
+                               bool useNativeCode,
+                               bool cachePlans)
+      : m_queueCapacity(queueCapacity),
+        m_shutdown(false),
+        m_rejectedCount(0),
+        m_joined(false)
+    {
+        CHECK_GT(threadCount, 0u)
+            << "QueryService requires at least one thread.";
+        CHECK_GT(queueCapacity, 0u)
+            << "QueryService requires a queue capacity of at least one.";
+
+        if (cachePlans)
+        {
+            m_planCache.reset(new QueryPlanCache(c_planCacheCapacity));
+            m_termRowCache.reset(new TermRowCache(c_termRowCacheCapacity));
+        }
+
+        for (size_t i = 0; i < threadCount; ++i)
+        {
+            m_workers.push_back(
+                std::unique_ptr<IThreadBase>(
+                    new Worker(*this,
+                               index,
+                               config,
+                               useNativeCode,
+                               m_planCache.get(),
+                               m_termRowCache.get())));
+        }
+
+        m_threadManager = Factories::CreateThreadManager(m_workers);
+    }
+
+
+    QueryService::~QueryService()
+    {
+        Shutdown();
+    }
+
+
+    std::future<QueryResponse> QueryService::Submit(std::string const & query)
+    {
+        // std::function requires a copyable target, so the promise is
+        // shared with the callback.
+        auto promise = std::make_shared<std::promise<QueryResponse>>();
+        auto future = promise->get_future();
+        Submit(query, [promise](QueryResponse && response)
+        {
+            promise->set_value(std::move(response));
+        });
+        return future;
+    }
+
+
+    void QueryService::Submit(std::string const & query, Callback callback)
+    {
+        if (!Enqueue(query, std::move(callback), true))
+        {
+            throw RecoverableError("QueryService: submitted query after shutdown.");
+        }
+    }
+
+
+    bool QueryService::TrySubmit(std::string const & query, Callback callback)
+    {
+        return Enqueue(query, std::move(callback), false);
+    }
+
+
+    void QueryService::Shutdown()
+    {
+        if (t_workerService == this)
+        {
+            throw RecoverableError("QueryService: Shutdown() called from a query callback.");
+        }
+
+        std::lock_guard<std::mutex> shutdownLock(m_shutdownLock);
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_shutdown = true;
+        }
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+
+        if (!m_joined)
+        {
+            m_threadManager->WaitForThreads();
+            m_joined = true;
+        }
+    }
+
+
+    size_t QueryService::GetQueueDepth() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_queue.size();
+    }
+
+
+    size_t QueryService::GetQueueCapacity() const
+    {
+        return m_queueCapacity;
+    }
+
+
+    size_t QueryService::GetRejectedCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_rejectedCount;
+    }
+
+
+    size_t QueryService::GetThreadCount() const
+    {
+        return m_workers.size();
+    }
+
+
+    bool QueryService::Enqueue(std::string const & query,
+                               Callback callback,
+                               bool wait)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            if (wait)
+            {
+                // DESIGN NOTE: see BlockingQueue for why this doesn't use
+                // wait with a predicate.
+                while (m_queue.size() >= m_queueCapacity && !m_shutdown)
+                {
+                    m_notFull.wait(lock);
+                }
+            }
+            else if (m_queue.size() >= m_queueCapacity)
+            {
+                ++m_rejectedCount;
+                return false;
+            }
+
+            if (m_shutdown)
+            {
+                return false;
+            }
+
+            m_queue.emplace_back();
+            Request & request = m_queue.back();
+            request.m_query = query;
+            request.m_callback = std::move(callback);
+        }
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+
+    bool QueryService::Dequeue(Request & request)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            while (m_queue.empty() && !m_shutdown)
+            {
+                m_notEmpty.wait(lock);
+            }
+
+            // Queries queued before shutdown are completed.
+            if (m_queue.empty())
+            {
+                return false;
+            }
+
+            request = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        m_notFull.notify_one();
+        return true;
+    }
+}
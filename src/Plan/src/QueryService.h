@@ -0,0 +1,134 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <condition_variable>                   // std::condition_variable embedded.
+#include <deque>                                // std::deque embedded.
+#include <memory>                               // std::unique_ptr embedded.
+#include <mutex>                                // std::mutex embedded.
+#include <vector>                               // std::vector embedded.
+
+#include "BitFunnel/NonCopyable.h"              // Base class.
+#include "BitFunnel/Plan/IQueryService.h"       // Base class.
+#include "BitFunnel/Utilities/IThreadManager.h" // IThreadBase embedded.
+#include "BitFunnel/Utilities/Stopwatch.h"      // Stopwatch embedded.
+
+
+namespace BitFunnel
+{
+    class ISimpleIndex;
+    class IStreamConfiguration;
+    class QueryPlanCache;
+    class TermRowCache;
+
+    //*************************************************************************
+    //
+    // QueryService
+    //
+    // IQueryService implementation. Each worker thread owns a query engine,
+    // which streams its matches into the QueryResponse through a
+    // CallbackResultsSink. The engines optionally share a QueryPlanCache and
+    // a TermRowCache owned by the service.
+    //
+    //*************************************************************************
+    class QueryService : public IQueryService, NonCopyable
+    {
+    public:
+        // Starts threadCount worker threads, which wait for queries. At most
+        // queueCapacity queries may wait for a worker. The index and config
+        // must outlive the service.
+        QueryService(ISimpleIndex const & index,
+                     IStreamConfiguration const & config,
+                     size_t threadCount,
+                     size_t queueCapacity,
+                     bool useNativeCode,
+                     bool cachePlans);
+
+        // Shuts down the service, completing any queued queries.
+        ~QueryService();
+
+        //
+        // IQueryService methods.
+        //
+        virtual std::future<QueryResponse> Submit(std::string const & query) override;
+        virtual void Submit(std::string const & query, Callback callback) override;
+        virtual bool TrySubmit(std::string const & query, Callback callback) override;
+        virtual void Shutdown() override;
+        virtual size_t GetQueueDepth() const override;
+        virtual size_t GetQueueCapacity() const override;
+        virtual size_t GetRejectedCount() const override;
+        virtual size_t GetThreadCount() const override;
+
+        // Maximum number of compiled queries retained when cachePlans is
+        // true.
+        static const size_t c_planCacheCapacity = 1024;
+
+        // Maximum number of terms whose rows are retained when cachePlans is
+        // true.
+        static const size_t c_termRowCacheCapacity = 65536;
+
+    private:
+        class Worker;
+
+        class Request
+        {
+        public:
+            std::string m_query;
+            Callback m_callback;
+
+            // Started when the request is queued.
+            Stopwatch m_stopwatch;
+        };
+
+        // Adds a request for query to the queue. If wait is true, blocks
+        // while the queue is full. Otherwise returns false if the queue is
+        // full. Returns false if the service has been shut down.
+        bool Enqueue(std::string const & query, Callback callback, bool wait);
+
+        // Blocks until a request is available and moves it into request.
+        // Returns false once the service has been shut down and the queue
+        // is empty.
+        bool Dequeue(Request & request);
+
+        std::unique_ptr<QueryPlanCache> m_planCache;
+        std::unique_ptr<TermRowCache> m_termRowCache;
+
+        const size_t m_queueCapacity;
+
+        // Protects the members that follow.
+        mutable std::mutex m_lock;
+        std::condition_variable m_notEmpty;
+        std::condition_variable m_notFull;
+        std::deque<Request> m_queue;
+        bool m_shutdown;
+        size_t m_rejectedCount;
+
+        // Serializes calls to Shutdown() so that the worker threads are
+        // joined exactly once.
+        std::mutex m_shutdownLock;
+        bool m_joined;
+
+        std::vector<std::unique_ptr<IThreadBase>> m_workers;
+        std::unique_ptr<IThreadManager> m_threadManager;
+    };
+}
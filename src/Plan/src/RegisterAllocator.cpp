@@ -101,6 +101,20 @@ namespace BitFunnel
     }
 
 
+    unsigned RegisterAllocator::GetRowCount() const
+    {
+        return m_rowCount;
+    }
+
+
+    bool RegisterAllocator::IsUsed(unsigned id) const
+    {
+        LogAssertB(id < m_rowCount,
+                   "id overflow.");
+        return m_rows[m_mapping[id]].IsUsed();
+    }
+
+
     bool RegisterAllocator::IsRegister(unsigned id) const
     {
         return (m_mapping != nullptr) && (m_mapping[id] < m_registerCount);
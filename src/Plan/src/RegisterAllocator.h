@@ -58,6 +58,13 @@ namespace BitFunnel
                           unsigned registerCount,
                           IAllocator& allocator);
 
+        // Returns the number of abstract rows, as passed to the constructor.
+        unsigned GetRowCount() const;
+
+        // Returns true if the abstract row with the specified id appears in
+        // the CompileNode tree.
+        bool IsUsed(unsigned id) const;
+
         // Returns true if the abstract row with the specified id has been
         // assigned a register.
         bool IsRegister(unsigned id) const;
@@ -0,0 +1,339 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <algorithm>                        // std::stable_sort.
+#include <cmath>                            // std::pow.
+#include <new>                              // For placement new.
+
+#include "BitFunnel/Allocators/IAllocator.h"
+#include "BitFunnel/Exceptions.h"
+#include "BitFunnel/Index/IIngestor.h"
+#include "BitFunnel/Index/ISimpleIndex.h"
+#include "BitFunnel/Index/IShard.h"
+#include "BitFunnel/Index/RowId.h"
+#include "IPlanRows.h"
+#include "RowDensityOrderer.h"
+#include "RowMatchNode.h"
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // RowDensityOrderer
+    //
+    //*************************************************************************
+    RowDensityOrderer::RowDensityOrderer(std::vector<double> const & densities,
+                                         IAllocator& allocator)
+      : m_densities(densities),
+        m_allocator(allocator)
+    {
+    }
+
+
+    RowMatchNode const & RowDensityOrderer::Reorder(RowMatchNode const & root) const
+    {
+        switch (root.GetType())
+        {
+        case RowMatchNode::AndMatch:
+            {
+                std::vector<RowMatchNode const *> operands;
+                Flatten(root, operands);
+
+                bool changed = false;
+                for (auto & operand : operands)
+                {
+                    RowMatchNode const & reordered = Reorder(*operand);
+                    if (&reordered != operand)
+                    {
+                        operand = &reordered;
+                        changed = true;
+                    }
+                }
+
+                // Sort each run of rows with the same rank. Runs are
+                // bounded by rank changes and by non-row operands so that
+                // the position of every Or, Not, and Report is unchanged.
+                auto start = operands.begin();
+                while (start != operands.end())
+                {
+                    if ((*start)->GetType() != RowMatchNode::RowMatch)
+                    {
+                        ++start;
+                        continue;
+                    }
+
+                    Rank rank =
+                        static_cast<RowMatchNode::Row const *>(*start)->GetRow().GetRank();
+                    auto end = start + 1;
+                    while (end != operands.end() &&
+                           (*end)->GetType() == RowMatchNode::RowMatch &&
+                           static_cast<RowMatchNode::Row const *>(*end)->GetRow().GetRank() == rank)
+                    {
+                        ++end;
+                    }
+
+                    if (!std::is_sorted(start, end,
+                        [this](RowMatchNode const * a, RowMatchNode const * b)
+                        {
+                            return GetDensity(*a) < GetDensity(*b);
+                        }))
+                    {
+                        std::stable_sort(start, end,
+                            [this](RowMatchNode const * a, RowMatchNode const * b)
+                            {
+                                return GetDensity(*a) < GetDensity(*b);
+                            });
+                        changed = true;
+                    }
+
+                    start = end;
+                }
+
+                if (!changed)
+                {
+                    return root;
+                }
+
+                // Rebuild as a right-leaning chain, preserving evaluation
+                // order.
+                RowMatchNode const * tree = operands.back();
+                for (size_t i = operands.size() - 1; i > 0; --i)
+                {
+                    tree = new (m_allocator.Allocate(sizeof(RowMatchNode::And)))
+                                RowMatchNode::And(*operands[i - 1], *tree);
+                }
+                return *tree;
+            }
+        case RowMatchNode::OrMatch:
+            {
+                RowMatchNode::Or const & node =
+                    static_cast<RowMatchNode::Or const &>(root);
+                RowMatchNode const & left = Reorder(node.GetLeft());
+                RowMatchNode const & right = Reorder(node.GetRight());
+                if (&left == &node.GetLeft() && &right == &node.GetRight())
+                {
+                    return root;
+                }
+                return *new (m_allocator.Allocate(sizeof(RowMatchNode::Or)))
+                            RowMatchNode::Or(left, right);
+            }
+        case RowMatchNode::NotMatch:
+            {
+                RowMatchNode::Not const & node =
+                    static_cast<RowMatchNode::Not const &>(root);
+                RowMatchNode const & child = Reorder(node.GetChild());
+                if (&child == &node.GetChild())
+                {
+                    return root;
+                }
+                return *new (m_allocator.Allocate(sizeof(RowMatchNode::Not)))
+                            RowMatchNode::Not(child);
+            }
+        case RowMatchNode::ReportMatch:
+            {
+                RowMatchNode::Report const & node =
+                    static_cast<RowMatchNode::Report const &>(root);
+                if (node.GetChild() == nullptr)
+                {
+                    return root;
+                }
+                RowMatchNode const & child = Reorder(*node.GetChild());
+                if (&child == node.GetChild())
+                {
+                    return root;
+                }
+                return *new (m_allocator.Allocate(sizeof(RowMatchNode::Report)))
+                            RowMatchNode::Report(&child);
+            }
+        case RowMatchNode::RowMatch:
+            return root;
+        default:
+            RecoverableError error("RowDensityOrderer::Reorder: unexpected node type.");
+            throw error;
+        }
+    }
+
+
+    double RowDensityOrderer::EstimateQuadwordCount(RowMatchNode const & root) const
+    {
+        double density = 1.0;
+        return Estimate(root, density);
+    }
+
+
+    std::vector<double>
+        RowDensityOrderer::EstimateDensities(ISimpleIndex const & index,
+                                             IPlanRows const & planRows)
+    {
+        std::vector<size_t> setBitCounts(planRows.GetRowCount(), 0);
+        std::vector<size_t> bitCounts(planRows.GetRowCount(), 0);
+
+        IIngestor & ingestor = index.GetIngestor();
+        std::vector<RowId> rows(planRows.GetRowCount());
+        for (ShardId shardId = 0; shardId < planRows.GetShardCount(); ++shardId)
+        {
+            for (unsigned id = 0; id < planRows.GetRowCount(); ++id)
+            {
+                rows[id] = planRows.PhysicalRow(shardId, id);
+            }
+            ingestor.GetShard(shardId).SampleRowDensities(rows,
+                                                          setBitCounts,
+                                                          bitCounts);
+        }
+
+        return GetDensities(setBitCounts, bitCounts);
+    }
+
+
+    std::vector<double>
+        RowDensityOrderer::EstimateDensities(ISimpleIndex const & index,
+                                             std::vector<std::vector<RowId>> const & rows)
+    {
+        const size_t rowCount = rows.empty() ? 0 : rows[0].size();
+        std::vector<size_t> setBitCounts(rowCount, 0);
+        std::vector<size_t> bitCounts(rowCount, 0);
+
+        IIngestor & ingestor = index.GetIngestor();
+        for (ShardId shardId = 0; shardId < rows.size(); ++shardId)
+        {
+            ingestor.GetShard(shardId).SampleRowDensities(rows[shardId],
+                                                          setBitCounts,
+                                                          bitCounts);
+        }
+
+        return GetDensities(setBitCounts, bitCounts);
+    }
+
+
+    std::vector<double>
+        RowDensityOrderer::GetDensities(std::vector<size_t> const & setBitCounts,
+                                        std::vector<size_t> const & bitCounts)
+    {
+        std::vector<double> densities(setBitCounts.size(), 0.0);
+        for (size_t id = 0; id < densities.size(); ++id)
+        {
+            // Rows with no sampled bits are treated as full so that they
+            // sort after every row with a measured density.
+            densities[id] = (bitCounts[id] == 0) ?
+                1.0 :
+                static_cast<double>(setBitCounts[id]) /
+                    static_cast<double>(bitCounts[id]);
+        }
+
+        return densities;
+    }
+
+
+    void RowDensityOrderer::Flatten(RowMatchNode const & node,
+                                    std::vector<RowMatchNode const *> & operands)
+    {
+        if (node.GetType() == RowMatchNode::AndMatch)
+        {
+            RowMatchNode::And const & andNode =
+                static_cast<RowMatchNode::And const &>(node);
+            Flatten(andNode.GetLeft(), operands);
+            Flatten(andNode.GetRight(), operands);
+        }
+        else
+        {
+            operands.push_back(&node);
+        }
+    }
+
+
+    // The accumulator is modeled as a stream of quadwords whose bits are
+    // independently set with probability density. A row is only loaded when
+    // the accumulator quadword is non-zero, and each row quadword at rank r
+    // covers 2^r rank 0 quadwords.
+    double RowDensityOrderer::Estimate(RowMatchNode const & node,
+                                       double & density) const
+    {
+        switch (node.GetType())
+        {
+        case RowMatchNode::AndMatch:
+            {
+                RowMatchNode::And const & andNode =
+                    static_cast<RowMatchNode::And const &>(node);
+                double cost = Estimate(andNode.GetLeft(), density);
+                cost += Estimate(andNode.GetRight(), density);
+                return cost;
+            }
+        case RowMatchNode::OrMatch:
+            {
+                RowMatchNode::Or const & orNode =
+                    static_cast<RowMatchNode::Or const &>(node);
+                double left = density;
+                double right = density;
+                double cost = Estimate(orNode.GetLeft(), left);
+                cost += Estimate(orNode.GetRight(), right);
+                density = 1.0 - (1.0 - left) * (1.0 - right);
+                return cost;
+            }
+        case RowMatchNode::NotMatch:
+            {
+                RowMatchNode::Not const & notNode =
+                    static_cast<RowMatchNode::Not const &>(node);
+                double child = density;
+                double cost = Estimate(notNode.GetChild(), child);
+                density = (std::max)(0.0, density - child);
+                return cost;
+            }
+        case RowMatchNode::ReportMatch:
+            {
+                RowMatchNode::Report const & reportNode =
+                    static_cast<RowMatchNode::Report const &>(node);
+                if (reportNode.GetChild() == nullptr)
+                {
+                    return 0.0;
+                }
+                return Estimate(*reportNode.GetChild(), density);
+            }
+        case RowMatchNode::RowMatch:
+            {
+                RowMatchNode::Row const & row =
+                    static_cast<RowMatchNode::Row const &>(node);
+                double const nonZero = 1.0 - std::pow(1.0 - density, 64.0);
+                double const cost =
+                    nonZero / static_cast<double>(1ull << row.GetRow().GetRank());
+                density *= GetDensity(node);
+                return cost;
+            }
+        default:
+            RecoverableError error("RowDensityOrderer::Estimate: unexpected node type.");
+            throw error;
+        }
+    }
+
+
+    double RowDensityOrderer::GetDensity(RowMatchNode const & node) const
+    {
+        AbstractRow const & row =
+            static_cast<RowMatchNode::Row const &>(node).GetRow();
+
+        // Rows without an estimate are treated as full.
+        double density = (row.GetId() < m_densities.size()) ?
+            m_densities[row.GetId()] : 1.0;
+
+        return row.IsInverted() ? 1.0 - density : density;
+    }
+}
@@ -0,0 +1,106 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <stddef.h>                 // size_t parameter.
+#include <vector>                   // std::vector embedded.
+
+#include "BitFunnel/BitFunnelTypes.h"   // Rank parameter.
+#include "BitFunnel/NonCopyable.h"  // Inherits from NonCopyable.
+
+
+namespace BitFunnel
+{
+    class IAllocator;
+    class IPlanRows;
+    class ISimpleIndex;
+    class RowId;
+    class RowMatchNode;
+
+    //*************************************************************************
+    //
+    // RowDensityOrderer reorders the rows in the and-expressions of a tree
+    // produced by MatchTreeRewriter so that sparse rows are intersected
+    // before dense rows. Since the matcher skips the rest of an
+    // and-expression as soon as the accumulator goes to zero, testing the
+    // rarest rows first reduces the number of quadwords loaded.
+    //
+    // Only consecutive rows of the same rank are reordered, so the
+    // descending rank order required by the RankDownCompiler is preserved.
+    //
+    //*************************************************************************
+    class RowDensityOrderer : NonCopyable
+    {
+    public:
+        // The densities parameter holds the estimated fraction of bits set
+        // in each abstract row, indexed by abstract row id. Nodes created by
+        // Reorder() are allocated from allocator.
+        RowDensityOrderer(std::vector<double> const & densities,
+                          IAllocator& allocator);
+
+        // Returns a tree equivalent to root with the rows of each
+        // and-expression ordered by increasing density. Subtrees that are
+        // unchanged are shared with the input tree.
+        RowMatchNode const & Reorder(RowMatchNode const & root) const;
+
+        // Returns the expected number of quadwords loaded per rank 0
+        // quadword of the index when matching the tree. The estimate
+        // assumes that rows are independent, and is intended for comparing
+        // different orderings of the same tree.
+        double EstimateQuadwordCount(RowMatchNode const & root) const;
+
+        // Returns the density of each abstract row in planRows, estimated
+        // from the samples that each shard of the index caches for its rows.
+        // See IShard::SampleRowDensities().
+        static std::vector<double>
+            EstimateDensities(ISimpleIndex const & index,
+                              IPlanRows const & planRows);
+
+        // Returns the density of each row, where rows[shard][id] is the
+        // physical row for id in shard, estimated in the same way.
+        static std::vector<double>
+            EstimateDensities(ISimpleIndex const & index,
+                              std::vector<std::vector<RowId>> const & rows);
+
+    private:
+        // Converts the counts accumulated by SampleRow() to densities.
+        static std::vector<double>
+            GetDensities(std::vector<size_t> const & setBitCounts,
+                         std::vector<size_t> const & bitCounts);
+
+        // Appends the operands of the and-expression rooted at node to
+        // operands, in evaluation order.
+        static void Flatten(RowMatchNode const & node,
+                            std::vector<RowMatchNode const *> & operands);
+
+        // Returns the estimated quadwords loaded by node per rank 0
+        // quadword. On entry, density holds the density of the
+        // accumulator. On exit it holds the density after node.
+        double Estimate(RowMatchNode const & node, double & density) const;
+
+        double GetDensity(RowMatchNode const & row) const;
+
+        std::vector<double> const & m_densities;
+        IAllocator& m_allocator;
+    };
+}
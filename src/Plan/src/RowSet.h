@@ -29,6 +29,7 @@
 namespace BitFunnel
 {
     class IAllocator;
+    class IPlanRows;
     // class Context;
     // class IIndexData;
     class ISimpleIndex;
@@ -42,10 +42,14 @@ namespace BitFunnel
     TermMatchTreeConverter::TermMatchTreeConverter(const ISimpleIndex& index,
                                                    PlanRows& planRows,
                                                    // bool generateNonBodyPlan,
-                                                   IAllocator& allocator)
+                                                   IAllocator& allocator,
+                                                   TermRowCache * termRowCache,
+                                                   std::vector<std::pair<unsigned, unsigned>> * termRows)
         : m_allocator(allocator),
           m_index(index),
-          m_planRows(planRows)
+          m_planRows(planRows),
+          m_termRowCache(termRowCache),
+          m_termRows(termRows)
           // m_generateNonBodyPlan(generateNonBodyPlan),
 
     {
@@ -87,7 +91,9 @@ namespace BitFunnel
     const RowMatchNode* TermMatchTreeConverter::BuildDocumentActiveMatchNode()
     {
         const Term documentActiveDocumentTerm = ITermTable::GetDocumentActiveTerm();
-        AbstractRowEnumerator rowEnumerator(documentActiveDocumentTerm, m_planRows);
+        AbstractRowEnumerator rowEnumerator(documentActiveDocumentTerm,
+                                            m_planRows,
+                                            m_termRowCache);
         LogAssertB(rowEnumerator.MoveNext(), "couldn't find documentActive row.");
 
         const RowMatchNode* result = RowMatchNode::Builder::CreateRowNode(rowEnumerator.Current(), m_allocator);
@@ -155,6 +161,7 @@ namespace BitFunnel
 
     const RowMatchNode* TermMatchTreeConverter::BuildMatchTree(const TermMatchNode::Phrase& node)
     {
+        const unsigned firstRow = m_planRows.GetRowCount();
         RowMatchNode::Builder builder(RowMatchNode::AndMatch, m_allocator);
         RingBuffer<Term, Term::c_log2MaxGramSize + 1> termBuffer;
 
@@ -175,12 +182,14 @@ namespace BitFunnel
             ProcessNGramBuffer(builder, termBuffer);
         }
 
+        RecordTermRows(firstRow);
         return builder.Complete();
     }
 
 
     const RowMatchNode* TermMatchTreeConverter::BuildMatchTree(const TermMatchNode::Unigram& node)
     {
+        const unsigned firstRow = m_planRows.GetRowCount();
         RowMatchNode::Builder builder(RowMatchNode::AndMatch, m_allocator);
 
         AppendTermRows(builder, GetUnigramTerm(node.GetText(), node.GetStreamId()));
@@ -190,18 +199,30 @@ namespace BitFunnel
         //     AppendTermRows(builder, GetUnigramTerm(node.GetText(),  BitFunnel::NonBody));
         // }
 
+        RecordTermRows(firstRow);
         return builder.Complete();
     }
 
 
     const RowMatchNode* TermMatchTreeConverter::BuildMatchTree(const TermMatchNode::Fact& node)
     {
+        const unsigned firstRow = m_planRows.GetRowCount();
         RowMatchNode::Builder builder(RowMatchNode::AndMatch, m_allocator);
         AppendTermRows(builder, node.GetFact());
+        RecordTermRows(firstRow);
         return builder.Complete();
     }
 
 
+    void TermMatchTreeConverter::RecordTermRows(unsigned firstRow)
+    {
+        if (m_termRows != nullptr)
+        {
+            m_termRows->push_back(std::make_pair(firstRow, m_planRows.GetRowCount()));
+        }
+    }
+
+
     // TODO: is this method needed at all? In the old codebase, there was a
     // giant switch based on Classification in order to determine the Tier. The
     // rewrite contains neither Tier nor Classification.
@@ -239,7 +260,7 @@ namespace BitFunnel
         // from a performance point of view.
         if (!m_planRows.IsFull())
         {
-            AbstractRowEnumerator rowEnumerator(term, m_planRows);
+            AbstractRowEnumerator rowEnumerator(term, m_planRows, m_termRowCache);
             while (rowEnumerator.MoveNext())
             {
                 builder.AddChild(RowMatchNode::Builder::CreateRowNode(rowEnumerator.Current(), m_allocator));
@@ -22,6 +22,9 @@
 
 #pragma once
 
+#include <utility>                          // std::pair parameter.
+#include <vector>                           // std::vector parameter.
+
 #include "BitFunnel/NonCopyable.h"
 #include "BitFunnel/Plan/TermMatchNode.h"
 #include "BitFunnel/Term.h"                 // Constant c_log2MaxGramSize.
@@ -34,16 +37,24 @@ namespace BitFunnel
     class IAllocator;
     class ISimpleIndex;
     class PlanRows;
+    class TermRowCache;
     template <typename T, size_t LOG2_CAPACITY>
     class RingBuffer;
 
     class TermMatchTreeConverter : NonCopyable
     {
     public:
+        // If termRowCache is not nullptr, the rows for each term are taken
+        // from the cache when possible. If termRows is not nullptr, the
+        // range of abstract row ids [first, second) added for each Unigram,
+        // Phrase, and Fact node is appended to it, in the order of a depth
+        // first, left to right traversal of the tree.
         TermMatchTreeConverter(const ISimpleIndex& index,
                                PlanRows& planRows,
                                // bool generateNonBodyPlan,
-                               IAllocator& allocator);
+                               IAllocator& allocator,
+                               TermRowCache * termRowCache = nullptr,
+                               std::vector<std::pair<unsigned, unsigned>> * termRows = nullptr);
 
         const RowMatchNode& BuildRowMatchTree(const TermMatchNode& root);
 
@@ -66,10 +77,19 @@ namespace BitFunnel
         void AppendTermRows(RowMatchNode::Builder& builder, const Term& term);
         void AppendTermRows(RowMatchNode::Builder& builder, const FactHandle& fact);
 
+        // Records the rows added since firstRow for a term.
+        void RecordTermRows(unsigned firstRow);
+
         IAllocator& m_allocator;
         const ISimpleIndex& m_index;
         PlanRows& m_planRows;
 
+        // Optional cache of the rows for each term, shared across queries.
+        TermRowCache * m_termRowCache;
+
+        // Optional record of the rows of each term.
+        std::vector<std::pair<unsigned, unsigned>> * m_termRows;
+
         // A flag to indicate if NonBodyQueryPlan is requested to be generated.
         // bool m_generateNonBodyPlan;
     };
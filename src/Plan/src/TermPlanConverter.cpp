@@ -36,14 +36,20 @@ namespace BitFunnel
     RowPlan const & TermPlanConverter::BuildRowPlan(TermMatchNode const & termMatchNode,
                                                     ISimpleIndex const & index,
                                                     // bool generateNonBodyPlan,
-                                                    IAllocator& allocator)
+                                                    IAllocator& allocator,
+                                                    TermRowCache * termRowCache,
+                                                    std::vector<std::pair<unsigned, unsigned>> * termRows)
     {
         // TODO: will need to modify this if we restore something like
         // generateNonBodyPlan.
         PlanRows& planRows = *new (allocator.Allocate(sizeof(PlanRows)))
             PlanRows(index);
         // TermMatchTreeConverter matchConverter(index, planRows, generateNonBodyPlan, allocator);
-        TermMatchTreeConverter matchConverter(index, planRows, allocator);
+        TermMatchTreeConverter matchConverter(index,
+                                              planRows,
+                                              allocator,
+                                              termRowCache,
+                                              termRows);
 
         RowMatchNode const & matchTree = matchConverter.BuildRowMatchTree(termMatchNode);
 
@@ -22,6 +22,9 @@
 
 #pragma once
 
+#include <utility>      // std::pair parameter.
+#include <vector>       // std::vector parameter.
+
 
 namespace BitFunnel
 {
@@ -31,14 +34,21 @@ namespace BitFunnel
     class ISimpleIndex;
     class RowPlan;
     class TermMatchNode;
+    class TermRowCache;
 
     class TermPlanConverter
     {
     public:
+        // If termRows is not nullptr, the range of abstract row ids
+        // [first, second) of each Unigram, Phrase, and Fact node is appended
+        // to it, in the order of a depth first, left to right traversal of
+        // termMatchNode.
         static const RowPlan& BuildRowPlan(const TermMatchNode& termMatchNode,
                                            const ISimpleIndex& index,
                                            // bool generateNonBodyPlan,
-                                           IAllocator& allocator);
+                                           IAllocator& allocator,
+                                           TermRowCache * termRowCache = nullptr,
+                                           std::vector<std::pair<unsigned, unsigned>> * termRows = nullptr);
 
         // static FalsePositiveEvaluationNode const & BuildFalsePositiveEvaluationPlan(
         //         TermMatchNode const & termMatchNode,
@@ -0,0 +1,232 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <stdint.h>                         // uint64_t.
+
+#include "BitFunnel/Index/RowIdSequence.h"
+#include "IPlanRows.h"
+#include "LoggerInterfaces/Check.h"
+#include "TermRowCache.h"
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // TermRows
+    //
+    //*************************************************************************
+    TermRows::TermRows(Term const & term, IPlanRows const & planRows)
+    {
+        m_shardStart.push_back(0);
+        for (ShardId shard = 0; shard < planRows.GetShardCount(); ++shard)
+        {
+            RowIdSequence rows(term, planRows.GetTermTable(shard));
+            for (auto row : rows)
+            {
+                m_rows.push_back(row);
+            }
+            m_shardStart.push_back(m_rows.size());
+        }
+    }
+
+
+    RowId const * TermRows::GetRows(ShardId shard) const
+    {
+        return m_rows.data() + m_shardStart[shard];
+    }
+
+
+    size_t TermRows::GetRowCount(ShardId shard) const
+    {
+        return m_shardStart[shard + 1] - m_shardStart[shard];
+    }
+
+
+    //*************************************************************************
+    //
+    // TermRowCache
+    //
+    //*************************************************************************
+    TermRowCache::Partition::Partition()
+      : m_hitCount(0),
+        m_missCount(0)
+    {
+    }
+
+
+    TermRowCache::TermRowCache(size_t capacity)
+      : m_capacity(capacity),
+        m_partitionCapacity((capacity + c_partitionCount - 1) / c_partitionCount)
+    {
+        CHECK_GT(capacity, 0u)
+            << "TermRowCache capacity must be at least one entry.";
+    }
+
+
+    std::shared_ptr<TermRows const>
+        TermRowCache::GetRows(Term const & term, IPlanRows const & planRows)
+    {
+        const Key key = { term.GetRawHash(), term.GetStream(), term.GetGramSize() };
+
+        // System terms have small raw hashes, so the key's hash is mixed
+        // before selecting a partition.
+        const uint64_t mixed =
+            static_cast<uint64_t>(KeyHasher()(key)) * 0x9e3779b97f4a7c15ull;
+        Partition & partition = m_partitions[(mixed >> 32) % c_partitionCount];
+
+        {
+            std::lock_guard<std::mutex> lock(partition.m_lock);
+
+            ValidateTermTables(partition, planRows);
+
+            auto it = partition.m_entriesByKey.find(key);
+            if (it != partition.m_entriesByKey.end())
+            {
+                ++partition.m_hitCount;
+
+                // Move the entry to the front of the LRU list.
+                partition.m_entries.splice(partition.m_entries.begin(),
+                                           partition.m_entries,
+                                           it->second);
+                return it->second->m_rows;
+            }
+
+            ++partition.m_missCount;
+        }
+
+        // Look up the rows without holding the lock. If another thread adds
+        // the same term in the meantime, its entry is kept and returned.
+        std::shared_ptr<TermRows const> rows(new TermRows(term, planRows));
+
+        std::lock_guard<std::mutex> lock(partition.m_lock);
+
+        ValidateTermTables(partition, planRows);
+
+        auto it = partition.m_entriesByKey.find(key);
+        if (it != partition.m_entriesByKey.end())
+        {
+            return it->second->m_rows;
+        }
+
+        if (partition.m_entries.size() == m_partitionCapacity)
+        {
+            partition.m_entriesByKey.erase(partition.m_entries.back().m_key);
+            partition.m_entries.pop_back();
+        }
+
+        partition.m_entries.push_front({ key, rows });
+        partition.m_entriesByKey[key] = partition.m_entries.begin();
+
+        return rows;
+    }
+
+
+    void TermRowCache::Clear()
+    {
+        for (auto & partition : m_partitions)
+        {
+            std::lock_guard<std::mutex> lock(partition.m_lock);
+            partition.m_entriesByKey.clear();
+            partition.m_entries.clear();
+        }
+    }
+
+
+    size_t TermRowCache::GetCapacity() const
+    {
+        return m_capacity;
+    }
+
+
+    size_t TermRowCache::GetEntryCount() const
+    {
+        size_t count = 0;
+        for (auto const & partition : m_partitions)
+        {
+            std::lock_guard<std::mutex> lock(partition.m_lock);
+            count += partition.m_entries.size();
+        }
+        return count;
+    }
+
+
+    size_t TermRowCache::GetHitCount() const
+    {
+        size_t count = 0;
+        for (auto const & partition : m_partitions)
+        {
+            std::lock_guard<std::mutex> lock(partition.m_lock);
+            count += partition.m_hitCount;
+        }
+        return count;
+    }
+
+
+    size_t TermRowCache::GetMissCount() const
+    {
+        size_t count = 0;
+        for (auto const & partition : m_partitions)
+        {
+            std::lock_guard<std::mutex> lock(partition.m_lock);
+            count += partition.m_missCount;
+        }
+        return count;
+    }
+
+
+    bool TermRowCache::Key::operator==(Key const & other) const
+    {
+        return m_rawHash == other.m_rawHash
+            && m_stream == other.m_stream
+            && m_gramSize == other.m_gramSize;
+    }
+
+
+    size_t TermRowCache::KeyHasher::operator()(Key const & key) const
+    {
+        return static_cast<size_t>(
+            Term::ComputeGeneralHash(key.m_rawHash, key.m_stream) ^ key.m_gramSize);
+    }
+
+
+    void TermRowCache::ValidateTermTables(Partition & partition,
+                                          IPlanRows const & planRows)
+    {
+        bool valid = (partition.m_termTables.size() == planRows.GetShardCount());
+        for (ShardId shard = 0; valid && shard < planRows.GetShardCount(); ++shard)
+        {
+            valid = (partition.m_termTables[shard] == &planRows.GetTermTable(shard));
+        }
+
+        if (!valid)
+        {
+            partition.m_entriesByKey.clear();
+            partition.m_entries.clear();
+            partition.m_termTables.clear();
+            for (ShardId shard = 0; shard < planRows.GetShardCount(); ++shard)
+            {
+                partition.m_termTables.push_back(&planRows.GetTermTable(shard));
+            }
+        }
+    }
+}
@@ -0,0 +1,162 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <list>                             // std::list embedded.
+#include <memory>                           // std::shared_ptr embedded.
+#include <mutex>                            // std::mutex embedded.
+#include <stddef.h>                         // size_t embedded.
+#include <unordered_map>                    // std::unordered_map embedded.
+#include <vector>                           // std::vector embedded.
+
+#include "BitFunnel/BitFunnelTypes.h"       // ShardId embedded.
+#include "BitFunnel/Index/RowId.h"          // RowId embedded.
+#include "BitFunnel/NonCopyable.h"          // Base class.
+#include "BitFunnel/Term.h"                 // Term::Hash embedded.
+
+
+namespace BitFunnel
+{
+    class IPlanRows;
+    class ITermTable;
+
+    //*************************************************************************
+    //
+    // TermRows
+    //
+    // The RowIds of a single Term in each shard of an index, in the order in
+    // which RowIdSequence enumerates them. TermRows are immutable and may be
+    // read from several threads at once.
+    //
+    //*************************************************************************
+    class TermRows : public NonCopyable
+    {
+    public:
+        // Looks up the rows of term in each of the shards of planRows.
+        TermRows(Term const & term, IPlanRows const & planRows);
+
+        // Returns the first of the term's rows in shard. The rows are
+        // contiguous and GetRowCount(shard) long.
+        RowId const * GetRows(ShardId shard) const;
+        size_t GetRowCount(ShardId shard) const;
+
+    private:
+        std::vector<RowId> m_rows;
+
+        // Rows for shard s are m_rows[m_shardStart[s]..m_shardStart[s + 1]).
+        std::vector<size_t> m_shardStart;
+    };
+
+
+    //*************************************************************************
+    //
+    // TermRowCache
+    //
+    // A thread-safe, bounded cache of the TermRows for recently planned
+    // Terms. It may be shared by any number of query engines running against
+    // the same index so that the TermTable lookups and adhoc row hashing for
+    // frequent terms are performed once per process rather than once per
+    // query.
+    //
+    // The cache is divided into partitions selected by the term's hash, each
+    // with its own lock and least recently used list, so that concurrent
+    // planners rarely contend. Each partition records the TermTables of the
+    // shards it was filled from and discards its entries when they change.
+    // Entries are held by std::shared_ptr so that an entry that is evicted
+    // while a planner is reading it remains valid.
+    //
+    //*************************************************************************
+    class TermRowCache : public NonCopyable
+    {
+    public:
+        // Constructs a cache that holds roughly capacity entries.
+        TermRowCache(size_t capacity);
+
+        // Returns the rows of term in each shard of planRows. The rows are
+        // looked up in the TermTables of planRows if they are not already in
+        // the cache.
+        std::shared_ptr<TermRows const> GetRows(Term const & term,
+                                                IPlanRows const & planRows);
+
+        // Discards all entries.
+        void Clear();
+
+        size_t GetCapacity() const;
+        size_t GetEntryCount() const;
+        size_t GetHitCount() const;
+        size_t GetMissCount() const;
+
+    private:
+        struct Key
+        {
+            Term::Hash m_rawHash;
+            Term::StreamId m_stream;
+            Term::GramSize m_gramSize;
+
+            bool operator==(Key const & other) const;
+        };
+
+        struct KeyHasher
+        {
+            size_t operator()(Key const & key) const;
+        };
+
+        struct Entry
+        {
+            Key m_key;
+            std::shared_ptr<TermRows const> m_rows;
+        };
+
+        typedef std::list<Entry> EntryList;
+
+        class Partition : public NonCopyable
+        {
+        public:
+            Partition();
+
+            // m_lock protects all of the members below.
+            mutable std::mutex m_lock;
+
+            std::vector<ITermTable const *> m_termTables;
+
+            // Most recently used entries are at the front of m_entries.
+            EntryList m_entries;
+            std::unordered_map<Key, EntryList::iterator, KeyHasher> m_entriesByKey;
+
+            size_t m_hitCount;
+            size_t m_missCount;
+        };
+
+        // Clears partition if its entries came from TermTables other than
+        // those of planRows. Must be called with the partition's lock held.
+        static void ValidateTermTables(Partition & partition,
+                                       IPlanRows const & planRows);
+
+        static const size_t c_partitionCount = 16;
+
+        const size_t m_capacity;
+        const size_t m_partitionCapacity;
+
+        Partition m_partitions[c_partitionCount];
+    };
+}
@@ -31,11 +31,11 @@
 #include "BitFunnel/Index/IDocumentCache.h"
 #include "BitFunnel/Index/IIngestor.h"
 #include "BitFunnel/Index/ISimpleIndex.h"
+#include "BitFunnel/Plan/ChunkedResultsSink.h"
 #include "BitFunnel/Plan/Factories.h"
 #include "BitFunnel/Plan/IQueryEngine.h"
 #include "BitFunnel/Plan/QueryInstrumentation.h"
 #include "BitFunnel/Plan/QueryParser.h"     // TODO: Can this move to src/plan?
-#include "BitFunnel/Plan/ResultsBuffer.h"
 #include "BitFunnel/Plan/VerifyOneQuerySynthetic.h"
 #include "BitFunnel/Utilities/Factories.h"
 #include "BitFunnel/Utilities/Primes.h"
@@ -184,7 +184,7 @@ namespace BitFunnel
 
             QueryInstrumentation instrumentation;
 
-            ResultsBuffer results(index.GetIngestor().GetDocumentCount());
+            ChunkedResultsSink results;
 
             queryEngine->Run(tree, instrumentation, results);
 
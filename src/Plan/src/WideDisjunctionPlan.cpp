@@ -0,0 +1,633 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifdef _MSC_VER
+#include <intrin.h>                         // __popcnt64, _BitScanForward64.
+#endif
+
+#include <algorithm>                        // std::stable_sort.
+#include <ostream>                          // std::endl.
+
+#include "BitFunnel/IDiagnosticStream.h"
+#include "BitFunnel/Index/IIngestor.h"
+#include "BitFunnel/Index/IShard.h"
+#include "BitFunnel/Index/ISimpleIndex.h"
+#include "BitFunnel/Index/ITermTable.h"
+#include "BitFunnel/Index/RowIdSequence.h"
+#include "BitFunnel/Plan/QueryCancellation.h"
+#include "BitFunnel/Plan/QueryInstrumentation.h"
+#include "BitFunnel/Plan/ResultsBuffer.h"
+#include "BitFunnel/Plan/TermMatchNode.h"
+#include "BitFunnel/Term.h"
+#include "BitFunnel/Utilities/Allocator.h"
+#include "IPlanRows.h"
+#include "PlanRows.h"
+#include "RowDensityOrderer.h"
+#include "RowMatchNode.h"
+#include "RowPlan.h"
+#include "StringVector.h"
+#include "TermPlanConverter.h"
+#include "WideDisjunctionPlan.h"
+
+
+namespace BitFunnel
+{
+    // Appends the operands of a chain of nested nodes of the given type to
+    // operands. For example, And(a, And(b, c)) has operands a, b, and c.
+    static void Flatten(TermMatchNode const & node,
+                        TermMatchNode::NodeType type,
+                        std::vector<TermMatchNode const *> & operands)
+    {
+        if (node.GetType() == type && type == TermMatchNode::AndMatch)
+        {
+            auto & andNode = static_cast<TermMatchNode::And const &>(node);
+            Flatten(andNode.GetLeft(), type, operands);
+            Flatten(andNode.GetRight(), type, operands);
+        }
+        else if (node.GetType() == type && type == TermMatchNode::OrMatch)
+        {
+            auto & orNode = static_cast<TermMatchNode::Or const &>(node);
+            Flatten(orNode.GetLeft(), type, operands);
+            Flatten(orNode.GetRight(), type, operands);
+        }
+        else
+        {
+            operands.push_back(&node);
+        }
+    }
+
+
+    static bool IsTerm(TermMatchNode const & node)
+    {
+        return node.GetType() == TermMatchNode::UnigramMatch ||
+               node.GetType() == TermMatchNode::PhraseMatch ||
+               node.GetType() == TermMatchNode::FactMatch;
+    }
+
+
+    // Returns an upper bound on the number of rows used by a term.
+    static size_t GetMaximumRowCount(TermMatchNode const & term)
+    {
+        size_t termCount = 1;
+        if (term.GetType() == TermMatchNode::PhraseMatch)
+        {
+            auto & phrase = static_cast<TermMatchNode::Phrase const &>(term);
+            termCount = phrase.GetGrams().GetSize() * Term::c_maxGramSize;
+        }
+        return termCount * c_maxRowsPerTerm;
+    }
+
+
+    // Appends the disjuncts of an OR of ANDs of terms to disjuncts. Each
+    // disjunct is the list of terms that must all match. Returns false if
+    // node has some other form.
+    static bool AppendDisjuncts(TermMatchNode const & node,
+                                std::vector<std::vector<TermMatchNode const *>> & disjuncts)
+    {
+        std::vector<TermMatchNode const *> operands;
+        Flatten(node, TermMatchNode::OrMatch, operands);
+        for (auto operand : operands)
+        {
+            std::vector<TermMatchNode const *> terms;
+            Flatten(*operand, TermMatchNode::AndMatch, terms);
+            for (auto term : terms)
+            {
+                if (!IsTerm(*term))
+                {
+                    return false;
+                }
+            }
+            disjuncts.push_back(terms);
+        }
+        return true;
+    }
+
+
+    //*************************************************************************
+    //
+    // WideDisjunctionPlan
+    //
+    //*************************************************************************
+    std::shared_ptr<WideDisjunctionPlan const>
+        WideDisjunctionPlan::TryCreate(TermMatchNode const & tree,
+                                       ISimpleIndex const & index,
+                                       size_t rowCountThreshold,
+                                       IDiagnosticStream & diagnosticStream,
+                                       TermRowCache * termRowCache)
+    {
+        typedef std::vector<TermMatchNode const *> TermList;
+
+        struct ClauseTerms
+        {
+            bool m_negated;
+            std::vector<TermList> m_disjuncts;
+        };
+
+        //
+        // Convert the tree to conjunctive normal form. Positive clauses with
+        // a single disjunct are combined into one clause.
+        //
+        std::vector<TermMatchNode const *> conjuncts;
+        Flatten(tree, TermMatchNode::AndMatch, conjuncts);
+
+        std::vector<ClauseTerms> clauseTerms;
+        TermList required;
+        size_t maximumRowCount = 0;
+
+        for (auto conjunct : conjuncts)
+        {
+            ClauseTerms clause;
+            clause.m_negated = (conjunct->GetType() == TermMatchNode::NotMatch);
+            TermMatchNode const & node =
+                clause.m_negated ?
+                    static_cast<TermMatchNode::Not const *>(conjunct)->GetChild() :
+                    *conjunct;
+
+            if (!AppendDisjuncts(node, clause.m_disjuncts))
+            {
+                return nullptr;
+            }
+
+            for (auto const & disjunct : clause.m_disjuncts)
+            {
+                for (auto term : disjunct)
+                {
+                    maximumRowCount += GetMaximumRowCount(*term);
+                }
+            }
+
+            if (!clause.m_negated && clause.m_disjuncts.size() == 1)
+            {
+                required.insert(required.end(),
+                                clause.m_disjuncts[0].begin(),
+                                clause.m_disjuncts[0].end());
+            }
+            else
+            {
+                clauseTerms.push_back(std::move(clause));
+            }
+        }
+
+        if (maximumRowCount <= rowCountThreshold)
+        {
+            // Avoid converting the terms of queries that are certain to be
+            // small enough for the QueryPlanner.
+            return nullptr;
+        }
+
+        if (required.size() > 0)
+        {
+            clauseTerms.push_back({ false, { required } });
+        }
+
+        //
+        // Look up the rows of each term.
+        //
+        IIngestor const & ingestor = index.GetIngestor();
+        const ShardId shardCount = ingestor.GetShardCount();
+
+        std::vector<std::vector<ptrdiff_t>> rowOffsets(shardCount);
+        std::vector<std::vector<RowId>> rowIds(shardCount);
+        std::vector<ptrdiff_t> matchAllOffsets;
+        std::vector<RowId> documentActiveRows;
+        Row documentActiveRow = { 0, 0 };
+
+        for (ShardId shard = 0; shard < shardCount; ++shard)
+        {
+            IShard const & s = ingestor.GetShard(shard);
+            ITermTable const & termTable = index.GetTermTable(shard);
+
+            RowId matchAll =
+                *RowIdSequence(ITermTable::GetMatchAllTerm(), termTable).begin();
+            matchAllOffsets.push_back(s.GetRowOffset(matchAll));
+
+            RowId documentActive =
+                *RowIdSequence(ITermTable::GetDocumentActiveTerm(), termTable).begin();
+            documentActiveRows.push_back(documentActive);
+            rowIds[shard].push_back(documentActive);
+            rowOffsets[shard].push_back(s.GetRowOffset(documentActive));
+            documentActiveRow.m_rank = documentActive.GetRank();
+        }
+
+        // TermPlanConverter plans each term in a scratch allocator that is
+        // large enough for its PlanRows.
+        Allocator allocator(sizeof(PlanRows) + (1ull << 16));
+
+        unsigned rowCount = 1;
+        std::vector<Clause> clauses;
+        for (auto const & terms : clauseTerms)
+        {
+            Clause clause;
+            clause.m_negated = terms.m_negated;
+            for (auto const & disjunct : terms.m_disjuncts)
+            {
+                std::vector<Row> rows;
+                std::vector<unsigned> termRowCounts;
+                for (auto term : disjunct)
+                {
+                    const size_t firstRow = rows.size();
+                    allocator.Reset();
+                    RowPlan const & rowPlan =
+                        TermPlanConverter::BuildRowPlan(*term,
+                                                        index,
+                                                        allocator,
+                                                        termRowCache);
+                    IPlanRows const & planRows = rowPlan.GetPlanRows();
+
+                    for (unsigned id = 0; id < planRows.GetRowCount(); ++id)
+                    {
+                        bool isDocumentActive = true;
+                        for (ShardId shard = 0; shard < shardCount; ++shard)
+                        {
+                            if (planRows.PhysicalRow(shard, id) != documentActiveRows[shard])
+                            {
+                                isDocumentActive = false;
+                            }
+                        }
+                        if (isDocumentActive)
+                        {
+                            continue;
+                        }
+
+                        for (ShardId shard = 0; shard < shardCount; ++shard)
+                        {
+                            RowId row = planRows.PhysicalRow(shard, id);
+                            rowIds[shard].push_back(row);
+                            rowOffsets[shard].push_back(
+                                ingestor.GetShard(shard).GetRowOffset(row));
+                        }
+                        rows.push_back({ rowCount++,
+                                         planRows.PhysicalRow(0, id).GetRank() });
+                    }
+                    termRowCounts.push_back(static_cast<unsigned>(rows.size() - firstRow));
+                }
+                clause.m_disjuncts.push_back(std::move(rows));
+                clause.m_termRowCounts.push_back(std::move(termRowCounts));
+            }
+            clauses.push_back(std::move(clause));
+        }
+
+        if (rowCount - 1 <= rowCountThreshold)
+        {
+            return nullptr;
+        }
+
+        std::stable_sort(clauses.begin(),
+                         clauses.end(),
+                         [](Clause const & a, Clause const & b)
+                         {
+                             return a.m_disjuncts.size() < b.m_disjuncts.size();
+                         });
+
+        if (diagnosticStream.IsEnabled("planning/wide"))
+        {
+            std::ostream& out = diagnosticStream.GetStream();
+            out << "--------------------" << std::endl;
+            out << "Wide Disjunction Plan:" << std::endl;
+            out << "  Row Count: " << rowCount << std::endl;
+            for (auto const & clause : clauses)
+            {
+                out << "  Clause: "
+                    << (clause.m_negated ? "NOT " : "")
+                    << clause.m_disjuncts.size() << " disjuncts" << std::endl;
+            }
+        }
+
+        return std::shared_ptr<WideDisjunctionPlan const>(
+            new WideDisjunctionPlan(rowCount,
+                                    rowOffsets,
+                                    documentActiveRow,
+                                    std::move(clauses),
+                                    std::move(matchAllOffsets),
+                                    RowDensityOrderer::EstimateDensities(index, rowIds)));
+    }
+
+
+    WideDisjunctionPlan::WideDisjunctionPlan(
+        unsigned rowCount,
+        std::vector<std::vector<ptrdiff_t>> const & rowOffsets,
+        Row documentActiveRow,
+        std::vector<Clause> && clauses,
+        std::vector<ptrdiff_t> && matchAllOffsets,
+        std::vector<double> && rowDensities)
+      : CompiledQuery(rowCount, rowOffsets),
+        m_documentActiveRow(documentActiveRow),
+        m_clauses(std::move(clauses)),
+        m_matchAllOffsets(std::move(matchAllOffsets)),
+        m_rowDensities(std::move(rowDensities))
+    {
+    }
+
+
+    WideDisjunctionPlan::Row const & WideDisjunctionPlan::GetDocumentActiveRow() const
+    {
+        return m_documentActiveRow;
+    }
+
+
+    std::vector<WideDisjunctionPlan::Clause> const & WideDisjunctionPlan::GetClauses() const
+    {
+        return m_clauses;
+    }
+
+
+    std::vector<double> const & WideDisjunctionPlan::GetRowDensities() const
+    {
+        return m_rowDensities;
+    }
+
+
+    ptrdiff_t WideDisjunctionPlan::GetMatchAllOffset(ShardId shard) const
+    {
+        return m_matchAllOffsets[shard];
+    }
+
+
+    //*************************************************************************
+    //
+    // WideDisjunctionMatcher
+    //
+    //*************************************************************************
+    static size_t PopulationCount(uint64_t value)
+    {
+#ifdef _MSC_VER
+        return static_cast<size_t>(__popcnt64(value));
+#else
+        return static_cast<size_t>(__builtin_popcountll(value));
+#endif
+    }
+
+
+    // DESIGN NOTE: this is undefined if value is 0.
+    static size_t LowestBit(uint64_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return index;
+#else
+        return static_cast<size_t>(__builtin_ctzll(value));
+#endif
+    }
+
+
+    // Copies (if first is true) or ands a row of the given rank into a
+    // buffer of quadwordCount rank 0 quadwords. Each quadword of a rank r row
+    // covers 2^r consecutive rank 0 quadwords.
+    static void AndRow(uint64_t * buffer,
+                       uint64_t const * row,
+                       Rank rank,
+                       size_t quadwordCount,
+                       bool first)
+    {
+        if (rank == 0)
+        {
+            if (first)
+            {
+                for (size_t i = 0; i < quadwordCount; ++i)
+                {
+                    buffer[i] = row[i];
+                }
+            }
+            else
+            {
+                for (size_t i = 0; i < quadwordCount; ++i)
+                {
+                    buffer[i] &= row[i];
+                }
+            }
+        }
+        else
+        {
+            const size_t stride = 1ull << rank;
+            for (size_t i = 0; i < (quadwordCount >> rank); ++i)
+            {
+                const uint64_t value = row[i];
+                uint64_t * out = buffer + (i << rank);
+                if (first)
+                {
+                    for (size_t j = 0; j < stride; ++j)
+                    {
+                        out[j] = value;
+                    }
+                }
+                else
+                {
+                    for (size_t j = 0; j < stride; ++j)
+                    {
+                        out[j] &= value;
+                    }
+                }
+            }
+        }
+    }
+
+
+    WideDisjunctionMatcher::WideDisjunctionMatcher(IIngestor const & ingestor,
+                                                   WideDisjunctionPlan const & plan)
+      : m_ingestor(ingestor),
+        m_plan(plan)
+    {
+    }
+
+
+    bool WideDisjunctionMatcher::MatchMorsel(SliceMorsel const & morsel,
+                                             ResultsBuffer & results,
+                                             size_t maxMatches,
+                                             QueryCancellation const & cancellation,
+                                             QueryInstrumentation & instrumentation)
+    {
+        const size_t quadwordCount =
+            m_ingestor.GetShard(morsel.m_shard).GetSliceCapacity() >> 6;
+        std::vector<uint64_t> scratch(3 * quadwordCount);
+        uint64_t * matches = scratch.data();
+
+        size_t matchCount = 0;
+        size_t rowQuadwordCount = 0;
+        bool wasCancelled = false;
+
+        for (size_t i = 0; i < morsel.m_sliceCount && matchCount < maxMatches; ++i)
+        {
+            // Each slice is matched in a single pass, so the token is only
+            // checked between slices.
+            if (cancellation.IsCancelled())
+            {
+                wasCancelled = true;
+                break;
+            }
+
+            char const * sliceBuffer =
+                reinterpret_cast<char const *>(morsel.m_sliceBuffers[i]);
+            rowQuadwordCount += MatchSlice(sliceBuffer,
+                                           morsel.m_shard,
+                                           quadwordCount,
+                                           matches,
+                                           matches + quadwordCount,
+                                           matches + 2 * quadwordCount);
+
+            // The slice pointer is at the beginning of the slice buffer.
+            Slice* slice =
+                *reinterpret_cast<Slice* const *>(sliceBuffer);
+
+            for (size_t q = 0; q < quadwordCount && matchCount < maxMatches; ++q)
+            {
+                uint64_t bits = matches[q];
+                while (bits != 0 && matchCount < maxMatches)
+                {
+                    results.push_back(slice, q * 64 + LowestBit(bits));
+                    ++matchCount;
+
+                    // Clear the lowest bit set.
+                    bits &= (bits - 1);
+                }
+            }
+        }
+
+        instrumentation.IncrementQuadwordCount(rowQuadwordCount);
+
+        return wasCancelled;
+    }
+
+
+    size_t WideDisjunctionMatcher::CountMorsel(SliceMorsel const & morsel,
+                                               QueryInstrumentation & instrumentation)
+    {
+        const size_t quadwordCount =
+            m_ingestor.GetShard(morsel.m_shard).GetSliceCapacity() >> 6;
+        std::vector<uint64_t> scratch(3 * quadwordCount);
+        uint64_t * matches = scratch.data();
+
+        size_t matchCount = 0;
+        size_t rowQuadwordCount = 0;
+
+        for (size_t i = 0; i < morsel.m_sliceCount; ++i)
+        {
+            rowQuadwordCount +=
+                MatchSlice(reinterpret_cast<char const *>(morsel.m_sliceBuffers[i]),
+                           morsel.m_shard,
+                           quadwordCount,
+                           matches,
+                           matches + quadwordCount,
+                           matches + 2 * quadwordCount);
+
+            for (size_t q = 0; q < quadwordCount; ++q)
+            {
+                matchCount += PopulationCount(matches[q]);
+            }
+        }
+
+        instrumentation.IncrementQuadwordCount(rowQuadwordCount);
+
+        return matchCount;
+    }
+
+
+    size_t WideDisjunctionMatcher::MatchSlice(char const * sliceBuffer,
+                                              ShardId shard,
+                                              size_t quadwordCount,
+                                              uint64_t * matches,
+                                              uint64_t * clause,
+                                              uint64_t * term) const
+    {
+        ptrdiff_t const * rowOffsets = m_plan.GetRowOffsets(shard);
+        const ptrdiff_t matchAll = m_plan.GetMatchAllOffset(shard);
+
+        auto getRow = [&](WideDisjunctionPlan::Row const & row)
+        {
+            return reinterpret_cast<uint64_t const *>(sliceBuffer + rowOffsets[row.m_id]);
+        };
+
+        auto const & documentActive = m_plan.GetDocumentActiveRow();
+        AndRow(matches,
+               getRow(documentActive),
+               documentActive.m_rank,
+               quadwordCount,
+               true);
+        size_t rowQuadwordCount = quadwordCount >> documentActive.m_rank;
+
+        for (auto const & c : m_plan.GetClauses())
+        {
+            // Skip the remaining clauses once nothing in the slice matches.
+            uint64_t any = 0;
+            for (size_t i = 0; i < quadwordCount; ++i)
+            {
+                any |= matches[i];
+            }
+            if (any == 0)
+            {
+                break;
+            }
+
+            for (size_t i = 0; i < quadwordCount; ++i)
+            {
+                clause[i] = 0;
+            }
+
+            for (auto const & disjunct : c.m_disjuncts)
+            {
+                bool first = true;
+                for (auto const & row : disjunct)
+                {
+                    if (rowOffsets[row.m_id] == matchAll)
+                    {
+                        continue;
+                    }
+                    AndRow(term, getRow(row), row.m_rank, quadwordCount, first);
+                    rowQuadwordCount += quadwordCount >> row.m_rank;
+                    first = false;
+                }
+
+                if (first)
+                {
+                    // Every row of the disjunct is the match-all row.
+                    for (size_t i = 0; i < quadwordCount; ++i)
+                    {
+                        clause[i] = ~0ull;
+                    }
+                    break;
+                }
+
+                for (size_t i = 0; i < quadwordCount; ++i)
+                {
+                    clause[i] |= term[i];
+                }
+            }
+
+            if (c.m_negated)
+            {
+                for (size_t i = 0; i < quadwordCount; ++i)
+                {
+                    matches[i] &= ~clause[i];
+                }
+            }
+            else
+            {
+                for (size_t i = 0; i < quadwordCount; ++i)
+                {
+                    matches[i] &= clause[i];
+                }
+            }
+        }
+
+        return rowQuadwordCount;
+    }
+}
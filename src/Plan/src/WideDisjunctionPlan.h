@@ -0,0 +1,169 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include <memory>                           // std::shared_ptr return value.
+#include <stddef.h>                         // size_t, ptrdiff_t embedded.
+#include <stdint.h>                         // uint64_t parameter.
+#include <vector>                           // std::vector embedded.
+
+#include "BitFunnel/BitFunnelTypes.h"       // Rank, ShardId embedded.
+#include "ParallelMatcher.h"                // Base class.
+#include "QueryPlanCache.h"                 // Base class.
+
+
+namespace BitFunnel
+{
+    class IDiagnosticStream;
+    class IIngestor;
+    class ISimpleIndex;
+    class QueryCancellation;
+    class QueryInstrumentation;
+    class TermMatchNode;
+    class TermRowCache;
+
+    //*************************************************************************
+    //
+    // WideDisjunctionPlan
+    //
+    // An engine independent plan for queries that need more rows than the
+    // QueryPlanner should handle. These are typically synonym or prefix
+    // expansions that OR together hundreds or thousands of terms. The
+    // QueryPlanner is limited to c_maxRowsPerQuery rows and drops the rest,
+    // and MatchTreeRewriter multiplies wide disjunctions out into large
+    // cross products.
+    //
+    // A WideDisjunctionPlan applies to queries in conjunctive normal form:
+    // an AND of clauses, each of which is an OR of disjuncts, optionally
+    // negated. Each disjunct is a term, a phrase, or an AND of terms and
+    // phrases. Instead of matching one quadword at a time, the
+    // WideDisjunctionMatcher evaluates each clause over a whole slice,
+    // ORing the rows of its disjuncts into a slice-sized accumulator in
+    // tight loops that the compiler can vectorize. The accumulators are
+    // then ANDed together with the document active row.
+    //
+    //*************************************************************************
+    class WideDisjunctionPlan : public CompiledQuery
+    {
+    public:
+        // A row of a disjunct. The id indexes the offsets returned by
+        // GetRowOffsets().
+        struct Row
+        {
+            unsigned m_id;
+            Rank m_rank;
+        };
+
+        struct Clause
+        {
+            bool m_negated;
+            std::vector<std::vector<Row>> m_disjuncts;
+
+            // The number of consecutive rows of each term in each disjunct.
+            // Not used for matching, but needed to estimate matches.
+            std::vector<std::vector<unsigned>> m_termRowCounts;
+        };
+
+        // Returns a plan for tree if it is in conjunctive normal form and
+        // needs more than rowCountThreshold rows. Otherwise returns nullptr
+        // and the query should be planned by the QueryPlanner. If
+        // termRowCache is not nullptr, the rows for each term are taken from
+        // the cache when possible.
+        static std::shared_ptr<WideDisjunctionPlan const>
+            TryCreate(TermMatchNode const & tree,
+                      ISimpleIndex const & index,
+                      size_t rowCountThreshold,
+                      IDiagnosticStream & diagnosticStream,
+                      TermRowCache * termRowCache = nullptr);
+
+        // Returns the document active row.
+        Row const & GetDocumentActiveRow() const;
+
+        // Returns the clauses, ordered by increasing number of disjuncts so
+        // that narrow clauses can clear the accumulator before the wide ones
+        // are evaluated.
+        std::vector<Clause> const & GetClauses() const;
+
+        // Returns the offset of a shard's match-all row. Rows with this
+        // offset pad terms that have fewer rows in the shard than in others
+        // and are skipped by the matcher.
+        ptrdiff_t GetMatchAllOffset(ShardId shard) const;
+
+        // Returns the density of each row, indexed by Row::m_id. Estimated
+        // once, when the plan is created, so that estimating a cached plan
+        // reads no rows.
+        std::vector<double> const & GetRowDensities() const;
+
+    private:
+        WideDisjunctionPlan(unsigned rowCount,
+                            std::vector<std::vector<ptrdiff_t>> const & rowOffsets,
+                            Row documentActiveRow,
+                            std::vector<Clause> && clauses,
+                            std::vector<ptrdiff_t> && matchAllOffsets,
+                            std::vector<double> && rowDensities);
+
+        const Row m_documentActiveRow;
+        const std::vector<Clause> m_clauses;
+        const std::vector<ptrdiff_t> m_matchAllOffsets;
+        const std::vector<double> m_rowDensities;
+    };
+
+
+    //*************************************************************************
+    //
+    // WideDisjunctionMatcher
+    //
+    // Runs a WideDisjunctionPlan over the slices of a SliceMorsel. Holds no
+    // mutable state, so it may be invoked from several threads at once.
+    //
+    //*************************************************************************
+    class WideDisjunctionMatcher : public IMorselMatcher
+    {
+    public:
+        WideDisjunctionMatcher(IIngestor const & ingestor,
+                               WideDisjunctionPlan const & plan);
+
+        virtual bool MatchMorsel(SliceMorsel const & morsel,
+                                 ResultsBuffer & results,
+                                 size_t maxMatches,
+                                 QueryCancellation const & cancellation,
+                                 QueryInstrumentation & instrumentation) override;
+
+        virtual size_t CountMorsel(SliceMorsel const & morsel,
+                                   QueryInstrumentation & instrumentation) override;
+
+    private:
+        // Writes the matches in a slice of quadwordCount rank 0 quadwords to
+        // matches, using clause and term as scratch space. Returns the
+        // number of row quadwords read.
+        size_t MatchSlice(char const * sliceBuffer,
+                          ShardId shard,
+                          size_t quadwordCount,
+                          uint64_t * matches,
+                          uint64_t * clause,
+                          uint64_t * term) const;
+
+        IIngestor const & m_ingestor;
+        WideDisjunctionPlan const & m_plan;
+    };
+}
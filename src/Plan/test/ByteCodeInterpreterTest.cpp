@@ -648,6 +648,49 @@ namespace BitFunnel
     }
 
 
+    //*************************************************************************
+    //
+    // Not test cases
+    //
+    //*************************************************************************
+
+    // Not must take the bitwise complement of the accumulator. A logical
+    // complement would leave at most the lowest bit set, so a query with a
+    // NOT clause would match almost nothing.
+    TEST(ByteCodeInterpreter, NotMatches)
+    {
+        ShardId c_numShards = 1;
+
+        char const * text =
+            "LoadRowJz {"
+            "  Row: Row(0, 0, 0, false),"
+            "  Child: Report {"
+            "    Child: Not {"
+            "      Child: LoadRow(1, 0, 0, false)"
+            "    }"
+            "  }"
+            "}";
+
+        const Rank initialRank = 0;
+        ByteCodeVerifier verifier(GetIndex(c_numShards), initialRank);
+
+        verifier.DeclareRow("3");
+        verifier.DeclareRow("5");
+
+        for (auto iteration : verifier.GetIterations())
+        {
+            const size_t slice = verifier.GetSliceNumber(iteration);
+            const size_t offset = verifier.GetOffset(iteration);
+
+            const uint64_t row0 = verifier.GetRowData(0, offset, slice);
+            const uint64_t row1 = verifier.GetRowData(1, offset, slice);
+            verifier.ExpectResult(row0 & ~row1, offset, slice);
+        }
+
+        verifier.Verify(text);
+    }
+
+
     //*************************************************************************
     //
     // Out-of-order test cases
@@ -743,4 +786,52 @@ namespace BitFunnel
 
         verifier.Verify(text);
     }
+
+
+    TEST(ByteCodeInterpreter, RankDownDelta2)
+    {
+        ShardId c_numShards = 1;
+
+        // Exercises the RankDownLoop, LoadRowJz, AndRowJz and AndRowReport
+        // fused instructions.
+        char const * text =
+            "LoadRowJz {"
+            "  Row: Row(0, 2, 0, false),"
+            "  Child: RankDown {"
+            "    Delta: 2,"
+            "    Child: AndRowJz {"
+            "      Row: Row(1, 0, 0, false),"
+            "      Child: AndRowJz {"
+            "        Row: Row(2, 0, 0, true),"
+            "        Child: Report {"
+            "          Child: "
+            "        }"
+            "      }"
+            "    }"
+            "  }"
+            "}";
+
+        const Rank initialRank = 2;
+        ByteCodeVerifier verifier(GetIndex(c_numShards), initialRank);
+
+        verifier.DeclareRow("2");
+        verifier.DeclareRow("3");
+        verifier.DeclareRow("5");
+
+        for (auto iteration : verifier.GetIterations())
+        {
+            const size_t slice = verifier.GetSliceNumber(iteration);
+            const size_t offset = verifier.GetOffset(iteration);
+
+            const uint64_t row0 = verifier.GetRowData(0, offset, slice);
+            for (size_t i = 0; i < 4; ++i)
+            {
+                const uint64_t row1 = verifier.GetRowData(1, offset * 4 + i, slice);
+                const uint64_t row2 = verifier.GetRowData(2, offset * 4 + i, slice);
+                verifier.ExpectResult(row0 & row1 & ~row2, offset * 4 + i, slice);
+            }
+        }
+
+        verifier.Verify(text);
+    }
 }
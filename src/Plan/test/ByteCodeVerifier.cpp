@@ -22,13 +22,16 @@
 
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 
 #include "gtest/gtest.h"
 
 #include "BitFunnel/IDiagnosticStream.h" // TODO: remove.
 #include "BitFunnel/Index/IIngestor.h"
+#include "BitFunnel/Index/IShard.h"
 #include "BitFunnel/Index/ISimpleIndex.h"
 #include "BitFunnel/Index/RowIdSequence.h"
+#include "BitFunnel/Plan/QueryCancellation.h"
 #include "BitFunnel/Plan/QueryInstrumentation.h"
 #include "BitFunnel/Plan/ResultsBuffer.h"
 #include "BitFunnel/Utilities/Allocator.h"
@@ -70,6 +73,7 @@ namespace BitFunnel
         ByteCodeInterpreter interpreter(
             code,
             results,
+            results.m_capacity,
             m_slices.size(),
             m_slices.data(),
             GetIterationsPerSlice(),
@@ -82,5 +86,74 @@ namespace BitFunnel
         interpreter.Run();
 
         CheckResults(results);
+
+        // The Instrumented loop, selected by a diagnostic stream and a
+        // CacheLineRecorder, must find the same matches and count the same
+        // quadwords as the Uninstrumented loop.
+        std::stringstream diagnosticOutput;
+        auto diagnosticStream =
+            Factories::CreateDiagnosticStream(diagnosticOutput);
+        diagnosticStream->Enable("bytecode/loadrow");
+
+        QueryInstrumentation instrumented;
+        ResultsBuffer instrumentedResults(
+            m_index.GetIngestor().GetDocumentCount());
+        ByteCodeInterpreter instrumentedInterpreter(
+            code,
+            instrumentedResults,
+            instrumentedResults.m_capacity,
+            m_slices.size(),
+            m_slices.data(),
+            GetIterationsPerSlice(),
+            m_initialRank,
+            m_rowOffsets.data(),
+            diagnosticStream.get(),
+            instrumented,
+            m_index.GetIngestor().GetShard(0).GetSliceBufferSize());
+
+        instrumentedInterpreter.Run();
+
+        ASSERT_EQ(results.size(), instrumentedResults.size());
+        auto expected = results.begin();
+        for (auto result : instrumentedResults)
+        {
+            EXPECT_EQ((*expected).m_slice, result.m_slice);
+            EXPECT_EQ((*expected).m_index, result.m_index);
+            ++expected;
+        }
+        EXPECT_EQ(interpreter.GetMatchCount(),
+                  instrumentedInterpreter.GetMatchCount());
+        EXPECT_EQ(instrumentation.GetData().GetQuadwordCount(),
+                  instrumented.GetData().GetQuadwordCount());
+        EXPECT_GT(instrumented.GetData().GetCacheLineCount(), 0u);
+
+        // A cancelled query, or one whose deadline has passed, stops before
+        // its first iteration. The deadline is checked by the interpreter
+        // itself.
+        QueryCancellation cancelled;
+        cancelled.Cancel();
+        QueryCancellation expired(0.0);
+        QueryCancellation const * const tokens[] = { &cancelled, &expired };
+        for (auto token : tokens)
+        {
+            ResultsBuffer none(m_index.GetIngestor().GetDocumentCount());
+            ByteCodeInterpreter cancelledInterpreter(
+                code,
+                none,
+                none.m_capacity,
+                m_slices.size(),
+                m_slices.data(),
+                GetIterationsPerSlice(),
+                m_initialRank,
+                m_rowOffsets.data(),
+                nullptr,
+                instrumentation,
+                0);
+            cancelledInterpreter.SetCancellation(*token);
+
+            EXPECT_TRUE(cancelledInterpreter.Run());
+            EXPECT_TRUE(cancelledInterpreter.WasCancelled());
+            EXPECT_EQ(0u, none.size());
+        }
     }
 }
@@ -0,0 +1,164 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <algorithm>                            // std::min().
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "BitFunnel/Plan/CallbackResultsSink.h"
+#include "BitFunnel/Plan/ChunkedResultsSink.h"
+
+
+namespace BitFunnel
+{
+    namespace ChunkedResultsSinkTest
+    {
+        // The sink never dereferences Slice pointers, so arbitrary values
+        // may be used in place of real slices.
+        Slice* FakeSlice(size_t id)
+        {
+            return reinterpret_cast<Slice*>((id + 1) * 64);
+        }
+
+
+        // Returns count matches spread over runs of runLength matches from
+        // consecutive slices.
+        std::vector<ResultsBuffer::Result> CreateMatches(size_t count,
+                                                         size_t runLength)
+        {
+            std::vector<ResultsBuffer::Result> matches;
+            for (size_t i = 0; i < count; ++i)
+            {
+                matches.push_back({ FakeSlice(i / runLength), i % runLength });
+            }
+            return matches;
+        }
+
+
+        void Verify(std::vector<ResultsBuffer::Result> const & expected,
+                    ChunkedResultsSink const & sink)
+        {
+            ASSERT_EQ(expected.size(), sink.size());
+            ASSERT_EQ(expected.size(), sink.GetMatchCount());
+
+            size_t i = 0;
+            for (auto result : sink)
+            {
+                EXPECT_EQ(expected[i].m_slice, result.m_slice);
+                EXPECT_EQ(expected[i].m_index, result.m_index);
+                EXPECT_EQ(expected[i].m_slice, sink[i].m_slice);
+                EXPECT_EQ(expected[i].m_index, sink[i].m_index);
+                ++i;
+            }
+            EXPECT_EQ(expected.size(), i);
+        }
+
+
+        TEST(ChunkedResultsSink, Trivial)
+        {
+            ChunkedResultsSink sink;
+            EXPECT_EQ(0u, sink.size());
+            EXPECT_EQ(0u, sink.GetBytesAllocated());
+            EXPECT_FALSE(sink.begin() != sink.end());
+        }
+
+
+        TEST(ChunkedResultsSink, GrowsAcrossChunks)
+        {
+            // Several chunks, with runs of matches from the same slice that
+            // straddle chunk boundaries.
+            const size_t c_matchCount = 10000;
+            auto matches = CreateMatches(c_matchCount, 300);
+
+            ChunkedResultsSink sink;
+
+            // Add in uneven batches.
+            size_t added = 0;
+            size_t batchSize = 1;
+            while (added < matches.size())
+            {
+                const size_t count = (std::min)(batchSize, matches.size() - added);
+                sink.Add(matches.data() + added, count);
+                added += count;
+                batchSize = batchSize * 3 + 1;
+            }
+
+            Verify(matches, sink);
+
+            // Each match takes 8 bytes, plus the slice table.
+            const size_t bytes = sink.GetBytesAllocated();
+            EXPECT_GE(bytes, 8 * c_matchCount);
+            EXPECT_LT(bytes, 16 * c_matchCount);
+        }
+
+
+        TEST(ChunkedResultsSink, ResetReusesChunks)
+        {
+            auto matches = CreateMatches(5000, 7);
+
+            ChunkedResultsSink sink;
+            sink.Add(matches.data(), matches.size());
+            const size_t bytes = sink.GetBytesAllocated();
+
+            sink.Reset();
+            EXPECT_EQ(0u, sink.size());
+
+            auto fewer = CreateMatches(3000, 11);
+            sink.Add(fewer.data(), fewer.size());
+            Verify(fewer, sink);
+
+            // Reset() keeps the chunks and the slice table.
+            EXPECT_EQ(bytes, sink.GetBytesAllocated());
+        }
+
+
+        TEST(ChunkedResultsSink, CopyTo)
+        {
+            auto matches = CreateMatches(1000, 13);
+
+            ChunkedResultsSink source;
+            source.Add(matches.data(), matches.size());
+
+            // CopyTo() delivers matches in batches to any IResultsSink.
+            std::vector<ResultsBuffer::Result> copied;
+            CallbackResultsSink destination(
+                [&copied](ResultsBuffer::Result const * batch, size_t count)
+                {
+                    copied.insert(copied.end(), batch, batch + count);
+                });
+
+            const size_t c_start = 17;
+            const size_t c_count = 900;
+            source.CopyTo(c_start, c_count, destination);
+            source.CopyTo(0, 0, destination);
+
+            EXPECT_EQ(c_count, destination.GetMatchCount());
+            ASSERT_EQ(c_count, copied.size());
+            for (size_t i = 0; i < c_count; ++i)
+            {
+                EXPECT_EQ(matches[c_start + i].m_slice, copied[i].m_slice);
+                EXPECT_EQ(matches[c_start + i].m_index, copied[i].m_index);
+            }
+        }
+    }
+}
@@ -0,0 +1,509 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "gtest/gtest.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "BitFunnel/Utilities/Allocator.h"
+#include "BitFunnel/Utilities/TextObjectFormatter.h"
+#include "CommonRowHoister.h"
+#include "CompileNode.h"
+#include "IPlanRows.h"
+#include "RankDownCompiler.h"
+#include "RowMatchNode.h"
+#include "SameExceptForWhitespace.h"
+#include "TextObjectParser.h"
+
+
+namespace BitFunnel
+{
+    namespace CommonRowHoisterUnitTest
+    {
+        struct InputOutput
+        {
+        public:
+            char const * m_input;
+            char const * m_output;
+        };
+
+
+        const InputOutput c_cases[] =
+        {
+            // Branches share their first row.
+            // Expect the row to be loaded once, before the Or.
+            {
+                "Or {"
+                "  Children: ["
+                "    And {"
+                "      Children: ["
+                "        Row(0, 6, 0, false),"
+                "        Row(1, 6, 0, false)"
+                "      ]"
+                "    },"
+                "    And {"
+                "      Children: ["
+                "        Row(0, 6, 0, false),"
+                "        Row(2, 6, 0, false)"
+                "      ]"
+                "    }"
+                "  ]"
+                "}",
+                "LoadRowJz {"
+                "  Row: Row(0, 6, 0, false),"
+                "  Child: Or {"
+                "    Children: ["
+                "      AndRowJz {"
+                "        Row: Row(1, 6, 0, false),"
+                "        Child: RankDown {"
+                "          Delta: 6,"
+                "          Child: Report {"
+                "            Child:"
+                "          }"
+                "        }"
+                "      },"
+                "      AndRowJz {"
+                "        Row: Row(2, 6, 0, false),"
+                "        Child: RankDown {"
+                "          Delta: 6,"
+                "          Child: Report {"
+                "            Child:"
+                "          }"
+                "        }"
+                "      }"
+                "    ]"
+                "  }"
+                "}"
+            },
+
+            // Branches share a row that is not first in either of them.
+            {
+                "Or {"
+                "  Children: ["
+                "    And {"
+                "      Children: ["
+                "        Row(1, 6, 0, false),"
+                "        Row(0, 6, 0, false)"
+                "      ]"
+                "    },"
+                "    And {"
+                "      Children: ["
+                "        Row(2, 6, 0, false),"
+                "        Row(0, 6, 0, false)"
+                "      ]"
+                "    }"
+                "  ]"
+                "}",
+                "LoadRowJz {"
+                "  Row: Row(0, 6, 0, false),"
+                "  Child: Or {"
+                "    Children: ["
+                "      AndRowJz {"
+                "        Row: Row(1, 6, 0, false),"
+                "        Child: RankDown {"
+                "          Delta: 6,"
+                "          Child: Report {"
+                "            Child:"
+                "          }"
+                "        }"
+                "      },"
+                "      AndRowJz {"
+                "        Row: Row(2, 6, 0, false),"
+                "        Child: RankDown {"
+                "          Delta: 6,"
+                "          Child: Report {"
+                "            Child:"
+                "          }"
+                "        }"
+                "      }"
+                "    ]"
+                "  }"
+                "}"
+            },
+
+            // Three branches, two of which share a row.
+            // Expect the third branch to be left alone.
+            {
+                "Or {"
+                "  Children: ["
+                "    And {"
+                "      Children: ["
+                "        Row(0, 6, 0, false),"
+                "        Row(1, 6, 0, false)"
+                "      ]"
+                "    },"
+                "    Or {"
+                "      Children: ["
+                "        Row(3, 6, 0, false),"
+                "        And {"
+                "          Children: ["
+                "            Row(0, 6, 0, false),"
+                "            Row(2, 6, 0, false)"
+                "          ]"
+                "        }"
+                "      ]"
+                "    }"
+                "  ]"
+                "}",
+                "Or {"
+                "  Children: ["
+                "    LoadRowJz {"
+                "      Row: Row(0, 6, 0, false),"
+                "      Child: Or {"
+                "        Children: ["
+                "          AndRowJz {"
+                "            Row: Row(1, 6, 0, false),"
+                "            Child: RankDown {"
+                "              Delta: 6,"
+                "              Child: Report {"
+                "                Child:"
+                "              }"
+                "            }"
+                "          },"
+                "          AndRowJz {"
+                "            Row: Row(2, 6, 0, false),"
+                "            Child: RankDown {"
+                "              Delta: 6,"
+                "              Child: Report {"
+                "                Child:"
+                "              }"
+                "            }"
+                "          }"
+                "        ]"
+                "      }"
+                "    },"
+                "    LoadRowJz {"
+                "      Row: Row(3, 6, 0, false),"
+                "      Child: RankDown {"
+                "        Delta: 6,"
+                "        Child: Report {"
+                "          Child:"
+                "        }"
+                "      }"
+                "    }"
+                "  ]"
+                "}"
+            },
+
+            // One branch is a subset of the other.
+            // Expect the more restrictive branch to be dropped.
+            {
+                "Or {"
+                "  Children: ["
+                "    Row(0, 0, 0, false),"
+                "    And {"
+                "      Children: ["
+                "        Row(0, 0, 0, false),"
+                "        Row(1, 0, 0, false)"
+                "      ]"
+                "    }"
+                "  ]"
+                "}",
+                "RankDown {"
+                "  Delta: 6,"
+                "  Child: LoadRowJz {"
+                "    Row: Row(0, 0, 0, false),"
+                "    Child: Report {"
+                "      Child:"
+                "    }"
+                "  }"
+                "}"
+            },
+
+            // Branches rank down to share a rank 0 row.
+            // Expect a single RankDown loop and the rank 0 row hoisted into
+            // it.
+            {
+                "Or {"
+                "  Children: ["
+                "    And {"
+                "      Children: ["
+                "        Row(0, 0, 0, false),"
+                "        Row(1, 0, 0, false)"
+                "      ]"
+                "    },"
+                "    And {"
+                "      Children: ["
+                "        Row(0, 0, 0, false),"
+                "        Row(2, 0, 0, false)"
+                "      ]"
+                "    },"
+                "    Row(3, 3, 0, false)"
+                "  ]"
+                "}",
+                "RankDown {"
+                "  Delta: 3,"
+                "  Child: Or {"
+                "    Children: ["
+                "      RankDown {"
+                "        Delta: 3,"
+                "        Child: LoadRowJz {"
+                "          Row: Row(0, 0, 0, false),"
+                "          Child: Or {"
+                "            Children: ["
+                "              AndRowJz {"
+                "                Row: Row(1, 0, 0, false),"
+                "                Child: Report {"
+                "                  Child:"
+                "                }"
+                "              },"
+                "              AndRowJz {"
+                "                Row: Row(2, 0, 0, false),"
+                "                Child: Report {"
+                "                  Child:"
+                "                }"
+                "              }"
+                "            ]"
+                "          }"
+                "        }"
+                "      },"
+                "      LoadRowJz {"
+                "        Row: Row(3, 3, 0, false),"
+                "        Child: RankDown {"
+                "          Delta: 3,"
+                "          Child: Report {"
+                "            Child:"
+                "          }"
+                "        }"
+                "      }"
+                "    ]"
+                "  }"
+                "}"
+            },
+
+            // Branches load the same physical row through different
+            // abstract rows.
+            // Expect the row to be hoisted.
+            {
+                "Or {"
+                "  Children: ["
+                "    And {"
+                "      Children: ["
+                "        Row(4, 6, 0, false),"
+                "        Row(1, 6, 0, false)"
+                "      ]"
+                "    },"
+                "    And {"
+                "      Children: ["
+                "        Row(5, 6, 0, false),"
+                "        Row(2, 6, 0, false)"
+                "      ]"
+                "    }"
+                "  ]"
+                "}",
+                "LoadRowJz {"
+                "  Row: Row(4, 6, 0, false),"
+                "  Child: Or {"
+                "    Children: ["
+                "      AndRowJz {"
+                "        Row: Row(1, 6, 0, false),"
+                "        Child: RankDown {"
+                "          Delta: 6,"
+                "          Child: Report {"
+                "            Child:"
+                "          }"
+                "        }"
+                "      },"
+                "      AndRowJz {"
+                "        Row: Row(2, 6, 0, false),"
+                "        Child: RankDown {"
+                "          Delta: 6,"
+                "          Child: Report {"
+                "            Child:"
+                "          }"
+                "        }"
+                "      }"
+                "    ]"
+                "  }"
+                "}"
+            },
+
+            // Inverted and non-inverted rows are different rows.
+            // Expect no change.
+            {
+                "Or {"
+                "  Children: ["
+                "    And {"
+                "      Children: ["
+                "        Row(0, 6, 0, false),"
+                "        Row(1, 6, 0, false)"
+                "      ]"
+                "    },"
+                "    And {"
+                "      Children: ["
+                "        Row(0, 6, 0, true),"
+                "        Row(2, 6, 0, false)"
+                "      ]"
+                "    }"
+                "  ]"
+                "}",
+                "Or {"
+                "  Children: ["
+                "    LoadRowJz {"
+                "      Row: Row(0, 6, 0, false),"
+                "      Child: AndRowJz {"
+                "        Row: Row(1, 6, 0, false),"
+                "        Child: RankDown {"
+                "          Delta: 6,"
+                "          Child: Report {"
+                "            Child:"
+                "          }"
+                "        }"
+                "      }"
+                "    },"
+                "    LoadRowJz {"
+                "      Row: Row(0, 6, 0, true),"
+                "      Child: AndRowJz {"
+                "        Row: Row(2, 6, 0, false),"
+                "        Child: RankDown {"
+                "          Delta: 6,"
+                "          Child: Report {"
+                "            Child:"
+                "          }"
+                "        }"
+                "      }"
+                "    }"
+                "  ]"
+                "}"
+            },
+        };
+
+
+        void VerifyCase(InputOutput const & testCase)
+        {
+            std::stringstream input(testCase.m_input);
+
+            Allocator allocator(4096);
+            TextObjectParser parser(input, allocator, &RowPlanBase::GetType);
+            RowMatchNode const & root = RowMatchNode::Parse(parser);
+
+            RankDownCompiler compiler(allocator);
+            compiler.Compile(root);
+            CompileNode const & compiled = compiler.CreateTree(6);
+
+            // Abstract rows 4 and 5 refer to the same physical row as row 0.
+            std::vector<unsigned> rowClasses = { 0, 1, 2, 3, 0, 0 };
+            CommonRowHoister hoister(rowClasses, allocator);
+            CompileNode const & hoisted = hoister.Hoist(compiled);
+
+            std::stringstream output;
+            TextObjectFormatter formatter(output);
+            hoisted.Format(formatter);
+
+            EXPECT_TRUE(SameExceptForWhitespace(output.str().c_str(), testCase.m_output));
+
+            // Hoisting never adds row reads, and removes some whenever it
+            // changes the tree.
+            size_t before = CommonRowHoister::CountRowReads(compiled);
+            size_t after = CommonRowHoister::CountRowReads(hoisted);
+            if (&hoisted == &compiled)
+            {
+                EXPECT_EQ(before, after);
+            }
+            else
+            {
+                EXPECT_LT(after, before);
+            }
+        }
+
+
+        TEST(CommonRowHoister, Hoist)
+        {
+            for (unsigned i = 0; i < sizeof(c_cases) / sizeof(InputOutput); ++i)
+            {
+                VerifyCase(c_cases[i]);
+            }
+        }
+
+
+        // IPlanRows with fixed physical rows, for GetRowClasses().
+        class FixedPlanRows : public IPlanRows
+        {
+        public:
+            FixedPlanRows(std::vector<std::vector<RowId>> const & rows)
+              : m_rows(rows)
+            {
+            }
+
+            virtual ShardId GetShardCount() const override
+            {
+                return static_cast<ShardId>(m_rows.size());
+            }
+
+            virtual unsigned GetRowCount() const override
+            {
+                return static_cast<unsigned>(m_rows[0].size());
+            }
+
+            virtual const ITermTable& GetTermTable(ShardId) const override
+            {
+                throw std::runtime_error("Not implemented.");
+            }
+
+            virtual bool IsFull() const override
+            {
+                return false;
+            }
+
+            virtual AbstractRow AddRow(Rank) override
+            {
+                throw std::runtime_error("Not implemented.");
+            }
+
+            virtual RowId const & PhysicalRow(ShardId shard,
+                                              unsigned id) const override
+            {
+                return m_rows[shard][id];
+            }
+
+            virtual RowId& PhysicalRow(ShardId shard, unsigned id) override
+            {
+                return m_rows[shard][id];
+            }
+
+            virtual void Write(std::ostream&) const override
+            {
+                throw std::runtime_error("Not implemented.");
+            }
+
+        private:
+            std::vector<std::vector<RowId>> m_rows;
+        };
+
+
+        TEST(CommonRowHoister, GetRowClasses)
+        {
+            // Rows 0 and 2 are the same in shard 0 but not in shard 1. Rows
+            // 1, 3, and 4 are the same in both shards. Row 5 differs from row
+            // 1 only in being adhoc.
+            FixedPlanRows planRows({
+                { RowId(0, 10), RowId(3, 7), RowId(0, 10), RowId(3, 7), RowId(3, 7), RowId(3, 7, true) },
+                { RowId(0, 20), RowId(0, 5), RowId(0, 21), RowId(0, 5), RowId(0, 5), RowId(0, 5, true) }
+            });
+
+            const std::vector<unsigned> expected = { 0, 1, 2, 1, 1, 5 };
+            EXPECT_EQ(expected, CommonRowHoister::GetRowClasses(planRows));
+        }
+    }
+}
@@ -270,12 +270,12 @@ namespace BitFunnel
                 "    Pop()\n"
                 "    IncrementOffset()\n"
                 "    Call(0)\n"
+                "    RightShiftOffset(1)\n"
                 "    Jmp(1)\n"
                 "L0:\n"
                 "    LoadRow(1, false, 0)\n"
                 "    Return()\n"
                 "L1:\n"
-                "    RightShiftOffset(1)\n"
             },
 
             // Report with no child.
@@ -0,0 +1,218 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "BitFunnel/Configuration/Factories.h"
+#include "BitFunnel/Configuration/IFileSystem.h"
+#include "BitFunnel/Configuration/IStreamConfiguration.h"
+#include "BitFunnel/Index/ISimpleIndex.h"
+#include "BitFunnel/Mocks/Factories.h"
+#include "BitFunnel/Plan/Factories.h"
+#include "BitFunnel/Plan/IQueryService.h"
+#include "BitFunnel/Plan/LoadGenerator.h"
+
+
+namespace BitFunnel
+{
+    namespace LoadGeneratorUnitTest
+    {
+        static const Term::StreamId c_streamId = 0;
+        static const DocId c_maxDocId = 1000;
+
+
+        class ServiceFixture
+        {
+        public:
+            ServiceFixture(size_t threadCount, size_t queueCapacity)
+              : m_fileSystem(Factories::CreateRAMFileSystem()),
+                m_index(Factories::CreatePrimeFactorsIndex(*m_fileSystem,
+                                                           c_maxDocId,
+                                                           c_streamId,
+                                                           2)),
+                m_config(Factories::CreateStreamConfiguration()),
+                m_service(Factories::CreateQueryService(*m_index,
+                                                        *m_config,
+                                                        threadCount,
+                                                        queueCapacity))
+            {
+            }
+
+            IQueryService & GetService() const
+            {
+                return *m_service;
+            }
+
+        private:
+            std::unique_ptr<IFileSystem> m_fileSystem;
+            std::unique_ptr<ISimpleIndex> m_index;
+            std::unique_ptr<IStreamConfiguration> m_config;
+            std::unique_ptr<IQueryService> m_service;
+        };
+
+
+        // At a low rate, every query completes. Saturation is not checked,
+        // since it depends on timing that a loaded host may not meet.
+        TEST(LoadGenerator, LowRate)
+        {
+            ServiceFixture fixture(2, 64);
+            const std::vector<std::string> queries = { "2", "3 5", "7" };
+
+            const LoadGenerator::Arrivals c_arrivals[] = {
+                LoadGenerator::Fixed,
+                LoadGenerator::Poisson
+            };
+            for (auto arrivals : c_arrivals)
+            {
+                LoadGenerator generator(fixture.GetService(), queries, arrivals);
+                auto step = generator.Run(100, 0.2);
+
+                EXPECT_GT(step.m_issued, 0u);
+                EXPECT_EQ(step.m_issued, step.m_completed);
+                EXPECT_EQ(0u, step.m_dropped);
+                EXPECT_EQ(0u, step.m_failed);
+                EXPECT_EQ(step.m_completed, step.m_latencies.GetCount());
+                EXPECT_GE(step.m_elapsedTime, 0.19);
+                EXPECT_GT(step.m_latencies.GetMax(), 0.0);
+
+                if (arrivals == LoadGenerator::Fixed)
+                {
+                    EXPECT_EQ(20u, step.m_issued);
+                }
+            }
+        }
+
+
+        // Fixed arrivals issue exactly rate * duration queries, even where
+        // a running sum of the interval would fall short of the duration.
+        TEST(LoadGenerator, FixedArrivalCount)
+        {
+            ServiceFixture fixture(2, 64);
+            const std::vector<std::string> queries = { "2" };
+
+            LoadGenerator generator(fixture.GetService(), queries, LoadGenerator::Fixed);
+            EXPECT_EQ(8u, generator.Run(10, 0.8).m_issued);
+        }
+
+
+        TEST(LoadGenerator, BehindSchedule)
+        {
+            LoadGenerator::Step step(100, 1.0);
+            step.m_elapsedTime = 1.0;
+            step.m_issued = 100;
+            step.m_completed = 100;
+            step.m_maxLag = 0.01;
+            EXPECT_FALSE(LoadGenerator::IsBehindSchedule(step));
+
+            step.m_maxLag = 0.2;
+            EXPECT_TRUE(LoadGenerator::IsBehindSchedule(step));
+
+            std::vector<LoadGenerator::Step> steps(1, step);
+            std::stringstream output;
+            LoadGenerator::Print(output, steps, 0.0);
+            EXPECT_NE(std::string::npos, output.str().find("behind schedule"));
+            EXPECT_NE(std::string::npos, output.str().find("No rate was sustained."));
+        }
+
+
+        // Failed queries are counted separately from completed ones.
+        TEST(LoadGenerator, FailedQueries)
+        {
+            ServiceFixture fixture(1, 64);
+            const std::vector<std::string> queries = { "(2" };
+
+            LoadGenerator generator(fixture.GetService(), queries, LoadGenerator::Fixed);
+            auto step = generator.Run(100, 0.05);
+
+            EXPECT_EQ(step.m_issued, step.m_failed);
+            EXPECT_EQ(0u, step.m_completed);
+        }
+
+
+        // A rate far beyond what a single worker with a one-entry queue can
+        // absorb drops queries and stops the ramp.
+        TEST(LoadGenerator, RampStopsAtSaturation)
+        {
+            ServiceFixture fixture(1, 1);
+            const std::vector<std::string> queries = { "2", "3", "5" };
+
+            LoadGenerator generator(fixture.GetService(), queries, LoadGenerator::Fixed);
+            auto steps = generator.Ramp(1e5, 2.0, 5, 0.02, 0.0);
+
+            ASSERT_EQ(1u, steps.size());
+            EXPECT_GT(steps[0].m_dropped, 0u);
+            EXPECT_TRUE(LoadGenerator::IsSaturated(steps[0], 0.0));
+            EXPECT_EQ(steps[0].m_issued,
+                      steps[0].m_completed + steps[0].m_dropped + steps[0].m_failed);
+
+            std::stringstream output;
+            LoadGenerator::Print(output, steps, 0.0);
+            EXPECT_NE(std::string::npos, output.str().find("saturated"));
+        }
+
+
+        TEST(LoadGenerator, LatencyLimit)
+        {
+            LoadGenerator::Step step(100, 1.0);
+            step.m_elapsedTime = 1.0;
+            step.m_issued = 100;
+            step.m_completed = 100;
+            for (size_t i = 0; i < 100; ++i)
+            {
+                step.m_latencies.Record(0.001 * (i + 1));
+            }
+
+            EXPECT_FALSE(LoadGenerator::IsSaturated(step, 0.0));
+            EXPECT_FALSE(LoadGenerator::IsSaturated(step, 0.2));
+            EXPECT_TRUE(LoadGenerator::IsSaturated(step, 0.05));
+        }
+
+
+        // Saturation is judged against the queries that were issued, not
+        // against the offered rate.
+        TEST(LoadGenerator, SaturationUsesIssuedQueries)
+        {
+            // Fewer queries than the offered rate, all answered promptly.
+            LoadGenerator::Step step(100, 1.0);
+            step.m_elapsedTime = 1.01;
+            step.m_issued = 80;
+            step.m_completed = 79;
+            step.m_failed = 1;
+            EXPECT_FALSE(LoadGenerator::IsSaturated(step, 0.0));
+
+            // The service took too long to drain its backlog.
+            step.m_elapsedTime = 1.2;
+            EXPECT_TRUE(LoadGenerator::IsSaturated(step, 0.0));
+
+            // A dropped query.
+            step.m_elapsedTime = 1.01;
+            step.m_completed = 78;
+            step.m_dropped = 1;
+            EXPECT_TRUE(LoadGenerator::IsSaturated(step, 0.0));
+        }
+    }
+}
@@ -29,6 +29,7 @@
 #include "BitFunnel/Index/IShard.h"
 #include "BitFunnel/Index/ISimpleIndex.h"
 #include "BitFunnel/Index/RowIdSequence.h"
+#include "BitFunnel/Plan/QueryCancellation.h"
 #include "BitFunnel/Plan/QueryInstrumentation.h"
 #include "BitFunnel/Utilities/Allocator.h"
 #include "CompileNode.h"
@@ -78,7 +79,9 @@ namespace BitFunnel
                                    *code,
                                    compileNodeTree,
                                    registers,
-                                   m_initialRank);
+                                   m_initialRank,
+                                   false,
+                                   { 0, false });
 
         ResultsBuffer results(m_index.GetIngestor().GetDocumentCount());
 
@@ -86,8 +89,45 @@ namespace BitFunnel
                      m_slices.data(),
                      GetIterationsPerSlice(),
                      m_rowOffsets.data(),
-                     results);
+                     results,
+                     results.m_capacity);
 
         CheckResults(results);
+
+        // A cancelled query, or one whose deadline has passed, stops before
+        // its first iteration. The generated code checks the deadline
+        // itself.
+        QueryCancellation cancellation;
+        cancellation.Cancel();
+        QueryCancellation expired(0.0);
+        QueryCancellation const * const tokens[] = { &cancellation, &expired };
+        for (auto token : tokens)
+        {
+            ResultsBuffer cancelled(m_index.GetIngestor().GetDocumentCount());
+            bool wasCancelled = false;
+            compiler.Run(m_slices.size(),
+                         m_slices.data(),
+                         GetIterationsPerSlice(),
+                         m_rowOffsets.data(),
+                         cancelled,
+                         cancelled.m_capacity,
+                         token,
+                         &wasCancelled);
+            EXPECT_TRUE(wasCancelled);
+            EXPECT_EQ(0u, cancelled.size());
+        }
+
+        // The call out for the deadline preserves the matching state.
+        QueryCancellation deadline(3600.0);
+        deadline.SetStride(1);
+        ResultsBuffer beforeDeadline(m_index.GetIngestor().GetDocumentCount());
+        compiler.Run(m_slices.size(),
+                     m_slices.data(),
+                     GetIterationsPerSlice(),
+                     m_rowOffsets.data(),
+                     beforeDeadline,
+                     beforeDeadline.m_capacity,
+                     &deadline);
+        CheckResults(beforeDeadline);
     }
 }
@@ -0,0 +1,1261 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "BitFunnel/Configuration/Factories.h"
+#include "BitFunnel/Configuration/IFileSystem.h"
+#include "BitFunnel/Configuration/IStreamConfiguration.h"
+#include "BitFunnel/Index/DocumentHandle.h"
+#include "BitFunnel/Index/IIngestor.h"
+#include "BitFunnel/Index/IShard.h"
+#include "BitFunnel/Index/ISimpleIndex.h"
+#include "BitFunnel/Mocks/Factories.h"
+#include "BitFunnel/Plan/CallbackResultsSink.h"
+#include "BitFunnel/Plan/ChunkedResultsSink.h"
+#include "BitFunnel/Plan/IQueryEngine.h"
+#include "BitFunnel/Plan/QueryCancellation.h"
+#include "BitFunnel/Plan/QueryInstrumentation.h"
+#include "BitFunnel/Utilities/Allocator.h"
+#include "ByteCodeQueryEngine.h"
+#include "NativeJITQueryEngine.h"
+#include "QueryPlanCache.h"
+
+
+namespace BitFunnel
+{
+    namespace QueryEngineUnitTest
+    {
+        static const Term::StreamId c_streamId = 0;
+
+        // Large enough to span several slices so that queries are divided
+        // into multiple morsels. Larger values exceed the capacity of the
+        // PrimeFactors index slice buffers.
+        static const DocId c_maxDocId = 2000;
+
+        static const size_t c_allocatorSize = 1ull << 17;
+
+
+        class IndexFixture
+        {
+        public:
+            IndexFixture(ShardId shardCount)
+              : m_fileSystem(Factories::CreateRAMFileSystem()),
+                m_index(Factories::CreatePrimeFactorsIndex(*m_fileSystem,
+                                                           c_maxDocId,
+                                                           c_streamId,
+                                                           shardCount)),
+                m_config(Factories::CreateStreamConfiguration())
+            {
+            }
+
+            std::unique_ptr<IQueryEngine> CreateEngine(
+                bool useNativeCode,
+                QueryPlanCache * planCache = nullptr) const
+            {
+                if (useNativeCode)
+                {
+                    return std::unique_ptr<IQueryEngine>(
+                        new NativeJITQueryEngine(*m_index,
+                                                 *m_config,
+                                                 c_allocatorSize,
+                                                 c_allocatorSize,
+                                                 planCache));
+                }
+                else
+                {
+                    return std::unique_ptr<IQueryEngine>(
+                        new ByteCodeQueryEngine(*m_index,
+                                                *m_config,
+                                                c_allocatorSize,
+                                                planCache));
+                }
+            }
+
+            ISimpleIndex const & GetIndex() const
+            {
+                return *m_index;
+            }
+
+            IStreamConfiguration const & GetConfiguration() const
+            {
+                return *m_config;
+            }
+
+        private:
+            std::unique_ptr<IFileSystem> m_fileSystem;
+            std::unique_ptr<ISimpleIndex> m_index;
+            std::unique_ptr<IStreamConfiguration> m_config;
+        };
+
+
+        // Runs query and returns the set of matching DocIds.
+        std::set<DocId> RunQuery(IQueryEngine & engine,
+                                 ISimpleIndex const & index,
+                                 char const * query,
+                                 QueryInstrumentation & instrumentation)
+        {
+            ChunkedResultsSink results;
+
+            auto tree = engine.Parse(query);
+            engine.Run(tree, instrumentation, results);
+            EXPECT_LE(results.size(), index.GetIngestor().GetDocumentCount());
+
+            std::set<DocId> matches;
+            for (auto result : results)
+            {
+                DocumentHandle handle = result.GetHandle();
+                if (handle.IsActive())
+                {
+                    matches.insert(handle.GetDocId());
+                }
+            }
+
+            return matches;
+        }
+
+
+        // Returns the DocIds of the prime factors documents divisible by
+        // divisor. The PrimeFactors index has no false positives for these
+        // queries since each term has a private rank 0 row.
+        std::set<DocId> ExpectedMatches(DocId divisor)
+        {
+            std::set<DocId> expected;
+            for (DocId docId = divisor; docId <= c_maxDocId; docId += divisor)
+            {
+                expected.insert(docId);
+            }
+            return expected;
+        }
+
+
+        void VerifyParallelMatching(bool useNativeCode, ShardId shardCount)
+        {
+            IndexFixture fixture(shardCount);
+
+            // Parallel matching is only exercised if there are several
+            // slices to distribute.
+            ASSERT_GT(fixture.GetIndex().GetIngestor().GetShard(0).GetSliceBuffers().size(),
+                      2u);
+
+            struct Case
+            {
+                char const * m_query;
+                DocId m_divisor;
+            };
+
+            const Case c_cases[] =
+            {
+                { "2", 2 },
+                { "2 3", 6 },
+                { "5 7", 35 },
+                { "11 13", 143 }
+            };
+
+            const size_t c_threadCounts[] = { 2, 3, 8 };
+            const size_t c_slicesPerMorsel[] = { 1, 3 };
+
+            for (auto const & c : c_cases)
+            {
+                QueryInstrumentation serialInstrumentation;
+                auto serialEngine = fixture.CreateEngine(useNativeCode);
+                auto serial = RunQuery(*serialEngine,
+                                       fixture.GetIndex(),
+                                       c.m_query,
+                                       serialInstrumentation);
+
+                EXPECT_EQ(ExpectedMatches(c.m_divisor), serial);
+
+                for (auto threadCount : c_threadCounts)
+                {
+                    for (auto slicesPerMorsel : c_slicesPerMorsel)
+                    {
+                        QueryInstrumentation instrumentation;
+                        auto engine = fixture.CreateEngine(useNativeCode);
+                        engine->SetMatchingThreads(threadCount, slicesPerMorsel);
+                        auto parallel = RunQuery(*engine,
+                                                 fixture.GetIndex(),
+                                                 c.m_query,
+                                                 instrumentation);
+
+                        EXPECT_EQ(serial, parallel)
+                            << "Query \"" << c.m_query << "\" with "
+                            << threadCount << " threads.";
+                        EXPECT_EQ(serialInstrumentation.GetData().GetQuadwordCount(),
+                                  instrumentation.GetData().GetQuadwordCount());
+                        EXPECT_EQ(serial.size(),
+                                  instrumentation.GetData().GetMatchCount());
+                    }
+                }
+            }
+        }
+
+
+        TEST(QueryEngine, ParallelMatchingByteCode)
+        {
+            VerifyParallelMatching(false, 1);
+        }
+
+
+        TEST(QueryEngine, ParallelMatchingByteCodeShards2)
+        {
+            VerifyParallelMatching(false, 2);
+        }
+
+
+        TEST(QueryEngine, ParallelMatchingNativeCode)
+        {
+            VerifyParallelMatching(true, 1);
+        }
+
+
+        TEST(QueryEngine, ParallelMatchingNativeCodeShards2)
+        {
+            VerifyParallelMatching(true, 2);
+        }
+
+
+        TEST(QueryEngine, PlanCacheKeyNormalization)
+        {
+            IndexFixture fixture(1);
+            auto engine = fixture.CreateEngine(false);
+
+            auto key = [&engine](char const * query)
+            {
+                return QueryPlanCache::CreateKey(*engine->Parse(query));
+            };
+
+            // Conjuncts and disjuncts are sorted.
+            EXPECT_EQ(key("2 3"), key("3 2"));
+            EXPECT_EQ(key("2|3"), key("3|2"));
+
+            // Nested ANDs and ORs are flattened.
+            EXPECT_EQ(key("(2 3) 5"), key("2 (3 5)"));
+            EXPECT_EQ(key("(2|3)|5"), key("5|(3|2)"));
+            EXPECT_EQ(key("(2|3) (5|7)"), key("(7|5) (3|2)"));
+
+            // Structure is preserved.
+            EXPECT_NE(key("2 3"), key("2|3"));
+            EXPECT_NE(key("2 (3|5)"), key("(2 3)|5"));
+            EXPECT_NE(key("2 -3"), key("-2 3"));
+            EXPECT_NE(key("23"), key("2 3"));
+        }
+
+
+        void VerifyPlanCache(bool useNativeCode)
+        {
+            IndexFixture fixture(2);
+            QueryPlanCache cache(2);
+
+            auto engine = fixture.CreateEngine(useNativeCode, &cache);
+            QueryInstrumentation missInstrumentation;
+            QueryInstrumentation instrumentation;
+
+            // First run of each query is a miss. The same engine can run
+            // several queries, including ones that are already cached.
+            EXPECT_EQ(ExpectedMatches(6),
+                      RunQuery(*engine, fixture.GetIndex(), "2 3", missInstrumentation));
+            EXPECT_EQ(ExpectedMatches(35),
+                      RunQuery(*engine, fixture.GetIndex(), "5 7", instrumentation));
+            EXPECT_EQ(0u, cache.GetHitCount());
+            EXPECT_EQ(2u, cache.GetMissCount());
+            EXPECT_EQ(2u, cache.GetEntryCount());
+
+            // A permutation of a cached query is a hit, even from another
+            // engine sharing the cache.
+            auto other = fixture.CreateEngine(useNativeCode, &cache);
+            QueryInstrumentation hitInstrumentation;
+            EXPECT_EQ(ExpectedMatches(6),
+                      RunQuery(*other, fixture.GetIndex(), "3 2", hitInstrumentation));
+            EXPECT_EQ(1u, cache.GetHitCount());
+            EXPECT_EQ(missInstrumentation.GetData().GetRowCount(),
+                      hitInstrumentation.GetData().GetRowCount());
+
+            // Cache holds two entries, so "5 7", the least recently used,
+            // is evicted.
+            EXPECT_EQ(ExpectedMatches(143),
+                      RunQuery(*engine, fixture.GetIndex(), "11 13", instrumentation));
+            EXPECT_EQ(2u, cache.GetEntryCount());
+            EXPECT_EQ(ExpectedMatches(6),
+                      RunQuery(*engine, fixture.GetIndex(), "2 3", instrumentation));
+            EXPECT_EQ(ExpectedMatches(35),
+                      RunQuery(*engine, fixture.GetIndex(), "7 5", instrumentation));
+            EXPECT_EQ(2u, cache.GetHitCount());
+            EXPECT_EQ(4u, cache.GetMissCount());
+
+            // Entries compiled by the other kind of engine are not shared.
+            auto mixed = fixture.CreateEngine(!useNativeCode, &cache);
+            EXPECT_EQ(ExpectedMatches(35),
+                      RunQuery(*mixed, fixture.GetIndex(), "5 7", instrumentation));
+            EXPECT_EQ(2u, cache.GetHitCount());
+            EXPECT_EQ(5u, cache.GetMissCount());
+
+            // Running against an index with a different layout invalidates
+            // the cache.
+            IndexFixture fixture2(1);
+            auto engine2 = fixture2.CreateEngine(useNativeCode, &cache);
+            EXPECT_EQ(ExpectedMatches(35),
+                      RunQuery(*engine2, fixture2.GetIndex(), "5 7", instrumentation));
+            EXPECT_EQ(1u, cache.GetInvalidationCount());
+            EXPECT_EQ(1u, cache.GetEntryCount());
+            EXPECT_EQ(2u, cache.GetHitCount());
+            EXPECT_EQ(6u, cache.GetMissCount());
+        }
+
+
+        TEST(QueryEngine, PlanCacheByteCode)
+        {
+            VerifyPlanCache(false);
+        }
+
+
+        TEST(QueryEngine, PlanCacheNativeCode)
+        {
+            VerifyPlanCache(true);
+        }
+
+
+        // Runs query and returns the number of active matches from each
+        // shard. Also verifies that every match is a multiple of divisor.
+        std::map<ShardId, size_t> CountMatchesByShard(IQueryEngine & engine,
+                                                      ISimpleIndex const & index,
+                                                      char const * query,
+                                                      DocId divisor,
+                                                      QueryInstrumentation & instrumentation)
+        {
+            ChunkedResultsSink results;
+
+            auto tree = engine.Parse(query);
+            engine.Run(tree, instrumentation, results);
+            EXPECT_LE(results.size(), index.GetIngestor().GetDocumentCount());
+
+            std::set<DocId> unique;
+            std::map<ShardId, size_t> counts;
+            for (auto result : results)
+            {
+                DocumentHandle handle = result.GetHandle();
+                if (handle.IsActive())
+                {
+                    EXPECT_EQ(0u, handle.GetDocId() % divisor);
+                    EXPECT_TRUE(unique.insert(handle.GetDocId()).second);
+                    ++counts[handle.GetShardId()];
+                }
+            }
+
+            return counts;
+        }
+
+
+        size_t Total(std::map<ShardId, size_t> const & counts)
+        {
+            size_t total = 0;
+            for (auto const & count : counts)
+            {
+                total += count.second;
+            }
+            return total;
+        }
+
+
+        void VerifyMatchLimit(bool useNativeCode)
+        {
+            IndexFixture fixture(2);
+            auto & index = fixture.GetIndex();
+
+            QueryInstrumentation fullInstrumentation;
+            auto full = CountMatchesByShard(*fixture.CreateEngine(useNativeCode),
+                                            index,
+                                            "2",
+                                            2,
+                                            fullInstrumentation);
+            ASSERT_EQ(ExpectedMatches(2).size(), Total(full));
+
+            const size_t c_threadCounts[] = { 1, 3 };
+            for (auto threadCount : c_threadCounts)
+            {
+                // Overall limit.
+                {
+                    QueryInstrumentation instrumentation;
+                    auto engine = fixture.CreateEngine(useNativeCode);
+                    engine->SetMatchingThreads(threadCount, 1);
+                    engine->SetMatchLimit(100, 0);
+                    auto counts = CountMatchesByShard(*engine, index, "2", 2, instrumentation);
+                    EXPECT_EQ(100u, Total(counts));
+                    EXPECT_EQ(100u, instrumentation.GetData().GetMatchCount());
+
+                    // The quadword count is only available from native code
+                    // compiled with QUADWORDCOUNT.
+                    if (!useNativeCode && threadCount == 1)
+                    {
+                        EXPECT_LT(instrumentation.GetData().GetQuadwordCount(),
+                                  fullInstrumentation.GetData().GetQuadwordCount());
+                    }
+                }
+
+                // Per-shard quota.
+                {
+                    const size_t c_quota = 50;
+                    QueryInstrumentation instrumentation;
+                    auto engine = fixture.CreateEngine(useNativeCode);
+                    engine->SetMatchingThreads(threadCount, 1);
+                    engine->SetMatchLimit(0, c_quota);
+                    auto counts = CountMatchesByShard(*engine, index, "2", 2, instrumentation);
+                    for (auto const & count : full)
+                    {
+                        EXPECT_EQ((std::min)(c_quota, count.second),
+                                  counts[count.first]);
+                    }
+                }
+
+                // Both limits.
+                {
+                    const size_t c_limit = 70;
+                    const size_t c_quota = 50;
+                    size_t available = 0;
+                    for (auto const & count : full)
+                    {
+                        available += (std::min)(c_quota, count.second);
+                    }
+
+                    QueryInstrumentation instrumentation;
+                    auto engine = fixture.CreateEngine(useNativeCode);
+                    engine->SetMatchingThreads(threadCount, 1);
+                    engine->SetMatchLimit(c_limit, c_quota);
+                    auto counts = CountMatchesByShard(*engine, index, "2", 2, instrumentation);
+                    EXPECT_EQ((std::min)(c_limit, available), Total(counts));
+                    for (auto const & count : counts)
+                    {
+                        EXPECT_LE(count.second, c_quota);
+                    }
+                }
+
+                // Limit larger than the number of matches.
+                {
+                    QueryInstrumentation instrumentation;
+                    auto engine = fixture.CreateEngine(useNativeCode);
+                    engine->SetMatchingThreads(threadCount, 1);
+                    engine->SetMatchLimit(100000, 100000);
+                    auto counts = CountMatchesByShard(*engine, index, "2", 2, instrumentation);
+                    EXPECT_EQ(full, counts);
+                }
+            }
+        }
+
+
+        TEST(QueryEngine, MatchLimitByteCode)
+        {
+            VerifyMatchLimit(false);
+        }
+
+
+        TEST(QueryEngine, MatchLimitNativeCode)
+        {
+            VerifyMatchLimit(true);
+        }
+    
+
+        void VerifyCount(bool useNativeCode)
+        {
+            IndexFixture fixture(2);
+
+            char const * c_queries[] = { "2", "5 7", "3|5", "2 -3", "11 13 17" };
+
+            const size_t c_threadCounts[] = { 1, 3 };
+            for (auto threadCount : c_threadCounts)
+            {
+                QueryPlanCache cache(16);
+                auto engine = fixture.CreateEngine(useNativeCode, &cache);
+                engine->SetMatchingThreads(threadCount, 1);
+
+                for (auto query : c_queries)
+                {
+                    ChunkedResultsSink results;
+                    QueryInstrumentation runInstrumentation;
+                    engine->Run(engine->Parse(query), runInstrumentation, results);
+
+                    // Count twice so the second call reuses a cached plan.
+                    for (unsigned i = 0; i < 2; ++i)
+                    {
+                        QueryInstrumentation instrumentation;
+                        size_t count = engine->Count(engine->Parse(query),
+                                                     instrumentation);
+                        EXPECT_EQ(results.size(), count) << query;
+                        EXPECT_EQ(count, instrumentation.GetData().GetMatchCount());
+                        EXPECT_TRUE(instrumentation.GetData().GetSucceeded());
+                    }
+                }
+
+                // A match limit constrains Run(), but not Count().
+                engine->SetMatchLimit(10, 0);
+                QueryInstrumentation instrumentation;
+                EXPECT_EQ(ExpectedMatches(2).size(),
+                          engine->Count(engine->Parse("2"), instrumentation));
+            }
+        }
+
+
+        TEST(QueryEngine, CountByteCode)
+        {
+            VerifyCount(false);
+        }
+
+
+        TEST(QueryEngine, CountNativeCode)
+        {
+            VerifyCount(true);
+        }
+    
+
+        // Estimates are validated against the actual match, row and
+        // quadword counts recorded in QueryInstrumentation by Run(). Terms in
+        // the PrimeFactors index are independent, so the estimates should be
+        // close. A wideDisjunctionRowCount below c_maxRowsPerQuery plans
+        // queries as WideDisjunctionPlans.
+        void VerifyEstimate(bool useNativeCode, size_t wideDisjunctionRowCount)
+        {
+            IndexFixture fixture(2);
+            auto & index = fixture.GetIndex();
+            auto engine = fixture.CreateEngine(useNativeCode);
+            engine->SetWideDisjunctionRowCount(wideDisjunctionRowCount);
+            const bool isWide = (wideDisjunctionRowCount < c_maxRowsPerQuery);
+            const double documentCount =
+                static_cast<double>(index.GetIngestor().GetDocumentCount());
+
+            char const * c_queries[] = { "2", "3", "2 3", "2 5", "3|5", "2 -3" };
+
+            for (auto query : c_queries)
+            {
+                QueryInstrumentation estimateInstrumentation;
+                QueryEstimate estimate =
+                    engine->Estimate(engine->Parse(query), estimateInstrumentation);
+
+                ChunkedResultsSink results;
+                QueryInstrumentation runInstrumentation;
+                engine->Run(engine->Parse(query), runInstrumentation, results);
+
+                auto & actual = runInstrumentation.GetData();
+                auto & predicted = estimateInstrumentation.GetData();
+
+                EXPECT_TRUE(predicted.GetSucceeded()) << query;
+                EXPECT_EQ(estimate.m_matchCount, predicted.GetMatchEstimate()) << query;
+                EXPECT_EQ(actual.GetRowCount(), estimate.m_rowCount) << query;
+                EXPECT_NEAR(static_cast<double>(actual.GetMatchCount()),
+                            estimate.m_matchCount,
+                            0.02 * documentCount) << query;
+
+                // Only the byte code interpreter and the wide disjunction
+                // matcher count quadwords.
+                if (!useNativeCode || isWide)
+                {
+                    const double quadwords =
+                        static_cast<double>(actual.GetQuadwordCount());
+                    EXPECT_NEAR(quadwords,
+                                estimate.m_quadwordCount,
+                                0.25 * quadwords) << query;
+                }
+            }
+        }
+
+
+        TEST(QueryEngine, EstimateByteCode)
+        {
+            VerifyEstimate(false, c_maxRowsPerQuery);
+        }
+
+
+        TEST(QueryEngine, EstimateNativeCode)
+        {
+            VerifyEstimate(true, c_maxRowsPerQuery);
+        }
+
+
+        TEST(QueryEngine, EstimateWideDisjunctionByteCode)
+        {
+            VerifyEstimate(false, 2);
+        }
+
+
+        TEST(QueryEngine, EstimateWideDisjunctionNativeCode)
+        {
+            VerifyEstimate(true, 2);
+        }
+
+
+        std::set<DocId> GetDocIds(ChunkedResultsSink const & results)
+        {
+            std::set<DocId> docIds;
+            for (auto result : results)
+            {
+                docIds.insert(result.GetHandle().GetDocId());
+            }
+            return docIds;
+        }
+
+
+        TEST(QueryEngine, MatchTreeHighWaterMark)
+        {
+            IndexFixture fixture(1);
+            for (bool useNativeCode : { false, true })
+            {
+                auto engine = fixture.CreateEngine(useNativeCode);
+                EXPECT_EQ(0u, engine->GetMatchTreeHighWaterMark());
+
+                QueryInstrumentation instrumentation;
+                RunQuery(*engine, fixture.GetIndex(), "2 3", instrumentation);
+                const size_t highWaterMark = engine->GetMatchTreeHighWaterMark();
+                EXPECT_GT(highWaterMark, 0u);
+
+                // A smaller query does not lower the mark.
+                RunQuery(*engine, fixture.GetIndex(), "2", instrumentation);
+                EXPECT_LE(highWaterMark, engine->GetMatchTreeHighWaterMark());
+            }
+        }
+
+
+        // Rows are intersected sparsest first whatever the order of the
+        // terms in the query, so the quadwords read by the byte code
+        // interpreter do not depend on that order.
+        TEST(QueryEngine, RowDensityOrdering)
+        {
+            IndexFixture fixture(2);
+            auto engine = fixture.CreateEngine(false);
+
+            char const * c_queries[] = { "2 997", "997 2" };
+            size_t quadwordCounts[2];
+            for (size_t i = 0; i < 2; ++i)
+            {
+                ChunkedResultsSink results;
+                QueryInstrumentation instrumentation;
+                engine->Run(engine->Parse(c_queries[i]), instrumentation, results);
+
+                auto & data = instrumentation.GetData();
+                EXPECT_EQ(ExpectedMatches(2 * 997), GetDocIds(results));
+                quadwordCounts[i] = data.GetQuadwordCount();
+                EXPECT_LE(data.GetOrderedQuadwordEstimate(),
+                          data.GetUnorderedQuadwordEstimate()) << c_queries[i];
+
+                // Only the dense-first query is reordered.
+                EXPECT_EQ(i == 1,
+                          data.GetOrderedQuadwordEstimate() <
+                              data.GetUnorderedQuadwordEstimate()) << c_queries[i];
+            }
+            EXPECT_EQ(quadwordCounts[0], quadwordCounts[1]);
+        }
+
+
+        void VerifyBatch(bool useNativeCode)
+        {
+            IndexFixture fixture(2);
+
+            std::vector<char const *> queries = { "2", "5 7", "3|5", "2 -3", "11 13 17" };
+
+            // Expected results from running each query by itself.
+            std::vector<std::set<DocId>> expected;
+            {
+                auto engine = fixture.CreateEngine(useNativeCode);
+                for (auto query : queries)
+                {
+                    ChunkedResultsSink results;
+                    QueryInstrumentation instrumentation;
+                    engine->Run(engine->Parse(query), instrumentation, results);
+                    expected.push_back(GetDocIds(results));
+                }
+            }
+
+            std::vector<std::unique_ptr<ChunkedResultsSink>> owners;
+            std::vector<IResultsSink *> results;
+            for (size_t i = 0; i < queries.size(); ++i)
+            {
+                owners.emplace_back(new ChunkedResultsSink());
+                results.push_back(owners.back().get());
+            }
+
+            const size_t c_threadCounts[] = { 1, 3 };
+            for (auto threadCount : c_threadCounts)
+            {
+                auto engine = fixture.CreateEngine(useNativeCode);
+                engine->SetMatchingThreads(threadCount, 1);
+
+                std::vector<QueryInstrumentation> instrumentation(queries.size());
+                std::vector<QueryInstrumentation *> batchInstrumentation;
+                for (auto & item : instrumentation)
+                {
+                    batchInstrumentation.push_back(&item);
+                }
+
+                engine->RunBatch(queries, batchInstrumentation, results);
+
+                for (size_t i = 0; i < queries.size(); ++i)
+                {
+                    EXPECT_EQ(expected[i].size(), owners[i]->size()) << queries[i];
+                    EXPECT_EQ(expected[i], GetDocIds(*owners[i])) << queries[i];
+
+                    EXPECT_TRUE(instrumentation[i].GetData().GetSucceeded());
+                    EXPECT_EQ(owners[i]->size(),
+                              instrumentation[i].GetData().GetMatchCount());
+                }
+
+                // Match limits apply to each query in the batch.
+                const size_t c_limit = 20;
+                engine->SetMatchLimit(c_limit, 0);
+                std::vector<QueryInstrumentation> limited(queries.size());
+                batchInstrumentation.clear();
+                for (auto & item : limited)
+                {
+                    batchInstrumentation.push_back(&item);
+                }
+
+                engine->RunBatch(queries, batchInstrumentation, results);
+
+                for (size_t i = 0; i < queries.size(); ++i)
+                {
+                    EXPECT_EQ((std::min)(c_limit, expected[i].size()),
+                              owners[i]->size()) << queries[i];
+                    for (auto docId : GetDocIds(*owners[i]))
+                    {
+                        EXPECT_EQ(1u, expected[i].count(docId));
+                    }
+                }
+            }
+        }
+
+
+        TEST(QueryEngine, BatchByteCode)
+        {
+            VerifyBatch(false);
+        }
+
+
+        TEST(QueryEngine, BatchNativeCode)
+        {
+            VerifyBatch(true);
+        }
+
+
+        // Matches streamed through a CallbackResultsSink are the same as the
+        // matches stored by a ChunkedResultsSink.
+        void VerifyCallbackSink(bool useNativeCode)
+        {
+            IndexFixture fixture(2);
+            const char * c_query = "3";
+            const size_t c_limit = 100;
+
+            const size_t c_threadCounts[] = { 1, 3 };
+            for (auto threadCount : c_threadCounts)
+            {
+                auto engine = fixture.CreateEngine(useNativeCode);
+                engine->SetMatchingThreads(threadCount, 1);
+
+                std::set<DocId> streamed;
+                size_t batchCount = 0;
+                CallbackResultsSink results(
+                    [&](ResultsBuffer::Result const * matches, size_t count)
+                    {
+                        ++batchCount;
+                        for (size_t i = 0; i < count; ++i)
+                        {
+                            streamed.insert(matches[i].GetHandle().GetDocId());
+                        }
+                    });
+
+                QueryInstrumentation instrumentation;
+                engine->Run(engine->Parse(c_query), instrumentation, results);
+
+                EXPECT_EQ(ExpectedMatches(3), streamed);
+                EXPECT_EQ(streamed.size(), results.GetMatchCount());
+                EXPECT_EQ(streamed.size(),
+                          instrumentation.GetData().GetMatchCount());
+                EXPECT_GT(batchCount, 0u);
+
+                // Run() resets the sink and match limits apply.
+                engine->SetMatchLimit(c_limit, 0);
+                QueryInstrumentation limited;
+                engine->Run(engine->Parse(c_query), limited, results);
+                EXPECT_EQ(c_limit, results.GetMatchCount());
+            }
+        }
+
+
+        TEST(QueryEngine, CallbackSinkByteCode)
+        {
+            VerifyCallbackSink(false);
+        }
+
+
+        TEST(QueryEngine, CallbackSinkNativeCode)
+        {
+            VerifyCallbackSink(true);
+        }
+
+
+        // Cancelled queries keep the matches found so far and are marked as
+        // truncated. Queries that finish before their deadline are not.
+        void VerifyCancellation(bool useNativeCode)
+        {
+            IndexFixture fixture(2);
+            const char * c_query = "3";
+            const std::set<DocId> expected = ExpectedMatches(3);
+
+            const size_t c_threadCounts[] = { 1, 3 };
+            for (auto threadCount : c_threadCounts)
+            {
+                auto engine = fixture.CreateEngine(useNativeCode);
+                engine->SetMatchingThreads(threadCount, 1);
+
+                {
+                    // Cancelled before the query starts.
+                    QueryCancellation cancellation;
+                    cancellation.Cancel();
+                    ChunkedResultsSink results;
+                    QueryInstrumentation instrumentation;
+                    engine->Run(engine->Parse(c_query),
+                                instrumentation,
+                                results,
+                                cancellation);
+                    EXPECT_EQ(0u, results.size());
+                    EXPECT_TRUE(instrumentation.GetData().GetSucceeded());
+                    EXPECT_TRUE(instrumentation.GetData().GetTruncated());
+                }
+
+                {
+                    // Deadline already passed.
+                    QueryCancellation cancellation(0.0);
+                    ChunkedResultsSink results;
+                    QueryInstrumentation instrumentation;
+                    engine->Run(engine->Parse(c_query),
+                                instrumentation,
+                                results,
+                                cancellation);
+                    EXPECT_EQ(0u, results.size());
+                    EXPECT_TRUE(instrumentation.GetData().GetTruncated());
+                }
+
+                {
+                    // Deadline far in the future.
+                    QueryCancellation cancellation(3600.0);
+                    ChunkedResultsSink results;
+                    QueryInstrumentation instrumentation;
+                    engine->Run(engine->Parse(c_query),
+                                instrumentation,
+                                results,
+                                cancellation);
+                    EXPECT_EQ(expected, GetDocIds(results));
+                    EXPECT_FALSE(instrumentation.GetData().GetTruncated());
+                }
+
+                {
+                    // Running without a QueryCancellation never truncates.
+                    ChunkedResultsSink results;
+                    QueryInstrumentation instrumentation;
+                    engine->Run(engine->Parse(c_query), instrumentation, results);
+                    EXPECT_EQ(expected, GetDocIds(results));
+                    EXPECT_FALSE(instrumentation.GetData().GetTruncated());
+                }
+            }
+
+            {
+                // Cancelled by the sink after the first window with matches.
+                // With a single thread, windows are streamed to the sink as
+                // they are matched, so the remaining windows are skipped. The
+                // deadline limits each window to a single slice.
+                auto engine = fixture.CreateEngine(useNativeCode);
+                engine->SetMatchingThreads(1, 1);
+
+                QueryCancellation cancellation(3600.0);
+                std::set<DocId> streamed;
+                CallbackResultsSink results(
+                    [&](ResultsBuffer::Result const * matches, size_t count)
+                    {
+                        for (size_t i = 0; i < count; ++i)
+                        {
+                            streamed.insert(matches[i].GetHandle().GetDocId());
+                        }
+                        cancellation.Cancel();
+                    });
+
+                QueryInstrumentation instrumentation;
+                engine->Run(engine->Parse(c_query),
+                            instrumentation,
+                            results,
+                            cancellation);
+
+                EXPECT_GT(streamed.size(), 0u);
+                EXPECT_LT(streamed.size(), expected.size());
+                for (auto docId : streamed)
+                {
+                    EXPECT_EQ(1u, expected.count(docId));
+                }
+                EXPECT_EQ(streamed.size(),
+                          instrumentation.GetData().GetMatchCount());
+                EXPECT_TRUE(instrumentation.GetData().GetTruncated());
+            }
+
+            {
+                // Cancelled after every slice has been matched. With more
+                // than one thread, the sink only receives matches once all
+                // of the morsels are done, so the results are complete and
+                // the run is not truncated.
+                auto engine = fixture.CreateEngine(useNativeCode);
+                engine->SetMatchingThreads(3, 1);
+
+                QueryCancellation cancellation(3600.0);
+                std::set<DocId> streamed;
+                CallbackResultsSink results(
+                    [&](ResultsBuffer::Result const * matches, size_t count)
+                    {
+                        for (size_t i = 0; i < count; ++i)
+                        {
+                            streamed.insert(matches[i].GetHandle().GetDocId());
+                        }
+                        cancellation.Cancel();
+                    });
+
+                QueryInstrumentation instrumentation;
+                engine->Run(engine->Parse(c_query),
+                            instrumentation,
+                            results,
+                            cancellation);
+
+                EXPECT_TRUE(cancellation.WasCancelled());
+                EXPECT_EQ(expected, streamed);
+                EXPECT_FALSE(instrumentation.GetData().GetTruncated());
+            }
+        }
+
+
+        TEST(QueryEngine, CancellationByteCode)
+        {
+            VerifyCancellation(false);
+        }
+
+
+        TEST(QueryEngine, CancellationNativeCode)
+        {
+            VerifyCancellation(true);
+        }
+    
+
+        // Queries that use more rows than there are row registers exercise
+        // the stack slots that hold the remaining row offsets.
+        TEST(QueryEngine, NativeCodeManyRows)
+        {
+            IndexFixture fixture(1);
+            auto & index = fixture.GetIndex();
+            auto engine = fixture.CreateEngine(true);
+
+            struct Case
+            {
+                char const * m_query;
+                std::function<bool(DocId)> m_matches;
+            };
+
+            auto divides = [](DocId divisor, DocId docId)
+            {
+                return (docId % divisor) == 0;
+            };
+
+            const Case c_cases[] =
+            {
+                {
+                    "2|3|5|7|11|13|17|19|23|29|31|37",
+                    [&](DocId d)
+                    {
+                        for (DocId p : { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 })
+                        {
+                            if (divides(p, d))
+                            {
+                                return true;
+                            }
+                        }
+                        return false;
+                    }
+                },
+                {
+                    "(2|3) (5|7) (11|13) (17|19) -(23|29|31)",
+                    [&](DocId d)
+                    {
+                        return (divides(2, d) || divides(3, d)) &&
+                               (divides(5, d) || divides(7, d)) &&
+                               (divides(11, d) || divides(13, d)) &&
+                               (divides(17, d) || divides(19, d)) &&
+                               !(divides(23, d) || divides(29, d) || divides(31, d));
+                    }
+                },
+                {
+                    "2 3 -5 -7 -11 -13 -17 -19 -23 -29 -31",
+                    [&](DocId d)
+                    {
+                        if (!divides(6, d))
+                        {
+                            return false;
+                        }
+                        for (DocId p : { 5, 7, 11, 13, 17, 19, 23, 29, 31 })
+                        {
+                            if (divides(p, d))
+                            {
+                                return false;
+                            }
+                        }
+                        return true;
+                    }
+                }
+            };
+
+            for (auto const & c : c_cases)
+            {
+                std::set<DocId> expected;
+                for (DocId docId = 1; docId <= c_maxDocId; ++docId)
+                {
+                    if (c.m_matches(docId))
+                    {
+                        expected.insert(docId);
+                    }
+                }
+
+                QueryInstrumentation instrumentation;
+                EXPECT_EQ(expected,
+                          RunQuery(*engine, index, c.m_query, instrumentation))
+                    << c.m_query;
+            }
+        }
+
+
+        TEST(QueryEngine, NativeCodePrefetch)
+        {
+            IndexFixture fixture(2);
+            auto & index = fixture.GetIndex();
+
+            char const * c_queries[] = { "2", "5 7", "3|5", "2 -3", "11 13 17" };
+
+            // Prefetching must not change the results, including at
+            // distances that reach into the next slice or beyond.
+            const size_t c_distances[] = { 1, 4, 1000 };
+            for (auto distance : c_distances)
+            {
+                for (unsigned nonTemporal = 0; nonTemporal < 2; ++nonTemporal)
+                {
+                    NativeJITQueryEngine engine(index,
+                                                fixture.GetConfiguration(),
+                                                c_allocatorSize,
+                                                c_allocatorSize);
+                    engine.SetPrefetch(distance, nonTemporal != 0);
+                    auto reference = fixture.CreateEngine(true);
+
+                    for (auto query : c_queries)
+                    {
+                        QueryInstrumentation instrumentation;
+                        EXPECT_EQ(RunQuery(*reference, index, query, instrumentation),
+                                  RunQuery(engine, index, query, instrumentation))
+                            << query;
+                    }
+                }
+            }
+        }
+
+        TEST(QueryEngine, NativeCodeShardSpecialization)
+        {
+            IndexFixture fixture(3);
+            auto & index = fixture.GetIndex();
+
+            char const * c_queries[] = {
+                "2", "5 7", "3|5", "2 -3", "11 13 17", "-2 -3 -5 -7 -11 -13 -17 -19 -23 -29"
+            };
+
+            // Specialized code must return the same matches as shared code,
+            // with and without a plan cache and with prefetching enabled.
+            for (unsigned cached = 0; cached < 2; ++cached)
+            {
+                for (unsigned prefetch = 0; prefetch < 2; ++prefetch)
+                {
+                    QueryPlanCache planCache(16);
+                    NativeJITQueryEngine engine(index,
+                                                fixture.GetConfiguration(),
+                                                c_allocatorSize,
+                                                c_allocatorSize,
+                                                (cached != 0) ? &planCache : nullptr);
+                    engine.SetShardSpecialization(true);
+                    engine.SetPrefetch(prefetch != 0 ? 4 : 0, false);
+                    auto reference = fixture.CreateEngine(true);
+
+                    // Run each query twice so that cached plans are reused.
+                    for (unsigned pass = 0; pass < 2; ++pass)
+                    {
+                        for (auto query : c_queries)
+                        {
+                            QueryInstrumentation instrumentation;
+                            EXPECT_EQ(RunQuery(*reference, index, query, instrumentation),
+                                      RunQuery(engine, index, query, instrumentation))
+                                << query;
+                        }
+                    }
+                }
+            }
+        }
+
+
+        // Returns the set of DocIds in [1, c_maxDocId] that satisfy matches.
+        std::set<DocId> ExpectedMatches(std::function<bool(DocId)> matches)
+        {
+            std::set<DocId> expected;
+            for (DocId docId = 1; docId <= c_maxDocId; ++docId)
+            {
+                if (matches(docId))
+                {
+                    expected.insert(docId);
+                }
+            }
+            return expected;
+        }
+
+
+        void VerifyWideDisjunction(bool useNativeCode)
+        {
+            IndexFixture fixture(2);
+            auto & index = fixture.GetIndex();
+
+            auto divides = [](DocId divisor, DocId docId)
+            {
+                return (docId % divisor) == 0;
+            };
+
+            //
+            // An OR of every prime term needs far more than
+            // c_maxRowsPerQuery rows. Every document other than 1 has a
+            // prime factor.
+            //
+            std::string allPrimes;
+            for (DocId p = 2; p <= c_maxDocId; ++p)
+            {
+                bool isPrime = true;
+                for (DocId d = 2; d * d <= p; ++d)
+                {
+                    if (divides(d, p))
+                    {
+                        isPrime = false;
+                        break;
+                    }
+                }
+                if (isPrime)
+                {
+                    allPrimes += (allPrimes.empty() ? "" : "|") + std::to_string(p);
+                }
+            }
+
+            {
+                auto engine = fixture.CreateEngine(useNativeCode);
+                engine->SetMatchingThreads(3, 1);
+
+                QueryInstrumentation instrumentation;
+                auto expected = ExpectedMatches([](DocId d) { return d > 1; });
+                EXPECT_EQ(expected,
+                          RunQuery(*engine, index, allPrimes.c_str(), instrumentation));
+                EXPECT_GT(instrumentation.GetData().GetRowCount(), c_maxRowsPerQuery);
+
+                QueryInstrumentation countInstrumentation;
+                EXPECT_EQ(expected.size(),
+                          engine->Count(engine->Parse(allPrimes.c_str()),
+                                        countInstrumentation));
+            }
+
+            //
+            // With a low threshold, ordinary queries in conjunctive normal
+            // form use the wide disjunction path as well.
+            //
+            struct Case
+            {
+                char const * m_query;
+                std::function<bool(DocId)> m_matches;
+            };
+
+            const Case c_cases[] =
+            {
+                {
+                    "2|3|5|7|11|13",
+                    [&](DocId d)
+                    {
+                        return divides(2, d) || divides(3, d) || divides(5, d) ||
+                               divides(7, d) || divides(11, d) || divides(13, d);
+                    }
+                },
+                {
+                    "2 (3|5 7|11) -(13|17)",
+                    [&](DocId d)
+                    {
+                        return divides(2, d) &&
+                               (divides(3, d) || divides(35, d) || divides(11, d)) &&
+                               !(divides(13, d) || divides(17, d));
+                    }
+                },
+                {
+                    "3 5 -7 -11",
+                    [&](DocId d)
+                    {
+                        return divides(15, d) && !divides(7, d) && !divides(11, d);
+                    }
+                }
+            };
+
+            QueryPlanCache cache(16);
+            auto engine = fixture.CreateEngine(useNativeCode, &cache);
+            engine->SetWideDisjunctionRowCount(2);
+
+            // Run each query twice so that cached plans are reused.
+            for (unsigned pass = 0; pass < 2; ++pass)
+            {
+                for (auto const & c : c_cases)
+                {
+                    auto expected = ExpectedMatches(c.m_matches);
+
+                    QueryInstrumentation instrumentation;
+                    EXPECT_EQ(expected,
+                              RunQuery(*engine, index, c.m_query, instrumentation))
+                        << c.m_query;
+
+                    QueryInstrumentation countInstrumentation;
+                    EXPECT_EQ(expected.size(),
+                              engine->Count(engine->Parse(c.m_query),
+                                            countInstrumentation))
+                        << c.m_query;
+                }
+            }
+        }
+
+
+        TEST(QueryEngine, WideDisjunctionByteCode)
+        {
+            VerifyWideDisjunction(false);
+        }
+
+
+        TEST(QueryEngine, WideDisjunctionNativeCode)
+        {
+            VerifyWideDisjunction(true);
+        }
+    }
+}
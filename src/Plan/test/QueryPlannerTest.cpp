@@ -0,0 +1,163 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "gtest/gtest.h"
+
+#include <iostream>
+#include <sstream>
+
+#include "BitFunnel/Configuration/Factories.h"
+#include "BitFunnel/Configuration/IFileSystem.h"
+#include "BitFunnel/Configuration/IShardDefinition.h"
+#include "BitFunnel/IDiagnosticStream.h"
+#include "BitFunnel/Index/Factories.h"
+#include "BitFunnel/Index/ISimpleIndex.h"
+#include "BitFunnel/Index/ITermTable.h"
+#include "BitFunnel/Index/ITermTableCollection.h"
+#include "BitFunnel/Plan/QueryInstrumentation.h"
+#include "BitFunnel/Plan/TermMatchNode.h"
+#include "BitFunnel/Utilities/Allocator.h"
+#include "BitFunnel/Utilities/Factories.h"
+#include "QueryPlanner.h"
+#include "TextObjectParser.h"
+
+
+namespace BitFunnel
+{
+    namespace QueryPlannerUnitTest
+    {
+        // Creates a TermTable for a single term, "foo", with two rank 0
+        // rows and, if rank3RowCount is non-zero, that many rank 3 rows.
+        static std::unique_ptr<ITermTable> CreateTermTable(size_t rank3RowCount)
+        {
+            auto termTable = Factories::CreateTermTable();
+
+            termTable->OpenTerm();
+            RowIndex explicitRowCount = ITermTable::SystemTerm::Count;
+            termTable->AddRowId(RowId(0, explicitRowCount++));
+            termTable->AddRowId(RowId(0, explicitRowCount++));
+            for (RowIndex i = 0; i < rank3RowCount; ++i)
+            {
+                termTable->AddRowId(RowId(3, i));
+            }
+            termTable->CloseTerm(Term::ComputeRawHash("foo"));
+
+            termTable->SetRowCounts(0, explicitRowCount, 1);
+            termTable->SetRowCounts(3, rank3RowCount, 0);
+            termTable->Seal();
+
+            return termTable;
+        }
+
+
+        class TwoShardIndex
+        {
+        public:
+            TwoShardIndex(size_t shard0Rank3RowCount,
+                          size_t shard1Rank3RowCount)
+              : m_fileSystem(Factories::CreateFileSystem()),
+                m_index(Factories::CreateSimpleIndex(*m_fileSystem))
+            {
+                auto shardDefinition = Factories::CreateShardDefinition();
+                shardDefinition->AddShard(0, 0.15);
+                shardDefinition->AddShard(100, 0.15);
+                m_index->SetShardDefinition(std::move(shardDefinition));
+
+                auto termTables = Factories::CreateTermTableCollection();
+                termTables->AddTermTable(CreateTermTable(shard0Rank3RowCount));
+                termTables->AddTermTable(CreateTermTable(shard1Rank3RowCount));
+                m_index->SetTermTableCollection(std::move(termTables));
+
+                m_index->ConfigureAsMock(1, false);
+                m_index->StartIndex();
+            }
+
+            ISimpleIndex const & GetIndex() const
+            {
+                return *m_index;
+            }
+
+        private:
+            std::unique_ptr<IFileSystem> m_fileSystem;
+            std::unique_ptr<ISimpleIndex> m_index;
+        };
+
+
+        TermMatchNode const & ParseTermTree(char const * text,
+                                            IAllocator& allocator)
+        {
+            std::stringstream input(text);
+            TextObjectParser parser(input, allocator, &TermMatchNode::GetType);
+            return TermMatchNode::Parse(parser);
+        }
+
+
+        TEST(QueryPlanner, PerShardInitialRank)
+        {
+            // Shard 0 has a rank 3 row for "foo". In shard 1 the plan pads
+            // this row with the match-all row, which should be removed from
+            // shard 1's plan.
+            TwoShardIndex index(1, 0);
+
+            Allocator allocator(4096*256);
+            TermMatchNode const & tree =
+                ParseTermTree("Unigram(\"foo\", 0)", allocator);
+
+            auto diagnosticStream = Factories::CreateDiagnosticStream(std::cout);
+            QueryInstrumentation instrumentation;
+            QueryPlanner planner(tree,
+                                 500,
+                                 index.GetIndex(),
+                                 allocator,
+                                 *diagnosticStream,
+                                 instrumentation);
+
+            EXPECT_EQ(3u, planner.GetInitialRank(0));
+            EXPECT_EQ(0u, planner.GetInitialRank(1));
+            EXPECT_NE(&planner.GetCompileTree(0), &planner.GetCompileTree(1));
+        }
+
+
+        TEST(QueryPlanner, SharedCompileTree)
+        {
+            // Both shards have the same rows, so they share one tree.
+            TwoShardIndex index(1, 1);
+
+            Allocator allocator(4096*256);
+            TermMatchNode const & tree =
+                ParseTermTree("Unigram(\"foo\", 0)", allocator);
+
+            auto diagnosticStream = Factories::CreateDiagnosticStream(std::cout);
+            QueryInstrumentation instrumentation;
+            QueryPlanner planner(tree,
+                                 500,
+                                 index.GetIndex(),
+                                 allocator,
+                                 *diagnosticStream,
+                                 instrumentation);
+
+            EXPECT_EQ(3u, planner.GetInitialRank(0));
+            EXPECT_EQ(3u, planner.GetInitialRank(1));
+            EXPECT_EQ(&planner.GetCompileTree(0), &planner.GetCompileTree(1));
+        }
+    }
+}
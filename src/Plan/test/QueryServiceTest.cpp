@@ -0,0 +1,257 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2018, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <future>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "BitFunnel/Configuration/Factories.h"
+#include "BitFunnel/Configuration/IFileSystem.h"
+#include "BitFunnel/Configuration/IStreamConfiguration.h"
+#include "BitFunnel/Exceptions.h"
+#include "BitFunnel/Index/ISimpleIndex.h"
+#include "BitFunnel/Mocks/Factories.h"
+#include "BitFunnel/Plan/Factories.h"
+#include "BitFunnel/Plan/IQueryService.h"
+
+
+namespace BitFunnel
+{
+    namespace QueryServiceUnitTest
+    {
+        static const Term::StreamId c_streamId = 0;
+        static const DocId c_maxDocId = 1000;
+
+
+        std::set<DocId> ExpectedMatches(DocId divisor)
+        {
+            std::set<DocId> expected;
+            for (DocId docId = divisor; docId <= c_maxDocId; docId += divisor)
+            {
+                expected.insert(docId);
+            }
+            return expected;
+        }
+
+
+        void VerifyQueries(bool useNativeCode, bool cachePlans)
+        {
+            auto fileSystem = Factories::CreateRAMFileSystem();
+            auto index = Factories::CreatePrimeFactorsIndex(*fileSystem,
+                                                            c_maxDocId,
+                                                            c_streamId,
+                                                            2);
+            auto config = Factories::CreateStreamConfiguration();
+
+            auto service = Factories::CreateQueryService(*index,
+                                                         *config,
+                                                         3,
+                                                         4,
+                                                         useNativeCode,
+                                                         cachePlans);
+            EXPECT_EQ(3u, service->GetThreadCount());
+            EXPECT_EQ(4u, service->GetQueueCapacity());
+
+            struct Case
+            {
+                char const * m_query;
+                DocId m_divisor;
+            };
+
+            const Case c_cases[] = {
+                { "2", 2 },
+                { "3 5", 15 },
+                { "7", 7 },
+                { "2 3 5", 30 }
+            };
+
+            // Submit more queries than the queue holds so that Submit()
+            // blocks some of the time.
+            const size_t c_iterations = 5;
+            std::vector<std::future<QueryResponse>> responses;
+            for (size_t i = 0; i < c_iterations; ++i)
+            {
+                for (auto const & c : c_cases)
+                {
+                    responses.push_back(service->Submit(c.m_query));
+                }
+            }
+
+            for (size_t i = 0; i < responses.size(); ++i)
+            {
+                auto const & c = c_cases[i % (sizeof(c_cases) / sizeof(c_cases[0]))];
+                QueryResponse response = responses[i].get();
+
+                EXPECT_EQ(c.m_query, response.m_query);
+                EXPECT_TRUE(response.m_instrumentation.GetSucceeded());
+                EXPECT_TRUE(response.m_error.empty());
+                EXPECT_GE(response.m_queueTime, 0.0);
+
+                std::set<DocId> matches(response.m_matches.begin(),
+                                        response.m_matches.end());
+                EXPECT_EQ(ExpectedMatches(c.m_divisor), matches) << c.m_query;
+                EXPECT_EQ(response.m_matches.size(),
+                          response.m_instrumentation.GetMatchCount());
+            }
+
+            // Queries that fail are reported without stopping the worker.
+            QueryResponse failed = service->Submit("(2 3").get();
+            EXPECT_FALSE(failed.m_instrumentation.GetSucceeded());
+            EXPECT_FALSE(failed.m_error.empty());
+            EXPECT_EQ(ExpectedMatches(2).size(),
+                      service->Submit("2").get().m_matches.size());
+
+            service->Shutdown();
+            EXPECT_THROW(service->Submit("2"), RecoverableError);
+            EXPECT_FALSE(service->TrySubmit("2", [](QueryResponse &&) {}));
+        }
+
+
+        TEST(QueryService, ByteCode)
+        {
+            VerifyQueries(false, false);
+            VerifyQueries(false, true);
+        }
+
+
+        TEST(QueryService, NativeCode)
+        {
+            VerifyQueries(true, false);
+            VerifyQueries(true, true);
+        }
+
+
+        TEST(QueryService, Backpressure)
+        {
+            auto fileSystem = Factories::CreateRAMFileSystem();
+            auto index = Factories::CreatePrimeFactorsIndex(*fileSystem,
+                                                            c_maxDocId,
+                                                            c_streamId,
+                                                            1);
+            auto config = Factories::CreateStreamConfiguration();
+
+            const size_t c_queueCapacity = 2;
+            auto service = Factories::CreateQueryService(*index,
+                                                         *config,
+                                                         1,
+                                                         c_queueCapacity,
+                                                         false);
+
+            // The first callback holds the only worker until release is
+            // signalled, so the queries that follow must wait in the queue.
+            std::promise<void> started;
+            std::promise<void> release;
+            std::shared_future<void> released = release.get_future().share();
+            std::promise<size_t> first;
+            service->Submit("2", [&](QueryResponse && response)
+            {
+                started.set_value();
+                released.wait();
+                first.set_value(response.m_matches.size());
+            });
+            started.get_future().wait();
+            EXPECT_EQ(0u, service->GetQueueDepth());
+
+            std::vector<std::future<size_t>> queued;
+            std::vector<std::promise<size_t>> promises(c_queueCapacity);
+            for (auto & promise : promises)
+            {
+                queued.push_back(promise.get_future());
+                EXPECT_TRUE(service->TrySubmit("3", [&promise](QueryResponse && response)
+                {
+                    promise.set_value(response.m_matches.size());
+                }));
+            }
+            EXPECT_EQ(c_queueCapacity, service->GetQueueDepth());
+
+            EXPECT_FALSE(service->TrySubmit("5", [](QueryResponse &&) {}));
+            EXPECT_EQ(1u, service->GetRejectedCount());
+
+            release.set_value();
+            EXPECT_EQ(ExpectedMatches(2).size(), first.get_future().get());
+            for (auto & future : queued)
+            {
+                EXPECT_EQ(ExpectedMatches(3).size(), future.get());
+            }
+
+            // Shutdown completes queries that are already queued.
+            std::promise<size_t> last;
+            auto lastFuture = last.get_future();
+            service->Submit("7", [&last](QueryResponse && response)
+            {
+                last.set_value(response.m_matches.size());
+            });
+            service->Shutdown();
+            EXPECT_EQ(0u, service->GetQueueDepth());
+            EXPECT_EQ(ExpectedMatches(7).size(), lastFuture.get());
+        }
+
+
+        TEST(QueryService, CallbackErrors)
+        {
+            auto fileSystem = Factories::CreateRAMFileSystem();
+            auto index = Factories::CreatePrimeFactorsIndex(*fileSystem,
+                                                            c_maxDocId,
+                                                            c_streamId,
+                                                            1);
+            auto config = Factories::CreateStreamConfiguration();
+
+            auto service = Factories::CreateQueryService(*index,
+                                                         *config,
+                                                         1,
+                                                         2,
+                                                         false);
+
+            // A callback that throws must not stop its worker.
+            service->Submit("2", [](QueryResponse &&)
+            {
+                throw RecoverableError("Callback failed.");
+            });
+
+            // Shutdown() from a callback is rejected rather than waiting for
+            // the callback's own thread to exit.
+            auto & s = *service;
+            std::promise<bool> rejected;
+            service->Submit("3", [&s, &rejected](QueryResponse &&)
+            {
+                try
+                {
+                    s.Shutdown();
+                    rejected.set_value(false);
+                }
+                catch (RecoverableError const &)
+                {
+                    rejected.set_value(true);
+                }
+            });
+            EXPECT_TRUE(rejected.get_future().get());
+
+            EXPECT_EQ(ExpectedMatches(5).size(),
+                      service->Submit("5").get().m_matches.size());
+            service->Shutdown();
+        }
+    }
+}
@@ -0,0 +1,213 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <sstream>
+#include <vector>
+
+#include "BitFunnel/Utilities/Allocator.h"
+#include "BitFunnel/Utilities/TextObjectFormatter.h"
+#include "RowDensityOrderer.h"
+#include "RowMatchNode.h"
+#include "SameExceptForWhitespace.h"
+#include "TextObjectParser.h"
+
+
+namespace BitFunnel
+{
+    namespace RowDensityOrdererUnitTest
+    {
+        struct InputOutput
+        {
+        public:
+            char const * m_input;
+            char const * m_output;
+        };
+
+
+        // Densities indexed by abstract row id.
+        const std::vector<double> c_densities = { 0.5, 0.01, 0.2, 0.9 };
+
+
+        const InputOutput c_reorderCases[] =
+        {
+            // Rows within each rank are sorted by density. Rank order and
+            // the position of the Report node are unchanged.
+            {
+                "And {"
+                "  Children: ["
+                "    Row(0, 3, 0, false),"
+                "    Row(1, 3, 0, false),"
+                "    Row(3, 0, 0, false),"
+                "    Row(2, 0, 0, false),"
+                "    Report {"
+                "      Child:"
+                "    }"
+                "  ]"
+                "}",
+                "And {"
+                "  Children: ["
+                "    Row(1, 3, 0, false),"
+                "    Row(0, 3, 0, false),"
+                "    Row(2, 0, 0, false),"
+                "    Row(3, 0, 0, false),"
+                "    Report {"
+                "      Child:"
+                "    }"
+                "  ]"
+                "}"
+            },
+
+
+            // Inverted rows use the complement of the row's density.
+            {
+                "And {"
+                "  Children: ["
+                "    Row(1, 0, 0, true),"
+                "    Row(0, 0, 0, false)"
+                "  ]"
+                "}",
+                "And {"
+                "  Children: ["
+                "    Row(0, 0, 0, false),"
+                "    Row(1, 0, 0, true)"
+                "  ]"
+                "}"
+            },
+
+
+            // Rows are not moved across an Or. The branches of the Or are
+            // reordered independently.
+            {
+                "And {"
+                "  Children: ["
+                "    Row(3, 0, 0, false),"
+                "    Or {"
+                "      Children: ["
+                "        And {"
+                "          Children: ["
+                "            Row(0, 0, 0, false),"
+                "            Row(1, 0, 0, false)"
+                "          ]"
+                "        },"
+                "        Row(2, 0, 0, false)"
+                "      ]"
+                "    },"
+                "    Row(2, 0, 0, false),"
+                "    Row(1, 0, 0, false)"
+                "  ]"
+                "}",
+                "And {"
+                "  Children: ["
+                "    Row(3, 0, 0, false),"
+                "    Or {"
+                "      Children: ["
+                "        And {"
+                "          Children: ["
+                "            Row(1, 0, 0, false),"
+                "            Row(0, 0, 0, false)"
+                "          ]"
+                "        },"
+                "        Row(2, 0, 0, false)"
+                "      ]"
+                "    },"
+                "    Row(1, 0, 0, false),"
+                "    Row(2, 0, 0, false)"
+                "  ]"
+                "}"
+            },
+        };
+
+
+        RowMatchNode const & Parse(char const * text, IAllocator& allocator)
+        {
+            std::stringstream input(text);
+            TextObjectParser parser(input, allocator, &RowPlanBase::GetType);
+            return RowMatchNode::Parse(parser);
+        }
+
+
+        TEST(RowDensityOrderer, Reorder)
+        {
+            for (unsigned i = 0; i < sizeof(c_reorderCases) / sizeof(InputOutput); ++i)
+            {
+                Allocator allocator(1024*4);
+                RowMatchNode const & root = Parse(c_reorderCases[i].m_input, allocator);
+
+                RowDensityOrderer orderer(c_densities, allocator);
+                RowMatchNode const & ordered = orderer.Reorder(root);
+
+                std::stringstream output;
+                TextObjectFormatter formatter(output);
+                ordered.Format(formatter);
+
+                EXPECT_TRUE(SameExceptForWhitespace(output.str().c_str(),
+                                                    c_reorderCases[i].m_output));
+
+                // Reordering never increases the estimated cost.
+                EXPECT_LE(orderer.EstimateQuadwordCount(ordered),
+                          orderer.EstimateQuadwordCount(root));
+
+                // Reordering a tree that is already ordered is a no-op.
+                EXPECT_EQ(&ordered, &orderer.Reorder(ordered));
+            }
+        }
+
+
+        TEST(RowDensityOrderer, Estimate)
+        {
+            Allocator allocator(1024*4);
+
+            // The first row is always loaded. The second row is loaded only
+            // when the first leaves a non-zero quadword.
+            RowMatchNode const & sparseFirst = Parse(
+                "And {"
+                "  Children: ["
+                "    Row(1, 0, 0, false),"
+                "    Row(3, 0, 0, false)"
+                "  ]"
+                "}",
+                allocator);
+            RowMatchNode const & denseFirst = Parse(
+                "And {"
+                "  Children: ["
+                "    Row(3, 0, 0, false),"
+                "    Row(1, 0, 0, false)"
+                "  ]"
+                "}",
+                allocator);
+
+            RowDensityOrderer orderer(c_densities, allocator);
+            double const sparse = orderer.EstimateQuadwordCount(sparseFirst);
+            double const dense = orderer.EstimateQuadwordCount(denseFirst);
+
+            EXPECT_NEAR(1.0 + (1.0 - std::pow(0.99, 64)), sparse, 1e-9);
+            EXPECT_NEAR(2.0, dense, 1e-9);
+
+            // Each quadword of a rank 3 row covers 8 rank 0 quadwords.
+            RowMatchNode const & rank3 = Parse("Row(0, 3, 0, false)", allocator);
+            EXPECT_DOUBLE_EQ(0.125, orderer.EstimateQuadwordCount(rank3));
+        }
+    }
+}
@@ -33,8 +33,12 @@
 #include "BitFunnel/Utilities/Allocator.h"
 #include "BitFunnel/Utilities/TextObjectFormatter.h"
 #include "RowMatchNode.h"
+#include "IPlanRows.h"
+#include "PlanRows.h"
+#include "RowPlan.h"
 #include "TextObjectParser.h"
 #include "TermPlanConverter.h"
+#include "TermRowCache.h"
 // #include "BitFunnel/FalsePositiveEvaluationNode.h"
 // #include "MockIndexConfiguration.h"
 // #include "MockTermTable.h"
@@ -481,6 +485,190 @@ namespace BitFunnel
         }
 
 
+        // Creates a single shard index whose TermTable has fooRowCount
+        // explicit rank 0 rows for "foo".
+        static std::unique_ptr<ISimpleIndex>
+            CreateFooIndex(IFileSystem & filesystem, size_t fooRowCount)
+        {
+            auto index = Factories::CreateSimpleIndex(filesystem);
+
+            auto termTable = Factories::CreateTermTable();
+            const size_t adhocRowCount = 4;
+
+            termTable->OpenTerm();
+            auto hash = Term::ComputeRawHash("foo");
+            RowIndex explicitRowCount = ITermTable::SystemTerm::Count;
+            for (size_t i = 0; i < fooRowCount; ++i)
+            {
+                termTable->AddRowId(RowId(0, explicitRowCount++));
+            }
+            termTable->CloseTerm(hash);
+
+            termTable->SetRowCounts(0, explicitRowCount, adhocRowCount);
+            termTable->Seal();
+
+            auto termTableCollection = Factories::CreateTermTableCollection();
+            termTableCollection->AddTermTable(std::move(termTable));
+
+            index->SetTermTableCollection(std::move(termTableCollection));
+            index->ConfigureAsMock(1, false);
+            index->StartIndex();
+
+            return index;
+        }
+
+
+        TEST(TermPlanConverter,TermRowCache)
+        {
+            auto filesystem = Factories::CreateFileSystem();
+            auto index = CreateFooIndex(*filesystem, 2);
+
+            // "bar" is not in the TermTable and uses adhoc rows.
+            char const * input =
+                "And {\n"
+                "  Children: [\n"
+                "    Unigram(\"bar\", 13),\n"
+                "    Unigram(\"foo\", 13)\n"
+                "  ]\n"
+                "}";
+
+            Allocator allocator(4096*256);
+            std::stringstream inputStream(input);
+            TextObjectParser parser(inputStream, allocator, &TermMatchNode::GetType);
+            TermMatchNode const & termMatchNode = TermMatchNode::Parse(parser);
+
+            RowPlan const & expected =
+                TermPlanConverter::BuildRowPlan(termMatchNode, *index, allocator);
+
+            std::stringstream expectedText;
+            TextObjectFormatter expectedFormatter(expectedText);
+            expected.Format(expectedFormatter);
+
+            TermRowCache cache(1024);
+
+            // The first plan fills the cache and the second is built
+            // entirely from it. Both must match the uncached plan.
+            size_t firstPassLookups = 0;
+            for (unsigned pass = 0; pass < 2; ++pass)
+            {
+                RowPlan const & rowPlan =
+                    TermPlanConverter::BuildRowPlan(termMatchNode,
+                                                    *index,
+                                                    allocator,
+                                                    &cache);
+
+                std::stringstream text;
+                TextObjectFormatter formatter(text);
+                rowPlan.Format(formatter);
+                EXPECT_EQ(expectedText.str(), text.str());
+
+                IPlanRows const & expectedRows = expected.GetPlanRows();
+                IPlanRows const & planRows = rowPlan.GetPlanRows();
+                ASSERT_EQ(expectedRows.GetRowCount(), planRows.GetRowCount());
+                for (unsigned id = 0; id < planRows.GetRowCount(); ++id)
+                {
+                    EXPECT_EQ(expectedRows.PhysicalRow(0, id),
+                              planRows.PhysicalRow(0, id));
+                }
+
+                if (pass == 0)
+                {
+                    firstPassLookups = cache.GetHitCount() + cache.GetMissCount();
+                }
+            }
+
+            // Document active, match-all, match-none, bar, and foo. The
+            // match-all and match-none rows are looked up for every term, so
+            // the first pass also has hits. Every lookup of the second pass
+            // is a hit.
+            EXPECT_EQ(5u, cache.GetEntryCount());
+            EXPECT_EQ(5u, cache.GetMissCount());
+            EXPECT_EQ(2 * firstPassLookups - 5u, cache.GetHitCount());
+
+            cache.Clear();
+            EXPECT_EQ(0u, cache.GetEntryCount());
+        }
+
+
+        TEST(TermPlanConverter,TermRowCacheEviction)
+        {
+            auto filesystem = Factories::CreateFileSystem();
+            auto index = CreateFooIndex(*filesystem, 2);
+            PlanRows planRows(*index);
+
+            // A cache with one entry per partition keeps only the most
+            // recent of two terms in the same partition. Use it to find
+            // terms that share a partition with a.
+            const Term a(0x1000, 0);
+            std::vector<Term> samePartition;
+            TermRowCache single(16);
+            for (Term::Hash hash = 0x1001; samePartition.size() < 2; ++hash)
+            {
+                const Term term(hash, 0);
+                single.Clear();
+                single.GetRows(a, planRows);
+                single.GetRows(term, planRows);
+                if (single.GetEntryCount() == 1)
+                {
+                    samePartition.push_back(term);
+                }
+            }
+
+            // b evicted a.
+            const size_t misses = single.GetMissCount();
+            single.GetRows(a, planRows);
+            EXPECT_EQ(misses + 1, single.GetMissCount());
+
+            // With two entries per partition, the least recently used entry
+            // is evicted.
+            const Term & b = samePartition[0];
+            const Term & c = samePartition[1];
+            TermRowCache cache(32);
+            cache.GetRows(a, planRows);
+            cache.GetRows(b, planRows);
+            cache.GetRows(a, planRows);
+            cache.GetRows(c, planRows);
+            EXPECT_EQ(2u, cache.GetEntryCount());
+            EXPECT_EQ(1u, cache.GetHitCount());
+            EXPECT_EQ(3u, cache.GetMissCount());
+
+            cache.GetRows(a, planRows);
+            cache.GetRows(c, planRows);
+            EXPECT_EQ(3u, cache.GetHitCount());
+
+            cache.GetRows(b, planRows);
+            EXPECT_EQ(4u, cache.GetMissCount());
+        }
+
+
+        TEST(TermPlanConverter,TermRowCacheTermTables)
+        {
+            auto filesystem = Factories::CreateFileSystem();
+            auto index = CreateFooIndex(*filesystem, 2);
+            auto replacement = CreateFooIndex(*filesystem, 3);
+            PlanRows planRows(*index);
+            PlanRows replacementRows(*replacement);
+
+            const Term foo("foo", 0, index->GetConfiguration());
+            TermRowCache cache(1024);
+
+            EXPECT_EQ(2u, cache.GetRows(foo, planRows)->GetRowCount(0));
+            EXPECT_EQ(2u, cache.GetRows(foo, planRows)->GetRowCount(0));
+            EXPECT_EQ(1u, cache.GetHitCount());
+            EXPECT_EQ(1u, cache.GetMissCount());
+
+            // Planning against different TermTables discards the entries
+            // from the old ones.
+            EXPECT_EQ(3u, cache.GetRows(foo, replacementRows)->GetRowCount(0));
+            EXPECT_EQ(1u, cache.GetHitCount());
+            EXPECT_EQ(2u, cache.GetMissCount());
+            EXPECT_EQ(1u, cache.GetEntryCount());
+
+            EXPECT_EQ(3u, cache.GetRows(foo, replacementRows)->GetRowCount(0));
+            EXPECT_EQ(2u, cache.GetHitCount());
+        }
+
+
         // TODO: need at least one test that tests ad hoc rows.
 
         // TODO: need to implement nonBody.
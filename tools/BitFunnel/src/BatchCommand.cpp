@@ -0,0 +1,100 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <iostream>
+#include <stdexcept>
+
+#include "BatchCommand.h"
+#include "BitFunnel/Exceptions.h"
+#include "Environment.h"
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // BatchCommand
+    //
+    //*************************************************************************
+    BatchCommand::BatchCommand(Environment & environment,
+                               Id id,
+                               char const * parameters)
+        : TaskBase(environment, id, Type::Synchronous)
+    {
+        // stoull throws std::invalid_argument and std::out_of_range, which
+        // would end the REPL, and accepts trailing characters and a sign.
+        auto token = TaskFactory::GetNextToken(parameters);
+        size_t end = 0;
+        try
+        {
+            m_batchSize = stoull(token, &end);
+        }
+        catch (std::logic_error const &)
+        {
+            end = 0;
+        }
+        if (end == 0 || end != token.size() || token[0] == '-')
+        {
+            RecoverableError error("batch: expected batch <size>.");
+            throw error;
+        }
+        if (m_batchSize == 0)
+        {
+            RecoverableError error("batch: size must be at least 1.");
+            throw error;
+        }
+    }
+
+
+    void BatchCommand::Execute()
+    {
+        GetEnvironment().SetBatchSize(m_batchSize);
+        if (m_batchSize == 1)
+        {
+            std::cout
+                << "Queries now run one at a time.";
+        }
+        else
+        {
+            std::cout
+                << "Queries now run in batches of "
+                << m_batchSize
+                << ".";
+        }
+        std::cout
+            << std::endl
+            << std::endl;
+    }
+
+
+    ICommand::Documentation BatchCommand::GetDocumentation()
+    {
+        return Documentation(
+            "batch",
+            "Set the number of queries matched together.",
+            "batch <size>\n"
+            "  Set the number of queries from a query log that are matched\n"
+            "  together in a single pass over the index. A size of 1, the\n"
+            "  default, runs each query separately."
+        );
+    }
+}
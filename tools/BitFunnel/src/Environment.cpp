@@ -23,6 +23,7 @@
 #include "BitFunnel/Index/Factories.h"
 #include "BitFunnel/Index/IRecycler.h"
 #include "AnalyzeCommand.h"
+#include "BatchCommand.h"
 #include "CacheLineCountCommand.h"
 #include "CdCommand.h"
 #include "CompilerCommand.h"
@@ -33,10 +34,13 @@
 #include "HelpCommand.h"
 #include "IngestCommands.h"
 #include "InterpreterCommand.h"
+#include "PlanCacheCommand.h"
+#include "PrefetchCommand.h"
 #include "QueryCommand.h"
 #include "ScriptCommand.h"
 #include "ShardCommand.h"
 #include "ShowCommand.h"
+#include "SpecializeCommand.h"
 #include "StatusCommand.h"
 #include "TaskFactory.h"
 #include "TaskPool.h"
@@ -60,9 +64,14 @@ namespace BitFunnel
         // Start one extra thread for the Recycler.
         m_taskPool(new TaskPool(threadCount + 1)),
         m_index(Factories::CreateSimpleIndex(fileSystem)),
+        m_batchSize(1),
         m_cacheLineCountMode(false),
         m_compilerMode(true),
+        m_planCacheMode(false),
         m_failOnException(false),
+        m_prefetchDistance(0),
+        m_prefetchNonTemporal(false),
+        m_shardSpecializationMode(false),
         m_threadCount(threadCount),
         m_memory(memory),
         m_directory(directory),
@@ -78,6 +87,7 @@ namespace BitFunnel
     void Environment::RegisterCommands()
     {
         m_taskFactory->RegisterCommand<Analyze>();
+        m_taskFactory->RegisterCommand<BatchCommand>();
         m_taskFactory->RegisterCommand<Cache>();
         m_taskFactory->RegisterCommand<CacheLineCountCommand>();
         m_taskFactory->RegisterCommand<Cd>();
@@ -88,10 +98,13 @@ namespace BitFunnel
         m_taskFactory->RegisterCommand<Help>();
         m_taskFactory->RegisterCommand<InterpreterCommand>();
         m_taskFactory->RegisterCommand<Load>();
+        m_taskFactory->RegisterCommand<PlanCacheCommand>();
+        m_taskFactory->RegisterCommand<PrefetchCommand>();
         m_taskFactory->RegisterCommand<Query>();
         m_taskFactory->RegisterCommand<Script>();
         m_taskFactory->RegisterCommand<ShardCommand>();
         m_taskFactory->RegisterCommand<Show>();
+        m_taskFactory->RegisterCommand<SpecializeCommand>();
         m_taskFactory->RegisterCommand<Status>();
         m_taskFactory->RegisterCommand<ThreadsCommand>();
         m_taskFactory->RegisterCommand<Verify>();
@@ -119,6 +132,18 @@ namespace BitFunnel
     }
 
 
+    size_t Environment::GetBatchSize() const
+    {
+        return m_batchSize;
+    }
+
+
+    void Environment::SetBatchSize(size_t batchSize)
+    {
+        m_batchSize = batchSize;
+    }
+
+
     bool Environment::GetCacheLineCountMode() const
     {
         return m_cacheLineCountMode;
@@ -155,6 +180,18 @@ namespace BitFunnel
     }
 
 
+    bool Environment::GetPlanCacheMode() const
+    {
+        return m_planCacheMode;
+    }
+
+
+    void Environment::SetPlanCacheMode(bool mode)
+    {
+        m_planCacheMode = mode;
+    }
+
+
     std::string const & Environment::GetOutputDir() const
     {
         return m_outputDir;
@@ -173,6 +210,37 @@ namespace BitFunnel
     }
 
 
+    size_t Environment::GetPrefetchDistance() const
+    {
+        return m_prefetchDistance;
+    }
+
+
+    bool Environment::GetPrefetchNonTemporal() const
+    {
+        return m_prefetchNonTemporal;
+    }
+
+
+    void Environment::SetPrefetch(size_t distance, bool nonTemporal)
+    {
+        m_prefetchDistance = distance;
+        m_prefetchNonTemporal = nonTemporal;
+    }
+
+
+    bool Environment::GetShardSpecializationMode() const
+    {
+        return m_shardSpecializationMode;
+    }
+
+
+    void Environment::SetShardSpecializationMode(bool mode)
+    {
+        m_shardSpecializationMode = mode;
+    }
+
+
     size_t Environment::GetMinShard() const
     {
         return m_minshard;
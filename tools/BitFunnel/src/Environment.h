@@ -54,24 +54,37 @@ namespace BitFunnel
 
         IFileSystem & GetFileSystem() const;
 
+        size_t GetBatchSize() const;
+        void SetBatchSize(size_t batchSize);
+
         bool GetCacheLineCountMode() const;
         void SetCacheLineCountMode(bool mode);
 
         bool GetCompilerMode() const;
         void SetCompilerMode(bool mode);
 
+        bool GetPlanCacheMode() const;
+        void SetPlanCacheMode(bool mode);
+
         bool GetFailOnException() const;
         void SetFailOnException(bool mode);
 
         std::string const & GetOutputDir() const;
         void SetOutputDir(std::string dir);
 
+        bool GetShardSpecializationMode() const;
+        void SetShardSpecializationMode(bool mode);
+
         size_t GetMinShard() const;
         size_t GetMaxShard() const;
         void SetShards(size_t minshard, size_t maxshard);
 
         std::ostream & GetOutputStream() const;
 
+        size_t GetPrefetchDistance() const;
+        bool GetPrefetchNonTemporal() const;
+        void SetPrefetch(size_t distance, bool nonTemporal);
+
         size_t GetThreadCount() const;
         void SetThreadCount(size_t threadCount);
 
@@ -93,9 +106,14 @@ namespace BitFunnel
         std::unique_ptr<TaskPool> m_taskPool;
         std::unique_ptr<ISimpleIndex> m_index;
 
+        size_t m_batchSize;
         bool m_cacheLineCountMode;
         bool m_compilerMode;
+        bool m_planCacheMode;
         bool m_failOnException;
+        size_t m_prefetchDistance;
+        bool m_prefetchNonTemporal;
+        bool m_shardSpecializationMode;
         size_t m_threadCount;
         size_t m_memory;
         std::string m_directory;
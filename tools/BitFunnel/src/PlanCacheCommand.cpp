@@ -0,0 +1,76 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <iostream>
+
+#include "Environment.h"
+#include "PlanCacheCommand.h"
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // PlanCacheCommand
+    //
+    //*************************************************************************
+    PlanCacheCommand::PlanCacheCommand(Environment & environment,
+                                       Id id,
+                                       char const * /*parameters*/)
+        : TaskBase(environment, id, Type::Synchronous)
+    {
+    }
+
+
+    void PlanCacheCommand::Execute()
+    {
+        auto & env = GetEnvironment();
+        env.SetPlanCacheMode(!env.GetPlanCacheMode());
+
+        if (env.GetPlanCacheMode())
+        {
+            std::cout
+                << "Caching compiled query plans.";
+        }
+        else
+        {
+            std::cout
+                << "Query plan caching disabled.";
+        }
+        std::cout
+            << std::endl
+            << std::endl;
+    }
+
+
+    ICommand::Documentation PlanCacheCommand::GetDocumentation()
+    {
+        return Documentation(
+            "plancache",
+            "Toggles caching of compiled query plans.",
+            "plancache\n"
+            "  Toggles caching of compiled query plans during query log\n"
+            "  processing. When enabled, a query that repeats is planned and\n"
+            "  compiled once and the result is shared by all threads."
+        );
+    }
+}
@@ -0,0 +1,113 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <iostream>
+#include <stdexcept>
+
+#include "BitFunnel/Exceptions.h"
+#include "Environment.h"
+#include "PrefetchCommand.h"
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // PrefetchCommand
+    //
+    //*************************************************************************
+    PrefetchCommand::PrefetchCommand(Environment & environment,
+                                     Id id,
+                                     char const * parameters)
+        : TaskBase(environment, id, Type::Synchronous),
+          m_nonTemporal(false)
+    {
+        // stoull throws std::invalid_argument and std::out_of_range, which
+        // would end the REPL, and accepts trailing characters and a sign.
+        auto token = TaskFactory::GetNextToken(parameters);
+        size_t end = 0;
+        try
+        {
+            m_distance = stoull(token, &end);
+        }
+        catch (std::logic_error const &)
+        {
+            end = 0;
+        }
+        if (end == 0 || end != token.size() || token[0] == '-')
+        {
+            RecoverableError error("prefetch: expected prefetch <distance> [nta].");
+            throw error;
+        }
+
+        token = TaskFactory::GetNextToken(parameters);
+        if (token.compare("nta") == 0)
+        {
+            m_nonTemporal = true;
+        }
+        else if (!token.empty())
+        {
+            RecoverableError error("prefetch: expected \"nta\" after distance.");
+            throw error;
+        }
+    }
+
+
+    void PrefetchCommand::Execute()
+    {
+        GetEnvironment().SetPrefetch(m_distance, m_nonTemporal);
+        if (m_distance == 0)
+        {
+            std::cout
+                << "Software prefetching disabled.";
+        }
+        else
+        {
+            std::cout
+                << "Prefetching rows "
+                << m_distance
+                << " cache line"
+                << ((m_distance == 1) ? "" : "s")
+                << " ahead with "
+                << (m_nonTemporal ? "prefetchnta" : "prefetcht0")
+                << ".";
+        }
+        std::cout
+            << std::endl
+            << std::endl;
+    }
+
+
+    ICommand::Documentation PrefetchCommand::GetDocumentation()
+    {
+        return Documentation(
+            "prefetch",
+            "Configures software prefetching in compiled queries.",
+            "prefetch <distance> [nta]\n"
+            "  Sets the number of cache lines ahead of the current position\n"
+            "  at which compiled queries prefetch their rows. A distance of 0,\n"
+            "  the default, disables prefetching. 'nta' selects non-temporal\n"
+            "  prefetches, which reduce cache pollution on large indexes.\n"
+            "  Only applies to the native code compiler."
+        );
+    }
+}
@@ -20,18 +20,23 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#include <cmath>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
 #include "BitFunnel/Configuration/Factories.h"
 #include "BitFunnel/Configuration/IFileSystem.h"
 #include "BitFunnel/Configuration/IStreamConfiguration.h"
 #include "BitFunnel/Exceptions.h"
 #include "BitFunnel/Index/IIngestor.h"
+#include "BitFunnel/Plan/ChunkedResultsSink.h"
 #include "BitFunnel/Plan/Factories.h"
 #include "BitFunnel/Plan/IQueryEngine.h"
+#include "BitFunnel/Plan/IQueryService.h"
+#include "BitFunnel/Plan/LoadGenerator.h"
 #include "BitFunnel/Plan/QueryInstrumentation.h"
 #include "BitFunnel/Plan/QueryRunner.h"
-#include "BitFunnel/Plan/ResultsBuffer.h"
 #include "BitFunnel/Utilities/ReadLines.h"
 #include "CsvTsv/Csv.h"
 #include "Environment.h"
@@ -41,6 +46,62 @@
 
 namespace BitFunnel
 {
+    // Queue capacity of the query service used by "query load". Queries
+    // that arrive while the queue is full are dropped.
+    static const size_t c_loadQueueCapacity = 1024;
+
+    static char const * const c_loadUsage =
+        "query load: expected <file> <qps> [fixed|poisson] "
+        "[<growth> [<steps> [<seconds> [<p99 ms>]]]].";
+
+
+    // std::stod and std::stoull throw std::invalid_argument and
+    // std::out_of_range, which would end the REPL. These report malformed
+    // numbers, including those with trailing characters and, for
+    // ParseDouble, infinities and NaNs, as a RecoverableError with the
+    // usage instead.
+    static double ParseDouble(std::string const & token)
+    {
+        size_t end = 0;
+        double value = 0;
+        try
+        {
+            value = std::stod(token, &end);
+        }
+        catch (std::logic_error const &)
+        {
+            end = 0;
+        }
+
+        if (end == 0 || end != token.size() || !std::isfinite(value))
+        {
+            throw RecoverableError(c_loadUsage);
+        }
+        return value;
+    }
+
+
+    static size_t ParseCount(std::string const & token)
+    {
+        size_t end = 0;
+        unsigned long long value = 0;
+        try
+        {
+            value = std::stoull(token, &end);
+        }
+        catch (std::logic_error const &)
+        {
+            end = 0;
+        }
+
+        if (end == 0 || end != token.size() || token[0] == '-')
+        {
+            throw RecoverableError(c_loadUsage);
+        }
+        return static_cast<size_t>(value);
+    }
+
+
     //*************************************************************************
     //
     // Query
@@ -49,7 +110,13 @@ namespace BitFunnel
     Query::Query(Environment & environment,
                  Id id,
                  char const * parameters)
-        : TaskBase(environment, id, Type::Synchronous)
+        : TaskBase(environment, id, Type::Synchronous),
+          m_rate(0),
+          m_poisson(true),
+          m_growth(1.5),
+          m_steps(10),
+          m_duration(5.0),
+          m_latencyLimit(0)
     {
         auto command = TaskFactory::GetNextToken(parameters);
         if (command.compare("one") == 0)
@@ -62,13 +129,59 @@ namespace BitFunnel
             m_queryCommand = QueryDocs;
             m_query = parameters;
         }
+        else if (command.compare("load") == 0)
+        {
+            m_queryCommand = QueryLoad;
+            m_query = TaskFactory::GetNextToken(parameters);
+
+            auto token = TaskFactory::GetNextToken(parameters);
+            if (m_query.empty() || token.empty())
+            {
+                throw RecoverableError(c_loadUsage);
+            }
+            m_rate = ParseDouble(token);
+
+            token = TaskFactory::GetNextToken(parameters);
+            if (token.compare("fixed") == 0 || token.compare("poisson") == 0)
+            {
+                m_poisson = (token.compare("poisson") == 0);
+                token = TaskFactory::GetNextToken(parameters);
+            }
+            if (!token.empty())
+            {
+                m_growth = ParseDouble(token);
+                token = TaskFactory::GetNextToken(parameters);
+            }
+            if (!token.empty())
+            {
+                m_steps = ParseCount(token);
+                token = TaskFactory::GetNextToken(parameters);
+            }
+            if (!token.empty())
+            {
+                m_duration = ParseDouble(token);
+                token = TaskFactory::GetNextToken(parameters);
+            }
+            if (!token.empty())
+            {
+                // Given in milliseconds.
+                m_latencyLimit = ParseDouble(token) / 1000.0;
+            }
+
+            if (m_rate <= 0 || m_growth <= 1.0 || m_steps == 0 || m_duration <= 0)
+            {
+                throw RecoverableError(
+                    "query load: qps and seconds must be positive, growth "
+                    "must be greater than 1 and steps at least 1.");
+            }
+        }
         else
         {
             m_queryCommand = QueryLog;
             if (command.compare("log") != 0)
             {
                 std::stringstream message;
-                message << "expected log or one" << std::endl;
+                message << "expected one, docs, log, or load" << std::endl;
                 throw RecoverableError(message.str().c_str());
             }
             m_query = TaskFactory::GetNextToken(parameters);
@@ -107,14 +220,14 @@ namespace BitFunnel
                     << "\"" << std::endl;
 
                 BitFunnel::QueryInstrumentation instrumentation;
-                auto resultsBuffer = BitFunnel::ResultsBuffer(GetEnvironment().GetSimpleIndex().GetIngestor().GetDocumentCount());
+                BitFunnel::ChunkedResultsSink results;
                 auto streammap = BitFunnel::Factories::CreateStreamConfiguration();
                 auto queryEngine = BitFunnel::Factories::CreateQueryEngine(GetEnvironment().GetSimpleIndex(), *streammap);
                 auto tree = queryEngine->Parse(m_query.c_str());
                 instrumentation.FinishParsing();
                 if (tree != nullptr)
                 {
-                    queryEngine->Run(tree, instrumentation, resultsBuffer);
+                    queryEngine->Run(tree, instrumentation, results);
                 }
 
                 output << "Results:" << std::endl;
@@ -123,12 +236,51 @@ namespace BitFunnel
                 instrumentation.GetData().Format(formatter);
 
                 output << std::endl << "Document Ids" << std::endl;
-                for (auto result : resultsBuffer)
+                for (auto result : results)
                 {
                     output << result.GetHandle().GetDocId() << std::endl;
                 }
 
             }
+            else if (m_queryCommand == QueryLoad)
+            {
+                auto fileSystem = Factories::CreateFileSystem();  // TODO: Use environment file system
+                auto queries = ReadLines(*fileSystem, m_query.c_str());
+                CHECK_GT(queries.size(), 0u)
+                    << "No queries in \"" << m_query << "\"";
+
+                const size_t c_threadCount = GetEnvironment().GetThreadCount();
+                output
+                    << "Issuing queries from log at \""
+                    << m_query
+                    << "\" with "
+                    << (m_poisson ? "Poisson" : "fixed")
+                    << " arrivals to "
+                    << c_threadCount
+                    << " threads." << std::endl;
+
+                auto config = Factories::CreateStreamConfiguration();
+                auto service =
+                    Factories::CreateQueryService(GetEnvironment().GetSimpleIndex(),
+                                                  *config,
+                                                  c_threadCount,
+                                                  c_loadQueueCapacity,
+                                                  GetEnvironment().GetCompilerMode(),
+                                                  GetEnvironment().GetPlanCacheMode());
+
+                LoadGenerator generator(*service,
+                                        queries,
+                                        m_poisson ? LoadGenerator::Poisson : LoadGenerator::Fixed);
+                auto steps = generator.Ramp(m_rate,
+                                            m_growth,
+                                            m_steps,
+                                            m_duration,
+                                            m_latencyLimit);
+                service->Shutdown();
+
+                output << "Results (latencies in seconds):" << std::endl;
+                LoadGenerator::Print(output, steps, m_latencyLimit);
+            }
             else
             {
                 CHECK_NE(*GetEnvironment().GetOutputDir().c_str(), '\0')
@@ -153,7 +305,12 @@ namespace BitFunnel
                         queries,
                         c_iterations,
                         GetEnvironment().GetCompilerMode(),
-                        GetEnvironment().GetCacheLineCountMode());
+                        GetEnvironment().GetCacheLineCountMode(),
+                        GetEnvironment().GetPlanCacheMode(),
+                        GetEnvironment().GetBatchSize(),
+                        GetEnvironment().GetPrefetchDistance(),
+                        GetEnvironment().GetPrefetchNonTemporal(),
+                        GetEnvironment().GetShardSpecializationMode());
                 output << "Results:" << std::endl;
                 statistics.Print(output);
 
@@ -186,9 +343,17 @@ namespace BitFunnel
             "query",
             "Process a single query or list of queries.",
             "query (one <query>) | (docs <query>) | (log <file>)\n"
+            "      | (load <file> <qps> [fixed|poisson]\n"
+            "               [<growth> [<steps> [<seconds> [<p99 ms>]]]])\n"
             "  Processes a single query or a list of queries\n"
             "  specified by a file.\n"
-            "  'docs' lists all matching documents."
+            "  'docs' lists all matching documents.\n"
+            "  'load' issues the queries in the file open-loop, on a\n"
+            "  Poisson (default) or fixed schedule, for <seconds> (5) at\n"
+            "  <qps>, then at rates <growth> (1.5) times higher, for up to\n"
+            "  <steps> (10) steps or until the rate cannot be sustained or\n"
+            "  the p99 latency exceeds <p99 ms>. Latency is measured from\n"
+            "  each query's scheduled start. Uses the 'threads' setting."
         );
     }
 }
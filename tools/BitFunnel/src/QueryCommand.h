@@ -43,9 +43,18 @@ namespace BitFunnel
         enum QueryCommand {
             QueryOne,
             QueryLog,
-            QueryDocs
+            QueryDocs,
+            QueryLoad
         };
         QueryCommand m_queryCommand;
         std::string m_query;
+
+        // Parameters for QueryLoad.
+        double m_rate;
+        bool m_poisson;
+        double m_growth;
+        size_t m_steps;
+        double m_duration;
+        double m_latencyLimit;
     };
 }
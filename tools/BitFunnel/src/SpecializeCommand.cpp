@@ -0,0 +1,78 @@
+// The MIT License (MIT)
+
+// Copyright (c) 2016, Microsoft
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <iostream>
+
+#include "Environment.h"
+#include "SpecializeCommand.h"
+
+
+namespace BitFunnel
+{
+    //*************************************************************************
+    //
+    // SpecializeCommand
+    //
+    //*************************************************************************
+    SpecializeCommand::SpecializeCommand(Environment & environment,
+                                         Id id,
+                                         char const * /*parameters*/)
+        : TaskBase(environment, id, Type::Synchronous)
+    {
+    }
+
+
+    void SpecializeCommand::Execute()
+    {
+        auto & env = GetEnvironment();
+        env.SetShardSpecializationMode(!env.GetShardSpecializationMode());
+
+        if (env.GetShardSpecializationMode())
+        {
+            std::cout
+                << "Compiling one function per shard with row offsets as immediates.";
+        }
+        else
+        {
+            std::cout
+                << "Compiling one function shared by all shards.";
+        }
+        std::cout
+            << std::endl
+            << std::endl;
+    }
+
+
+    ICommand::Documentation SpecializeCommand::GetDocumentation()
+    {
+        return Documentation(
+            "specialize",
+            "Toggles per-shard specialization of compiled queries.",
+            "specialize\n"
+            "  Toggles per-shard specialization of native code during query\n"
+            "  log processing. When enabled, each shard gets its own function\n"
+            "  in which row offsets are encoded as displacements instead of\n"
+            "  being loaded into registers. Combine with plancache to amortize\n"
+            "  the extra compilation."
+        );
+    }
+}
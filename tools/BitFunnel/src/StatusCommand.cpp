@@ -24,6 +24,7 @@
 
 #include "BitFunnel/BitFunnelTypes.h"
 #include "BitFunnel/Index/IIngestor.h"
+#include "BitFunnel/Index/IRecycler.h"
 #include "BitFunnel/Index/IShard.h"
 #include "BitFunnel/Index/ITermTable.h"
 #include "Environment.h"
@@ -61,6 +62,10 @@ namespace BitFunnel
 
         std::cout << std::endl;
 
+        GetEnvironment().GetIngestor().GetRecycler().GetStatistics().Print(std::cout);
+
+        std::cout << std::endl;
+
         std::cout << "SHARD " << m_shard << "-->" << std::endl << std::endl;
 
         double bytesPerDocument = 0;